@@ -0,0 +1,368 @@
+// batch.cpp - structure-of-arrays kernels declared in <Cg/batch.hpp>
+
+#include <float.h>
+#include <math.h>
+
+#include <Cg/vector.hpp>
+#include <Cg/matrix.hpp>
+#include <Cg/inverse.hpp>
+#include <Cg/simd.hpp>
+#include <Cg/batch.hpp>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+# include <immintrin.h>
+# define BATCH_HAVE_AVX 1
+#endif
+
+namespace Cg {
+
+namespace {
+
+// Affine rows applied to (x,y,z,1)
+typedef float Rows3x4[3][4];
+
+typedef void (*TransformKernel)(const Rows3x4 &r,
+                                const float *x, const float *y, const float *z,
+                                float *ox, float *oy, float *oz, size_t n);
+typedef void (*NormalizeKernel)(const float *x, const float *y, const float *z,
+                                float *ox, float *oy, float *oz, size_t n);
+typedef void (*BoundsKernel)(const float *x, const float *y, const float *z, size_t n,
+                             float lo[3], float hi[3]);
+
+struct Kernels {
+    const char *name;
+    TransformKernel transform;
+    NormalizeKernel normalize;
+    BoundsKernel bounds;
+};
+
+/// SCALAR
+
+void transformScalar(const Rows3x4 &r,
+                     const float *x, const float *y, const float *z,
+                     float *ox, float *oy, float *oz, size_t n)
+{
+    for (size_t i=0; i<n; i++) {
+        float px = x[i], py = y[i], pz = z[i];
+        ox[i] = r[0][0]*px + r[0][1]*py + r[0][2]*pz + r[0][3];
+        oy[i] = r[1][0]*px + r[1][1]*py + r[1][2]*pz + r[1][3];
+        oz[i] = r[2][0]*px + r[2][1]*py + r[2][2]*pz + r[2][3];
+    }
+}
+
+void normalizeScalar(const float *x, const float *y, const float *z,
+                     float *ox, float *oy, float *oz, size_t n)
+{
+    for (size_t i=0; i<n; i++) {
+        float len2 = x[i]*x[i] + y[i]*y[i] + z[i]*z[i];
+        float s = len2 > 0 ? 1 / ::sqrtf(len2) : 0;
+        ox[i] = x[i]*s;
+        oy[i] = y[i]*s;
+        oz[i] = z[i]*s;
+    }
+}
+
+void boundsScalar(const float *x, const float *y, const float *z, size_t n,
+                  float lo[3], float hi[3])
+{
+    for (size_t i=0; i<n; i++) {
+        lo[0] = x[i] < lo[0] ? x[i] : lo[0];
+        lo[1] = y[i] < lo[1] ? y[i] : lo[1];
+        lo[2] = z[i] < lo[2] ? z[i] : lo[2];
+        hi[0] = x[i] > hi[0] ? x[i] : hi[0];
+        hi[1] = y[i] > hi[1] ? y[i] : hi[1];
+        hi[2] = z[i] > hi[2] ? z[i] : hi[2];
+    }
+}
+
+const Kernels scalar_kernels = { "scalar", transformScalar, normalizeScalar, boundsScalar };
+
+/// FOUR-LANE (SSE or NEON)
+
+#ifdef __CG_SIMD
+
+void transform4(const Rows3x4 &r,
+                const float *x, const float *y, const float *z,
+                float *ox, float *oy, float *oz, size_t n)
+{
+    __CGsimd4f m[3][4];
+    for (int i=0; i<3; i++) {
+        for (int j=0; j<4; j++) {
+            m[i][j] = __CGsimd_set1(r[i][j]);
+        }
+    }
+    size_t i = 0;
+    for (; i+4<=n; i+=4) {
+        __CGsimd4f px = __CGsimd_load(x+i), py = __CGsimd_load(y+i), pz = __CGsimd_load(z+i);
+        __CGsimd4f rx = __CGsimd_add(__CGsimd_add(__CGsimd_mul(m[0][0], px), __CGsimd_mul(m[0][1], py)),
+                                     __CGsimd_add(__CGsimd_mul(m[0][2], pz), m[0][3]));
+        __CGsimd4f ry = __CGsimd_add(__CGsimd_add(__CGsimd_mul(m[1][0], px), __CGsimd_mul(m[1][1], py)),
+                                     __CGsimd_add(__CGsimd_mul(m[1][2], pz), m[1][3]));
+        __CGsimd4f rz = __CGsimd_add(__CGsimd_add(__CGsimd_mul(m[2][0], px), __CGsimd_mul(m[2][1], py)),
+                                     __CGsimd_add(__CGsimd_mul(m[2][2], pz), m[2][3]));
+        __CGsimd_store(ox+i, rx);
+        __CGsimd_store(oy+i, ry);
+        __CGsimd_store(oz+i, rz);
+    }
+    transformScalar(r, x+i, y+i, z+i, ox+i, oy+i, oz+i, n-i);
+}
+
+void normalize4(const float *x, const float *y, const float *z,
+                float *ox, float *oy, float *oz, size_t n)
+{
+    // Clamping the squared length keeps zero vectors at zero instead of NaN.
+    const __CGsimd4f tiny = __CGsimd_set1(FLT_MIN);
+    size_t i = 0;
+    for (; i+4<=n; i+=4) {
+        __CGsimd4f px = __CGsimd_load(x+i), py = __CGsimd_load(y+i), pz = __CGsimd_load(z+i);
+        __CGsimd4f len2 = __CGsimd_add(__CGsimd_add(__CGsimd_mul(px, px), __CGsimd_mul(py, py)),
+                                       __CGsimd_mul(pz, pz));
+        __CGsimd4f len = __CGsimd_sqrt(__CGsimd_max(len2, tiny));
+        __CGsimd_store(ox+i, __CGsimd_div(px, len));
+        __CGsimd_store(oy+i, __CGsimd_div(py, len));
+        __CGsimd_store(oz+i, __CGsimd_div(pz, len));
+    }
+    normalizeScalar(x+i, y+i, z+i, ox+i, oy+i, oz+i, n-i);
+}
+
+void bounds4(const float *x, const float *y, const float *z, size_t n,
+             float lo[3], float hi[3])
+{
+    size_t i = 0;
+    if (n >= 4) {
+        __CGsimd4f lx = __CGsimd_set1(lo[0]), ly = __CGsimd_set1(lo[1]), lz = __CGsimd_set1(lo[2]);
+        __CGsimd4f hx = __CGsimd_set1(hi[0]), hy = __CGsimd_set1(hi[1]), hz = __CGsimd_set1(hi[2]);
+        for (; i+4<=n; i+=4) {
+            __CGsimd4f px = __CGsimd_load(x+i), py = __CGsimd_load(y+i), pz = __CGsimd_load(z+i);
+            lx = __CGsimd_min(lx, px);
+            ly = __CGsimd_min(ly, py);
+            lz = __CGsimd_min(lz, pz);
+            hx = __CGsimd_max(hx, px);
+            hy = __CGsimd_max(hy, py);
+            hz = __CGsimd_max(hz, pz);
+        }
+        float l[3][4], h[3][4];
+        __CGsimd_store(l[0], lx);
+        __CGsimd_store(l[1], ly);
+        __CGsimd_store(l[2], lz);
+        __CGsimd_store(h[0], hx);
+        __CGsimd_store(h[1], hy);
+        __CGsimd_store(h[2], hz);
+        for (int c=0; c<3; c++) {
+            for (int k=0; k<4; k++) {
+                lo[c] = l[c][k] < lo[c] ? l[c][k] : lo[c];
+                hi[c] = h[c][k] > hi[c] ? h[c][k] : hi[c];
+            }
+        }
+    }
+    boundsScalar(x+i, y+i, z+i, n-i, lo, hi);
+}
+
+# ifdef __CG_SIMD_SSE
+const Kernels simd_kernels = { "sse", transform4, normalize4, bounds4 };
+# else
+const Kernels simd_kernels = { "neon", transform4, normalize4, bounds4 };
+# endif
+
+#endif // __CG_SIMD
+
+/// EIGHT-LANE (AVX, selected at run time)
+
+#ifdef BATCH_HAVE_AVX
+
+__attribute__((target("avx")))
+void transformAVX(const Rows3x4 &r,
+                  const float *x, const float *y, const float *z,
+                  float *ox, float *oy, float *oz, size_t n)
+{
+    __m256 m[3][4];
+    for (int i=0; i<3; i++) {
+        for (int j=0; j<4; j++) {
+            m[i][j] = _mm256_set1_ps(r[i][j]);
+        }
+    }
+    size_t i = 0;
+    for (; i+8<=n; i+=8) {
+        __m256 px = _mm256_loadu_ps(x+i), py = _mm256_loadu_ps(y+i), pz = _mm256_loadu_ps(z+i);
+        __m256 rx = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[0][0], px), _mm256_mul_ps(m[0][1], py)),
+                                  _mm256_add_ps(_mm256_mul_ps(m[0][2], pz), m[0][3]));
+        __m256 ry = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[1][0], px), _mm256_mul_ps(m[1][1], py)),
+                                  _mm256_add_ps(_mm256_mul_ps(m[1][2], pz), m[1][3]));
+        __m256 rz = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[2][0], px), _mm256_mul_ps(m[2][1], py)),
+                                  _mm256_add_ps(_mm256_mul_ps(m[2][2], pz), m[2][3]));
+        _mm256_storeu_ps(ox+i, rx);
+        _mm256_storeu_ps(oy+i, ry);
+        _mm256_storeu_ps(oz+i, rz);
+    }
+    transformScalar(r, x+i, y+i, z+i, ox+i, oy+i, oz+i, n-i);
+}
+
+__attribute__((target("avx")))
+void normalizeAVX(const float *x, const float *y, const float *z,
+                  float *ox, float *oy, float *oz, size_t n)
+{
+    const __m256 tiny = _mm256_set1_ps(FLT_MIN);
+    size_t i = 0;
+    for (; i+8<=n; i+=8) {
+        __m256 px = _mm256_loadu_ps(x+i), py = _mm256_loadu_ps(y+i), pz = _mm256_loadu_ps(z+i);
+        __m256 len2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px, px), _mm256_mul_ps(py, py)),
+                                    _mm256_mul_ps(pz, pz));
+        __m256 len = _mm256_sqrt_ps(_mm256_max_ps(len2, tiny));
+        _mm256_storeu_ps(ox+i, _mm256_div_ps(px, len));
+        _mm256_storeu_ps(oy+i, _mm256_div_ps(py, len));
+        _mm256_storeu_ps(oz+i, _mm256_div_ps(pz, len));
+    }
+    normalizeScalar(x+i, y+i, z+i, ox+i, oy+i, oz+i, n-i);
+}
+
+__attribute__((target("avx")))
+void boundsAVX(const float *x, const float *y, const float *z, size_t n,
+               float lo[3], float hi[3])
+{
+    size_t i = 0;
+    if (n >= 8) {
+        __m256 l[3], h[3];
+        for (int c=0; c<3; c++) {
+            l[c] = _mm256_set1_ps(lo[c]);
+            h[c] = _mm256_set1_ps(hi[c]);
+        }
+        for (; i+8<=n; i+=8) {
+            __m256 px = _mm256_loadu_ps(x+i), py = _mm256_loadu_ps(y+i), pz = _mm256_loadu_ps(z+i);
+            l[0] = _mm256_min_ps(l[0], px);
+            l[1] = _mm256_min_ps(l[1], py);
+            l[2] = _mm256_min_ps(l[2], pz);
+            h[0] = _mm256_max_ps(h[0], px);
+            h[1] = _mm256_max_ps(h[1], py);
+            h[2] = _mm256_max_ps(h[2], pz);
+        }
+        for (int c=0; c<3; c++) {
+            float ls[8], hs[8];
+            _mm256_storeu_ps(ls, l[c]);
+            _mm256_storeu_ps(hs, h[c]);
+            for (int k=0; k<8; k++) {
+                lo[c] = ls[k] < lo[c] ? ls[k] : lo[c];
+                hi[c] = hs[k] > hi[c] ? hs[k] : hi[c];
+            }
+        }
+    }
+    boundsScalar(x+i, y+i, z+i, n-i, lo, hi);
+}
+
+const Kernels avx_kernels = { "avx", transformAVX, normalizeAVX, boundsAVX };
+
+#endif // BATCH_HAVE_AVX
+
+const Kernels &selectKernels()
+{
+#ifdef BATCH_HAVE_AVX
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx")) {
+        return avx_kernels;
+    }
+#endif
+#ifdef __CG_SIMD
+    return simd_kernels;
+#else
+    return scalar_kernels;
+#endif
+}
+
+const Kernels &kernels()
+{
+    static const Kernels &selected = selectKernels();
+    return selected;
+}
+
+void affineRows(const float4x4 &m, Rows3x4 &r)
+{
+    for (int i=0; i<3; i++) {
+        for (int j=0; j<4; j++) {
+            r[i][j] = m[i][j];
+        }
+    }
+}
+
+} // namespace
+
+void deinterleave(const std::vector<float> & xyz, float3_soa & out)
+{
+    const size_t n = xyz.size() / 3;
+    out.resize(n);
+    for (size_t i=0; i<n; i++) {
+        out.x[i] = xyz[3*i+0];
+        out.y[i] = xyz[3*i+1];
+        out.z[i] = xyz[3*i+2];
+    }
+}
+
+void interleave(const float3_soa & in, std::vector<float> & xyz)
+{
+    const size_t n = in.size();
+    xyz.resize(3*n);
+    for (size_t i=0; i<n; i++) {
+        xyz[3*i+0] = in.x[i];
+        xyz[3*i+1] = in.y[i];
+        xyz[3*i+2] = in.z[i];
+    }
+}
+
+void transformPoints(const float4x4 & m, const float3_soa & in, float3_soa & out)
+{
+    Rows3x4 r;
+    affineRows(m, r);
+    out.resize(in.size());
+    if (in.size()) {
+        kernels().transform(r, &in.x[0], &in.y[0], &in.z[0], &out.x[0], &out.y[0], &out.z[0], in.size());
+    }
+}
+
+void transformNormals(const float4x4 & m, const float3_soa & in, float3_soa & out)
+{
+    float3x3 upper;
+    for (int i=0; i<3; i++) {
+        for (int j=0; j<3; j++) {
+            upper[i][j] = m[i][j];
+        }
+    }
+    float3x3 upper_inv = inverse(upper);
+
+    Rows3x4 r;
+    for (int i=0; i<3; i++) {
+        for (int j=0; j<3; j++) {
+            r[i][j] = upper_inv[j][i];  // inverse transpose
+        }
+        r[i][3] = 0;
+    }
+    out.resize(in.size());
+    if (in.size()) {
+        kernels().transform(r, &in.x[0], &in.y[0], &in.z[0], &out.x[0], &out.y[0], &out.z[0], in.size());
+    }
+}
+
+void normalize(const float3_soa & in, float3_soa & out)
+{
+    out.resize(in.size());
+    if (in.size()) {
+        kernels().normalize(&in.x[0], &in.y[0], &in.z[0], &out.x[0], &out.y[0], &out.z[0], in.size());
+    }
+}
+
+bool boundingBox(const float3_soa & in, float3 & lo, float3 & hi)
+{
+    if (in.size() == 0) {
+        return false;
+    }
+    float l[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+    float h[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    kernels().bounds(&in.x[0], &in.y[0], &in.z[0], in.size(), l, h);
+    lo = float3(l[0], l[1], l[2]);
+    hi = float3(h[0], h[1], h[2]);
+    return true;
+}
+
+const char *batchKernelName()
+{
+    return kernels().name;
+}
+
+} // namespace Cg
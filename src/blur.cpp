@@ -0,0 +1,158 @@
+// blur.cpp - wide blurs as passes on a post chain
+//
+// A blur's cost is kept in log2 of its radius by blurring at reduced
+// resolution: each halving doubles the reach of a fixed number of taps.
+
+#include <math.h>
+#include <stdio.h>
+
+#include <Cg/double.hpp>
+#include <Cg/vector.hpp>
+
+#include "blur.hpp"
+
+using namespace Cg;
+
+BlurMethod blur_method = BLUR_GAUSSIAN;
+float blur_radius = 8.0f;
+int blur_downsample = 1;
+
+namespace {
+
+// Widest Gaussian run at one resolution, in texels either side
+const int max_gaussian_texels = 16;
+// Bilinear fetches either side of the center, each covering two texels
+const int max_gaussian_taps = max_gaussian_texels / 2;
+// Deepest Kawase pyramid, in levels below the downsample asked for
+const int max_kawase_levels = 8;
+// Standard deviation of a dual Kawase blur in texels of its deepest
+// level, measured on a point of light
+const float kawase_sigma_texels = 0.93f;
+
+// Weights and offsets, in texels, of a Gaussian reaching texels either
+// side of the center at three standard deviations.  Tap 0 is the center;
+// each other tap sits between two texels where bilinear filtering blends
+// them in proportion to their weights.
+struct GaussianTaps {
+    int count;
+    float weights[max_gaussian_taps + 1];
+    float offsets[max_gaussian_taps + 1];
+
+    explicit GaussianTaps(float texels);
+};
+
+GaussianTaps::GaussianTaps(float texels)
+{
+    int reach = int(ceilf(texels));
+    reach = reach < 1 ? 1 : reach > max_gaussian_texels ? max_gaussian_texels : reach;
+    float sigma = texels / 3 > 0.5f ? texels / 3 : 0.5f;
+    float w[max_gaussian_texels + 2];
+    float total = 0;
+    for (int i=0; i<=reach+1; i++) {
+        w[i] = i <= reach ? expf(-0.5f * i * i / (sigma * sigma)) : 0;
+        total += i ? 2*w[i] : w[i];
+    }
+    weights[0] = w[0] / total;
+    offsets[0] = 0;
+    count = 1;
+    for (int i=1; i<=reach; i+=2) {
+        float pair = w[i] + w[i+1];
+        weights[count] = pair / total;
+        offsets[count] = (i * w[i] + (i+1) * w[i+1]) / pair;
+        count++;
+    }
+}
+
+void setFloats(GLSLProgram &program, const char *name, const float *values, int count)
+{
+    program.use();
+    GLint location = glGetUniformLocation(program.program_object, name);
+    if (location >= 0) {
+        glUniform1fv(location, count, values);
+    }
+}
+
+// Halves input into a new target at level.
+int addKawaseDown(PostChain &chain, int input, int level)
+{
+    int output = chain.addTarget("blur down", level);
+    chain.addPass("kawase down", "glsl/post.vert", "glsl/blur_kawase_down.frag")
+        .read("source", input)
+        .write(output);
+    return output;
+}
+
+int addGaussian(PostChain &chain, int input, float radius, int downsample)
+{
+    // Enough halvings that the kernel fits the taps at the level reached
+    int level = downsample;
+    while (radius / (1 << level) > max_gaussian_texels && level < 16) {
+        level++;
+    }
+    for (int l=chain.downsample(input)+1; l<=level; l++) {
+        input = addKawaseDown(chain, input, l);
+    }
+
+    GaussianTaps taps(radius / (1 << level));
+    const char *names[2] = { "gaussian horizontal", "gaussian vertical" };
+    for (int axis=0; axis<2; axis++) {
+        int output = chain.addTarget(names[axis], level);
+        float2 direction = axis == 0 ? float2(1, 0) : float2(0, 1);
+        chain.addPass(names[axis], "glsl/post.vert", "glsl/blur_gaussian.frag")
+            .read("source", input)
+            .write(output)
+            .setUniforms([taps, direction](GLSLProgram &program, const Camera &) {
+                program.setVec2f("direction", direction);
+                program.setVec1f("taps", float(taps.count));
+                setFloats(program, "weights", taps.weights, taps.count);
+                setFloats(program, "offsets", taps.offsets, taps.count);
+            });
+        input = output;
+    }
+    return input;
+}
+
+// The deepest level sets the blur, so each doubling of the radius is one
+// more level down and back up.  Radius is taken as three standard
+// deviations, as for the Gaussian, and the depth is the nearest match.
+int addKawase(PostChain &chain, int input, float radius, int downsample)
+{
+    int deepest = int(floorf(log2f(radius / 3 / kawase_sigma_texels) + 0.5f));
+    deepest = deepest < downsample + 1 ? downsample + 1 : deepest;
+    deepest = deepest > downsample + max_kawase_levels ? downsample + max_kawase_levels : deepest;
+    for (int l=chain.downsample(input)+1; l<=deepest; l++) {
+        input = addKawaseDown(chain, input, l);
+    }
+    for (int l=deepest-1; l>=downsample; l--) {
+        int output = chain.addTarget("blur up", l);
+        chain.addPass("kawase up", "glsl/post.vert", "glsl/blur_kawase_up.frag")
+            .read("source", input)
+            .write(output);
+        input = output;
+    }
+    return input;
+}
+
+} // namespace
+
+int addBlur(PostChain &chain, int input, float radius, int downsample, BlurMethod method)
+{
+    downsample = downsample < chain.downsample(input) ? chain.downsample(input) : downsample;
+    radius = radius > 1 ? radius : 1;
+    if (method == BLUR_KAWASE) {
+        return addKawase(chain, input, radius, downsample);
+    }
+    return addGaussian(chain, input, radius, downsample);
+}
+
+void addToonBlur(PostChain &chain, int color, int output)
+{
+    int blurred = addBlur(chain, color, blur_radius, blur_downsample, blur_method);
+    chain.addPass("toon blur composite", "glsl/post.vert", "glsl/blur_composite.frag")
+        .read("sceneColor", color)
+        .read("blurred", blurred)
+        .write(output)
+        .setUniforms([](GLSLProgram &program, const Camera &) {
+            program.setVec1f("amount", 0.5f);
+        });
+}
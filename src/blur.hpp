@@ -0,0 +1,37 @@
+// blur.hpp - wide blurs as passes on a post chain
+
+#ifndef __blur_hpp__
+#define __blur_hpp__
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+# pragma once
+#endif
+
+#include "post.hpp"
+
+enum BlurMethod {
+    // Separable Gaussian, two taps per bilinear fetch, run after enough
+    // halvings that the kernel spans at most max_gaussian_texels.
+    BLUR_GAUSSIAN,
+    // Dual Kawase: a pyramid of 5-tap downsamples and 8-tap upsamples,
+    // a level for each doubling of the radius.
+    BLUR_KAWASE
+};
+
+// Appends passes blurring input by about radius pixels of the full
+// viewport and returns the target holding the result.  The result is
+// at downsample or coarser, for the consumer's bilinear fetches to
+// scale back up.  The input may itself be at reduced resolution.
+// Either method costs passes in log2(radius), each a bounded number of
+// fetches per pixel.
+int addBlur(PostChain &chain, int input, float radius, int downsample, BlurMethod method);
+
+// Appends the soft focus for glsl/toon_blur.frag: color blurred by
+// blur_radius and blended half and half with itself.
+void addToonBlur(PostChain &chain, int color, int output);
+
+extern BlurMethod blur_method;  // -kawase
+extern float blur_radius;       // -blurradius, in pixels
+extern int blur_downsample;     // -blurdownsample, halvings
+
+#endif // __blur_hpp__
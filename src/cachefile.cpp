@@ -0,0 +1,38 @@
+// cachefile.cpp - headers of binary caches built from a source file
+
+#include <string.h>
+#include <sys/stat.h>
+
+#include "cachefile.hpp"
+
+namespace {
+
+bool sourceStamp(const char *filename, long long &size, long long &mtime)
+{
+    struct stat st;
+    if (stat(filename, &st) != 0) {
+        return false;
+    }
+    size = st.st_size;
+    mtime = st.st_mtime;
+    return true;
+}
+
+} // namespace
+
+bool makeCacheStamp(CacheStamp &stamp, const char magic[8], int version, const char *source_filename)
+{
+    memcpy(stamp.magic, magic, sizeof(stamp.magic));
+    stamp.version = version;
+    return sourceStamp(source_filename, stamp.source_size, stamp.source_mtime);
+}
+
+bool cacheStampMatches(const CacheStamp &stamp, const char magic[8], int version, const char *source_filename)
+{
+    long long size, mtime;
+    return sourceStamp(source_filename, size, mtime) &&
+           memcmp(stamp.magic, magic, sizeof(stamp.magic)) == 0 &&
+           stamp.version == version &&
+           stamp.source_size == size &&
+           stamp.source_mtime == mtime;
+}
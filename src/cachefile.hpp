@@ -0,0 +1,26 @@
+// cachefile.hpp - headers of binary caches built from a source file
+
+#ifndef __cachefile_hpp__
+#define __cachefile_hpp__
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+# pragma once
+#endif
+
+// Leads every cache file: what kind of cache it is, its format version,
+// and the size and modification time of the file it was built from.
+struct CacheStamp {
+    char magic[8];
+    int version;
+    long long source_size;
+    long long source_mtime;
+};
+
+// Stamps a cache of source_filename; false when it cannot be stat'ed.
+bool makeCacheStamp(CacheStamp &stamp, const char magic[8], int version, const char *source_filename);
+
+// Whether stamp, read from a cache, is of this kind and version and was
+// built from source_filename as it is now.
+bool cacheStampMatches(const CacheStamp &stamp, const char magic[8], int version, const char *source_filename);
+
+#endif // __cachefile_hpp__
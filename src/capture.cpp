@@ -0,0 +1,397 @@
+// capture.cpp - reading frames back from the GPU and encoding them
+//
+// glReadPixels into client memory waits for the GPU to finish every
+// command before it.  Into a pixel buffer object it only queues a copy,
+// and the fence after it says when the copy is done, so a frame can be
+// mapped a frame or two later, when mapping no longer waits.
+
+#include <ctype.h>
+#include <string.h>
+
+#include <chrono>
+
+#include "capture.hpp"
+#include "parallel.hpp"
+#include "png.hpp"
+#include "qoi.hpp"
+#include "timesource.hpp"
+#include "process.hpp"
+
+extern const char *program_name;
+
+FrameCapture frame_capture;
+const char *capture_output = NULL;
+CaptureFormat capture_format = CAPTURE_PNG;
+
+namespace {
+
+bool isPipe(const std::string &output)
+{
+    return !output.empty() && output[0] == '|';
+}
+
+// rgba's rows, bottom first, as RGB rows top first.
+void toRawRGB(const unsigned char *rgba, int width, int height, std::vector<unsigned char> &rgb)
+{
+    size_t stride = size_t(width) * 3;
+    rgb.resize(stride * height);
+    for (int y=0; y<height; y++) {
+        const unsigned char *src = rgba + size_t(height - 1 - y) * width * 4;
+        unsigned char *dst = &rgb[y * stride];
+        for (int x=0; x<width; x++) {
+            dst[3*x+0] = src[4*x+0];
+            dst[3*x+1] = src[4*x+1];
+            dst[3*x+2] = src[4*x+2];
+        }
+    }
+}
+
+} // namespace
+
+FrameWriter::FrameWriter(const std::string &output)
+    : output(output)
+    , file(NULL)
+{
+}
+
+FrameWriter::~FrameWriter()
+{
+    close();
+}
+
+bool FrameWriter::valid(const std::string &output)
+{
+    if (isPipe(output)) {
+        return true;
+    }
+    int conversions = 0;
+    for (size_t i=0; i<output.size(); i++) {
+        if (output[i] != '%') {
+            continue;
+        }
+        if (++i < output.size() && output[i] == '%') {
+            continue;
+        }
+        while (i < output.size() && isdigit((unsigned char)output[i])) {
+            i++;
+        }
+        if (i == output.size() || output[i] != 'd' || ++conversions > 1) {
+            return false;
+        }
+    }
+    return !output.empty();
+}
+
+bool FrameWriter::write(int frame, const std::vector<unsigned char> &bytes)
+{
+    if (isPipe(output)) {
+        if (!file) {
+#ifdef _WIN32
+            file = popen(output.c_str() + 1, "wb");
+#else
+            file = popen(output.c_str() + 1, "w");
+#endif
+        }
+    } else {
+        char name[1024];
+        snprintf(name, sizeof(name), output.c_str(), frame);
+        if (!file || file_name != name) {
+            close();
+            file_name = name;
+            file = fopen(name, "wb");
+        }
+    }
+    return file && fwrite(&bytes[0], 1, bytes.size(), file) == bytes.size();
+}
+
+bool FrameWriter::close()
+{
+    bool ok = true;
+    if (file) {
+        ok = (isPipe(output) ? pclose(file) : fclose(file)) == 0;
+        file = NULL;
+    }
+    return ok;
+}
+
+FrameCapture::FrameCapture()
+    : format(CAPTURE_PNG)
+    , width(0)
+    , height(0)
+    , next_slot(0)
+    , use_fences(false)
+    , next_sequence(0)
+    , next_written(0)
+    , collected(0)
+    , max_queued(0)
+    , stopping(false)
+    , writing(false)
+    , failed(false)
+    , frames(0)
+    , capture_milliseconds(0)
+    , stall_milliseconds(0)
+{
+}
+
+FrameCapture::~FrameCapture()
+{
+    if (active()) {
+        finish();
+    }
+}
+
+void FrameCapture::begin(CaptureFormat format, const Sink &sink, int ring, int threads)
+{
+    if (active()) {
+        finish();
+    }
+    this->format = format;
+    this->sink = sink;
+    width = height = 0;
+    Slot empty = { 0, 0, 0, 0, false };
+    slots.assign(ring > 1 ? ring : 2, empty);
+    next_slot = 0;
+    use_fences = GLEW_ARB_sync || GLEW_VERSION_3_2;
+    next_sequence = next_written = collected = 0;
+    stopping = writing = failed = false;
+    frames = 0;
+    capture_milliseconds = stall_milliseconds = 0;
+
+    int count = threads > 0 ? threads : numWorkerThreads();
+    // Enough frames in hand to keep every encoder busy, and no more.
+    max_queued = size_t(2 * count);
+    for (int i=0; i<count; i++) {
+        encoders.push_back(std::thread(&FrameCapture::encodeLoop, this));
+    }
+}
+
+// Frames in the buffers are collected first, so they keep their order.
+void FrameCapture::resize(int width, int height)
+{
+    for (size_t i=0; i<slots.size(); i++) {
+        Slot &slot = slots[(next_slot + i) % slots.size()];
+        if (slot.pending) {
+            collect(slot);
+        }
+        if (slot.buffer) {
+            glDeleteBuffers(1, &slot.buffer);
+            slot.buffer = 0;
+        }
+    }
+    this->width = width;
+    this->height = height;
+    for (size_t i=0; i<slots.size(); i++) {
+        glGenBuffers(1, &slots[i].buffer);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slots[i].buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, GLsizeiptr(width) * height * 4, NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+bool FrameCapture::ready(const Slot &slot) const
+{
+    if (!slot.fence) {
+        return false;
+    }
+    GLenum status = glClientWaitSync(slot.fence, 0, 0);
+    return status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED;
+}
+
+// Maps slot's buffer, waiting for its copy when it is not done, and
+// queues its pixels for the encoders, waiting for room when they are
+// behind.
+void FrameCapture::collect(Slot &slot)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (slot.fence) {
+        while (glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {
+        }
+        glDeleteSync(slot.fence);
+        slot.fence = 0;
+    }
+    Job job;
+    job.sequence = slot.sequence;
+    job.frame = slot.frame;
+    job.width = width;
+    job.height = height;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        room.wait(lock, [this] { return size_t(collected - next_written) < max_queued; });
+        if (!free_pixels.empty()) {
+            job.pixels.swap(free_pixels.back());
+            free_pixels.pop_back();
+        }
+    }
+    stall_milliseconds += elapsedMilliseconds(start);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+    if (const void *pixels = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY)) {
+        job.pixels.resize(size_t(width) * height * 4);
+        memcpy(&job.pixels[0], pixels, job.pixels.size());
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    } else {
+        // The copy is lost.  The frame still goes on, empty, so that the
+        // writer fails the capture at it, after the frames before it.
+        job.pixels.clear();
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    slot.pending = false;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    jobs.push_back(Job());
+    jobs.back().sequence = job.sequence;
+    jobs.back().frame = job.frame;
+    jobs.back().width = job.width;
+    jobs.back().height = job.height;
+    jobs.back().pixels.swap(job.pixels);
+    collected++;
+    work.notify_one();
+}
+
+void FrameCapture::capture(int frame, int width, int height)
+{
+    if (!active() || width <= 0 || height <= 0) {
+        return;
+    }
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (width != this->width || height != this->height) {
+        resize(width, height);
+    }
+    Slot &slot = slots[next_slot];
+    if (slot.pending) {
+        collect(slot);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if (use_fences) {
+        slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        // Without a flush, nothing need reach the GPU before the wait.
+        glFlush();
+    }
+    slot.sequence = next_sequence++;
+    slot.frame = frame;
+    slot.pending = true;
+    next_slot = (next_slot + 1) % int(slots.size());
+
+    // Earlier frames whose copies are done, oldest first.
+    for (size_t i=0; i+1<slots.size(); i++) {
+        Slot &older = slots[(next_slot + i) % slots.size()];
+        if (!older.pending) {
+            continue;
+        }
+        if (!ready(older)) {
+            break;
+        }
+        collect(older);
+    }
+    frames++;
+    capture_milliseconds += elapsedMilliseconds(start);
+}
+
+void FrameCapture::encodeLoop()
+{
+    std::vector<unsigned char> encoded;
+    for (;;) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            work.wait(lock, [this] { return stopping || !jobs.empty(); });
+            if (jobs.empty()) {
+                return;
+            }
+            job.sequence = jobs.front().sequence;
+            job.frame = jobs.front().frame;
+            job.width = jobs.front().width;
+            job.height = jobs.front().height;
+            job.pixels.swap(jobs.front().pixels);
+            jobs.pop_front();
+        }
+
+        if (job.pixels.empty()) {
+            encoded.clear();
+        } else {
+            switch (format) {
+            case CAPTURE_PNG:
+                encodePNG(&job.pixels[0], job.width, job.height, encoded);
+                break;
+            case CAPTURE_QOI:
+                encodeQOI(&job.pixels[0], job.width, job.height, encoded);
+                break;
+            case CAPTURE_RAW:
+                toRawRGB(&job.pixels[0], job.width, job.height, encoded);
+                break;
+            }
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        free_pixels.push_back(std::vector<unsigned char>());
+        free_pixels.back().swap(job.pixels);
+        std::pair<int, std::vector<unsigned char> > &entry = done[job.sequence];
+        entry.first = job.frame;
+        entry.second.swap(encoded);
+        // One thread at a time writes, in order; the others leave their
+        // frames to it.
+        if (writing) {
+            continue;
+        }
+        writing = true;
+        while (!done.empty() && done.begin()->first == next_written) {
+            std::pair<int, std::vector<unsigned char> > next;
+            next.first = done.begin()->second.first;
+            next.second.swap(done.begin()->second.second);
+            done.erase(done.begin());
+            bool skip = failed;
+            lock.unlock();
+            // After a failure the rest are dropped.  A frame that could
+            // not be read back has nothing encoded.
+            bool ok = skip || (!next.second.empty() && sink(next.first, next.second));
+            lock.lock();
+            failed = failed || !ok;
+            next_written++;
+            room.notify_all();
+            written.notify_all();
+        }
+        writing = false;
+    }
+}
+
+bool FrameCapture::finish()
+{
+    if (!active()) {
+        return !failed;
+    }
+    for (size_t i=0; i<slots.size(); i++) {
+        Slot &slot = slots[(next_slot + i) % slots.size()];
+        if (slot.pending) {
+            collect(slot);
+        }
+    }
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        written.wait(lock, [this] { return next_written == next_sequence; });
+        stopping = true;
+    }
+    work.notify_all();
+    for (size_t i=0; i<encoders.size(); i++) {
+        encoders[i].join();
+    }
+    encoders.clear();
+    for (size_t i=0; i<slots.size(); i++) {
+        if (slots[i].buffer) {
+            glDeleteBuffers(1, &slots[i].buffer);
+        }
+    }
+    slots.clear();
+    free_pixels.clear();
+    return !failed;
+}
+
+void FrameCapture::printTimes(const char *name) const
+{
+    if (frames > 0) {
+        printf("%s: %d frames captured, %.3f ms a frame reading back, %.3f ms of it waiting%s\n",
+               name, frames, capture_milliseconds / frames, stall_milliseconds / frames,
+               use_fences ? "" : " (no fences)");
+    }
+}
@@ -0,0 +1,128 @@
+// capture.hpp - reading frames back from the GPU and encoding them
+
+#ifndef __capture_hpp__
+#define __capture_hpp__
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+# pragma once
+#endif
+
+#include <stdio.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <GL/glew.h>
+
+enum CaptureFormat {
+    CAPTURE_PNG,  // png.hpp
+    CAPTURE_QOI,  // qoi.hpp
+    CAPTURE_RAW   // RGB8, rows top first, as ffmpeg's -f rawvideo -pix_fmt rgb24 takes
+};
+
+// Writes encoded frames out.  output is a file name with a printf
+// conversion such as %04d for the frame number, where frames that land on
+// the same name go to one file, one after another; or "| command", to
+// stream every frame to command's input.
+class FrameWriter {
+    std::string output;
+    FILE *file;
+    std::string file_name;
+
+    FrameWriter(const FrameWriter &);  // not copyable
+    FrameWriter &operator =(const FrameWriter &);
+
+public:
+    FrameWriter(const std::string &output);
+    ~FrameWriter();
+
+    // Whether output is a pipe or a file name that takes the frame number
+    // at most once, as an int.
+    static bool valid(const std::string &output);
+
+    bool write(int frame, const std::vector<unsigned char> &bytes);
+    // False when the last file or the command failed.
+    bool close();
+};
+
+// Copies frames out of the framebuffer without waiting for the GPU to
+// draw them.  Each frame is read into the next of a ring of pixel buffer
+// objects and fenced; a buffer is mapped once its fence has passed, or
+// when the ring comes back round to it, and its pixels go to a pool of
+// encoder threads.  The encoded frames reach the sink one at a time, in
+// the order they were captured, on the encoder threads.
+class FrameCapture {
+public:
+    typedef std::function<bool (int frame, const std::vector<unsigned char> &encoded)> Sink;
+
+private:
+    struct Slot {
+        GLuint buffer;
+        GLsync fence;
+        int sequence, frame;
+        bool pending;
+    };
+    struct Job {
+        int sequence, frame;
+        int width, height;
+        std::vector<unsigned char> pixels;
+    };
+
+    CaptureFormat format;
+    Sink sink;
+    int width, height;
+    std::vector<Slot> slots;
+    int next_slot;
+    bool use_fences;
+
+    std::vector<std::thread> encoders;
+    std::mutex mutex;
+    std::condition_variable work, room, written;
+    std::deque<Job> jobs;
+    std::vector< std::vector<unsigned char> > free_pixels;
+    std::map< int, std::pair<int, std::vector<unsigned char> > > done;  // by sequence
+    int next_sequence, next_written;
+    int collected;      // frames handed to the encoders
+    size_t max_queued;  // encoded or not, but not yet written
+    bool stopping, writing, failed;
+
+    int frames;
+    double capture_milliseconds;  // on the GL thread, in capture
+    double stall_milliseconds;    // of those, waiting on the GPU or the encoders
+
+    void resize(int width, int height);
+    bool ready(const Slot &slot) const;
+    void collect(Slot &slot);
+    void encodeLoop();
+
+    FrameCapture(const FrameCapture &);  // not copyable
+    FrameCapture &operator =(const FrameCapture &);
+
+public:
+    FrameCapture();
+    ~FrameCapture();
+
+    // ring buffers, and encoder threads; 0 for one per hardware thread.
+    void begin(CaptureFormat format, const Sink &sink, int ring = 3, int threads = 0);
+    // Reads the lower left width by height pixels of the read buffer of
+    // the bound framebuffer.  frame is passed on to the sink.
+    void capture(int frame, int width, int height);
+    // Waits until every frame captured is written, and stops the threads.
+    // False when the sink failed on any.
+    bool finish();
+
+    bool active() const { return !encoders.empty(); }
+    void printTimes(const char *name) const;
+};
+
+extern FrameCapture frame_capture;       // of the window, for -capture
+extern const char *capture_output;       // -capture
+extern CaptureFormat capture_format;     // -captureformat
+
+#endif // __capture_hpp__
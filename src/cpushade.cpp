@@ -0,0 +1,358 @@
+// cpushade.cpp - fragment shaders run on the CPU over G-buffers
+//
+// Each shader is written once, as a function template over its lane type:
+// a number, or a group of numbers, with arithmetic, comparisons giving a
+// mask, and select for the branches, which every lane of a group takes.
+// ScalarLane holds one pixel and SimdLane four neighbouring pixels in a
+// <Cg/simd.hpp> register; both follow the scalar float rules of the GLSL
+// built-ins below, so the two give the same pixels.
+
+#include <math.h>
+
+#include <Cg/double.hpp>
+#include <Cg/vector.hpp>
+#include <Cg/simd.hpp>
+
+#include "cpushade.hpp"
+#include "parallel.hpp"
+#include "raster.hpp"
+
+bool simd_shading = true;
+
+namespace {
+
+// One pixel.
+struct ScalarLane {
+    enum { width = 1 };
+    typedef bool Mask;
+
+    float v;
+
+    ScalarLane() {}
+    ScalarLane(float s) : v(s) {}
+
+    static ScalarLane load(const float *p) { return ScalarLane(*p); }
+    void store(float *p) const { *p = v; }
+};
+
+inline ScalarLane operator +(ScalarLane a, ScalarLane b) { return a.v + b.v; }
+inline ScalarLane operator -(ScalarLane a, ScalarLane b) { return a.v - b.v; }
+inline ScalarLane operator *(ScalarLane a, ScalarLane b) { return a.v * b.v; }
+inline ScalarLane operator /(ScalarLane a, ScalarLane b) { return a.v / b.v; }
+inline bool operator <(ScalarLane a, ScalarLane b) { return a.v < b.v; }
+inline ScalarLane select(bool mask, ScalarLane a, ScalarLane b) { return mask ? a : b; }
+inline ScalarLane sqrt(ScalarLane a) { return sqrtf(a.v); }
+inline ScalarLane pow(ScalarLane x, ScalarLane y) { return glslPow(x.v, y.v); }
+
+#ifdef __CG_SIMD
+
+// Four pixels along a row.
+struct SimdLane {
+    enum { width = 4 };
+    typedef Cg::__CGsimd4f Mask;
+
+    Cg::__CGsimd4f v;
+
+    SimdLane() {}
+    SimdLane(float s) : v(Cg::__CGsimd_set1(s)) {}
+    SimdLane(Cg::__CGsimd4f r) : v(r) {}
+
+    static SimdLane load(const float *p) { return SimdLane(Cg::__CGsimd_load(p)); }
+    void store(float *p) const { Cg::__CGsimd_store(p, v); }
+};
+
+inline SimdLane operator +(SimdLane a, SimdLane b) { return Cg::__CGsimd_add(a.v, b.v); }
+inline SimdLane operator -(SimdLane a, SimdLane b) { return Cg::__CGsimd_sub(a.v, b.v); }
+inline SimdLane operator *(SimdLane a, SimdLane b) { return Cg::__CGsimd_mul(a.v, b.v); }
+inline SimdLane operator /(SimdLane a, SimdLane b) { return Cg::__CGsimd_div(a.v, b.v); }
+inline SimdLane::Mask operator <(SimdLane a, SimdLane b) { return Cg::__CGsimd_less(a.v, b.v); }
+inline SimdLane select(SimdLane::Mask mask, SimdLane a, SimdLane b) { return Cg::__CGsimd_select(mask, a.v, b.v); }
+inline SimdLane sqrt(SimdLane a) { return Cg::__CGsimd_sqrt(a.v); }
+// Lane by lane through the scalar one, which keeps the two bit-identical;
+// the shaders here call it at most once per pixel.
+inline SimdLane pow(SimdLane x, SimdLane y)
+{
+    float xs[4], ys[4];
+    x.store(xs);
+    y.store(ys);
+    for (int k=0; k<4; k++) {
+        xs[k] = glslPow(xs[k], ys[k]);
+    }
+    return SimdLane::load(xs);
+}
+
+#endif // __CG_SIMD
+
+// GLSL's min and max as GPUs compare: the second operand where the first
+// is NaN, so clamping NaN gives the lower bound.
+template <typename Lane>
+inline Lane min(Lane a, Lane b) { return select(a < b, a, b); }
+template <typename Lane>
+inline Lane max(Lane a, Lane b) { return select(b < a, a, b); }
+template <typename Lane>
+inline Lane clamp(Lane x, float lo, float hi) { return min(max(x, Lane(lo)), Lane(hi)); }
+template <typename Lane>
+inline Lane mix(Lane a, Lane b, Lane t) { return a * (Lane(1) - t) + b * t; }
+
+template <typename Lane>
+struct Vec3 {
+    Lane x, y, z;
+
+    Vec3() {}
+    Vec3(Lane x, Lane y, Lane z) : x(x), y(y), z(z) {}
+};
+
+template <typename Lane>
+inline Vec3<Lane> operator +(const Vec3<Lane> &a, const Vec3<Lane> &b) { return Vec3<Lane>(a.x + b.x, a.y + b.y, a.z + b.z); }
+template <typename Lane>
+inline Vec3<Lane> operator -(const Vec3<Lane> &a, const Vec3<Lane> &b) { return Vec3<Lane>(a.x - b.x, a.y - b.y, a.z - b.z); }
+template <typename Lane>
+inline Vec3<Lane> operator *(Lane s, const Vec3<Lane> &a) { return Vec3<Lane>(s * a.x, s * a.y, s * a.z); }
+template <typename Lane>
+inline Lane dot(const Vec3<Lane> &a, const Vec3<Lane> &b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+template <typename Lane>
+inline Vec3<Lane> normalize(const Vec3<Lane> &a) { return (Lane(1) / sqrt(dot(a, a))) * a; }
+template <typename Lane>
+inline Vec3<Lane> reflect(const Vec3<Lane> &i, const Vec3<Lane> &n) { return i - (Lane(2) * dot(n, i)) * n; }
+
+// model.vert's varyings the shaders read.
+template <typename Lane>
+struct Fragment {
+    Vec3<Lane> light_direction, eye_direction, normal, c;
+};
+
+template <typename Lane>
+struct Color {
+    Lane rgba[4];
+};
+
+// glsl/gooch.frag
+struct Gooch {
+    template <typename Lane>
+    Color<Lane> operator ()(const SoftUniforms &u, const Fragment<Lane> &f) const
+    {
+        const float warm[3] = { 0.6f, 0.6f, 0 };
+        const float cool[3] = { 0, 0, 0.6f };
+        const float outline = 0.4f;
+
+        Vec3<Lane> N = normalize(f.normal);
+        Vec3<Lane> L = normalize(f.light_direction);
+        Vec3<Lane> E = normalize(f.c);
+        Vec3<Lane> H = normalize(L + E);
+
+        Lane diffuse = dot(L, N);
+        Lane specular = pow(dot(N, H), Lane(32));
+        typename Lane::Mask edge = dot(N, E) < Lane(outline);
+
+        Color<Lane> color;
+        for (int k=0; k<3; k++) {
+            Lane cool_k = min(Lane(cool[k] + u.LMd[k]), Lane(1));
+            Lane warm_k = min(Lane(warm[k] + u.LMd[k]), Lane(1));
+            color.rgba[k] = select(edge, Lane(0), min(mix(cool_k, warm_k, diffuse) + specular, Lane(1)));
+        }
+        color.rgba[3] = Lane(1);
+        return color;
+    }
+};
+
+// glsl/toon_simple_glossy.frag; its branches are taken from the last,
+// each later select overriding the ones it falls through to.
+struct ToonSimpleGlossy {
+    template <typename Lane>
+    Color<Lane> operator ()(const SoftUniforms &u, const Fragment<Lane> &f) const
+    {
+        Lane diffuse = dot(f.light_direction, f.normal);
+        Lane amount_light_to_eye = dot(reflect(f.light_direction, f.normal), f.eye_direction);
+        Lane specular = pow(amount_light_to_eye, Lane(u.shininess));
+
+        typename Lane::Mask lit = Lane(0) < diffuse;
+        typename Lane::Mask bright = Lane(0.5f) < diffuse;
+        typename Lane::Mask glossy = Lane(0.5f) < specular;
+        const float dark_scale[4] = { 0.33f, 0.33f, 0.33f, 1 };
+        Color<Lane> color;
+        for (int k=0; k<4; k++) {
+            Lane c = Lane(k == 3 ? 1.0f : 0.0f);
+            c = select(lit, Lane(dark_scale[k] * u.LMd[k]), c);
+            c = select(bright, Lane(0.9f * u.LMd[k]), c);
+            color.rgba[k] = select(glossy, Lane(u.LMs[k]), c);
+        }
+        return color;
+    }
+};
+
+// glsl/sepia.frag
+struct Sepia {
+    template <typename Lane>
+    Color<Lane> operator ()(const SoftUniforms &u, const Fragment<Lane> &f) const
+    {
+        const float tone[3][3] = {
+            { 0.393f, 0.769f, 0.189f },
+            { 0.349f, 0.686f, 0.168f },
+            { 0.272f, 0.534f, 0.131f }
+        };
+
+        Lane diffuse = dot(f.light_direction, f.normal);
+        Lane amount_light_to_eye = dot(reflect(f.light_direction, f.normal), f.eye_direction);
+        Lane specular = pow(amount_light_to_eye, Lane(u.shininess));
+
+        Lane phong[3];
+        for (int k=0; k<3; k++) {
+            phong[k] = clamp(Lane(u.LMa[k]) + Lane(u.LMd[k]) * diffuse + specular * Lane(u.LMs[k]), 0, 1);
+        }
+        Color<Lane> color;
+        for (int k=0; k<3; k++) {
+            color.rgba[k] = phong[0] * Lane(tone[k][0]) + phong[1] * Lane(tone[k][1]) + phong[2] * Lane(tone[k][2]);
+        }
+        color.rgba[3] = Lane(1);
+        return color;
+    }
+};
+
+template <typename Lane>
+inline Vec3<Lane> loadVec3(const GBuffer &g, int plane, size_t i)
+{
+    return Vec3<Lane>(Lane::load(&g.plane[plane][i]), Lane::load(&g.plane[plane+1][i]),
+                      Lane::load(&g.plane[plane+2][i]));
+}
+
+inline unsigned char toUnorm8(float c)
+{
+    return (unsigned char)(c * 255 + 0.5f);
+}
+
+// glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA) on every channel, of
+// a color already clamped.
+inline void blendOver(unsigned char *dst, const float src[4])
+{
+    float a = src[3];
+    if (a == 1) {
+        for (int k=0; k<4; k++) {
+            dst[k] = toUnorm8(src[k]);
+        }
+        return;
+    }
+    for (int k=0; k<4; k++) {
+        dst[k] = toUnorm8(src[k] * a + dst[k] * (1 / 255.0f) * (1 - a));
+    }
+}
+
+// Pixels [x,x1) of row y a group of Lane::width at a time, as far as
+// whole groups go; returns where it stopped.
+template <typename Lane, typename Program>
+int shadeRow(const Program &program, const SoftUniforms &u, const GBuffer &g,
+             int y, int x, int x1, unsigned char *rgba, int &shaded)
+{
+    const int n = Lane::width;
+    for (; x+n<=x1; x+=n) {
+        size_t i = size_t(y) * g.width + x;
+        const unsigned char *covered = &g.covered[i];
+        int any = 0;
+        for (int k=0; k<n; k++) {
+            any |= covered[k];
+        }
+        if (!any) {
+            continue;
+        }
+        Fragment<Lane> f;
+        f.light_direction = loadVec3<Lane>(g, GBuffer::LIGHT_X, i);
+        f.eye_direction = loadVec3<Lane>(g, GBuffer::EYE_X, i);
+        f.normal = loadVec3<Lane>(g, GBuffer::NORMAL_X, i);
+        f.c = loadVec3<Lane>(g, GBuffer::C_X, i);
+        Color<Lane> color = program(u, f);
+
+        // Clamped as GL does before blending, which NaN does not survive.
+        float channels[4][n];
+        for (int c=0; c<4; c++) {
+            clamp(color.rgba[c], 0, 1).store(channels[c]);
+        }
+        for (int k=0; k<n; k++) {
+            if (covered[k]) {
+                float src[4] = { channels[0][k], channels[1][k], channels[2][k], channels[3][k] };
+                blendOver(&rgba[4*(i+k)], src);
+                shaded++;
+            }
+        }
+    }
+    return x;
+}
+
+template <typename Program>
+int shadeWith(const Program &program, const SoftUniforms &u, const GBuffer &g, unsigned char *rgba)
+{
+    std::vector<int> shaded(g.height, 0);
+    parallelFor(0, g.height, 16, [&](int first, int last) {
+        for (int y=first; y<last; y++) {
+            int x = 0;
+#ifdef __CG_SIMD
+            if (simd_shading) {
+                x = shadeRow<SimdLane>(program, u, g, y, x, g.width, rgba, shaded[y]);
+            }
+#endif
+            shadeRow<ScalarLane>(program, u, g, y, x, g.width, rgba, shaded[y]);
+        }
+    });
+    int total = 0;
+    for (int y=0; y<g.height; y++) {
+        total += shaded[y];
+    }
+    return total;
+}
+
+inline Vec3<ScalarLane> toVec3(const Cg::float3 &v)
+{
+    return Vec3<ScalarLane>(ScalarLane(v[0]), ScalarLane(v[1]), ScalarLane(v[2]));
+}
+
+template <typename Program>
+Cg::float4 shadeOne(const Program &program, const SoftUniforms &u, const SoftVaryings &v)
+{
+    Fragment<ScalarLane> f;
+    f.light_direction = toVec3(v.light_direction);
+    f.eye_direction = toVec3(v.eye_direction);
+    f.normal = toVec3(v.normal);
+    f.c = toVec3(v.c);
+    Color<ScalarLane> color = program(u, f);
+    return Cg::float4(color.rgba[0].v, color.rgba[1].v, color.rgba[2].v, color.rgba[3].v);
+}
+
+} // namespace
+
+bool cpuShaderFor(const std::string &fragment_filename, CpuShader &shader)
+{
+    if (fragment_filename == "glsl/gooch.frag") {
+        shader = CPU_GOOCH;
+    } else if (fragment_filename == "glsl/toon_simple_glossy.frag") {
+        shader = CPU_TOON_SIMPLE_GLOSSY;
+    } else if (fragment_filename == "glsl/sepia.frag") {
+        shader = CPU_SEPIA;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+Cg::float4 shadeCpu(CpuShader shader, const SoftUniforms &uniforms, const SoftVaryings &varyings)
+{
+    switch (shader) {
+    case CPU_GOOCH:
+        return shadeOne(Gooch(), uniforms, varyings);
+    case CPU_TOON_SIMPLE_GLOSSY:
+        return shadeOne(ToonSimpleGlossy(), uniforms, varyings);
+    case CPU_SEPIA:
+    default:
+        return shadeOne(Sepia(), uniforms, varyings);
+    }
+}
+
+int shadeGBuffer(CpuShader shader, const SoftUniforms &uniforms, const GBuffer &gbuffer, unsigned char *rgba)
+{
+    switch (shader) {
+    case CPU_GOOCH:
+        return shadeWith(Gooch(), uniforms, gbuffer, rgba);
+    case CPU_TOON_SIMPLE_GLOSSY:
+        return shadeWith(ToonSimpleGlossy(), uniforms, gbuffer, rgba);
+    case CPU_SEPIA:
+    default:
+        return shadeWith(Sepia(), uniforms, gbuffer, rgba);
+    }
+}
@@ -0,0 +1,39 @@
+// cpushade.hpp - fragment shaders run on the CPU over G-buffers
+
+#ifndef __cpushade_hpp__
+#define __cpushade_hpp__
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+# pragma once
+#endif
+
+#include <string>
+
+#include <Cg/vector.hpp>
+
+#include <GL/glew.h>
+
+#include "softraster.hpp"
+
+// The fragment shaders with a port in cpushade.cpp.
+enum CpuShader {
+    CPU_GOOCH,              // glsl/gooch.frag
+    CPU_TOON_SIMPLE_GLOSSY, // glsl/toon_simple_glossy.frag
+    CPU_SEPIA               // glsl/sepia.frag
+};
+
+// The port of fragment_filename; false when it has none.
+bool cpuShaderFor(const std::string &fragment_filename, CpuShader &shader);
+
+// gl_FragColor of shader for one fragment, before clamping.
+Cg::float4 shadeCpu(CpuShader shader, const SoftUniforms &uniforms, const SoftVaryings &varyings);
+
+// Shades every covered pixel of gbuffer and blends it by its alpha over
+// rgba, RGBA8 of the same size with rows bottom first.  Rows are split
+// over the threads; along a row, four pixels are shaded at a time unless
+// simd_shading is off.  Returns how many pixels were shaded.
+int shadeGBuffer(CpuShader shader, const SoftUniforms &uniforms, const GBuffer &gbuffer, unsigned char *rgba);
+
+extern bool simd_shading;  // -nosimdshading turns off
+
+#endif // __cpushade_hpp__
@@ -0,0 +1,172 @@
+// frustum.cpp - view frustum planes for culling bounding volumes
+
+#include <math.h>
+#include <stdio.h>
+
+#include <Cg/vector.hpp>
+#include <Cg/matrix.hpp>
+#include <Cg/simd.hpp>
+
+#include "frustum.hpp"
+
+using namespace Cg;
+
+namespace {
+
+void cullVolumesScalar(const BoundingVolumes &v, size_t begin, size_t end,
+                       const Frustum &frustum, unsigned char *visible)
+{
+    for (size_t i=begin; i<end; i++) {
+        bool outside = false;
+        for (int p=0; p<6 && !outside; p++) {
+            const float4 &plane = frustum.planes[p];
+            float d = plane.x*v.center_x[i] + plane.y*v.center_y[i] + plane.z*v.center_z[i] + plane.w;
+            float box = fabsf(plane.x)*v.extent_x[i] + fabsf(plane.y)*v.extent_y[i] + fabsf(plane.z)*v.extent_z[i];
+            outside = d < -v.radius[i] || d < -box;
+        }
+        visible[i-begin] = !outside;
+    }
+}
+
+#ifdef __CG_SIMD
+
+void cullVolumes4(const BoundingVolumes &v, size_t begin, size_t end,
+                  const Frustum &frustum, unsigned char *visible)
+{
+    __CGsimd4f planes[6][4], abs_planes[6][3];
+    for (int p=0; p<6; p++) {
+        for (int c=0; c<4; c++) {
+            planes[p][c] = __CGsimd_set1(frustum.planes[p][c]);
+        }
+        for (int c=0; c<3; c++) {
+            abs_planes[p][c] = __CGsimd_set1(fabsf(frustum.planes[p][c]));
+        }
+    }
+    const __CGsimd4f zero = __CGsimd_set1(0);
+    size_t i = begin;
+    for (; i+4<=end; i+=4) {
+        __CGsimd4f cx = __CGsimd_load(&v.center_x[i]);
+        __CGsimd4f cy = __CGsimd_load(&v.center_y[i]);
+        __CGsimd4f cz = __CGsimd_load(&v.center_z[i]);
+        __CGsimd4f ex = __CGsimd_load(&v.extent_x[i]);
+        __CGsimd4f ey = __CGsimd_load(&v.extent_y[i]);
+        __CGsimd4f ez = __CGsimd_load(&v.extent_z[i]);
+        __CGsimd4f neg_r = __CGsimd_sub(zero, __CGsimd_load(&v.radius[i]));
+        int outside = 0;
+        for (int p=0; p<6; p++) {
+            __CGsimd4f d = __CGsimd_add(__CGsimd_add(__CGsimd_mul(planes[p][0], cx), __CGsimd_mul(planes[p][1], cy)),
+                                        __CGsimd_add(__CGsimd_mul(planes[p][2], cz), planes[p][3]));
+            __CGsimd4f box = __CGsimd_add(__CGsimd_add(__CGsimd_mul(abs_planes[p][0], ex),
+                                                       __CGsimd_mul(abs_planes[p][1], ey)),
+                                          __CGsimd_mul(abs_planes[p][2], ez));
+            outside |= __CGsimd_lessmask(d, __CGsimd_max(neg_r, __CGsimd_sub(zero, box)));
+        }
+        for (int k=0; k<4; k++) {
+            visible[i-begin+k] = !(outside & (1 << k));
+        }
+    }
+    cullVolumesScalar(v, i, end, frustum, visible + (i-begin));
+}
+
+#endif
+
+} // namespace
+
+Frustum::Frustum()
+{
+    for (int i=0; i<6; i++) {
+        planes[i] = float4(0,0,0,1);
+    }
+}
+
+Frustum::Frustum(const float4x4 &m)
+{
+    // Clip space keeps -w <= x,y,z <= w, so each plane is the w row plus
+    // or minus one of the others.
+    for (int i=0; i<3; i++) {
+        planes[2*i] = m[3] + m[i];
+        planes[2*i+1] = m[3] - m[i];
+    }
+    for (int i=0; i<6; i++) {
+        float len = sqrtf(planes[i].x*planes[i].x + planes[i].y*planes[i].y + planes[i].z*planes[i].z);
+        if (len > 0) {
+            planes[i] /= len;
+        }
+    }
+}
+
+bool Frustum::boxOutside(const float3 &lo, const float3 &hi) const
+{
+    // Test the corner furthest along each plane's normal.
+    for (int i=0; i<6; i++) {
+        const float4 &p = planes[i];
+        float x = p.x > 0 ? hi.x : lo.x;
+        float y = p.y > 0 ? hi.y : lo.y;
+        float z = p.z > 0 ? hi.z : lo.z;
+        if (p.x*x + p.y*y + p.z*z + p.w < 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Frustum::sphereOutside(const float3 &center, float radius) const
+{
+    for (int i=0; i<6; i++) {
+        const float4 &p = planes[i];
+        if (p.x*center.x + p.y*center.y + p.z*center.z + p.w < -radius) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void BoundingVolumes::clear()
+{
+    center_x.clear();
+    center_y.clear();
+    center_z.clear();
+    extent_x.clear();
+    extent_y.clear();
+    extent_z.clear();
+    radius.clear();
+}
+
+void BoundingVolumes::push_back(const float3 &lo, const float3 &hi, float r)
+{
+    center_x.push_back((lo.x + hi.x) / 2);
+    center_y.push_back((lo.y + hi.y) / 2);
+    center_z.push_back((lo.z + hi.z) / 2);
+    extent_x.push_back((hi.x - lo.x) / 2);
+    extent_y.push_back((hi.y - lo.y) / 2);
+    extent_z.push_back((hi.z - lo.z) / 2);
+    radius.push_back(r);
+}
+
+void cullVolumes(const BoundingVolumes &volumes, size_t begin, size_t end,
+                 const Frustum &frustum, unsigned char *visible)
+{
+#ifdef __CG_SIMD
+    cullVolumes4(volumes, begin, end, frustum, visible);
+#else
+    cullVolumesScalar(volumes, begin, end, frustum, visible);
+#endif
+}
+
+CullStats::CullStats()
+    : objects(0), objects_culled(0), objects_occluded(0)
+    , shapes(0), shapes_culled(0), shapes_occluded(0)
+    , meshlets(0), meshlets_culled(0), meshlets_occluded(0)
+    , triangles(0), triangles_culled(0)
+    , occluder_triangles(0)
+{
+}
+
+void CullStats::print(const char *name) const
+{
+    printf("%s: culled %d of %d objects, %d of %d shapes, %d of %d meshlets, %lld of %lld triangles\n",
+           name, objects_culled, objects, shapes_culled, shapes, meshlets_culled, meshlets,
+           triangles_culled, triangles);
+    printf("  occluded %d objects, %d shapes, %d meshlets behind %lld occluder triangles\n",
+           objects_occluded, shapes_occluded, meshlets_occluded, occluder_triangles);
+}
@@ -0,0 +1,63 @@
+// frustum.hpp - view frustum planes for culling bounding volumes
+
+#ifndef __frustum_hpp__
+#define __frustum_hpp__
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+# pragma once
+#endif
+
+#include <stddef.h>
+
+#include <vector>
+
+#include <Cg/vector.hpp>
+#include <Cg/matrix.hpp>
+
+// The six clip planes of a projection, in whatever space the matrix takes
+// points from.  Planes are normalized and face inward: a point p is inside
+// plane i when dot(planes[i].xyz, p) + planes[i].w >= 0.
+struct Frustum {
+    Cg::float4 planes[6];  // left, right, bottom, top, near, far
+
+    Frustum();
+    // Gribb and Hartmann's extraction from the rows of clip_from_space,
+    // for example projection * view * model for object space.
+    explicit Frustum(const Cg::float4x4 &clip_from_space);
+
+    bool sphereOutside(const Cg::float3 &center, float radius) const;
+    bool boxOutside(const Cg::float3 &lo, const Cg::float3 &hi) const;
+};
+
+// Axis-aligned boxes, each with a sphere about the box's center bounding
+// the same contents, as a structure of arrays.  The sphere is the tighter
+// of the two seen along a box diagonal, the box along an axis.
+struct BoundingVolumes {
+    std::vector<float> center_x, center_y, center_z;
+    std::vector<float> extent_x, extent_y, extent_z;  // half the box size
+    std::vector<float> radius;
+
+    size_t size() const { return radius.size(); }
+    void clear();
+    void push_back(const Cg::float3 &lo, const Cg::float3 &hi, float radius);
+};
+
+// Sets visible[i-begin] for volumes [begin,end) to whether volume i is
+// not wholly outside a plane of frustum by either its box or its sphere.
+void cullVolumes(const BoundingVolumes &volumes, size_t begin, size_t end,
+                 const Frustum &frustum, unsigned char *visible);
+
+// Per-frame culling counters.  The culled counts include the occluded
+// ones.  Triangles are those of the levels of detail that were selected.
+struct CullStats {
+    int objects, objects_culled, objects_occluded;
+    int shapes, shapes_culled, shapes_occluded;
+    int meshlets, meshlets_culled, meshlets_occluded;
+    long long triangles, triangles_culled;
+    long long occluder_triangles;
+
+    CullStats();
+    void print(const char *name) const;
+};
+
+#endif // __frustum_hpp__
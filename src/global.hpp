@@ -15,14 +15,12 @@ extern LightPtr light;
 extern CubeMapPtr envmap;
 
 extern float bump_height;
+extern bool gpu_normal_maps;
+extern bool without_gl;  // -softwareframe: loading makes no GL or GLUT calls
 
 extern double maxFramerate;
 extern double timeUntilRefresh;
 
-extern clock_t clockStartProgram;
-extern double timePreviousFrame;
-extern double timeCurrentFrame;
-
 void stopObjectSpinning();
 void toggleWireframe();
 
@@ -0,0 +1,15 @@
+#version 120
+
+// Blends the scene with a blurred copy of itself, which may be at lower
+// resolution.
+
+uniform sampler2D sceneColor;
+uniform sampler2D blurred;
+uniform float amount;  // 0 is sharp, 1 is all blur
+
+void main()
+{
+    vec2 st = gl_TexCoord[0].st;
+    vec4 color = texture2D(sceneColor, st);
+    gl_FragColor = vec4(mix(color.rgb, texture2D(blurred, st).rgb, amount), color.a);
+}
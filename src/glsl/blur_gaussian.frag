@@ -0,0 +1,27 @@
+#version 120
+
+// One axis of a separable Gaussian.  Taps past the first sit between
+// texels so that bilinear filtering fetches two weighted texels at once;
+// blur.cpp computes their weights and offsets.
+
+uniform sampler2D source;
+uniform vec2 texelSize;  // of source
+uniform vec2 direction;  // (1,0) or (0,1)
+uniform float taps;
+uniform float weights[9];
+uniform float offsets[9];  // texels
+
+void main()
+{
+    vec2 st = gl_TexCoord[0].st;
+    vec2 step = direction * texelSize;
+    vec4 sum = texture2D(source, st) * weights[0];
+    for (int i=1; i<9; i++) {
+        if (float(i) >= taps) {
+            break;
+        }
+        sum += texture2D(source, st + step * offsets[i]) * weights[i];
+        sum += texture2D(source, st - step * offsets[i]) * weights[i];
+    }
+    gl_FragColor = sum;
+}
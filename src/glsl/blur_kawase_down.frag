@@ -0,0 +1,19 @@
+#version 120
+
+// Dual Kawase downsample: the source texel under this one weighted four
+// times against its four diagonal neighbours, each a bilinear fetch
+// blending four texels.
+
+uniform sampler2D source;
+uniform vec2 texelSize;  // of source
+
+void main()
+{
+    vec2 st = gl_TexCoord[0].st;
+    vec4 sum = texture2D(source, st) * 4.0;
+    sum += texture2D(source, st + vec2(-texelSize.x, -texelSize.y));
+    sum += texture2D(source, st + vec2( texelSize.x, -texelSize.y));
+    sum += texture2D(source, st + vec2(-texelSize.x,  texelSize.y));
+    sum += texture2D(source, st + vec2( texelSize.x,  texelSize.y));
+    gl_FragColor = sum / 8.0;
+}
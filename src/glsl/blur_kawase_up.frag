@@ -0,0 +1,23 @@
+#version 120
+
+// Dual Kawase upsample: a ring of eight bilinear fetches around the
+// source position, a source texel away along the axes and half of one
+// on the diagonals, the diagonals weighted twice.
+
+uniform sampler2D source;
+uniform vec2 texelSize;  // of source
+
+void main()
+{
+    vec2 st = gl_TexCoord[0].st;
+    vec2 h = texelSize * 0.5;
+    vec4 sum = texture2D(source, st + vec2(-2.0*h.x, 0.0));
+    sum += texture2D(source, st + vec2( 2.0*h.x, 0.0));
+    sum += texture2D(source, st + vec2(0.0, -2.0*h.y));
+    sum += texture2D(source, st + vec2(0.0,  2.0*h.y));
+    sum += texture2D(source, st + vec2(-h.x, -h.y)) * 2.0;
+    sum += texture2D(source, st + vec2( h.x, -h.y)) * 2.0;
+    sum += texture2D(source, st + vec2(-h.x,  h.y)) * 2.0;
+    sum += texture2D(source, st + vec2( h.x,  h.y)) * 2.0;
+    gl_FragColor = sum / 12.0;
+}
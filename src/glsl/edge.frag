@@ -1,13 +1,90 @@
-uniform sampler2D my_color_texture;
-uniform sampler2D normalMap;
-uniform sampler2D texture;
-uniform sampler2D heightField;
-uniform samplerCube envmap;
+#version 120
 
+// Ink lines over the rendered scene.  Sobel on view depth finds
+// silhouettes; Roberts cross on normals rebuilt from depth finds creases.
+// Taps are edgeWidth pixels apart, so wider spacing draws thicker lines.
+
+uniform sampler2D sceneColor;
+uniform sampler2D sceneDepth;
+uniform vec2 texelSize;   // 1/width, 1/height
+uniform float edgeWidth;  // pixels
+uniform vec2 clipPlanes;  // near, far
+uniform vec2 viewScale;   // view-space x and y per unit ndc and depth
+uniform vec4 inkColor;
+
+varying vec2 st;
+
+// Depth jump, relative to the nearer side, that starts a silhouette
+const float depthThreshold = 0.02;
+// Length of the normals' difference that starts a crease, about 30 degrees
+const float normalThreshold = 0.5;
+
+// Distance from the eye along the view axis, for taps (i,j) in -1..2
+float z[16];
+
+vec2 tap(int i, int j)
+{
+    return st + vec2(float(i), float(j)) * edgeWidth * texelSize;
+}
+
+float viewDepth(int i, int j)
+{
+    float d = texture2D(sceneDepth, tap(i, j)).r;
+    return clipPlanes.x * clipPlanes.y / (clipPlanes.y - d * (clipPlanes.y - clipPlanes.x));
+}
+
+float depthAt(int i, int j)
+{
+    return z[(j+1)*4 + (i+1)];
+}
+
+vec3 position(int i, int j)
+{
+    float d = depthAt(i, j);
+    return vec3((tap(i, j) * 2.0 - 1.0) * viewScale * d, -d);
+}
+
+// Of the differences toward either neighbour, the one that stays on the
+// same surface is the smaller.
+vec3 tangent(vec3 center, vec3 before, vec3 after)
+{
+    vec3 forward = after - center, backward = center - before;
+    return abs(forward.z) < abs(backward.z) ? forward : backward;
+}
+
+vec3 normal(int i, int j)
+{
+    vec3 p = position(i, j);
+    vec3 dx = tangent(p, position(i-1, j), position(i+1, j));
+    vec3 dy = tangent(p, position(i, j-1), position(i, j+1));
+    return normalize(cross(dx, dy));
+}
 
 void main()
 {
+    for (int j=-1; j<=2; j++) {
+        for (int i=-1; i<=2; i++) {
+            z[(j+1)*4 + (i+1)] = viewDepth(i, j);
+        }
+    }
+
+    float gx = (depthAt(1,-1) + 2.0*depthAt(1,0) + depthAt(1,1))
+             - (depthAt(-1,-1) + 2.0*depthAt(-1,0) + depthAt(-1,1));
+    float gy = (depthAt(-1,1) + 2.0*depthAt(0,1) + depthAt(1,1))
+             - (depthAt(-1,-1) + 2.0*depthAt(0,-1) + depthAt(1,-1));
+
+    vec3 n00 = normal(0, 0), n10 = normal(1, 0), n01 = normal(0, 1), n11 = normal(1, 1);
+    float crease = length(n00 - n11) + length(n10 - n01);
+
+    // Surfaces seen edge on change depth quickly without any silhouette,
+    // so the threshold grows as the center surface turns away.
+    vec3 view = normalize(position(0, 0));
+    float facing = max(abs(dot(n00, view)), 0.1);
+    float jump = length(vec2(gx, gy)) / 8.0 / depthAt(0, 0);
 
-gl_FragColor = texture2D(texture, gl_TexCoord[0].st);
+    float ink = max(smoothstep(depthThreshold, 2.0*depthThreshold, jump * facing),
+                    smoothstep(normalThreshold, 2.0*normalThreshold, crease));
 
-}
\ No newline at end of file
+    vec4 color = texture2D(sceneColor, st);
+    gl_FragColor = vec4(mix(color.rgb, inkColor.rgb, ink * inkColor.a), color.a);
+}
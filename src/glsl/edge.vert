@@ -1,9 +1,11 @@
+#version 120
 
+// Full-screen pass over the unit square; st addresses the scene targets.
+
+varying vec2 st;
 
 void main()
 {
-gl_TexCoord[0] = gl_MultiTexCoord0;
-gl_Position = gl_ModelViewProjectionMatrix * gl_Vertex;
-
-
-}
\ No newline at end of file
+    st = gl_Vertex.xy;
+    gl_Position = vec4(gl_Vertex.xy * 2.0 - 1.0, 0.0, 1.0);
+}
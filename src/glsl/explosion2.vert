@@ -88,20 +88,38 @@ float snoise(vec2 v)
   return 130.0 * dot(m, g);
 }
 
+// Packed vertex (see mesh.hpp): positions are 16-bit fractions of the
+// shape's bounding box, normals are octahedral snorm16, texcoords are half.
+attribute vec3 packedPosition;
+attribute vec2 packedNormal;
+attribute vec2 packedTexCoord;
+uniform vec3 positionScale; // bounding box extent
+uniform vec3 positionBias; // bounding box minimum
+
+vec3 decodeOctahedral(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
 void main (void)
 {
+  vec4 vertex = vec4(positionBias + positionScale * packedPosition, 1.0);
 
-  gl_TexCoord[0] = gl_MultiTexCoord0;
-  vertexInModelViewSpace = vec3(gl_Vertex);
-  normal = normalize(gl_Normal);
+  gl_TexCoord[0] = vec4(packedTexCoord, 0.0, 1.0);
+  vertexInModelViewSpace = vec3(vertex);
+  normal = decodeOctahedral(packedNormal);
 
-  vec4 temp = gl_ModelViewMatrix *gl_Vertex;
+  vec4 temp = gl_ModelViewMatrix *vertex;
   c = vec3(-temp[0],-temp[1], -temp[2]);
 
   lightDirection = normalize(lightPosition - vertexInModelViewSpace);
   eyeDirection = normalize(eyePosition - vertexInModelViewSpace);
 
-  vertexInModelViewSpace = vec3(gl_Vertex);
+  vertexInModelViewSpace = vec3(vertex);
 
 
   float displacement = cos(2.0*timePreviousFrame)*snoise(vec2(normal.x, normal.y));
@@ -4,11 +4,12 @@ uniform sampler2D ColorBuffer;
 
 void main()
 {
-    int Samples = 128;
-    float Intensity = 0.125, Decay = 0.96875;
+    int Samples = 32;
+    float Intensity = 0.125, Decay = 0.88;  // weights sum to about one
     vec2 TexCoord = gl_TexCoord[0].st, Direction = vec2(0.5) - TexCoord;
     Direction /= Samples;
-    vec3 Color = texture2D(ColorBuffer, TexCoord).rgb;
+    // Only the shafts; the composite pass adds them over the scene.
+    vec3 Color = vec3(0.0);
     
     for(int Sample = 0; Sample < Samples; Sample++)
     {
@@ -0,0 +1,13 @@
+#version 120
+
+// Adds the light shafts, gathered at lower resolution, over the scene.
+
+uniform sampler2D ColorBuffer;
+uniform sampler2D RayBuffer;
+
+void main()
+{
+    vec2 TexCoord = gl_TexCoord[0].st;
+    vec4 Color = texture2D(ColorBuffer, TexCoord);
+    gl_FragColor = vec4(Color.rgb + texture2D(RayBuffer, TexCoord).rgb, Color.a);
+}
@@ -0,0 +1,29 @@
+#version 120
+
+// Converts a tiling height field into a packed tangent-space normal map.
+// Same Sobel filter and 128+127*n packing as NormalMap::computeNormals.
+
+uniform sampler2D heightField;
+uniform vec2 texelSize;
+uniform float scale;
+
+varying vec2 st;
+
+float height(float ds, float dt)
+{
+    vec3 rgb = texture2D(heightField, st + vec2(ds, dt) * texelSize).rgb;
+    return dot(rgb, vec3(0.299, 0.587, 0.114));
+}
+
+void main()
+{
+    float h00 = height(-1.0, -1.0), h10 = height(0.0, -1.0), h20 = height(1.0, -1.0);
+    float h01 = height(-1.0,  0.0),                          h21 = height(1.0,  0.0);
+    float h02 = height(-1.0,  1.0), h12 = height(0.0,  1.0), h22 = height(1.0,  1.0);
+
+    float ds = ((h20 - h00) + 2.0*(h21 - h01) + (h22 - h02)) / 8.0;
+    float dt = ((h02 + 2.0*h12 + h22) - (h00 + 2.0*h10 + h20)) / 8.0;
+
+    vec3 normal = normalize(vec3(-scale*ds, -scale*dt, 1.0));
+    gl_FragColor = vec4((128.0 + 127.0*normal) / 255.0, 1.0);
+}
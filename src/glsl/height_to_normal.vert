@@ -0,0 +1,11 @@
+#version 120
+
+// Full-screen pass over the unit square; st addresses the height field.
+
+varying vec2 st;
+
+void main()
+{
+    st = gl_Vertex.xy;
+    gl_Position = vec4(gl_Vertex.xy * 2.0 - 1.0, 0.0, 1.0);
+}
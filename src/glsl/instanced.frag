@@ -0,0 +1,42 @@
+
+uniform vec4 LMa; // Light-Material ambient
+uniform vec4 LMd; // Light-Material diffuse
+uniform vec4 LMs; // Light-Material specular
+uniform float shininess;
+
+varying vec3 lightDirection; // in
+varying vec3 eyeDirection; // in
+varying vec3 normal; // in
+varying vec4 tint; // in
+
+// Three-band toon shading, as toon_simple.frag, of the material tinted by
+// each instance's color.
+void main () {
+    vec3 N = normalize(normal);
+    vec3 L = normalize(lightDirection);
+    vec3 E = normalize(eyeDirection);
+    float diffuse = dot(L, N);
+    float Outline = 0.2;
+
+    float band;
+    if (diffuse > 0.95) {
+        band = 1.0;
+    }
+    else if (diffuse > 0.5) {
+        band = 0.625;
+    }
+    else if (diffuse > 0.05) {
+        band = 0.35;
+    }
+    else {
+        band = 0.1;
+    }
+    float specular = pow(max(0.0, dot(N, normalize(L + E))), shininess) > 0.5 ? 1.0 : 0.0;
+
+    vec4 outputColor = tint * (LMa + band * LMd) + specular * LMs;
+    // Dark rim where the surface turns away from the eye
+    if (dot(N, E) < Outline) {
+        outputColor = vec4(0.0, 0.0, 0.0, 1.0);
+    }
+    gl_FragColor = vec4(outputColor.rgb, 1.0);
+}
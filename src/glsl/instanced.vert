@@ -0,0 +1,49 @@
+
+uniform vec3 lightPosition; // Object-space
+uniform vec3 eyePosition; // Object-space
+
+varying vec3 lightDirection; // out
+varying vec3 eyeDirection; // out
+varying vec3 normal; // out
+varying vec4 tint; // out
+
+// Packed vertex (see mesh.hpp), as in model.vert.
+attribute vec3 packedPosition;
+attribute vec2 packedNormal;
+attribute vec2 packedTexCoord;
+uniform vec3 positionScale; // bounding box extent
+uniform vec3 positionBias; // bounding box minimum
+
+// Per instance: rows of the 3x4 object-from-instance matrix and a color
+// that tints the material.
+attribute vec4 instanceRow0;
+attribute vec4 instanceRow1;
+attribute vec4 instanceRow2;
+attribute vec4 instanceColor;
+
+vec3 decodeOctahedral(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+void main (void)
+{
+    vec4 local = vec4(positionBias + positionScale * packedPosition, 1.0);
+    vec4 vertex = vec4(dot(instanceRow0, local), dot(instanceRow1, local), dot(instanceRow2, local), 1.0);
+
+    // Instances are turned and scaled uniformly, so the upper 3x3 carries
+    // normals too.
+    vec3 n = decodeOctahedral(packedNormal);
+    normal = normalize(vec3(dot(instanceRow0.xyz, n), dot(instanceRow1.xyz, n), dot(instanceRow2.xyz, n)));
+
+    gl_TexCoord[0] = vec4(packedTexCoord, 0.0, 1.0);
+    tint = instanceColor;
+
+    lightDirection = normalize(lightPosition - vertex.xyz);
+    eyeDirection = normalize(eyePosition - vertex.xyz);
+    gl_Position = gl_ModelViewProjectionMatrix * vertex;
+}
@@ -26,18 +26,36 @@ uniform samplerCube envmap;
 
 
 
+// Packed vertex (see mesh.hpp): positions are 16-bit fractions of the
+// shape's bounding box, normals are octahedral snorm16, texcoords are half.
+attribute vec3 packedPosition;
+attribute vec2 packedNormal;
+attribute vec2 packedTexCoord;
+uniform vec3 positionScale; // bounding box extent
+uniform vec3 positionBias; // bounding box minimum
+
+vec3 decodeOctahedral(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
 void main (void)
 {
-    vertexInModelViewSpace = vec3(gl_Vertex);
-    normal = normalize(gl_Normal);
+    vec4 vertex = vec4(positionBias + positionScale * packedPosition, 1.0);
+    vertexInModelViewSpace = vec3(vertex);
+    normal = decodeOctahedral(packedNormal);
 
-    vec4 temp = gl_ModelViewMatrix *gl_Vertex;
+    vec4 temp = gl_ModelViewMatrix *vertex;
     c = vec3(-temp[0],-temp[1], -temp[2]);
     
     //lightDirection = normalize(lightPosition - vertexInModelViewSpace);
     lightDirection = reflect(-c ,  normal);
     eyeDirection = normalize(eyePosition - vertexInModelViewSpace);
     //gl_FrontColor = gl_Color;
-    gl_Position = gl_ModelViewProjectionMatrix * gl_Vertex;
+    gl_Position = gl_ModelViewProjectionMatrix * vertex;
 
 }
\ No newline at end of file
@@ -0,0 +1,23 @@
+#version 120
+
+// One level of a packed normal map's mip chain from the level above: the
+// 2x2 normals under the texel are unpacked, averaged and renormalized,
+// as MipChain does for MIP_NORMAL, where glGenerateMipmap would leave
+// them short.
+
+uniform sampler2D normalMap;  // only the level above is visible, unfiltered
+uniform vec2 texelSize;       // of the level above
+
+varying vec2 st;
+
+vec3 unpack(float ds, float dt)
+{
+    return texture2D(normalMap, st + vec2(ds, dt) * texelSize).rgb * 255.0 - 128.0;
+}
+
+void main()
+{
+    vec3 sum = unpack(-0.5, -0.5) + unpack(0.5, -0.5) + unpack(-0.5, 0.5) + unpack(0.5, 0.5);
+    vec3 normal = dot(sum, sum) > 0.0 ? normalize(sum) : vec3(0.0, 0.0, 1.0);
+    gl_FragColor = vec4((128.0 + 127.0*normal) / 255.0, 1.0);
+}
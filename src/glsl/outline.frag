@@ -0,0 +1,6 @@
+uniform vec4 outlineColor;
+
+void main (void)
+{
+    gl_FragColor = outlineColor;
+}
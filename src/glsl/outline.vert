@@ -0,0 +1,10 @@
+// Packed vertex (see mesh.hpp); only the position is used.
+attribute vec3 packedPosition;
+uniform vec3 positionScale; // bounding box extent
+uniform vec3 positionBias; // bounding box minimum
+
+void main (void)
+{
+    vec4 vertex = vec4(positionBias + positionScale * packedPosition, 1.0);
+    gl_Position = gl_ModelViewProjectionMatrix * vertex;
+}
@@ -0,0 +1,10 @@
+#version 120
+
+// Full-screen pass over the unit square, which also carries the texture
+// coordinates.
+
+void main()
+{
+    gl_TexCoord[0] = gl_MultiTexCoord0;
+    gl_Position = vec4(gl_Vertex.xy * 2.0 - 1.0, 0.0, 1.0);
+}
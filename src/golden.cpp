@@ -0,0 +1,543 @@
+// golden.cpp - golden-image regression of fixed frames
+//
+// The difference follows LDR-FLIP (Andersson et al., "FLIP: A Difference
+// Evaluator for Alternating Images", 2020).  Every filter in it is a
+// Gaussian or a Gaussian's derivative, or a sum of them, so each runs as
+// two one-dimensional passes, four pixels at a time on <Cg/simd.hpp> and
+// rows split over the threads.
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cctype>
+
+#include <Cg/double.hpp>
+#include <Cg/vector.hpp>
+#include <Cg/simd.hpp>
+
+#include <GL/glew.h>
+
+#include "golden.hpp"
+#include "png.hpp"
+#include "offscreen.hpp"
+#include "parallel.hpp"
+#include "menus.hpp"
+#include "global.hpp"
+#include "timesource.hpp"
+#include "../stb/stb_image.h"
+
+using namespace Cg;
+
+extern const char *program_name;
+
+const char *golden_directory = NULL;
+bool golden_update = false;
+const char *golden_filter = NULL;
+// A change of 1/255 everywhere already averages about 0.03, so the mean
+// only catches broad shifts; the changed fraction catches the rest.
+GoldenThresholds golden_thresholds = { 0.3f, 0.001f, 0.05f };
+
+namespace {
+
+const int golden_width = 320, golden_height = 240;
+const double golden_time = 1.0;          // seconds per frame; frame 1 is drawn
+const float pixels_per_degree = 67.0f;   // FLIP's default: a 24" 4K monitor 0.7 m away
+
+// A plane of floats, rows bottom first.
+struct Plane {
+    int width, height;
+    std::vector<float> v;
+
+    Plane(int w, int h) : width(w), height(h), v(size_t(w) * h) {}
+
+    float *row(int y) { return &v[size_t(y) * width]; }
+    const float *row(int y) const { return &v[size_t(y) * width]; }
+};
+
+typedef std::vector<float> Kernel;  // taps from -radius to radius
+
+int radiusFor(float sigma)
+{
+    return std::max(1, int(ceilf(3 * sigma)));
+}
+
+Kernel gaussian(float sigma)
+{
+    int r = radiusFor(sigma);
+    Kernel k(2*r + 1);
+    float sum = 0;
+    for (int i=-r; i<=r; i++) {
+        k[i+r] = expf(-0.5f * i * i / (sigma * sigma));
+        sum += k[i+r];
+    }
+    for (size_t i=0; i<k.size(); i++) {
+        k[i] /= sum;
+    }
+    return k;
+}
+
+// The first or second derivative of a Gaussian, with its positive and
+// its negative taps each summing to one, as FLIP's edge and point
+// detectors.
+Kernel gaussianDerivative(float sigma, int order)
+{
+    int r = radiusFor(sigma);
+    Kernel k(2*r + 1);
+    float positive = 0, negative = 0;
+    for (int i=-r; i<=r; i++) {
+        float g = expf(-0.5f * i * i / (sigma * sigma));
+        float d = order == 1 ? -i * g : (i * i / (sigma * sigma) - 1) * g;
+        k[i+r] = d;
+        if (d > 0) {
+            positive += d;
+        } else {
+            negative -= d;
+        }
+    }
+    for (size_t i=0; i<k.size(); i++) {
+        k[i] /= k[i] > 0 ? positive : negative;
+    }
+    return k;
+}
+
+// Taps over consecutive rows of floats at rows[t] + x.
+inline void accumulate(const Kernel &k, const float *const *rows, int x, int end, float *out)
+{
+#ifdef __CG_SIMD
+    for (; x+4<=end; x+=4) {
+        __CGsimd4f sum = __CGsimd_set1(0);
+        for (size_t t=0; t<k.size(); t++) {
+            sum = __CGsimd_add(sum, __CGsimd_mul(__CGsimd_set1(k[t]), __CGsimd_load(rows[t] + x)));
+        }
+        __CGsimd_store(out + x, sum);
+    }
+#endif
+    for (; x<end; x++) {
+        float sum = 0;
+        for (size_t t=0; t<k.size(); t++) {
+            sum += k[t] * rows[t][x];
+        }
+        out[x] = sum;
+    }
+}
+
+// src filtered along its rows by kx and then its columns by ky, into dst;
+// pixels past the edges repeat the edge's.
+void convolve(const Plane &src, const Kernel &kx, const Kernel &ky, Plane &scratch, Plane &dst)
+{
+    int w = src.width, h = src.height;
+    int rx = int(kx.size() / 2), ry = int(ky.size() / 2);
+    parallelFor(0, h, 16, [&](int first, int last) {
+        std::vector<float> padded(w + 2*rx);
+        std::vector<const float *> taps(kx.size());
+        for (size_t t=0; t<kx.size(); t++) {
+            taps[t] = &padded[t];
+        }
+        for (int y=first; y<last; y++) {
+            const float *s = src.row(y);
+            for (int i=0; i<w+2*rx; i++) {
+                padded[i] = s[std::min(std::max(i - rx, 0), w - 1)];
+            }
+            accumulate(kx, &taps[0], 0, w, scratch.row(y));
+        }
+    });
+    parallelFor(0, h, 16, [&](int first, int last) {
+        std::vector<const float *> taps(ky.size());
+        for (int y=first; y<last; y++) {
+            for (int t=0; t<int(ky.size()); t++) {
+                taps[t] = scratch.row(std::min(std::max(y + t - ry, 0), h - 1));
+            }
+            accumulate(ky, &taps[0], 0, w, dst.row(y));
+        }
+    });
+}
+
+const float rgb_to_xyz[3][3] = {
+    { 0.4124564f, 0.3575761f, 0.1804375f },
+    { 0.2126729f, 0.7151522f, 0.0721750f },
+    { 0.0193339f, 0.1191920f, 0.9503041f }
+};
+const float xyz_to_rgb[3][3] = {
+    {  3.2404542f, -1.5371385f, -0.4985314f },
+    { -0.9692660f,  1.8760108f,  0.0415560f },
+    {  0.0556434f, -0.2040259f,  1.0572252f }
+};
+const float white[3] = { 0.9504700f, 1.0000000f, 1.0888300f };  // of linear (1,1,1)
+
+inline void mul3(const float m[3][3], const float v[3], float out[3])
+{
+    for (int i=0; i<3; i++) {
+        out[i] = m[i][0] * v[0] + m[i][1] * v[1] + m[i][2] * v[2];
+    }
+}
+
+float srgbToLinear(unsigned char c)
+{
+    static const std::vector<float> table = [] {
+        std::vector<float> t(256);
+        for (int i=0; i<256; i++) {
+            float s = i / 255.0f;
+            t[i] = s <= 0.04045f ? s / 12.92f : powf((s + 0.055f) / 1.055f, 2.4f);
+        }
+        return t;
+    }();
+    return table[c];
+}
+
+// YCxCz, the opponent space the eye's filtering is applied in: CIELAB
+// without its cube roots.
+void toYCxCz(const unsigned char *rgba, Plane &y, Plane &cx, Plane &cz)
+{
+    parallelFor(0, y.height, 16, [&](int first, int last) {
+        for (size_t i=size_t(first)*y.width; i<size_t(last)*y.width; i++) {
+            float rgb[3] = { srgbToLinear(rgba[4*i]), srgbToLinear(rgba[4*i+1]), srgbToLinear(rgba[4*i+2]) };
+            float xyz[3];
+            mul3(rgb_to_xyz, rgb, xyz);
+            float fx = xyz[0] / white[0], fy = xyz[1] / white[1], fz = xyz[2] / white[2];
+            y.v[i] = 116 * fy - 16;
+            cx.v[i] = 500 * (fx - fy);
+            cz.v[i] = 200 * (fy - fz);
+        }
+    });
+}
+
+inline float labF(float t)
+{
+    const float delta = 6.0f / 29;
+    return t > delta * delta * delta ? cbrtf(t) : t / (3 * delta * delta) + 4.0f / 29;
+}
+
+// CIELAB with the Hunt effect, chroma fading with lightness, of linear RGB.
+void huntLab(const float rgb[3], float lab[3])
+{
+    float xyz[3];
+    mul3(rgb_to_xyz, rgb, xyz);
+    float fx = labF(xyz[0] / white[0]), fy = labF(xyz[1] / white[1]), fz = labF(xyz[2] / white[2]);
+    lab[0] = 116 * fy - 16;
+    lab[1] = 0.01f * lab[0] * 500 * (fx - fy);
+    lab[2] = 0.01f * lab[0] * 200 * (fy - fz);
+}
+
+// Filtered YCxCz back to linear RGB, clamped, in Hunt-adjusted CIELAB.
+void ycxczToHuntLab(float y, float cx, float cz, float lab[3])
+{
+    float fy = (y + 16) / 116;
+    float xyz[3] = { (cx / 500 + fy) * white[0], fy * white[1], (fy - cz / 200) * white[2] };
+    float rgb[3];
+    mul3(xyz_to_rgb, xyz, rgb);
+    for (int k=0; k<3; k++) {
+        rgb[k] = std::min(std::max(rgb[k], 0.0f), 1.0f);
+    }
+    huntLab(rgb, lab);
+}
+
+inline float hyab(const float a[3], const float b[3])
+{
+    float da = a[1] - b[1], db = a[2] - b[2];
+    return fabsf(a[0] - b[0]) + sqrtf(da * da + db * db);
+}
+
+// One image's planes: the eye-filtered colors and the feature strengths.
+struct Filtered {
+    Plane y, cx, cz;
+    Plane edges, points;
+
+    Filtered(int w, int h) : y(w, h), cx(w, h), cz(w, h), edges(w, h), points(w, h) {}
+};
+
+struct Filters {
+    Kernel achromatic, red_green, blue_yellow1, blue_yellow2;
+    float blue_yellow_weight1, blue_yellow_weight2;
+    Kernel feature, edge, point;
+
+    Filters(float ppd) {
+        // The contrast sensitivity of each channel as a Gaussian, or two,
+        // a exp(-pi^2 x^2 / b) over x in degrees, whose 2D integrals
+        // weigh them against each other.
+        const float pi = float(M_PI);
+        achromatic = gaussian(sqrtf(0.0047f / (2 * pi * pi)) * ppd);
+        red_green = gaussian(sqrtf(0.0053f / (2 * pi * pi)) * ppd);
+        blue_yellow1 = gaussian(sqrtf(0.04f / (2 * pi * pi)) * ppd);
+        blue_yellow2 = gaussian(sqrtf(0.025f / (2 * pi * pi)) * ppd);
+        float w1 = 34.1f * sqrtf(0.04f / pi), w2 = 13.5f * sqrtf(0.025f / pi);
+        blue_yellow_weight1 = w1 / (w1 + w2);
+        blue_yellow_weight2 = w2 / (w1 + w2);
+        // Features a hair, 0.082 degrees, across.
+        float sigma = 0.5f * 0.082f * ppd;
+        feature = gaussian(sigma);
+        edge = gaussianDerivative(sigma, 1);
+        point = gaussianDerivative(sigma, 2);
+    }
+};
+
+void filterImage(const unsigned char *rgba, const Filters &f, Plane &scratch, Plane &tmp, Filtered &out)
+{
+    int w = out.y.width, h = out.y.height;
+    Plane y(w, h), cx(w, h), cz(w, h);
+    toYCxCz(rgba, y, cx, cz);
+    convolve(y, f.achromatic, f.achromatic, scratch, out.y);
+    convolve(cx, f.red_green, f.red_green, scratch, out.cx);
+    convolve(cz, f.blue_yellow1, f.blue_yellow1, scratch, out.cz);
+    convolve(cz, f.blue_yellow2, f.blue_yellow2, scratch, tmp);
+    for (size_t i=0; i<out.cz.v.size(); i++) {
+        out.cz.v[i] = f.blue_yellow_weight1 * out.cz.v[i] + f.blue_yellow_weight2 * tmp.v[i];
+    }
+
+    // Features of the unfiltered lightness, scaled to [0,1].
+    for (size_t i=0; i<y.v.size(); i++) {
+        y.v[i] = (y.v[i] + 16) / 116;
+    }
+    Plane dx(w, h), dy(w, h);
+    convolve(y, f.edge, f.feature, scratch, dx);
+    convolve(y, f.feature, f.edge, scratch, dy);
+    for (size_t i=0; i<dx.v.size(); i++) {
+        out.edges.v[i] = sqrtf(dx.v[i] * dx.v[i] + dy.v[i] * dy.v[i]);
+    }
+    convolve(y, f.point, f.feature, scratch, dx);
+    convolve(y, f.feature, f.point, scratch, dy);
+    for (size_t i=0; i<dx.v.size(); i++) {
+        out.points.v[i] = sqrtf(dx.v[i] * dx.v[i] + dy.v[i] * dy.v[i]);
+    }
+}
+
+// The magma color scale at ninths.
+const float magma[9][3] = {
+    { 0.000f, 0.000f, 0.016f },
+    { 0.110f, 0.063f, 0.267f },
+    { 0.310f, 0.071f, 0.482f },
+    { 0.506f, 0.145f, 0.506f },
+    { 0.710f, 0.212f, 0.478f },
+    { 0.898f, 0.314f, 0.392f },
+    { 0.984f, 0.529f, 0.380f },
+    { 0.996f, 0.761f, 0.529f },
+    { 0.988f, 0.992f, 0.749f }
+};
+
+std::string nameOf(const char *path)
+{
+    std::string name = path;
+    size_t slash = name.find_last_of('/');
+    if (slash != std::string::npos) {
+        name = name.substr(slash + 1);
+    }
+    size_t dot = name.find_last_of('.');
+    if (dot != std::string::npos) {
+        name = name.substr(0, dot);
+    }
+    for (size_t i=0; i<name.size(); i++) {
+        name[i] = isalnum((unsigned char)name[i]) ? char(tolower((unsigned char)name[i])) : '_';
+    }
+    return name;
+}
+
+// A PNG as RGBA8 with rows bottom first; false unless it is width by height.
+bool readReference(const std::string &filename, int width, int height, std::vector<unsigned char> &rgba)
+{
+    int w, h, components;
+    unsigned char *image = stbi_load(filename.c_str(), &w, &h, &components, 4);
+    if (!image) {
+        return false;
+    }
+    bool ok = w == width && h == height;
+    if (ok) {
+        rgba.resize(size_t(w) * h * 4);
+        for (int y=0; y<h; y++) {
+            memcpy(&rgba[size_t(h-1-y) * w * 4], image + size_t(y) * w * 4, size_t(w) * 4);
+        }
+    }
+    stbi_image_free(image);
+    return ok;
+}
+
+// The menus as a user would pick them, from whatever the last case left.
+void applyCase(const GoldenCase &c, int &loaded_model)
+{
+    if (c.model != loaded_model) {
+        modelMenu(c.model);
+        loaded_model = c.model;
+    }
+    clearExtras();
+    shaderMenu(c.shader);
+    if (c.extra >= 0) {
+        extraMenu(c.extra);
+    }
+}
+
+} // namespace
+
+std::vector<GoldenCase> goldenCases(const char *filter)
+{
+    std::vector<GoldenCase> cases;
+    for (int m=0; m<modelCount(); m++) {
+        for (int s=0; s<shaderCount(); s++) {
+            GoldenCase c;
+            c.name = nameOf(modelFilename(m)) + "-" + nameOf(shaderFilename(s));
+            c.model = m;
+            c.shader = s;
+            c.extra = -1;
+            cases.push_back(c);
+        }
+        for (int e=0; e<extraCount(); e++) {
+            GoldenCase c;
+            c.name = nameOf(modelFilename(m)) + "-" + nameOf(shaderFilename(0)) + "-" + nameOf(extraAction(e));
+            c.model = m;
+            c.shader = 0;
+            c.extra = e;
+            cases.push_back(c);
+        }
+    }
+    if (filter && *filter) {
+        std::vector<GoldenCase> kept;
+        for (size_t i=0; i<cases.size(); i++) {
+            if (cases[i].name.find(filter) != std::string::npos) {
+                kept.push_back(cases[i]);
+            }
+        }
+        cases.swap(kept);
+    }
+    return cases;
+}
+
+FlipStats flipError(const unsigned char *test, const unsigned char *reference, int width, int height,
+                    float ppd, float pixel_threshold, float *error)
+{
+    const Filters filters(ppd);
+    Plane scratch(width, height), tmp(width, height);
+    Filtered t(width, height), r(width, height);
+    filterImage(test, filters, scratch, tmp, t);
+    filterImage(reference, filters, scratch, tmp, r);
+
+    // Color differences are compressed and then remapped so that the
+    // largest, green against blue, is one, with most of the range given
+    // to the smaller ones.
+    const float qc = 0.7f, pc = 0.4f, pt = 0.95f, qf = 0.5f;
+    const float green[3] = { 0, 1, 0 }, blue[3] = { 0, 0, 1 };
+    float green_lab[3], blue_lab[3];
+    huntLab(green, green_lab);
+    huntLab(blue, blue_lab);
+    const float cmax = powf(hyab(green_lab, blue_lab), qc);
+
+    std::vector<double> row_sum(height, 0);
+    std::vector<float> row_max(height, 0);
+    std::vector<int> row_changed(height, 0);
+    parallelFor(0, height, 16, [&](int first, int last) {
+        for (int y=first; y<last; y++) {
+            for (int x=0; x<width; x++) {
+                size_t i = size_t(y) * width + x;
+                float a[3], b[3];
+                ycxczToHuntLab(t.y.v[i], t.cx.v[i], t.cz.v[i], a);
+                ycxczToHuntLab(r.y.v[i], r.cx.v[i], r.cz.v[i], b);
+                float color = powf(hyab(a, b), qc);
+                color = color < pc * cmax ? pt / (pc * cmax) * color
+                                          : pt + (color - pc * cmax) / (cmax - pc * cmax) * (1 - pt);
+                color = std::min(color, 1.0f);
+                float feature = std::max(fabsf(t.edges.v[i] - r.edges.v[i]), fabsf(t.points.v[i] - r.points.v[i]));
+                feature = powf(std::min(feature / float(M_SQRT2), 1.0f), qf);
+                float e = powf(color, 1 - feature);
+                error[i] = e;
+                row_sum[y] += e;
+                row_max[y] = std::max(row_max[y], e);
+                row_changed[y] += e > pixel_threshold;
+            }
+        }
+    });
+
+    FlipStats stats;
+    double sum = 0;
+    int changed = 0;
+    stats.max = 0;
+    for (int y=0; y<height; y++) {
+        sum += row_sum[y];
+        stats.max = std::max(stats.max, row_max[y]);
+        changed += row_changed[y];
+    }
+    size_t count = size_t(width) * height;
+    stats.mean = count ? float(sum / count) : 0;
+    stats.changed = count ? float(double(changed) / count) : 0;
+    return stats;
+}
+
+void errorHeatmap(const float *error, size_t count, unsigned char *rgba)
+{
+    for (size_t i=0; i<count; i++) {
+        float s = std::min(std::max(error[i], 0.0f), 1.0f) * 8;
+        int k = std::min(int(s), 7);
+        float f = s - k;
+        for (int c=0; c<3; c++) {
+            float v = magma[k][c] + (magma[k+1][c] - magma[k][c]) * f;
+            rgba[4*i+c] = (unsigned char)(v * 255 + 0.5f);
+        }
+        rgba[4*i+3] = 255;
+    }
+}
+
+int runGoldenTests(const std::vector<GoldenCase> &cases, const std::function<void ()> &draw_frame)
+{
+    const int w = golden_width, h = golden_height;
+    OffscreenFrame offscreen;
+    if (!offscreen.create(w, h)) {
+        return int(cases.size());
+    }
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+
+    std::vector<unsigned char> frame(size_t(w) * h * 4), reference, heatmap(frame.size());
+    std::vector<float> error(size_t(w) * h);
+    const GoldenThresholds &thresholds = golden_thresholds;
+    TimeSource saved_time = frame_time;
+    frame_time.useFixed(golden_time);
+    int failures = 0, loaded_model = -1;
+    for (size_t n=0; n<cases.size(); n++) {
+        const GoldenCase &c = cases[n];
+        applyCase(c, loaded_model);
+        offscreen.bind();
+        scene->camera.setAspectRatio(float(w) / h);
+        frame_time.seek(1);
+        draw_frame();
+        offscreen.read(&frame[0]);
+
+        std::string base = std::string(golden_directory) + "/" + c.name;
+        if (golden_update) {
+            if (writePNG((base + ".png").c_str(), &frame[0], w, h)) {
+                printf("%s: %s written\n", program_name, c.name.c_str());
+            } else {
+                printf("%s: could not write %s.png\n", program_name, base.c_str());
+                failures++;
+            }
+            continue;
+        }
+        if (!readReference(base + ".png", w, h, reference)) {
+            printf("%s: %s has no %dx%d reference\n", program_name, c.name.c_str(), w, h);
+            writePNG((base + ".new.png").c_str(), &frame[0], w, h);
+            failures++;
+            continue;
+        }
+        FlipStats stats = flipError(&frame[0], &reference[0], w, h, pixels_per_degree, thresholds.pixel, &error[0]);
+        bool passed = stats.changed <= thresholds.changed && stats.mean <= thresholds.mean;
+        printf("%s: %s mean %.4f, max %.3f, %.3f%% over %.2f%s\n", program_name, c.name.c_str(),
+               stats.mean, stats.max, 100 * stats.changed, thresholds.pixel, passed ? "" : " FAILED");
+        // Stale results of earlier runs would mislead.
+        remove((base + ".new.png").c_str());
+        remove((base + ".diff.png").c_str());
+        if (stats.changed > 0 || !passed) {
+            errorHeatmap(&error[0], error.size(), &heatmap[0]);
+            writePNG((base + ".diff.png").c_str(), &heatmap[0], w, h);
+        }
+        if (!passed) {
+            writePNG((base + ".new.png").c_str(), &frame[0], w, h);
+            failures++;
+        }
+    }
+
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+    frame_time = saved_time;
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    if (viewport[3] > 0) {
+        scene->camera.setAspectRatio(float(viewport[2]) / viewport[3]);
+    }
+    printf("%s: %d of %d golden frames %s\n", program_name, failures, int(cases.size()),
+           golden_update ? "could not be written" : "failed");
+    return failures;
+}
@@ -0,0 +1,68 @@
+// golden.hpp - golden-image regression of fixed frames
+
+#ifndef __golden_hpp__
+#define __golden_hpp__
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+# pragma once
+#endif
+
+#include <functional>
+#include <string>
+#include <vector>
+
+// One frame of the suite: a model, shader and extra from the menus.
+struct GoldenCase {
+    std::string name;  // model-shader or model-shader-extra
+    int model, shader;
+    int extra;         // -1 for none
+};
+
+// Every model with every shader, then every extra on every model with
+// the first shader; those whose name contains filter, when there is one.
+std::vector<GoldenCase> goldenCases(const char *filter);
+
+struct GoldenThresholds {
+    float pixel;    // error over which a pixel counts as changed
+    float changed;  // fraction of the pixels that may change
+    float mean;     // mean error a frame may have
+};
+
+struct FlipStats {
+    float mean, max;
+    float changed;  // fraction of the pixels over the pixel threshold
+};
+
+// FLIP-style perceptual difference of test from reference, both width by
+// height RGBA8: colors are compared after the filtering of the eye at
+// pixels_per_degree, in a space where distance follows how different
+// they look, and the difference grows where edges or points appear or
+// vanish.  Writes each pixel's error, 0 for none to 1, to error.
+FlipStats flipError(const unsigned char *test, const unsigned char *reference, int width, int height,
+                    float pixels_per_degree, float pixel_threshold, float *error);
+// error mapped to the magma color scale, black for none, as RGBA8.
+void errorHeatmap(const float *error, size_t count, unsigned char *rgba);
+
+// Renders each case with draw_frame into an offscreen framebuffer at a
+// fixed size and time, and compares it with <directory>/<name>.png,
+// writing the frame as <name>.new.png and the error as <name>.diff.png
+// where it differs.  With golden_update the frames become the new
+// references instead.  Returns the number of cases that failed.
+//
+// golden/ holds references for the cube and the monkey only, drawn on
+// Mesa's llvmpipe, so "-golden golden -goldenfilter cube" and the same
+// with monkey pass from a fresh checkout; other models need a
+// -goldenupdate run on a known good build first.  The cube's face toward
+// the camera is unlit, so shaders that only recolor lighting all draw it
+// black; the monkey's curved faces are what tell those apart.  The
+// frames are drawn offscreen, but the program still makes its GLUT
+// window for the context, so a headless machine needs a virtual display
+// such as xvfb-run.
+int runGoldenTests(const std::vector<GoldenCase> &cases, const std::function<void ()> &draw_frame);
+
+extern const char *golden_directory;         // -golden
+extern bool golden_update;                   // -goldenupdate
+extern const char *golden_filter;            // -goldenfilter
+extern GoldenThresholds golden_thresholds;   // -goldenpixel, -goldenchanged, -goldenmean
+
+#endif // __golden_hpp__
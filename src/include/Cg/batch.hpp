@@ -0,0 +1,58 @@
+/*
+ * batch.hpp - structure-of-arrays kernels for transforming, normalizing
+ * and bounding many 3-component vectors at once.
+ *
+ * Each kernel is implemented for scalar code, four-lane SIMD (SSE or
+ * NEON, see <Cg/simd.hpp>) and, on x86 with GCC or Clang, AVX.  The
+ * widest variant the running CPU supports is picked on first use.
+ *
+ * Meshes loaded by tinyobj store positions and normals interleaved as
+ * x,y,z triples in std::vector<float>; deinterleave and interleave copy
+ * between that layout and float3_soa.
+ */
+
+#ifndef __Cg_batch_hpp__
+#define __Cg_batch_hpp__
+
+#ifdef __Cg_stdlib_hpp__
+#pragma message("error: include this header file (" __FILE__ ") before <Cg/stdlib.hpp>")
+#endif
+
+#include <Cg/matrix.hpp>
+
+#include <stddef.h>
+#include <vector>
+
+namespace Cg {
+
+struct float3_soa {
+    std::vector<float> x, y, z;
+
+    inline size_t size() const { return x.size(); }
+    inline void resize(size_t n) { x.resize(n); y.resize(n); z.resize(n); }
+};
+
+extern void deinterleave(const std::vector<float> & xyz, float3_soa & out);
+extern void interleave(const float3_soa & in, std::vector<float> & xyz);
+
+// out = (m * float4(in,1)).xyz.  The bottom row of m is ignored, so m must
+// be affine.  in and out may be the same span.
+extern void transformPoints(const float4x4 & m, const float3_soa & in, float3_soa & out);
+
+// out = inverse(transpose(upper 3x3 of m)) * in, where m is the matrix that
+// transforms the corresponding points.  Results are not renormalized.
+extern void transformNormals(const float4x4 & m, const float3_soa & in, float3_soa & out);
+
+// out = normalize(in); zero-length vectors stay zero.
+extern void normalize(const float3_soa & in, float3_soa & out);
+
+// Component-wise min and max over every vector; false if in is empty.
+extern bool boundingBox(const float3_soa & in, float3 & lo, float3 & hi);
+
+// Name of the kernel variant selected for this CPU: "avx", "sse", "neon"
+// or "scalar".
+extern const char *batchKernelName();
+
+} // namespace Cg
+
+#endif // __Cg_batch_hpp__
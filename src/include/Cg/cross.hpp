@@ -13,6 +13,7 @@
 #endif
 
 #include <Cg/vector.hpp>
+#include <Cg/simd.hpp>
 
 namespace Cg {
 
@@ -41,6 +42,21 @@ static inline __CGvector<typename __CGtype_trait<TA,TB>::numericType,3> cross(co
     return a_yzx * b_zxy - a_zxy * b_yzx;
 }
 
+#ifdef __CG_SIMD
+// float3 overload held in SIMD registers (padded with w=0):
+// cross(a,b) = (a * b.yzx - a.yzx * b).yzx
+static inline float3 cross(const float3 & a, const float3 & b)
+{
+    __CGsimd4f av = __CGsimd_load3(reinterpret_cast<const float*>(&a));
+    __CGsimd4f bv = __CGsimd_load3(reinterpret_cast<const float*>(&b));
+    __CGsimd4f c = __CGsimd_sub(__CGsimd_mul(av, __CGsimd_yzx(bv)),
+                                __CGsimd_mul(__CGsimd_yzx(av), bv));
+    float3 rv;
+    __CGsimd_store3(reinterpret_cast<float*>(&rv), __CGsimd_yzx(c));
+    return rv;
+}
+#endif // __CG_SIMD
+
 } // namespace Cg
 
 #endif // __Cg_cross_hpp__
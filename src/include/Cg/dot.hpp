@@ -13,6 +13,7 @@
 #endif
 
 #include <Cg/vector.hpp>
+#include <Cg/simd.hpp>
 
 namespace Cg {
 
@@ -77,6 +78,22 @@ static inline __CGvector<typename __CGtype_trait<TA,TB>::resultType,1> dot(const
     return __CGvector<typename __CGtype_trait<TA,TB>::numericType,1>(sum);
 }
 
+#ifdef __CG_SIMD
+// float3 and float4 overloads held in SIMD registers (float3 padded with w=0)
+static inline float1 dot(const float4 & a, const float4 & b)
+{
+    __CGsimd4f p = __CGsimd_mul(__CGsimd_load(reinterpret_cast<const float*>(&a)),
+                                __CGsimd_load(reinterpret_cast<const float*>(&b)));
+    return float1(__CGsimd_first(__CGsimd_hsum(p)));
+}
+static inline float1 dot(const float3 & a, const float3 & b)
+{
+    __CGsimd4f p = __CGsimd_mul(__CGsimd_load3(reinterpret_cast<const float*>(&a)),
+                                __CGsimd_load3(reinterpret_cast<const float*>(&b)));
+    return float1(__CGsimd_first(__CGsimd_hsum(p)));
+}
+#endif // __CG_SIMD
+
 } // namespace Cg
 
 #endif // __Cg_dot_hpp__
@@ -22,11 +22,23 @@ extern float2x2 inverse(float2x2 a);
 extern float3x3 inverse(float3x3 a);
 extern float4x4 inverse(float4x4 a);
 
+// Inverses of [A t; 0 1] matrices; the bottom row is assumed, not checked.
+// inverseRigid further assumes A is a rotation.
+extern float4x4 inverseAffine(float4x4 a);
+extern float4x4 inverseRigid(float4x4 a);
+
+// The Gauss-Jordan elimination the closed forms above replaced, kept as
+// the reference they are checked against.
+extern float3x3 inverseGaussJordan(float3x3 a);
+extern float4x4 inverseGaussJordan(float4x4 a);
+
 #ifdef __Cg_double_hpp__
 extern double1x1 inverse(double1x1 a);
 extern double2x2 inverse(double2x2 a);
 extern double3x3 inverse(double3x3 a);
 extern double4x4 inverse(double4x4 a);
+extern double4x4 inverseAffine(double4x4 a);
+extern double4x4 inverseRigid(double4x4 a);
 #endif
 
 } // namespace Cg
@@ -13,6 +13,7 @@
 #endif
 
 #include <Cg/matrix.hpp>
+#include <Cg/simd.hpp>
 
 namespace Cg {
 
@@ -94,6 +95,56 @@ static inline __CGmatrix<typename __CGtype_trait<TA,TB>::numericType,X,Z> mul(co
     return rv;
 }
 
+#ifdef __CG_SIMD
+// float4x4 overloads held in SIMD registers; preferred over the templates above
+static inline float4 mul(const float4x4 & m, const float4 & v)
+{
+    const float *mp = reinterpret_cast<const float*>(&m);
+    __CGsimd4f c0 = __CGsimd_load(mp+0),
+               c1 = __CGsimd_load(mp+4),
+               c2 = __CGsimd_load(mp+8),
+               c3 = __CGsimd_load(mp+12);
+    __CGsimd_transpose(c0, c1, c2, c3);
+    __CGsimd4f vv = __CGsimd_load(reinterpret_cast<const float*>(&v));
+    __CGsimd4f r = __CGsimd_add(__CGsimd_add(__CGsimd_mul(c0, __CGsimd_splat<0>(vv)),
+                                             __CGsimd_mul(c1, __CGsimd_splat<1>(vv))),
+                                __CGsimd_add(__CGsimd_mul(c2, __CGsimd_splat<2>(vv)),
+                                             __CGsimd_mul(c3, __CGsimd_splat<3>(vv))));
+    float4 rv;
+    __CGsimd_store(reinterpret_cast<float*>(&rv), r);
+    return rv;
+}
+
+static inline __CGsimd4f __CGsimd_rowmul(const float *row, const float *m)
+{
+    __CGsimd4f vv = __CGsimd_load(row);
+    return __CGsimd_add(__CGsimd_add(__CGsimd_mul(__CGsimd_splat<0>(vv), __CGsimd_load(m+0)),
+                                     __CGsimd_mul(__CGsimd_splat<1>(vv), __CGsimd_load(m+4))),
+                        __CGsimd_add(__CGsimd_mul(__CGsimd_splat<2>(vv), __CGsimd_load(m+8)),
+                                     __CGsimd_mul(__CGsimd_splat<3>(vv), __CGsimd_load(m+12))));
+}
+
+static inline float4 mul(const float4 & v, const float4x4 & m)
+{
+    float4 rv;
+    __CGsimd_store(reinterpret_cast<float*>(&rv),
+                   __CGsimd_rowmul(reinterpret_cast<const float*>(&v), reinterpret_cast<const float*>(&m)));
+    return rv;
+}
+
+static inline float4x4 mul(const float4x4 & a, const float4x4 & b)
+{
+    const float *ap = reinterpret_cast<const float*>(&a);
+    const float *bp = reinterpret_cast<const float*>(&b);
+    float4x4 rv;
+    float *rp = reinterpret_cast<float*>(&rv);
+    for (int i=0; i<4; i++) {
+        __CGsimd_store(rp+4*i, __CGsimd_rowmul(ap+4*i, bp));
+    }
+    return rv;
+}
+#endif // __CG_SIMD
+
 } // namespace Cg
 
 #endif // __Cg_mul_hpp__
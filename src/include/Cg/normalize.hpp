@@ -13,6 +13,7 @@
 #endif
 
 #include <Cg/vector.hpp>
+#include <Cg/simd.hpp>
 
 #include <math.h>  // for ::sqrt
 
@@ -35,6 +36,26 @@ static inline __CGvector<typename __CGtype_trait<T>::realType,N> normalize(const
     return __CGvector<T,N>(v / ::sqrt(sum));
 }
 
+#ifdef __CG_SIMD
+// float3 and float4 overloads held in SIMD registers (float3 padded with w=0)
+static inline float4 normalize(const float4 & v)
+{
+    __CGsimd4f vv = __CGsimd_load(reinterpret_cast<const float*>(&v));
+    __CGsimd4f len = __CGsimd_sqrt(__CGsimd_hsum(__CGsimd_mul(vv, vv)));
+    float4 rv;
+    __CGsimd_store(reinterpret_cast<float*>(&rv), __CGsimd_div(vv, len));
+    return rv;
+}
+static inline float3 normalize(const float3 & v)
+{
+    __CGsimd4f vv = __CGsimd_load3(reinterpret_cast<const float*>(&v));
+    __CGsimd4f len = __CGsimd_sqrt(__CGsimd_hsum(__CGsimd_mul(vv, vv)));
+    float3 rv;
+    __CGsimd_store3(reinterpret_cast<float*>(&rv), __CGsimd_div(vv, len));
+    return rv;
+}
+#endif // __CG_SIMD
+
 } // namespace Cg
 
 #endif // __Cg_normalize_hpp__
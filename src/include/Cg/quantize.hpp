@@ -0,0 +1,47 @@
+/*
+ * quantize.hpp - batch conversion of float arrays to the compact vertex
+ * formats GL accepts directly: half floats, 16-bit snorm/unorm, 8-bit
+ * unorm and octahedral-encoded unit normals.
+ *
+ * Rounding is to nearest (even on ties) throughout.  For half floats this
+ * matches F16C hardware bit for bit; the half class in <Cg/half.hpp>
+ * instead truncates results in the denormal range and rounds ties away
+ * from zero.  Values outside a normalized format's range are clamped.
+ * Kernels use F16C for half floats when the running CPU has it and SSE2
+ * elsewhere on x86.
+ */
+
+#ifndef __Cg_quantize_hpp__
+#define __Cg_quantize_hpp__
+
+#ifdef __Cg_stdlib_hpp__
+#pragma message("error: include this header file (" __FILE__ ") before <Cg/stdlib.hpp>")
+#endif
+
+#include <Cg/batch.hpp>
+
+#include <stddef.h>
+
+namespace Cg {
+
+extern void floatToHalf(const float *in, unsigned short *out, size_t n);
+extern void halfToFloat(const unsigned short *in, float *out, size_t n);
+
+// [-1,1] to [-32767,32767]
+extern void floatToSnorm16(const float *in, short *out, size_t n);
+// [0,1] to [0,65535]
+extern void floatToUnorm16(const float *in, unsigned short *out, size_t n);
+// [0,1] to [0,255]
+extern void floatToUnorm8(const float *in, unsigned char *out, size_t n);
+
+// Unit normals folded onto the octahedron and stored as two snorm16 values
+// per normal in out[2*i+0] and out[2*i+1].
+extern void encodeOctahedral(const float3_soa & normals, short *out);
+extern float3 decodeOctahedral(short u, short v);
+
+// Half-float conversion in use: "f16c" or "scalar"
+extern const char *quantizeKernelName();
+
+} // namespace Cg
+
+#endif // __Cg_quantize_hpp__
@@ -0,0 +1,139 @@
+/*
+ * simd.hpp - four-lane float register abstraction used by the float3,
+ * float4 and float4x4 overloads of mul, dot, normalize, cross and
+ * transpose.  Storage types are unchanged; values are only held in SIMD
+ * registers inside those functions (float3 is padded to four lanes with a
+ * zero w).
+ *
+ * Backends: SSE (x86 and x86-64) and NEON (AArch64).  Define __CG_NO_SIMD
+ * before including any Cg header to use the generic template loops.
+ */
+
+#ifndef __Cg_simd_hpp__
+#define __Cg_simd_hpp__
+
+#if !defined(__CG_NO_SIMD)
+# if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#  define __CG_SIMD_SSE 1
+# elif defined(__ARM_NEON) && defined(__aarch64__)
+#  define __CG_SIMD_NEON 1
+# endif
+#endif
+
+#if defined(__CG_SIMD_SSE)
+# include <xmmintrin.h>
+#elif defined(__CG_SIMD_NEON)
+# include <arm_neon.h>
+#endif
+
+#if defined(__CG_SIMD_SSE) || defined(__CG_SIMD_NEON)
+# define __CG_SIMD 1
+
+namespace Cg {
+
+#if defined(__CG_SIMD_SSE)
+
+typedef __m128 __CGsimd4f;
+
+static inline __CGsimd4f __CGsimd_load(const float *p) { return _mm_loadu_ps(p); }
+static inline __CGsimd4f __CGsimd_load3(const float *p) { return _mm_set_ps(0, p[2], p[1], p[0]); }
+static inline void __CGsimd_store(float *p, __CGsimd4f v) { _mm_storeu_ps(p, v); }
+static inline void __CGsimd_store3(float *p, __CGsimd4f v)
+{
+    _mm_storel_pi(reinterpret_cast<__m64*>(p), v);
+    _mm_store_ss(p+2, _mm_movehl_ps(v, v));
+}
+static inline __CGsimd4f __CGsimd_add(__CGsimd4f a, __CGsimd4f b) { return _mm_add_ps(a, b); }
+static inline __CGsimd4f __CGsimd_sub(__CGsimd4f a, __CGsimd4f b) { return _mm_sub_ps(a, b); }
+static inline __CGsimd4f __CGsimd_mul(__CGsimd4f a, __CGsimd4f b) { return _mm_mul_ps(a, b); }
+static inline __CGsimd4f __CGsimd_div(__CGsimd4f a, __CGsimd4f b) { return _mm_div_ps(a, b); }
+static inline __CGsimd4f __CGsimd_sqrt(__CGsimd4f a) { return _mm_sqrt_ps(a); }
+static inline __CGsimd4f __CGsimd_min(__CGsimd4f a, __CGsimd4f b) { return _mm_min_ps(a, b); }
+static inline __CGsimd4f __CGsimd_max(__CGsimd4f a, __CGsimd4f b) { return _mm_max_ps(a, b); }
+static inline __CGsimd4f __CGsimd_set1(float s) { return _mm_set1_ps(s); }
+template <int I>
+static inline __CGsimd4f __CGsimd_splat(__CGsimd4f a) { return _mm_shuffle_ps(a, a, _MM_SHUFFLE(I,I,I,I)); }
+// (y,z,x,w)
+static inline __CGsimd4f __CGsimd_yzx(__CGsimd4f a) { return _mm_shuffle_ps(a, a, _MM_SHUFFLE(3,0,2,1)); }
+// Sum of all four lanes, replicated into every lane
+static inline __CGsimd4f __CGsimd_hsum(__CGsimd4f a)
+{
+    __CGsimd4f t = _mm_add_ps(a, _mm_shuffle_ps(a, a, _MM_SHUFFLE(2,3,0,1)));
+    return _mm_add_ps(t, _mm_shuffle_ps(t, t, _MM_SHUFFLE(1,0,3,2)));
+}
+static inline float __CGsimd_first(__CGsimd4f a) { return _mm_cvtss_f32(a); }
+// Bit i set where lane i of a is less than lane i of b
+static inline int __CGsimd_lessmask(__CGsimd4f a, __CGsimd4f b) { return _mm_movemask_ps(_mm_cmplt_ps(a, b)); }
+// Every bit of lane i set where lane i of a is less than lane i of b
+static inline __CGsimd4f __CGsimd_less(__CGsimd4f a, __CGsimd4f b) { return _mm_cmplt_ps(a, b); }
+// Lane i of a where lane i of mask is set, of b where it is clear
+static inline __CGsimd4f __CGsimd_select(__CGsimd4f mask, __CGsimd4f a, __CGsimd4f b)
+{
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+static inline void __CGsimd_transpose(__CGsimd4f &r0, __CGsimd4f &r1, __CGsimd4f &r2, __CGsimd4f &r3)
+{
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+}
+
+#else // __CG_SIMD_NEON
+
+typedef float32x4_t __CGsimd4f;
+
+static inline __CGsimd4f __CGsimd_load(const float *p) { return vld1q_f32(p); }
+static inline __CGsimd4f __CGsimd_load3(const float *p) { return vcombine_f32(vld1_f32(p), vset_lane_f32(p[2], vdup_n_f32(0), 0)); }
+static inline void __CGsimd_store(float *p, __CGsimd4f v) { vst1q_f32(p, v); }
+static inline void __CGsimd_store3(float *p, __CGsimd4f v)
+{
+    vst1_f32(p, vget_low_f32(v));
+    p[2] = vgetq_lane_f32(v, 2);
+}
+static inline __CGsimd4f __CGsimd_add(__CGsimd4f a, __CGsimd4f b) { return vaddq_f32(a, b); }
+static inline __CGsimd4f __CGsimd_sub(__CGsimd4f a, __CGsimd4f b) { return vsubq_f32(a, b); }
+static inline __CGsimd4f __CGsimd_mul(__CGsimd4f a, __CGsimd4f b) { return vmulq_f32(a, b); }
+static inline __CGsimd4f __CGsimd_div(__CGsimd4f a, __CGsimd4f b) { return vdivq_f32(a, b); }
+static inline __CGsimd4f __CGsimd_sqrt(__CGsimd4f a) { return vsqrtq_f32(a); }
+static inline __CGsimd4f __CGsimd_min(__CGsimd4f a, __CGsimd4f b) { return vminq_f32(a, b); }
+static inline __CGsimd4f __CGsimd_max(__CGsimd4f a, __CGsimd4f b) { return vmaxq_f32(a, b); }
+static inline __CGsimd4f __CGsimd_set1(float s) { return vdupq_n_f32(s); }
+template <int I>
+static inline __CGsimd4f __CGsimd_splat(__CGsimd4f a) { return vdupq_laneq_f32(a, I); }
+// (y,z,x,w)
+static inline __CGsimd4f __CGsimd_yzx(__CGsimd4f a)
+{
+    __CGsimd4f yzwx = vextq_f32(a, a, 1);
+    return vsetq_lane_f32(vgetq_lane_f32(a, 3), vsetq_lane_f32(vgetq_lane_f32(a, 0), yzwx, 2), 3);
+}
+// Sum of all four lanes, replicated into every lane
+static inline __CGsimd4f __CGsimd_hsum(__CGsimd4f a) { return vdupq_n_f32(vaddvq_f32(a)); }
+static inline float __CGsimd_first(__CGsimd4f a) { return vgetq_lane_f32(a, 0); }
+// Bit i set where lane i of a is less than lane i of b
+static inline int __CGsimd_lessmask(__CGsimd4f a, __CGsimd4f b)
+{
+    static const uint32_t bits[4] = { 1, 2, 4, 8 };
+    return int(vaddvq_u32(vandq_u32(vcltq_f32(a, b), vld1q_u32(bits))));
+}
+// Every bit of lane i set where lane i of a is less than lane i of b
+static inline __CGsimd4f __CGsimd_less(__CGsimd4f a, __CGsimd4f b) { return vreinterpretq_f32_u32(vcltq_f32(a, b)); }
+// Lane i of a where lane i of mask is set, of b where it is clear
+static inline __CGsimd4f __CGsimd_select(__CGsimd4f mask, __CGsimd4f a, __CGsimd4f b)
+{
+    return vbslq_f32(vreinterpretq_u32_f32(mask), a, b);
+}
+static inline void __CGsimd_transpose(__CGsimd4f &r0, __CGsimd4f &r1, __CGsimd4f &r2, __CGsimd4f &r3)
+{
+    float32x4_t t0 = vzip1q_f32(r0, r2), t1 = vzip2q_f32(r0, r2);
+    float32x4_t t2 = vzip1q_f32(r1, r3), t3 = vzip2q_f32(r1, r3);
+    r0 = vzip1q_f32(t0, t2);
+    r1 = vzip2q_f32(t0, t2);
+    r2 = vzip1q_f32(t1, t3);
+    r3 = vzip2q_f32(t1, t3);
+}
+
+#endif
+
+} // namespace Cg
+
+#endif // __CG_SIMD
+
+#endif // __Cg_simd_hpp__
@@ -13,6 +13,7 @@
 #endif
 
 #include <Cg/matrix.hpp>
+#include <Cg/simd.hpp>
 
 namespace Cg {
 
@@ -28,6 +29,26 @@ static inline __CGmatrix<T,N,M> transpose(const __CGmatrix<T,M,N> & m)
     return rv;
 }
 
+#ifdef __CG_SIMD
+// float4x4 overload held in SIMD registers
+static inline float4x4 transpose(const float4x4 & m)
+{
+    const float *mp = reinterpret_cast<const float*>(&m);
+    __CGsimd4f r0 = __CGsimd_load(mp+0),
+               r1 = __CGsimd_load(mp+4),
+               r2 = __CGsimd_load(mp+8),
+               r3 = __CGsimd_load(mp+12);
+    __CGsimd_transpose(r0, r1, r2, r3);
+    float4x4 rv;
+    float *rp = reinterpret_cast<float*>(&rv);
+    __CGsimd_store(rp+0, r0);
+    __CGsimd_store(rp+4, r1);
+    __CGsimd_store(rp+8, r2);
+    __CGsimd_store(rp+12, r3);
+    return rv;
+}
+#endif // __CG_SIMD
+
 } // namespace Cg
 
 #endif // __Cg_transpose_hpp__
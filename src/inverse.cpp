@@ -90,6 +90,104 @@ static inline __CGmatrix<T,N,N> inverse(__CGmatrix<T,N,N> & input)
     return __CGmatrix<T,N,N>(result);
 }
 
+// Closed-form inverses by cofactor expansion.  Straight-line code with no
+// pivot search or data-dependent branches, so the compiler can keep the
+// whole matrix in registers and vectorize the products.  Like the
+// elimination above, a singular matrix yields non-finite elements.
+template <typename T>
+static inline __CGmatrix<T,3,3> inverse3x3(const __CGmatrix<T,3,3> & m)
+{
+    const T c00 = m[1][1]*m[2][2] - m[1][2]*m[2][1],
+            c01 = m[1][2]*m[2][0] - m[1][0]*m[2][2],
+            c02 = m[1][0]*m[2][1] - m[1][1]*m[2][0];
+    const T inv_det = T(1) / (m[0][0]*c00 + m[0][1]*c01 + m[0][2]*c02);
+
+    __CGmatrix<T,3,3> result;
+    result[0][0] = c00 * inv_det;
+    result[0][1] = (m[0][2]*m[2][1] - m[0][1]*m[2][2]) * inv_det;
+    result[0][2] = (m[0][1]*m[1][2] - m[0][2]*m[1][1]) * inv_det;
+    result[1][0] = c01 * inv_det;
+    result[1][1] = (m[0][0]*m[2][2] - m[0][2]*m[2][0]) * inv_det;
+    result[1][2] = (m[0][2]*m[1][0] - m[0][0]*m[1][2]) * inv_det;
+    result[2][0] = c02 * inv_det;
+    result[2][1] = (m[0][1]*m[2][0] - m[0][0]*m[2][1]) * inv_det;
+    result[2][2] = (m[0][0]*m[1][1] - m[0][1]*m[1][0]) * inv_det;
+    return result;
+}
+
+// 4x4 inverse from the 2x2 minors of the top (s) and bottom (c) row pairs.
+template <typename T>
+static inline __CGmatrix<T,4,4> inverse4x4(const __CGmatrix<T,4,4> & m)
+{
+    const T s0 = m[0][0]*m[1][1] - m[1][0]*m[0][1],
+            s1 = m[0][0]*m[1][2] - m[1][0]*m[0][2],
+            s2 = m[0][0]*m[1][3] - m[1][0]*m[0][3],
+            s3 = m[0][1]*m[1][2] - m[1][1]*m[0][2],
+            s4 = m[0][1]*m[1][3] - m[1][1]*m[0][3],
+            s5 = m[0][2]*m[1][3] - m[1][2]*m[0][3];
+    const T c5 = m[2][2]*m[3][3] - m[3][2]*m[2][3],
+            c4 = m[2][1]*m[3][3] - m[3][1]*m[2][3],
+            c3 = m[2][1]*m[3][2] - m[3][1]*m[2][2],
+            c2 = m[2][0]*m[3][3] - m[3][0]*m[2][3],
+            c1 = m[2][0]*m[3][2] - m[3][0]*m[2][2],
+            c0 = m[2][0]*m[3][1] - m[3][0]*m[2][1];
+    const T inv_det = T(1) / (s0*c5 - s1*c4 + s2*c3 + s3*c2 - s4*c1 + s5*c0);
+
+    __CGmatrix<T,4,4> result;
+    result[0][0] = ( m[1][1]*c5 - m[1][2]*c4 + m[1][3]*c3) * inv_det;
+    result[0][1] = (-m[0][1]*c5 + m[0][2]*c4 - m[0][3]*c3) * inv_det;
+    result[0][2] = ( m[3][1]*s5 - m[3][2]*s4 + m[3][3]*s3) * inv_det;
+    result[0][3] = (-m[2][1]*s5 + m[2][2]*s4 - m[2][3]*s3) * inv_det;
+    result[1][0] = (-m[1][0]*c5 + m[1][2]*c2 - m[1][3]*c1) * inv_det;
+    result[1][1] = ( m[0][0]*c5 - m[0][2]*c2 + m[0][3]*c1) * inv_det;
+    result[1][2] = (-m[3][0]*s5 + m[3][2]*s2 - m[3][3]*s1) * inv_det;
+    result[1][3] = ( m[2][0]*s5 - m[2][2]*s2 + m[2][3]*s1) * inv_det;
+    result[2][0] = ( m[1][0]*c4 - m[1][1]*c2 + m[1][3]*c0) * inv_det;
+    result[2][1] = (-m[0][0]*c4 + m[0][1]*c2 - m[0][3]*c0) * inv_det;
+    result[2][2] = ( m[3][0]*s4 - m[3][1]*s2 + m[3][3]*s0) * inv_det;
+    result[2][3] = (-m[2][0]*s4 + m[2][1]*s2 - m[2][3]*s0) * inv_det;
+    result[3][0] = (-m[1][0]*c3 + m[1][1]*c1 - m[1][2]*c0) * inv_det;
+    result[3][1] = ( m[0][0]*c3 - m[0][1]*c1 + m[0][2]*c0) * inv_det;
+    result[3][2] = (-m[3][0]*s3 + m[3][1]*s1 - m[3][2]*s0) * inv_det;
+    result[3][3] = ( m[2][0]*s3 - m[2][1]*s1 + m[2][2]*s0) * inv_det;
+    return result;
+}
+
+// Inverse of [A t; 0 1] is [inverse(A) -inverse(A)*t; 0 1].  For a rigid
+// transform A is a rotation and its inverse is its transpose.
+template <typename T>
+static inline __CGmatrix<T,4,4> inverseAffine4x4(const __CGmatrix<T,4,4> & m, bool rigid)
+{
+    __CGmatrix<T,3,3> a, a_inv;
+    for (int i=0; i<3; i++) {
+        for (int j=0; j<3; j++) {
+            a[i][j] = m[i][j];
+        }
+    }
+    if (rigid) {
+        for (int i=0; i<3; i++) {
+            for (int j=0; j<3; j++) {
+                a_inv[i][j] = a[j][i];
+            }
+        }
+    } else {
+        a_inv = inverse3x3<T>(a);
+    }
+
+    __CGmatrix<T,4,4> result;
+    for (int i=0; i<3; i++) {
+        for (int j=0; j<3; j++) {
+            result[i][j] = a_inv[i][j];
+        }
+        result[i][3] = -(a_inv[i][0]*m[0][3] + a_inv[i][1]*m[1][3] + a_inv[i][2]*m[2][3]);
+    }
+    result[3][0] = T(0);
+    result[3][1] = T(0);
+    result[3][2] = T(0);
+    result[3][3] = T(1);
+    return result;
+}
+
 float1x1 inverse(float1x1 a)
 {
     return inverse<float,1>(a);
@@ -100,9 +198,25 @@ float2x2 inverse(float2x2 a)
 }
 float3x3 inverse(float3x3 a)
 {
-    return inverse<float,3>(a);
+    return inverse3x3<float>(a);
 }
 float4x4 inverse(float4x4 a)
+{
+    return inverse4x4<float>(a);
+}
+float4x4 inverseAffine(float4x4 a)
+{
+    return inverseAffine4x4<float>(a, false);
+}
+float4x4 inverseRigid(float4x4 a)
+{
+    return inverseAffine4x4<float>(a, true);
+}
+float3x3 inverseGaussJordan(float3x3 a)
+{
+    return inverse<float,3>(a);
+}
+float4x4 inverseGaussJordan(float4x4 a)
 {
     return inverse<float,4>(a);
 }
@@ -117,11 +231,19 @@ double2x2 inverse(double2x2 a)
 }
 double3x3 inverse(double3x3 a)
 {
-    return inverse<double,3>(a);
+    return inverse3x3<double>(a);
 }
 double4x4 inverse(double4x4 a)
 {
-    return inverse<double,4>(a);
+    return inverse4x4<double>(a);
+}
+double4x4 inverseAffine(double4x4 a)
+{
+    return inverseAffine4x4<double>(a, false);
+}
+double4x4 inverseRigid(double4x4 a)
+{
+    return inverseAffine4x4<double>(a, true);
 }
 
 } // namespace Cg
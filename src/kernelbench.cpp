@@ -0,0 +1,839 @@
+// kernelbench.cpp - accuracy checks and timings of the CPU kernels
+//
+// Each suite builds its own data from a fixed seed, so runs on one machine
+// compare; times are the best of a few repetitions.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <functional>
+#include <random>
+#include <vector>
+
+#include <Cg/vector.hpp>
+#include <Cg/matrix.hpp>
+#include <Cg/mul.hpp>
+#include <Cg/dot.hpp>
+#include <Cg/cross.hpp>
+#include <Cg/normalize.hpp>
+#include <Cg/transpose.hpp>
+#include <Cg/inverse.hpp>
+#include <Cg/batch.hpp>
+#include <Cg/half.hpp>
+#include <Cg/quantize.hpp>
+
+#include <GL/glew.h>
+
+#include "kernelbench.hpp"
+#include "countof.h"
+#include "mipmap.hpp"
+#include "occlusion.hpp"
+
+using namespace Cg;
+
+extern const char *program_name;
+
+bool kernel_benchmarks = false;
+const char *kernel_filter = NULL;
+
+namespace {
+
+int failures;
+
+// Best wall time of body over repeats runs, in milliseconds.
+double bestMilliseconds(int repeats, const std::function<void ()> &body)
+{
+    double best = 1e30;
+    for (int i=0; i<repeats; i++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        body();
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        if (elapsed.count() < best) {
+            best = elapsed.count();
+        }
+    }
+    return best;
+}
+
+void check(const char *suite, const char *what, bool ok, double error)
+{
+    printf("%s: %s: %-48s %s (error %g)\n", program_name, suite, what, ok ? "ok" : "FAILED", error);
+    failures += !ok;
+}
+
+void timing(const char *suite, const char *what, double milliseconds, double reference_milliseconds)
+{
+    printf("%s: %s: %-48s %9.3f ms, %5.2fx the speed of the reference\n", program_name, suite, what,
+           milliseconds, reference_milliseconds / milliseconds);
+}
+
+// One way to compute a result, named for its timing line.
+struct Variant {
+    const char *name;
+    std::function<void ()> run;
+};
+
+// Times each variant on the same data, printing each against the first,
+// which is the reference.  When error is given, it then measures the
+// results the variants left behind and checks them against tolerance.
+void checkAndTime(const char *suite, const char *what, int repeats, const std::vector<Variant> &variants,
+                  const std::function<double ()> &error = std::function<double ()>(), double tolerance = 0)
+{
+    double reference = 0;
+    for (size_t i=0; i<variants.size(); i++) {
+        double milliseconds = bestMilliseconds(repeats, variants[i].run);
+        reference = i == 0 ? milliseconds : reference;
+        char line[96];
+        snprintf(line, sizeof(line), "%s %s", what, variants[i].name);
+        timing(suite, line, milliseconds, reference);
+    }
+    if (error) {
+        double e = error();
+        check(suite, what, e < tolerance, e);
+    }
+}
+
+// Values in [-range, range] from a fixed seed.
+std::vector<float> randomFloats(size_t count, float range, unsigned seed)
+{
+    std::mt19937 random(seed);
+    std::uniform_real_distribution<float> uniform(-range, range);
+    std::vector<float> v(count);
+    for (size_t i=0; i<count; i++) {
+        v[i] = uniform(random);
+    }
+    return v;
+}
+
+template <typename T>
+const float *floats(const T *v)
+{
+    return reinterpret_cast<const float*>(v);
+}
+
+// Largest difference of n floats, relative to the largest magnitude in a,
+// so that sums which cancel are held to the rounding of their terms.
+double relativeError(const float *a, const float *b, size_t n)
+{
+    double scale = 0, worst = 0;
+    for (size_t i=0; i<n; i++) {
+        scale = fabs(a[i]) > scale ? fabs(a[i]) : scale;
+        double e = fabs(double(a[i]) - b[i]);
+        worst = e > worst ? e : worst;
+    }
+    return scale > 0 ? worst / scale : worst;
+}
+
+// Smooth gradients under fine noise, so filters have edges and flat
+// areas to get wrong.
+std::vector<GLubyte> testImage(int width, int height, int components)
+{
+    std::mt19937 random(1234);
+    std::vector<GLubyte> image(size_t(width) * height * components);
+    for (int y=0; y<height; y++) {
+        for (int x=0; x<width; x++) {
+            GLubyte *t = &image[(size_t(y) * width + x) * components];
+            for (int c=0; c<components; c++) {
+                int ramp = c == 0 ? x * 255 / width : c == 1 ? y * 255 / height : (x ^ y) & 255;
+                int v = ramp + int(random() % 64) - 32;
+                t[c] = GLubyte(v < 0 ? 0 : v > 255 ? 255 : v);
+            }
+        }
+    }
+    return image;
+}
+
+// The CPU chains against glGenerateMipmap: a box-filtered linear chain
+// should match the driver's to rounding, normal chains stay unit length,
+// and both are timed from the bytes in memory to the last level in GL.
+void mipmaps()
+{
+    const char *suite = "mipmaps";
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+    const int size = 512;
+    std::vector<GLubyte> image = testImage(size, size, 4);
+    MipChain chain;
+    chain.build(&image[0], size, size, 4, MIP_FILTER_BOX, MIP_LINEAR);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, &image[0]);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    // The driver rounds each level to bytes before filtering the next, so
+    // only the first reduction is compared to rounding.
+    const MipLevel &mine = chain.levels[1];
+    std::vector<GLubyte> driver(mine.texels.size());
+    glGetTexImage(GL_TEXTURE_2D, 1, GL_RGBA, GL_UNSIGNED_BYTE, &driver[0]);
+    int worst = 0;
+    for (size_t i=0; i<driver.size(); i++) {
+        int d = abs(int(driver[i]) - int(mine.texels[i]));
+        worst = d > worst ? d : worst;
+    }
+    check(suite, "box linear level 1 matches glGenerateMipmap", worst <= 1, worst);
+
+    std::vector<GLubyte> normals = testImage(size, size, 3);
+    chain.build(&normals[0], size, size, 3, MIP_FILTER_KAISER, MIP_NORMAL);
+    double worst_length = 0;
+    for (size_t level=1; level<chain.levels.size(); level++) {
+        const std::vector<GLubyte> &t = chain.levels[level].texels;
+        for (size_t i=0; i+2<t.size(); i+=3) {
+            double n[3];
+            for (int c=0; c<3; c++) {
+                n[c] = (t[i+c] - 128.0) / 127.0;
+            }
+            double length = sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+            worst_length = fabs(length - 1) > worst_length ? fabs(length - 1) : worst_length;
+        }
+    }
+    check(suite, "normal chain levels are unit length", worst_length < 0.03, worst_length);
+
+    for (int s=512; s<=2048; s*=2) {
+        std::vector<GLubyte> source = testImage(s, s, 4);
+        std::vector<Variant> variants;
+        variants.push_back(Variant { "glGenerateMipmap", [&] {
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, s, s, 0, GL_RGBA, GL_UNSIGNED_BYTE, &source[0]);
+            glGenerateMipmap(GL_TEXTURE_2D);
+            glFinish();
+        } });
+        const MipFilter filters[2] = { MIP_FILTER_BOX, MIP_FILTER_KAISER };
+        const MipColorSpace spaces[2] = { MIP_LINEAR, MIP_SRGB };
+        const char *names[2][2] = { { "CPU box linear", "CPU box sRGB" }, { "CPU Kaiser linear", "CPU Kaiser sRGB" } };
+        for (int f=0; f<2; f++) {
+            for (int c=0; c<2; c++) {
+                MipFilter filter = filters[f];
+                MipColorSpace space = spaces[c];
+                variants.push_back(Variant { names[f][c], [&, filter, space] {
+                    chain.build(&source[0], s, s, 4, filter, space);
+                    chain.tellGL(GL_TEXTURE_2D, GL_RGBA8);
+                    glFinish();
+                } });
+            }
+        }
+        char what[64];
+        snprintf(what, sizeof(what), "%dx%d", s, s);
+        checkAndTime(suite, what, 5, variants);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glDeleteTextures(1, &texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+}
+
+// The float3, float4 and float4x4 overloads in SIMD registers against
+// the generic templates they shadow, called by their template arguments.
+void simd()
+{
+    const char *suite = "simd";
+    const size_t count = 1 << 16;
+    const int repeats = 20;
+    std::vector<float> values = randomFloats(count * 4, 10, 29);
+    const float4 *v = reinterpret_cast<const float4*>(&values[0]);
+    std::vector<float3> v3(count);
+    for (size_t i=0; i<count; i++) {
+        v3[i] = float3(values[4*i], values[4*i+1], values[4*i+2]);
+    }
+    std::vector<float> matrix_values = randomFloats(16 * 64, 2, 30);
+    const float4x4 *m = reinterpret_cast<const float4x4*>(&matrix_values[0]);
+
+    std::vector<float4> fast(count), generic(count);
+    std::vector<float3> fast3(count), generic3(count);
+    std::vector<float> fast1(count), generic1(count);
+
+    checkAndTime(suite, "mul(float4x4, float4)", repeats, {
+        { "generic", [&] {
+            for (size_t i=0; i<count; i++) {
+                generic[i] = mul<float, float, 4, 4>(m[i & 63], v[i]);
+            }
+        } },
+        { "SIMD", [&] {
+            for (size_t i=0; i<count; i++) {
+                fast[i] = mul(m[i & 63], v[i]);
+            }
+        } },
+    }, [&] { return relativeError(floats(&fast[0]), floats(&generic[0]), count*4); }, 1e-6);
+
+    checkAndTime(suite, "mul(float4, float4x4)", repeats, {
+        { "generic", [&] {
+            for (size_t i=0; i<count; i++) {
+                generic[i] = mul<float, float, 4, 4>(v[i], m[i & 63]);
+            }
+        } },
+        { "SIMD", [&] {
+            for (size_t i=0; i<count; i++) {
+                fast[i] = mul(v[i], m[i & 63]);
+            }
+        } },
+    }, [&] { return relativeError(floats(&fast[0]), floats(&generic[0]), count*4); }, 1e-6);
+
+    std::vector<float4x4> fast_m(count / 16), generic_m(count / 16);
+    checkAndTime(suite, "transpose(mul(float4x4, float4x4))", repeats, {
+        { "generic", [&] {
+            for (size_t i=0; i<generic_m.size(); i++) {
+                generic_m[i] = transpose<float, 4, 4>(mul<float, float, 4, 4, 4>(m[i & 63], m[(i+1) & 63]));
+            }
+        } },
+        { "SIMD", [&] {
+            for (size_t i=0; i<fast_m.size(); i++) {
+                fast_m[i] = transpose(mul(m[i & 63], m[(i+1) & 63]));
+            }
+        } },
+    }, [&] { return relativeError(floats(&fast_m[0]), floats(&generic_m[0]), fast_m.size()*16); }, 1e-6);
+
+    checkAndTime(suite, "dot(float4, float4)", repeats, {
+        { "generic", [&] {
+            for (size_t i=0; i<count; i++) {
+                generic1[i] = dot<float, 4>(v[i], v[count-1-i]);
+            }
+        } },
+        { "SIMD", [&] {
+            for (size_t i=0; i<count; i++) {
+                fast1[i] = dot(v[i], v[count-1-i]);
+            }
+        } },
+    }, [&] { return relativeError(&fast1[0], &generic1[0], count); }, 1e-6);
+
+    checkAndTime(suite, "normalize(cross(float3, float3))", repeats, {
+        { "generic", [&] {
+            for (size_t i=0; i<count; i++) {
+                generic3[i] = normalize<float, 3>(cross<float, float>(v3[i], v3[count-1-i]));
+            }
+        } },
+        { "SIMD", [&] {
+            for (size_t i=0; i<count; i++) {
+                fast3[i] = normalize(cross(v3[i], v3[count-1-i]));
+            }
+        } },
+    }, [&] { return relativeError(floats(&fast3[0]), floats(&generic3[0]), count*3); }, 1e-6);
+
+    checkAndTime(suite, "normalize(float4)", repeats, {
+        { "generic", [&] {
+            for (size_t i=0; i<count; i++) {
+                generic[i] = normalize<float, 4>(v[i]);
+            }
+        } },
+        { "SIMD", [&] {
+            for (size_t i=0; i<count; i++) {
+                fast[i] = normalize(v[i]);
+            }
+        } },
+    }, [&] { return relativeError(floats(&fast[0]), floats(&generic[0]), count*4); }, 1e-6);
+}
+
+// Rotations from random unit quaternions, then scaled and translated
+// when rigid is false.
+std::vector<float4x4> randomTransforms(size_t count, bool rigid, unsigned seed)
+{
+    std::vector<float> r = randomFloats(count * 10, 1, seed);
+    std::vector<float4x4> transforms(count);
+    for (size_t i=0; i<count; i++) {
+        const float *q = &r[i*10];
+        float n = sqrtf(q[0]*q[0] + q[1]*q[1] + q[2]*q[2] + q[3]*q[3]);
+        float w = q[0]/n, x = q[1]/n, y = q[2]/n, z = q[3]/n;
+        float sx = rigid ? 1 : 1.5f + q[4], sy = rigid ? 1 : 1.5f + q[5], sz = rigid ? 1 : 1.5f + q[6];
+        transforms[i] = float4x4(
+            (1 - 2*(y*y + z*z))*sx, 2*(x*y - w*z)*sy,       2*(x*z + w*y)*sz,       10*q[7],
+            2*(x*y + w*z)*sx,       (1 - 2*(x*x + z*z))*sy, 2*(y*z - w*x)*sz,       10*q[8],
+            2*(x*z - w*y)*sx,       2*(y*z + w*x)*sy,       (1 - 2*(x*x + y*y))*sz, 10*q[9],
+            0, 0, 0, 1);
+    }
+    return transforms;
+}
+
+// Largest element of m*inverse - I over every pair.
+template <typename M>
+double identityError(const std::vector<M> &m, const std::vector<M> &inverses, int n)
+{
+    double worst = 0;
+    for (size_t i=0; i<m.size(); i++) {
+        M product = mul(m[i], inverses[i]);
+        for (int r=0; r<n; r++) {
+            for (int c=0; c<n; c++) {
+                double e = fabs(product[r][c] - (r == c ? 1.0 : 0.0));
+                worst = e > worst ? e : worst;
+            }
+        }
+    }
+    return worst;
+}
+
+// The closed-form, affine and rigid inverses against Gauss-Jordan
+// elimination, each on the matrices it is meant for: M*inverse(M) must
+// come within a few times elimination's error of I, plus rounding.
+void inverses()
+{
+    const char *suite = "inverse";
+    const size_t count = 1 << 14;
+    const int repeats = 10;
+    const double tolerance = 1e-6;
+
+    // Diagonally dominant, so well conditioned, with a projective bottom row.
+    std::vector<float> values = randomFloats(count * 16, 1, 300);
+    std::vector<float4x4> general(count);
+    std::vector<float3x3> general3(count);
+    for (size_t i=0; i<count; i++) {
+        for (int r=0; r<4; r++) {
+            for (int c=0; c<4; c++) {
+                general[i][r][c] = values[i*16 + r*4 + c] + (r == c ? 4.0f : 0.0f);
+                if (r < 3 && c < 3) {
+                    general3[i][r][c] = general[i][r][c];
+                }
+            }
+        }
+    }
+    std::vector<float4x4> affine = randomTransforms(count, false, 301);
+    std::vector<float4x4> rigid = randomTransforms(count, true, 302);
+    std::vector<float4x4> result(count);
+    std::vector<float3x3> result3(count);
+
+    // Elimination's own error sets the tolerance, so it runs once before
+    // the timings, whose last variant leaves the fast path's results.
+    for (size_t i=0; i<count; i++) {
+        result3[i] = inverseGaussJordan(general3[i]);
+    }
+    double reference_error = identityError(general3, result3, 3);
+    checkAndTime(suite, "float3x3", repeats, {
+        { "Gauss-Jordan", [&] {
+            for (size_t i=0; i<count; i++) {
+                result3[i] = inverseGaussJordan(general3[i]);
+            }
+        } },
+        { "closed form", [&] {
+            for (size_t i=0; i<count; i++) {
+                result3[i] = inverse(general3[i]);
+            }
+        } },
+    }, [&] { return identityError(general3, result3, 3); }, 4*reference_error + tolerance);
+
+    const struct {
+        const char *name;
+        const std::vector<float4x4> *m;
+        float4x4 (*invert)(float4x4);
+    } cases[] = {
+        { "general", &general, inverse },
+        { "affine", &affine, inverseAffine },
+        { "rigid", &rigid, inverseRigid },
+    };
+    for (size_t k=0; k<countof(cases); k++) {
+        const std::vector<float4x4> &m = *cases[k].m;
+        for (size_t i=0; i<count; i++) {
+            result[i] = inverseGaussJordan(m[i]);
+        }
+        reference_error = identityError(m, result, 4);
+        std::vector<Variant> variants;
+        variants.push_back(Variant { "Gauss-Jordan", [&] {
+            for (size_t i=0; i<count; i++) {
+                result[i] = inverseGaussJordan(m[i]);
+            }
+        } });
+        // The closed form on the same matrices, for comparison.
+        variants.push_back(Variant { "closed form", [&] {
+            for (size_t i=0; i<count; i++) {
+                result[i] = inverse(m[i]);
+            }
+        } });
+        if (k > 0) {
+            float4x4 (*invert)(float4x4) = cases[k].invert;
+            variants.push_back(Variant { cases[k].name, [&, invert] {
+                for (size_t i=0; i<count; i++) {
+                    result[i] = invert(m[i]);
+                }
+            } });
+        }
+        char what[64];
+        snprintf(what, sizeof(what), "%s float4x4", cases[k].name);
+        checkAndTime(suite, what, repeats, variants,
+                     [&] { return identityError(m, result, 4); }, 4*reference_error + tolerance);
+    }
+}
+
+void grow(float3 &lo, float3 &hi, const float3 &v)
+{
+    for (int c=0; c<3; c++) {
+        lo[c] = v[c] < lo[c] ? float(v[c]) : float(lo[c]);
+        hi[c] = v[c] > hi[c] ? float(v[c]) : float(hi[c]);
+    }
+}
+
+// The structure-of-arrays kernels against the one-vector-at-a-time loops
+// they replace, over the interleaved xyz arrays tinyobj loads.  The
+// counts leave tails for every lane width, and 0 checks empty spans.
+void soa()
+{
+    const char *suite = "soa";
+    const int repeats = 20;
+    float4x4 m = randomTransforms(1, false, 310)[0];
+    float3x3 upper;
+    for (int r=0; r<3; r++) {
+        for (int c=0; c<3; c++) {
+            upper[r][c] = m[r][c];
+        }
+    }
+    float3x3 normal_matrix = inverse(transpose(upper));
+    printf("%s: %s: using the %s kernels\n", program_name, suite, batchKernelName());
+
+    const size_t counts[] = { 0, 1, 7, 16*1024 + 5 };
+    double worst_points = 0, worst_normals = 0, worst_unit = 0, worst_bounds = 0;
+    bool round_trip = true, empty_bounds = true;
+    for (size_t k=0; k<countof(counts); k++) {
+        const size_t n = counts[k];
+        std::vector<float> xyz = randomFloats(n * 3, 50, 311 + unsigned(k));
+        float3_soa in, out;
+        deinterleave(xyz, in);
+        std::vector<float> back;
+        interleave(in, back);
+        round_trip = round_trip && back == xyz;
+
+        std::vector<float> expected(n * 3), actual;
+        transformPoints(m, in, out);
+        interleave(out, actual);
+        for (size_t i=0; i<n; i++) {
+            float4 p = mul(m, float4(xyz[3*i], xyz[3*i+1], xyz[3*i+2], 1));
+            expected[3*i] = p.x;
+            expected[3*i+1] = p.y;
+            expected[3*i+2] = p.z;
+        }
+        if (n) {
+            double e = relativeError(&expected[0], &actual[0], n*3);
+            worst_points = e > worst_points ? e : worst_points;
+        }
+
+        transformNormals(m, in, out);
+        interleave(out, actual);
+        for (size_t i=0; i<n; i++) {
+            float3 q = mul(normal_matrix, float3(xyz[3*i], xyz[3*i+1], xyz[3*i+2]));
+            expected[3*i] = q.x;
+            expected[3*i+1] = q.y;
+            expected[3*i+2] = q.z;
+        }
+        if (n) {
+            double e = relativeError(&expected[0], &actual[0], n*3);
+            worst_normals = e > worst_normals ? e : worst_normals;
+        }
+
+        normalize(in, out);
+        interleave(out, actual);
+        for (size_t i=0; i<n; i++) {
+            float3 u = normalize(float3(xyz[3*i], xyz[3*i+1], xyz[3*i+2]));
+            for (int c=0; c<3; c++) {
+                double e = fabs(actual[3*i+c] - u[c]);
+                worst_unit = e > worst_unit ? e : worst_unit;
+            }
+        }
+
+        float3 lo, hi;
+        if (!boundingBox(in, lo, hi)) {
+            empty_bounds = empty_bounds && n == 0;
+            continue;
+        }
+        empty_bounds = empty_bounds && n > 0;
+        float3 expected_lo(xyz[0], xyz[1], xyz[2]), expected_hi = expected_lo;
+        for (size_t i=1; i<n; i++) {
+            float3 v(xyz[3*i], xyz[3*i+1], xyz[3*i+2]);
+            grow(expected_lo, expected_hi, v);
+        }
+        for (int c=0; c<3; c++) {
+            double e = fabs(lo[c] - expected_lo[c]) + fabs(hi[c] - expected_hi[c]);
+            worst_bounds = e > worst_bounds ? e : worst_bounds;
+        }
+    }
+    check(suite, "deinterleave and interleave round trip", round_trip, 0);
+    check(suite, "transformPoints", worst_points < 1e-6, worst_points);
+    check(suite, "transformNormals", worst_normals < 1e-6, worst_normals);
+    check(suite, "normalize", worst_unit < 1e-6, worst_unit);
+    check(suite, "boundingBox, and false when empty", empty_bounds && worst_bounds == 0, worst_bounds);
+
+    // Transform, normalize and bound a mesh's worth of vectors.
+    const size_t n = 64 * 1024;
+    std::vector<float> xyz = randomFloats(n * 3, 50, 320), transformed(n * 3);
+    float3 lo, hi;
+    float3_soa in, out;
+    deinterleave(xyz, in);
+    checkAndTime(suite, "64K points", repeats, {
+        { "one at a time", [&] {
+            lo = float3(1e30f, 1e30f, 1e30f);
+            hi = -lo;
+            for (size_t i=0; i<n; i++) {
+                float4 p = mul(m, float4(xyz[3*i], xyz[3*i+1], xyz[3*i+2], 1));
+                float3 u = normalize(float3(p.x, p.y, p.z));
+                transformed[3*i] = u.x;
+                transformed[3*i+1] = u.y;
+                transformed[3*i+2] = u.z;
+                grow(lo, hi, u);
+            }
+        } },
+        { "batched", [&] {
+            transformPoints(m, in, out);
+            normalize(out, out);
+            boundingBox(out, lo, hi);
+        } },
+        { "batched, converting layouts", [&] {
+            deinterleave(xyz, in);
+            transformPoints(m, in, out);
+            normalize(out, out);
+            boundingBox(out, lo, hi);
+            interleave(out, transformed);
+        } },
+    });
+}
+
+float halfToFloatValue(unsigned short h)
+{
+    float f;
+    halfToFloat(&h, &f, 1);
+    return f;
+}
+
+// Values spread evenly over the exponents from 2^-26 to 2^16, either sign,
+// so every half range gets its share: zeros, denormals, normals and those
+// that overflow.
+std::vector<float> spreadFloats(size_t count, unsigned seed)
+{
+    std::mt19937 random(seed);
+    std::uniform_real_distribution<float> exponent(-26, 16);
+    std::vector<float> v(count);
+    for (size_t i=0; i<count; i++) {
+        v[i] = exp2f(exponent(random)) * (random() & 1 ? -1 : 1);
+    }
+    return v;
+}
+
+// The batch converters against rounding done one value at a time in
+// double precision, and the half converter against the Cg half class it
+// stands in for at mesh load.
+void quantize()
+{
+    const char *suite = "quantize";
+    const int repeats = 10;
+    printf("%s: %s: using the %s half converter\n", program_name, suite, quantizeKernelName());
+
+    // Every half but the NaNs comes back to the same bits.
+    std::vector<unsigned short> halves(1 << 16), back(1 << 16);
+    for (size_t i=0; i<halves.size(); i++) {
+        halves[i] = (unsigned short)i;
+    }
+    std::vector<float> widened(halves.size());
+    halfToFloat(&halves[0], &widened[0], halves.size());
+    floatToHalf(&widened[0], &back[0], halves.size());
+    int mismatches = 0;
+    for (size_t i=0; i<halves.size(); i++) {
+        bool nan = (i & 0x7c00) == 0x7c00 && (i & 0x3ff) != 0;
+        mismatches += !nan && back[i] != halves[i];
+    }
+    check(suite, "every half round trips", mismatches == 0, mismatches);
+
+    // No neighbor of the half chosen is nearer.
+    const size_t count = 1 << 20;
+    std::vector<float> values = spreadFloats(count, 320);
+    std::vector<unsigned short> h(count);
+    floatToHalf(&values[0], &h[0], count);
+    int misrounded = 0, class_differs = 0;
+    for (size_t i=0; i<count; i++) {
+        double x = values[i];
+        if (fabs(x) > 65504) {
+            misrounded += (h[i] & 0x7fff) != 0x7c00 && fabs(x) >= 65520;
+            continue;
+        }
+        unsigned short neighbors[2] = { (unsigned short)(h[i] - 1), (unsigned short)(h[i] + 1) };
+        double chosen = fabs(x - halfToFloatValue(h[i]));
+        for (int k=0; k<2; k++) {
+            if ((neighbors[k] & 0x7c00) != 0x7c00 && (neighbors[k] ^ h[i]) < 0x8000) {
+                misrounded += fabs(x - halfToFloatValue(neighbors[k])) < chosen;
+            }
+        }
+        // The class truncates denormals and rounds ties away from zero;
+        // over the rest of the normals it should agree.
+        float by_class = half(values[i]);
+        if (fabs(x) >= 6.103515625e-05 && fabs(x - by_class) != chosen) {
+            class_differs += by_class != halfToFloatValue(h[i]);
+        }
+    }
+    check(suite, "floatToHalf rounds to the nearest half", misrounded == 0, misrounded);
+    check(suite, "floatToHalf agrees with half but for ties", class_differs == 0, class_differs);
+
+    std::vector<float> unit = randomFloats(count, 1.5f, 321);
+    std::vector<short> snorm(count);
+    std::vector<unsigned short> unorm(count);
+    std::vector<unsigned char> unorm8(count);
+    floatToSnorm16(&unit[0], &snorm[0], count);
+    floatToUnorm16(&unit[0], &unorm[0], count);
+    floatToUnorm8(&unit[0], &unorm8[0], count);
+    int wrong[3] = { 0, 0, 0 };
+    for (size_t i=0; i<count; i++) {
+        float x = unit[i];
+        float s = x < -1 ? -1 : x > 1 ? 1 : x;
+        float u = x < 0 ? 0 : x > 1 ? 1 : x;
+        wrong[0] += snorm[i] != lrintf(s * 32767);
+        wrong[1] += unorm[i] != lrintf(u * 65535);
+        wrong[2] += unorm8[i] != lrintf(u * 255);
+    }
+    check(suite, "floatToSnorm16 matches lrintf", wrong[0] == 0, wrong[0]);
+    check(suite, "floatToUnorm16 matches lrintf", wrong[1] == 0, wrong[1]);
+    check(suite, "floatToUnorm8 matches lrintf", wrong[2] == 0, wrong[2]);
+
+    // Random directions and the axes, where the octahedron folds.
+    float3_soa normals;
+    deinterleave(randomFloats(3 * count / 16, 1, 322), normals);
+    for (int axis=0; axis<6; axis++) {
+        float v[3] = { 0, 0, 0 };
+        v[axis % 3] = axis < 3 ? 1.0f : -1.0f;
+        normals.x.push_back(v[0]);
+        normals.y.push_back(v[1]);
+        normals.z.push_back(v[2]);
+    }
+    normalize(normals, normals);
+    std::vector<short> octahedral(2 * normals.size());
+    encodeOctahedral(normals, &octahedral[0]);
+    double worst_degrees = 0;
+    for (size_t i=0; i<normals.size(); i++) {
+        float3 d = decodeOctahedral(octahedral[2*i], octahedral[2*i+1]);
+        double c = (d[0]*normals.x[i] + d[1]*normals.y[i] + d[2]*normals.z[i]) /
+                   sqrt(double(d[0]*d[0] + d[1]*d[1] + d[2]*d[2]));
+        double degrees = acos(c > 1 ? 1 : c) * 180 / M_PI;
+        worst_degrees = degrees > worst_degrees ? degrees : worst_degrees;
+    }
+    check(suite, "octahedral normals within 0.05 degrees", worst_degrees < 0.05, worst_degrees);
+
+    checkAndTime(suite, "1M floats to half,", repeats, {
+        { "Cg half", [&] {
+            for (size_t i=0; i<count; i++) {
+                half v(values[i]);
+                memcpy(&h[i], &v, sizeof(h[i]));
+            }
+        } },
+        { "floatToHalf", [&] {
+            floatToHalf(&values[0], &h[0], count);
+        } },
+    });
+    checkAndTime(suite, "1M floats to snorm16,", repeats, {
+        { "one at a time", [&] {
+            for (size_t i=0; i<count; i++) {
+                float x = unit[i];
+                snorm[i] = short(lrintf((x < -1 ? -1 : x > 1 ? 1 : x) * 32767));
+            }
+        } },
+        { "floatToSnorm16", [&] {
+            floatToSnorm16(&unit[0], &snorm[0], count);
+        } },
+    });
+}
+
+const float4x4 identity(1, 0, 0, 0,
+                        0, 1, 0, 0,
+                        0, 0, 1, 0,
+                        0, 0, 0, 1);
+
+// Clip coordinates, w of 1, of a point (x,y) texels into the default
+// occlusion buffer at window depth z.
+void occlusionPoint(float x, float y, float z, float *p)
+{
+    p[0] = x / 128 - 1;
+    p[1] = y / 64 - 1;
+    p[2] = 2*z - 1;
+}
+
+// Whether a box over texels [x0,x1] by [y0,y1], at window depth z and
+// inset from their edges, is visible past the buffer.
+bool occludeeVisible(const OcclusionBuffer &buffer, int x0, int x1, int y0, int y1, float z)
+{
+    float lo[3], hi[3];
+    occlusionPoint(x0 + 0.25f, y0 + 0.25f, z, lo);
+    occlusionPoint(x1 + 0.75f, y1 + 0.75f, z, hi);
+    return buffer.boxVisible(identity, float3(lo[0], lo[1], lo[2]), float3(hi[0], hi[1], hi[2]));
+}
+
+// The occluder pass must only hide what the GPU would: a texel whose
+// center an edge passes through is half covered, and a texel of a
+// slanted occluder is as far as its farthest corner, not its center.
+void occlusion()
+{
+    const char *suite = "occlusion";
+    const unsigned int quad[6] = { 0, 1, 2, 0, 2, 3 };
+    float positions[12];
+
+    // A flat square at depth 0.5 whose edges run through the centers of
+    // texel columns 10 and 30 and rows 20 and 40.  So does its diagonal,
+    // along which neither triangle covers a texel whole, so the boxes
+    // that should be hidden keep off it.
+    OcclusionBuffer buffer;
+    occlusionPoint(10.5f, 20.5f, 0.5f, &positions[0]);
+    occlusionPoint(30.5f, 20.5f, 0.5f, &positions[3]);
+    occlusionPoint(30.5f, 40.5f, 0.5f, &positions[6]);
+    occlusionPoint(10.5f, 40.5f, 0.5f, &positions[9]);
+    buffer.rasterize(identity, positions, 4, quad, 6, true);
+    buffer.buildPyramid();
+    check(suite, "covered texels hide what is behind",
+          !occludeeVisible(buffer, 15, 16, 21, 22, 0.75f) && !occludeeVisible(buffer, 26, 27, 38, 39, 0.75f), 0);
+    bool halves_visible = occludeeVisible(buffer, 10, 10, 25, 25, 0.75f) &&
+                          occludeeVisible(buffer, 30, 30, 25, 25, 0.75f) &&
+                          occludeeVisible(buffer, 15, 15, 20, 20, 0.75f) &&
+                          occludeeVisible(buffer, 15, 15, 40, 40, 0.75f);
+    check(suite, "texels an edge halves hide nothing", halves_visible, 0);
+    check(suite, "what is in front stays visible", occludeeVisible(buffer, 15, 16, 21, 22, 0.25f), 0);
+
+    // A square over whole texels 40 to 79 across, whose depth rises by
+    // 0.01 a texel: column 60 spans depths 0.40 to 0.41.
+    buffer.clear();
+    occlusionPoint(40, 20, 0.2f, &positions[0]);
+    occlusionPoint(80, 20, 0.6f, &positions[3]);
+    occlusionPoint(80, 40, 0.6f, &positions[6]);
+    occlusionPoint(40, 40, 0.2f, &positions[9]);
+    buffer.rasterize(identity, positions, 4, quad, 6, true);
+    buffer.buildPyramid();
+    check(suite, "slanted occluder hides what is behind its far corner",
+          !occludeeVisible(buffer, 60, 60, 36, 36, 0.415f), 0);
+    check(suite, "slanted occluder keeps what is behind only its center",
+          occludeeVisible(buffer, 60, 60, 36, 36, 0.407f), 0);
+}
+
+struct Suite {
+    const char *name;
+    void (*run)();
+    bool needs_gl;
+};
+
+const Suite suites[] = {
+    { "mipmaps", mipmaps, true },
+    { "simd", simd, false },
+    { "inverse", inverses, false },
+    { "soa", soa, false },
+    { "quantize", quantize, false },
+    { "occlusion", occlusion, false },
+};
+
+bool selected(const Suite &suite, const char *filter)
+{
+    return !filter || strstr(suite.name, filter);
+}
+
+} // namespace
+
+int runKernelBenchmarks(const char *filter, bool gl)
+{
+    failures = 0;
+    int ran = 0;
+    for (size_t i=0; i<countof(suites); i++) {
+        if (selected(suites[i], filter) && suites[i].needs_gl == gl) {
+            suites[i].run();
+            ran++;
+        }
+    }
+    if (ran) {
+        printf("%s: %s kernel checks: %d failed\n", program_name, gl ? "GL" : "CPU", failures);
+    }
+    return failures;
+}
+
+bool kernelBenchmarksNeedGL(const char *filter)
+{
+    for (size_t i=0; i<countof(suites); i++) {
+        if (selected(suites[i], filter) && suites[i].needs_gl) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,24 @@
+// kernelbench.hpp - accuracy checks and timings of the CPU kernels
+
+#ifndef __kernelbench_hpp__
+#define __kernelbench_hpp__
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+# pragma once
+#endif
+
+// Runs each suite whose name contains filter, or every one when filter is
+// NULL.  A suite checks a fast path against the reference it replaces and
+// times the two on the same data, printing a line for each.  Only the
+// suites that need a current GL context (mipmaps) run when gl is true, and
+// only the others when it is false, so the CPU suites can run before there
+// is a window.  Returns how many checks failed.
+int runKernelBenchmarks(const char *filter, bool gl);
+
+// Whether any suite whose name contains filter needs a GL context.
+bool kernelBenchmarksNeedGL(const char *filter);
+
+extern bool kernel_benchmarks;          // -kernelbench
+extern const char *kernel_filter;       // -kernelfilter
+
+#endif // __kernelbench_hpp__
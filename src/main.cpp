@@ -13,6 +13,7 @@
 #include <GL/glut.h>
 #endif
 
+#include <chrono>
 #include <vector>
 using std::vector;
 
@@ -33,9 +34,23 @@ using boost::shared_ptr;
 #include "glmatrix.hpp"
 #include "scene.hpp"
 #include "texture.hpp"
+#include "mipmap.hpp"
+#include "mesh.hpp"
+#include "mesh_optimize.hpp"
 #include "countof.h"
 #include "trackball.h"
 #include "menus.hpp"
+#include "post.hpp"
+#include "blur.hpp"
+#include "softraster.hpp"
+#include "cpushade.hpp"
+#include "golden.hpp"
+#include "kernelbench.hpp"
+#include "timesource.hpp"
+#include "turntable.hpp"
+#include "capture.hpp"
+#include "png.hpp"
+#include "qoi.hpp"
 #include "global.hpp"
 #include "request_vsync.h"
 
@@ -58,15 +73,26 @@ ScenePtr scene;
 MaterialPtr material;
 LightPtr light;
 float bump_height = 2.0;
+bool gpu_normal_maps = true;
 
 float3 eye_vector = float3(0,0,5);
 float3 at_vector = float3(0,0,0);
 float3 up_vector = float3(0,1,0);
 
 bool verbose = false;
+bool without_gl = false;
+int instance_count = 0;  // -instances
+int start_model = 0;     // -model
+int start_shader = 0;    // -shader
 
 bool use_vsync = true;
 
+PostChain post_chain;
+int post_chain_effects = -1;  // what post_chain was built for
+GpuTimer scene_timer;
+SoftRenderer soft_renderer;  // draws instead of GL with -software
+const char *software_frame = NULL;  // -softwareframe
+
 bool moving_eye = false;
 int begin_x;
 int begin_y;
@@ -91,10 +117,9 @@ bool wireframe = false;
 
 double maxFramerate = 60.0;
 double timeUntilRefresh;
+std::chrono::steady_clock::time_point time_last_display = std::chrono::steady_clock::now();
 
-clock_t clockStartProgram;
-double timePreviousFrame;
-double timeCurrentFrame;
+int benchmark_frames = 0;  // -benchmark
 
 
 
@@ -107,8 +132,13 @@ void initglext()
         exit(1);
     }
     has_EXT_direct_state_access = !!glutExtensionSupported("GL_EXT_direct_state_access");
+    if (!GLEW_EXT_framebuffer_object) {
+        gpu_normal_maps = false;
+    }
 }
 
+void initScene();
+
 void initGraphics()
 {
     trackball(curquat, 0.0, 0.0, 0.0, 0.0);
@@ -133,6 +163,14 @@ void initGraphics()
     glEnable (GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
+    initScene();
+}
+
+// The scene the program starts with.  With without_gl set nothing is sent
+// to GL, and the environment map and instances, which only GL draws, are
+// left out.
+void initScene()
+{
     timeUntilRefresh = 1.0/maxFramerate;
 
     scene = ScenePtr(new Scene(Camera(40, 1, 0.1, 100),
@@ -143,14 +181,16 @@ void initGraphics()
     material = MaterialPtr(new Material());
 
     // A little hacky - pick initial values from menu items
-    modelMenu(0);
+    modelMenu(start_model);
     
     materialMenu(0);
 
     // bumpyMenu(0);
     // textureMenu(0);
-    envMapMenu(0);
-    shaderMenu(0);
+    if (!without_gl) {
+        envMapMenu(0);
+    }
+    shaderMenu(start_shader);
 
     light = LightPtr(new Light());
     light->setCenter(float3(0,0,0));
@@ -159,6 +199,15 @@ void initGraphics()
     // A little hacky - pick initial value from menu item
     lightMenu(1);
     scene->addLight(light);
+
+    // A field of instanced bunnies below the model
+    if (instance_count > 0 && !without_gl) {
+        Transform field;
+        field.setMatrix(translate4x4(float3(0,-1.5f,0)), TRANSFORM_RIGID);
+        InstancedObjectPtr bunnies(new InstancedObject("bunny.obj", "../media/bunny/", field, material));
+        bunnies->scatter(instance_count, 1);
+        scene->addObject(bunnies);
+    }
 }
 
 
@@ -186,6 +235,71 @@ void printMatrices()
     }
 }
 
+// Draws the scene on the CPU and copies the image into the framebuffer,
+// with its depth so the post passes work on it as on the GL path's.
+void drawSoftware()
+{
+    GLint viewport[4];
+    GLfloat clear_color[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glGetFloatv(GL_COLOR_CLEAR_VALUE, clear_color);
+    soft_renderer.resize(viewport[2], viewport[3]);
+    soft_renderer.clear(float4(clear_color[0], clear_color[1], clear_color[2], clear_color[3]));
+    static std::string unported;  // reported once
+    if (!soft_renderer.draw(*scene) && scene->models->fragment_filename != unported) {
+        unported = scene->models->fragment_filename;
+        printf("%s: %s has no software port, drawn as glsl/phong.frag\n", program_name, unported.c_str());
+    }
+
+    glPushAttrib(GL_ENABLE_BIT | GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+    glUseProgram(0);
+    glDisable(GL_BLEND);
+    glDisable(GL_DEPTH_TEST);
+    glWindowPos2i(viewport[0], viewport[1]);
+    glDrawPixels(viewport[2], viewport[3], GL_RGBA, GL_UNSIGNED_BYTE, soft_renderer.pixels());
+    // Depth is only written with the depth test on.
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_ALWAYS);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDrawPixels(viewport[2], viewport[3], GL_DEPTH_COMPONENT, GL_FLOAT, soft_renderer.depths());
+    glPopAttrib();
+}
+
+// -softwareframe: draws one 640x480 frame of the starting scene with the
+// software renderer alone and writes it to filename, as QOI when the name
+// ends in .qoi and PNG otherwise.  Runs before GLUT is initialized, so it
+// needs neither a display nor GL.
+bool writeSoftwareFrame(const char *filename)
+{
+    const int width = 640, height = 480;
+
+    without_gl = true;
+    initScene();
+    scene->camera.setAspectRatio(float(width) / height);
+
+    soft_renderer.resize(width, height);
+    soft_renderer.clear(float4(0.1, 0.1, 0.2, 0.0));
+    if (!soft_renderer.draw(*scene)) {
+        printf("%s: %s has no software port, drawn as glsl/phong.frag\n",
+            program_name, scene->models->fragment_filename.c_str());
+    }
+
+    std::vector<unsigned char> bytes;
+    size_t length = strlen(filename);
+    if (length >= 4 && !strcmp(filename + length - 4, ".qoi")) {
+        encodeQOI(soft_renderer.pixels(), width, height, bytes);
+    } else {
+        encodePNG(soft_renderer.pixels(), width, height, bytes);
+    }
+    FrameWriter writer(filename);
+    bool ok = writer.write(0, bytes);
+    ok = writer.close() && ok;
+    if (!ok) {
+        printf("%s: could not write %s\n", program_name, filename);
+    }
+    return ok;
+}
+
 void doGraphics()
 {
     if (new_spin_update) {
@@ -193,33 +307,122 @@ void doGraphics()
 
         build_rotmatrix(m, curquat);
         //`scene->object_list[0]->transform.setMatrix(m);
-        scene->models->transform.setMatrix(m);
+        scene->models->transform.setMatrix(m, TRANSFORM_RIGID);
+    }
+    if (software_rendering) {
+        drawSoftware();
+    } else {
+        scene->draw();
     }
-    scene->draw();
 #if 0
     printMatrices();
 #endif
 }
 
 
-void display() {
-    timePreviousFrame = timeCurrentFrame;
-    timeCurrentFrame = ((float)clock() - clockStartProgram)/CLOCKS_PER_SEC;
+// Rebuilds the post chain when the effects it is made of change.
+void updatePostChain()
+{
+    bool god_rays = scene->models->getGodsRay();
+    bool toon_blur = !god_rays && scene->models->fragment_filename == "glsl/toon_blur.frag";
+    int effects = int(screen_edges) | int(god_rays) << 1 | int(toon_blur) << 2;
+    if (effects == post_chain_effects) {
+        return;
+    }
+    post_chain_effects = effects;
+
+    post_chain.clear();
+    int color = PostChain::SCENE_COLOR;
+    if (screen_edges) {
+        int inked = god_rays || toon_blur ? post_chain.addTarget("inked") : int(PostChain::OUTPUT);
+        addScreenEdges(post_chain, color, PostChain::SCENE_DEPTH, inked);
+        color = inked;
+    }
+    if (god_rays) {
+        addGodRays(post_chain, color, PostChain::OUTPUT);
+    }
+    if (toon_blur) {
+        addToonBlur(post_chain, color, PostChain::OUTPUT);
+    }
+}
+
+// The scene and its post passes into the bound framebuffer.
+void drawFrame()
+{
+    updatePostChain();
+    bool post = post_chain.begin();
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    scene_timer.begin();
+    doGraphics();
+    scene_timer.end();
+    if (post) {
+        post_chain.end(scene->camera);
+    }
+}
+
+// Hands the frame just drawn to frame_capture, when capturing.
+void captureFrame()
+{
+    if (frame_capture.active()) {
+        frame_capture.capture(frame_time.frame(), int(window_widthf), int(window_heightf));
+    }
+}
 
-    // std::cout << "timePreviousFrame: " << timePreviousFrame << std::endl; 
-    // std::cout << "timeCurrentFrame: " << timeCurrentFrame << std::endl; 
-    // std::cout << "timeUntilRefresh: " << timeUntilRefresh << std::endl; 
-  
-    double deltaTime = timeCurrentFrame-timePreviousFrame;
+void finishCapture()
+{
+    if (!frame_capture.finish()) {
+        printf("%s: could not write every frame captured to %s\n", program_name, capture_output);
+    }
+}
 
-    timeUntilRefresh -= deltaTime;
+// Captures every frame drawn in the window to capture_output.
+void startCapture()
+{
+    static FrameWriter writer(capture_output);
+    frame_capture.begin(capture_format, [](int frame, const std::vector<unsigned char> &encoded) {
+        return writer.write(frame, encoded);
+    });
+    atexit(finishCapture);
+}
+
+void display() {
+    // The refresh rate follows the wall clock; what the frame shows
+    // follows frame_time.
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    std::chrono::duration<double> deltaTime = now - time_last_display;
+    time_last_display = now;
+
+    timeUntilRefresh -= deltaTime.count();
 
     if (timeUntilRefresh <= 0) {
         timeUntilRefresh = 1.0/maxFramerate;
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        doGraphics();
+        frame_time.advance();
+        drawFrame();
+        captureFrame();
+        glutSwapBuffers();
+    }
+}
+
+// Draws frames as fast as they go, with no refresh limit, and reports the
+// rate.  With a fixed step or a script, every run draws the same frames.
+void runBenchmark(int frames)
+{
+    frame_time.restart();
+    glFinish();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i=0; i<frames; i++) {
+        frame_time.advance();
+        drawFrame();
+        captureFrame();
         glutSwapBuffers();
     }
+    glFinish();
+    // Every frame captured counts as drawn once it is written.
+    finishCapture();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    printf("%s: %d frames, up to %.3f s of animation, in %.3f s: %.1f frames per second\n",
+        program_name, frames, frame_time.time(), elapsed.count(), frames / elapsed.count());
+    frame_capture.printTimes(program_name);
 }
 
 void reshape(int w, int h)
@@ -274,6 +477,26 @@ void keyboard(unsigned char c, int x, int y)
        break;
     case 'f':
         break;
+    case 'c':
+        scene->cull_stats.print(program_name);
+        scene->render_stats.print(program_name);
+        if (GpuTimer::supported()) {
+            printf("%s: %.3f ms of GPU time drawing the scene\n", program_name, scene_timer.milliseconds());
+        }
+        post_chain.printTimes(program_name);
+        frame_capture.printTimes(program_name);
+        if (software_rendering) {
+            soft_renderer.stats.print(program_name);
+        }
+        break;
+    case 's':
+        software_rendering = !software_rendering;
+        printf("software rendering = %s\n", software_rendering ? "enabled" : "disabled");
+        break;
+    case 'e':
+        screen_edges = !screen_edges;
+        printf("screen-space edges = %s\n", screen_edges ? "enabled" : "disabled");
+        break;
     case 'B':
         bump_height -= 0.2;
         // Fallthrough...
@@ -281,10 +504,12 @@ void keyboard(unsigned char c, int x, int y)
         bump_height += 0.1;
         printf("bump_height = %f\n", bump_height);
 
-        material->normal_map->load(bump_height);
-        material->normal_map->tellGL();
-
-        material->bindTextures();
+        if (gpu_normal_maps && material->generateNormalMap(bump_height)) {
+            material->bindTextures();
+        } else if (material->normal_map && material->normal_map->setScale(bump_height)) {
+            material->normal_map->tellGL();
+            material->bindTextures();
+        }
         break;
     default:
         return;
@@ -382,16 +607,143 @@ int main(int argc, char **argv)
 #if defined(_WIN32) && !defined(NDEBUG)  // Set to 1 for Windows heap debugging
     _CrtSetDbgFlag(_CRTDBG_ALLOC_MEM_DF | _CRTDBG_CHECK_ALWAYS_DF);
 #endif
-    glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE | GLUT_DEPTH);
-    glutInitWindowSize(640, 480);
-    glutInit(&argc, argv);
-
     for (int i=1; i<argc; i++) {
        if (!strcmp(argv[i], "-novsync")) {
            use_vsync = false;
+       } else if (!strcmp(argv[i], "-verbose")) {
+           verbose = true;
+       } else if (!strcmp(argv[i], "-cpumipmaps")) {
+           cpu_mipmaps = true;
+       } else if (!strcmp(argv[i], "-boxmipmaps")) {
+           mip_filter = MIP_FILTER_BOX;
+       } else if (!strcmp(argv[i], "-texcache")) {
+           texture_cache = true;
+       } else if (!strcmp(argv[i], "-meshcache")) {
+           mesh_cache = true;
+       } else if (!strcmp(argv[i], "-nomeshopt")) {
+           mesh_optimize = false;
+       } else if (!strcmp(argv[i], "-nomeshletcull")) {
+           meshlet_culling = false;
+       } else if (!strcmp(argv[i], "-noocclusion")) {
+           occlusion_culling = false;
+       } else if (!strcmp(argv[i], "-loderror") && i+1 < argc) {
+           lod_pixel_error = float(atof(argv[++i]));
+       } else if (!strcmp(argv[i], "-instances") && i+1 < argc) {
+           instance_count = atoi(argv[++i]);
+       } else if (!strcmp(argv[i], "-edges")) {
+           screen_edges = true;
+       } else if (!strcmp(argv[i], "-edgewidth") && i+1 < argc) {
+           edge_width = float(atof(argv[++i]));
+       } else if (!strcmp(argv[i], "-kawase")) {
+           blur_method = BLUR_KAWASE;
+       } else if (!strcmp(argv[i], "-blurradius") && i+1 < argc) {
+           blur_radius = float(atof(argv[++i]));
+       } else if (!strcmp(argv[i], "-blurdownsample") && i+1 < argc) {
+           blur_downsample = atoi(argv[++i]);
+       } else if (!strcmp(argv[i], "-software")) {
+           software_rendering = true;
+       } else if (!strcmp(argv[i], "-softwareframe") && i+1 < argc) {
+           if (FrameWriter::valid(argv[++i])) {
+               software_frame = argv[i];
+           } else {
+               printf("%s: cannot write a frame to %s\n", program_name, argv[i]);
+           }
+       } else if (!strcmp(argv[i], "-model") && i+1 < argc) {
+           start_model = findModel(argv[++i]);
+           if (start_model < 0) {
+               printf("%s: unknown model %s\n", program_name, argv[i]);
+               start_model = 0;
+           }
+       } else if (!strcmp(argv[i], "-shader") && i+1 < argc) {
+           start_shader = findShader(argv[++i]);
+           if (start_shader < 0) {
+               printf("%s: unknown shader %s\n", program_name, argv[i]);
+               start_shader = 0;
+           }
+       } else if (!strcmp(argv[i], "-nosimdshading")) {
+           simd_shading = false;
+       } else if (!strcmp(argv[i], "-golden") && i+1 < argc) {
+           golden_directory = argv[++i];
+       } else if (!strcmp(argv[i], "-goldenupdate")) {
+           golden_update = true;
+       } else if (!strcmp(argv[i], "-goldenfilter") && i+1 < argc) {
+           golden_filter = argv[++i];
+       } else if (!strcmp(argv[i], "-goldenpixel") && i+1 < argc) {
+           golden_thresholds.pixel = float(atof(argv[++i]));
+       } else if (!strcmp(argv[i], "-goldenchanged") && i+1 < argc) {
+           golden_thresholds.changed = float(atof(argv[++i]));
+       } else if (!strcmp(argv[i], "-goldenmean") && i+1 < argc) {
+           golden_thresholds.mean = float(atof(argv[++i]));
+       } else if (!strcmp(argv[i], "-kernelbench")) {
+           kernel_benchmarks = true;
+       } else if (!strcmp(argv[i], "-kernelfilter") && i+1 < argc) {
+           kernel_filter = argv[++i];
+       } else if (!strcmp(argv[i], "-fixedstep") && i+1 < argc) {
+           frame_time.useFixed(atof(argv[++i]));
+       } else if (!strcmp(argv[i], "-timescript") && i+1 < argc) {
+           if (!frame_time.useScript(argv[++i])) {
+               printf("%s: could not read times from %s\n", program_name, argv[i]);
+           }
+       } else if (!strcmp(argv[i], "-benchmark") && i+1 < argc) {
+           benchmark_frames = atoi(argv[++i]);
+       } else if (!strcmp(argv[i], "-capture") && i+1 < argc) {
+           if (FrameWriter::valid(argv[++i])) {
+               capture_output = argv[i];
+           } else {
+               printf("%s: cannot capture to %s\n", program_name, argv[i]);
+           }
+       } else if (!strcmp(argv[i], "-captureformat") && i+1 < argc) {
+           i++;
+           if (!strcmp(argv[i], "qoi")) {
+               capture_format = CAPTURE_QOI;
+           } else if (!strcmp(argv[i], "raw")) {
+               capture_format = CAPTURE_RAW;
+           } else if (!strcmp(argv[i], "png")) {
+               capture_format = CAPTURE_PNG;
+           } else {
+               printf("%s: unknown capture format %s\n", program_name, argv[i]);
+           }
+       } else if (!strcmp(argv[i], "-batch") && i+1 < argc) {
+           batch_filename = argv[++i];
+       } else if (!strcmp(argv[i], "-batchjob") && i+1 < argc) {
+           batch_job = atoi(argv[++i]);
+       } else if (!strcmp(argv[i], "-batchprocesses") && i+1 < argc) {
+           batch_processes = atoi(argv[++i]);
+       } else if (!strcmp(argv[i], "-cpunormalmaps")) {
+           gpu_normal_maps = false;
        }
     }
 
+    // The CPU kernel suites run before GLUT opens a display, so they need
+    // none; the GL ones wait for the window's context below.
+    if (kernel_benchmarks) {
+        int failures = runKernelBenchmarks(kernel_filter, false);
+        if (failures || !kernelBenchmarksNeedGL(kernel_filter)) {
+            exit(failures ? 1 : 0);
+        }
+    }
+
+    // So does a software frame, which never opens a window.
+    if (software_frame) {
+        exit(writeSoftwareFrame(software_frame) ? 0 : 1);
+    }
+
+    glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE | GLUT_DEPTH);
+    glutInitWindowSize(640, 480);
+    glutInit(&argc, argv);
+
+    std::vector<TurntableJob> turntable_jobs;
+    if (batch_filename) {
+        if (!readTurntableJobs(batch_filename, turntable_jobs)) {
+            exit(1);
+        }
+        // The jobs' own processes each make a window and draw in it.
+        if (batch_job < 0 && batch_processes > 1) {
+            int failures = runTurntableProcesses(argc, argv, int(turntable_jobs.size()), batch_processes);
+            exit(failures ? 1 : 0);
+        }
+    }
+
     glutCreateWindow(program_name);
 
     glutDisplayFunc(display);
@@ -402,9 +754,28 @@ int main(int argc, char **argv)
     glutIdleFunc(display);
 
     initglext();
+    if (kernel_benchmarks) {
+        int failures = runKernelBenchmarks(kernel_filter, true);
+        exit(failures ? 1 : 0);
+    }
     initGraphics();
     initMenus();
+    if (golden_directory) {
+        int failures = runGoldenTests(goldenCases(golden_filter), drawFrame);
+        exit(failures ? 1 : 0);
+    }
+    if (batch_filename) {
+        int failures = renderTurntables(turntable_jobs, batch_job, drawFrame);
+        exit(failures ? 1 : 0);
+    }
     requestSynchornizedSwapBuffers(use_vsync);
+    if (capture_output) {
+        startCapture();
+    }
+    if (benchmark_frames > 0) {
+        runBenchmark(benchmark_frames);
+        exit(0);
+    }
 
     glutMainLoop();
     return 0;
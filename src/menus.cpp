@@ -15,6 +15,14 @@
 #include "menus.hpp"
 #include "global.hpp"
 
+// The menus also set the scene up with no window, for -softwareframe.
+static void redisplay()
+{
+    if (!without_gl) {
+        glutPostRedisplay();
+    }
+}
+
 static const struct {
     const char *name;
     const char *pathToFolder; // From media folder
@@ -51,7 +59,7 @@ void modelMenu(int item)
     
     scene->changeModel(file_name, folder_path);
     scene->models->setExplosion(false);
-    glutPostRedisplay();
+    redisplay();
 }
 
 static const struct {
@@ -77,7 +85,7 @@ void envMapMenu(int item)
     material->envmap = envmap;
     scene->setEnvMap(envmap);
 
-    glutPostRedisplay();
+    redisplay();
 }
 
 static const struct {
@@ -101,20 +109,27 @@ void bumpyMenu(int item)
 
     const char *filename = bumpy_list[item].filename;
 
-    NormalMapPtr normal_map = NormalMapPtr(new NormalMap(filename));
-    normal_map->load(bump_height);
-    normal_map->tellGL();
-
     Texture2DPtr height_field(new Texture2D(filename));
+    height_field->setMipColorSpace(MIP_LINEAR);
     height_field->load();
     height_field->tellGL();
 
+    NormalMapPtr normal_map = NormalMapPtr(new NormalMap(filename));
+
     material->normal_map = normal_map;
     material->height_field = height_field;
 
+    if (!gpu_normal_maps || !material->generateNormalMap(bump_height)) {
+        if (!normal_map->load(bump_height)) {
+            printf("Bump map \"%s\" left flat\n", bumpy_list[item].name);
+        }
+        // Flat when the load failed, so the material's texture is complete.
+        normal_map->tellGL();
+    }
+
     material->bindTextures();
 
-    glutPostRedisplay();
+    redisplay();
 }
 
 static const struct {
@@ -141,7 +156,7 @@ void textureMenu(int item)
 
     material->texture = texture;
     material->bindTextures();
-    glutPostRedisplay();
+    redisplay();
 }
 
 static const struct {
@@ -186,7 +201,7 @@ void materialMenu(int item)
     material->diffuse = float4(material_list[item].diffuse, 1);
     material->specular = float4(material_list[item].specular, 1);
     material->shininess = material_list[item].shininess;
-    glutPostRedisplay();
+    redisplay();
 }
 
 static const struct {
@@ -207,7 +222,7 @@ void lightMenu(int item)
     assert(item < (int)countof(light_list));
 
     light->setColor(light_list[item].color);
-    glutPostRedisplay();
+    redisplay();
 }
 
 static const struct {
@@ -228,11 +243,12 @@ static const struct {
     { "Stripes & Spirals",       "glsl/stripes_spirals.frag" }, 
     { "Toon Simple 1",           "glsl/toon_simple.frag" },
     { "Toon Simple 2",           "glsl/toon_simple_glossy.frag" },
+    { "Toon Blur",               "glsl/toon_blur.frag" },
     { "Gooch",                   "glsl/gooch.frag" },
     { "Graphic",                 "glsl/graphic.frag" },
     { "Psychadelic",             "glsl/psychadelic.frag" },
     { "Stencilize",              "glsl/stencilize.frag" },
-    // { "God Ray",                 "glsl/gods_ray.frag"},
+    { "God Ray",                 "glsl/gods_ray.frag"},
     { "Ice",                     "glsl/ice.frag" },
     { "Noise Texture",           "glsl/noise_texture.frag" },
     { "Gritty Texture",          "glsl/gritty_texture.frag" },  
@@ -247,6 +263,11 @@ void shaderMenu(int item)
 
     const char *filename = shader_list[item].filename;
     printf("Switching to shader \"%s\", loaded from %s...\n", shader_list[item].name, filename);
+    if (without_gl) {
+        // The software renderer goes by the file name alone.
+        scene->models->fragment_filename = filename;
+        return;
+    }
     scene->models->setGodsRay();
     //scene->models->setExplosion(false);
     if(strcmp(shader_list[item].name,"God Ray")==0){
@@ -263,7 +284,7 @@ void shaderMenu(int item)
             scene->models->loadProgram();
     }
     material->bindTextures();
-    glutPostRedisplay();
+    redisplay();
 }
 static const struct {
     const char *name;
@@ -301,7 +322,7 @@ void extraMenu(int item)
         scene->models->setRandom(true);
         scene->models->loadRandomProgram();
     }
-    glutPostRedisplay();
+    redisplay();
 }
 
 enum {
@@ -324,6 +345,129 @@ static void menu(int item)
     }
 }
 
+int modelCount()
+{
+    return int(countof(model_list));
+}
+
+const char *modelFilename(int item)
+{
+    return model_list[item].filename;
+}
+
+int shaderCount()
+{
+    return int(countof(shader_list));
+}
+
+const char *shaderFilename(int item)
+{
+    return shader_list[item].filename;
+}
+
+int extraCount()
+{
+    return int(countof(extra_list));
+}
+
+const char *extraAction(int item)
+{
+    return extra_list[item].action;
+}
+
+#ifdef _WIN32  // the POSIX names
+#define strcasecmp _stricmp
+#define strncasecmp _strnicmp
+#else
+#include <strings.h>
+#endif
+
+static bool sameName(const char *name, const char *entry_name, const char *filename = NULL)
+{
+    if (!strcasecmp(name, entry_name)) {
+        return true;
+    }
+    if (!filename) {
+        return false;
+    }
+    const char *base = strrchr(filename, '/');
+    base = base ? base + 1 : filename;
+    const char *dot = strrchr(base, '.');
+    size_t length = dot ? size_t(dot - base) : strlen(base);
+    return strlen(name) == length && !strncasecmp(name, base, length);
+}
+
+int findModel(const char *name)
+{
+    for (size_t i=0; i<countof(model_list); i++) {
+        if (sameName(name, model_list[i].name, model_list[i].filename)) {
+            return int(i);
+        }
+    }
+    return -1;
+}
+
+int findShader(const char *name)
+{
+    for (size_t i=0; i<countof(shader_list); i++) {
+        if (sameName(name, shader_list[i].name, shader_list[i].filename)) {
+            return int(i);
+        }
+    }
+    return -1;
+}
+
+int findExtra(const char *name)
+{
+    for (size_t i=0; i<countof(extra_list); i++) {
+        if (sameName(name, extra_list[i].name, extra_list[i].action)) {
+            return int(i);
+        }
+    }
+    return -1;
+}
+
+int findMaterial(const char *name)
+{
+    for (size_t i=0; i<countof(material_list); i++) {
+        if (sameName(name, material_list[i].name)) {
+            return int(i);
+        }
+    }
+    return -1;
+}
+
+int findEnvMap(const char *name)
+{
+    for (size_t i=0; i<countof(envmap_list); i++) {
+        if (sameName(name, envmap_list[i].name)) {
+            return int(i);
+        }
+    }
+    return -1;
+}
+
+int findLight(const char *name)
+{
+    for (size_t i=0; i<countof(light_list); i++) {
+        if (sameName(name, light_list[i].name)) {
+            return int(i);
+        }
+    }
+    return -1;
+}
+
+void clearExtras()
+{
+    ModelObject &model = *scene->models;
+    model.setExplosion(false);
+    model.setExplosion2(false);
+    model.setRandom(false);
+    if (model.getOutline()) {
+        model.setOutline();
+    }
+}
+
 void initMenus()
 {
     int model_menu = glutCreateMenu(modelMenu);
@@ -16,4 +16,24 @@ void shaderMenu(int item);
 void extraMenu(int item);
 void initMenus();
 
+// The menus' entries, for driving the scene without them.
+int modelCount();
+const char *modelFilename(int item);
+int shaderCount();
+const char *shaderFilename(int item);
+int extraCount();
+const char *extraAction(int item);
+
+// The entry called name, ignoring case, or whose file has that name
+// without its folder and extension; -1 for none.
+int findModel(const char *name);
+int findShader(const char *name);
+int findExtra(const char *name);
+int findMaterial(const char *name);
+int findEnvMap(const char *name);
+int findLight(const char *name);
+
+// Turns the extras off, leaving the shader loaded as it was before any.
+void clearExtras();
+
 #endif // __menus_hpp__
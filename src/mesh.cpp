@@ -0,0 +1,990 @@
+// mesh.cpp - compact vertex format for uploaded model meshes
+//
+// Positions are stored as 16-bit fractions of each shape's bounding box
+// and rebuilt in the vertex shader from the positionScale/positionBias
+// uniforms, normals are folded onto the octahedron and stored as two
+// snorm16 values, and texcoords are half floats.  Quantization runs on the
+// Cg batch kernels, so the conversion itself is vectorized.
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+
+#include <Cg/double.hpp>
+#include <Cg/vector.hpp>
+#include <Cg/matrix.hpp>
+#include <Cg/mul.hpp>
+#include <Cg/batch.hpp>
+#include <Cg/quantize.hpp>
+#include <Cg/dot.hpp>
+#include <Cg/length.hpp>
+
+#include "glmatrix.hpp"
+#include "mesh.hpp"
+#include "cachefile.hpp"
+#include "parallel.hpp"
+
+using namespace Cg;
+
+bool mesh_cache = false;
+float lod_pixel_error = 1.0f;
+bool meshlet_culling = true;
+
+namespace {
+
+// Shapes that pass an occlusion test skip it this many frames after.
+const int occlusion_recheck_frames = 4;
+
+// Faces meeting at a sharper angle than this outline their shared edge.
+const float outline_crease_degrees = 60.0f;
+
+// Byte offsets within a packed vertex; position has one padding short so
+// every attribute starts 4-byte aligned.
+const size_t position_offset = 0;
+const size_t normal_offset = 8;
+const size_t texcoord_offset = 12;
+
+// Texcoords beyond what the format holds (and the 1e16 garbage some
+// exporters write) are zeroed, as the immediate-mode path used to do.
+const float half_max = 65504.0f;
+const float float_texcoord_max = 1e16f;
+
+unsigned int indexAt(const PackedShape &shape, GLsizei i)
+{
+    if (shape.index_type == GL_UNSIGNED_SHORT) {
+        unsigned short index;
+        memcpy(&index, &shape.indices[i*sizeof(index)], sizeof(index));
+        return index;
+    }
+    unsigned int index;
+    memcpy(&index, &shape.indices[i*sizeof(index)], sizeof(index));
+    return index;
+}
+
+void packIndices(const std::vector<unsigned int> &all, PackedShape &shape)
+{
+    shape.index_count = GLsizei(all.size());
+    if (shape.vertex_count <= 65536) {
+        shape.index_type = GL_UNSIGNED_SHORT;
+        shape.indices.resize(all.size() * sizeof(unsigned short));
+        for (size_t i=0; i<all.size(); i++) {
+            unsigned short index = (unsigned short)all[i];
+            memcpy(&shape.indices[i*sizeof(index)], &index, sizeof(index));
+        }
+    } else {
+        shape.index_type = GL_UNSIGNED_INT;
+        shape.indices.resize(all.size() * sizeof(unsigned int));
+        if (!all.empty()) {
+            memcpy(&shape.indices[0], &all[0], shape.indices.size());
+        }
+    }
+}
+
+// Positions, normals and texcoords of a packed shape back as floats.
+void dequantize(const PackedShape &shape, bool half_texcoords, GLsizei stride,
+                tinyobj::mesh_t &mesh)
+{
+    size_t n = size_t(shape.vertex_count);
+    float3 extent = shape.bounds_max - shape.bounds_min;
+    mesh.positions.resize(3*n);
+    mesh.normals.resize(3*n);
+    mesh.texcoords.resize(2*n);
+
+    std::vector<unsigned short> halves(half_texcoords ? 2*n : 0);
+    for (size_t i=0; i<n; i++) {
+        const GLubyte *v = &shape.vertices[i*stride];
+        unsigned short p[3];
+        short e[2];
+        memcpy(p, v + position_offset, sizeof(p));
+        memcpy(e, v + normal_offset, sizeof(e));
+        for (int c=0; c<3; c++) {
+            mesh.positions[3*i+c] = shape.bounds_min[c] + extent[c] * (p[c] / 65535.0f);
+        }
+        float3 normal = decodeOctahedral(e[0], e[1]);
+        mesh.normals[3*i+0] = normal.x;
+        mesh.normals[3*i+1] = normal.y;
+        mesh.normals[3*i+2] = normal.z;
+        if (half_texcoords) {
+            memcpy(&halves[2*i], v + texcoord_offset, 2*sizeof(unsigned short));
+        } else {
+            memcpy(&mesh.texcoords[2*i], v + texcoord_offset, 2*sizeof(float));
+        }
+    }
+    if (half_texcoords && n) {
+        halfToFloat(&halves[0], &mesh.texcoords[0], 2*n);
+    }
+
+    // Only the full mesh; coarser levels are rebuilt from the cache.
+    GLsizei count = shape.lods.empty() ? shape.index_count : shape.lods[0].count;
+    mesh.indices.resize(count);
+    for (GLsizei i=0; i<count; i++) {
+        mesh.indices[i] = indexAt(shape, i);
+    }
+}
+
+// True when every edge of the full mesh, with vertices that share a
+// quantized position taken as one, borders exactly two triangles.
+bool closedSurface(const PackedShape &shape, GLsizei stride)
+{
+    size_t n = size_t(shape.vertex_count);
+    std::vector<unsigned long long> keys(n);
+    for (size_t i=0; i<n; i++) {
+        unsigned short p[3];
+        memcpy(p, &shape.vertices[i*stride + position_offset], sizeof(p));
+        keys[i] = (unsigned long long)p[0] << 32 | (unsigned long long)p[1] << 16 | p[2];
+    }
+    std::vector<unsigned long long> sorted(keys);
+    std::sort(sorted.begin(), sorted.end());
+
+    GLsizei count = shape.lods.empty() ? shape.index_count : shape.lods[0].count;
+    std::vector<unsigned long long> edges;
+    edges.reserve(count);
+    for (GLsizei t=0; t+3<=count; t+=3) {
+        unsigned int id[3];
+        for (int k=0; k<3; k++) {
+            unsigned long long key = keys[indexAt(shape, t+k)];
+            id[k] = (unsigned int)(std::lower_bound(sorted.begin(), sorted.end(), key) - sorted.begin());
+        }
+        for (int k=0; k<3; k++) {
+            unsigned int a = id[k], b = id[(k+1)%3];
+            if (a != b) {
+                edges.push_back(a < b ? (unsigned long long)a << 32 | b : (unsigned long long)b << 32 | a);
+            }
+        }
+    }
+    std::sort(edges.begin(), edges.end());
+    for (size_t i=0; i<edges.size(); ) {
+        size_t j = i;
+        while (j < edges.size() && edges[j] == edges[i]) {
+            j++;
+        }
+        if (j - i != 2) {
+            return false;
+        }
+        i = j;
+    }
+    return !edges.empty();
+}
+
+struct CacheHeader {
+    CacheStamp stamp;
+    int half_texcoords;
+    int optimized;
+    int num_shapes;
+};
+
+const char cache_magic[8] = { 'P','A','C','K','M','E','S','H' };
+const int cache_version = 5;
+
+bool indicesInRange(const PackedShape &shape)
+{
+    for (GLsizei i=0; i<shape.index_count; i++) {
+        if (indexAt(shape, i) >= (unsigned int)shape.vertex_count) {
+            return false;
+        }
+    }
+    for (size_t l=0; l<shape.lods.size(); l++) {
+        const PackedLod &lod = shape.lods[l];
+        if (lod.first < 0 || lod.count < 0 || lod.count % 3 != 0 ||
+            lod.first > shape.index_count - lod.count) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool writeString(FILE *file, const std::string &s)
+{
+    int length = int(s.size());
+    return fwrite(&length, sizeof(length), 1, file) == 1 &&
+           (length == 0 || fwrite(s.data(), length, 1, file) == 1);
+}
+
+bool readString(FILE *file, std::string &s)
+{
+    int length;
+    if (fread(&length, sizeof(length), 1, file) != 1 || length < 0 || length > 4096) {
+        return false;
+    }
+    s.resize(length);
+    return length == 0 || fread(&s[0], length, 1, file) == 1;
+}
+
+// All of material, so a cached load draws as the OBJ's does.
+bool writeMaterial(FILE *file, const tinyobj::material_t &material)
+{
+    float values[17];
+    for (int c=0; c<3; c++) {
+        values[c] = material.ambient[c];
+        values[3+c] = material.diffuse[c];
+        values[6+c] = material.specular[c];
+        values[9+c] = material.transmittance[c];
+        values[12+c] = material.emission[c];
+    }
+    values[15] = material.shininess;
+    values[16] = material.ior;
+    int parameters = int(material.unknown_parameter.size());
+    bool ok = writeString(file, material.name) &&
+              fwrite(values, sizeof(values), 1, file) == 1 &&
+              writeString(file, material.ambient_texname) &&
+              writeString(file, material.diffuse_texname) &&
+              writeString(file, material.specular_texname) &&
+              writeString(file, material.normal_texname) &&
+              fwrite(&parameters, sizeof(parameters), 1, file) == 1;
+    std::map<std::string, std::string>::const_iterator p = material.unknown_parameter.begin();
+    for (; ok && p != material.unknown_parameter.end(); ++p) {
+        ok = writeString(file, p->first) && writeString(file, p->second);
+    }
+    return ok;
+}
+
+bool readMaterial(FILE *file, tinyobj::material_t &material)
+{
+    float values[17];
+    int parameters;
+    bool ok = readString(file, material.name) &&
+              fread(values, sizeof(values), 1, file) == 1 &&
+              readString(file, material.ambient_texname) &&
+              readString(file, material.diffuse_texname) &&
+              readString(file, material.specular_texname) &&
+              readString(file, material.normal_texname) &&
+              fread(&parameters, sizeof(parameters), 1, file) == 1 &&
+              parameters >= 0 && parameters <= 4096;
+    if (!ok) {
+        return false;
+    }
+    for (int c=0; c<3; c++) {
+        material.ambient[c] = values[c];
+        material.diffuse[c] = values[3+c];
+        material.specular[c] = values[6+c];
+        material.transmittance[c] = values[9+c];
+        material.emission[c] = values[12+c];
+    }
+    material.shininess = values[15];
+    material.ior = values[16];
+    material.unknown_parameter.clear();
+    for (int i=0; ok && i<parameters; i++) {
+        std::string key, value;
+        ok = readString(file, key) && readString(file, value);
+        material.unknown_parameter[key] = value;
+    }
+    return ok;
+}
+
+} // namespace
+
+PackedMesh::PackedMesh()
+    : half_texcoords(true)
+    , optimized(false)
+    , stride(16)
+{
+}
+
+PackedMesh::~PackedMesh()
+{
+    release();
+}
+
+void PackedMesh::build(const std::vector<tinyobj::shape_t> &source,
+                       const std::vector< std::vector<MeshLod> > &lods, bool half_texcoords_)
+{
+    release();
+    half_texcoords = half_texcoords_;
+    stride = GLsizei(texcoord_offset + (half_texcoords ? 2*sizeof(unsigned short) : 2*sizeof(float)));
+    shapes.resize(source.size());
+
+    for (size_t s=0; s<source.size(); s++) {
+        const tinyobj::mesh_t &mesh = source[s].mesh;
+        PackedShape &shape = shapes[s];
+        size_t n = mesh.positions.size() / 3;
+        shape.vertex_count = GLsizei(n);
+        shape.lod = 0;
+        shape.vertex_buffer = 0;
+        shape.index_buffer = 0;
+        shape.outline_buffer = 0;
+
+        float3_soa positions, unit;
+        deinterleave(mesh.positions, positions);
+        if (!boundingBox(positions, shape.bounds_min, shape.bounds_max)) {
+            shape.bounds_min = shape.bounds_max = float3(0,0,0);
+        }
+        float3 extent = shape.bounds_max - shape.bounds_min;
+        float3 inv_extent;
+        for (int c=0; c<3; c++) {
+            inv_extent[c] = extent[c] > 0 ? 1 / extent[c] : 0;
+        }
+        transformPoints(mul(scale4x4(inv_extent), translate4x4(-shape.bounds_min)), positions, unit);
+        std::vector<unsigned short> qx(n), qy(n), qz(n);
+        if (n) {
+            floatToUnorm16(&unit.x[0], &qx[0], n);
+            floatToUnorm16(&unit.y[0], &qy[0], n);
+            floatToUnorm16(&unit.z[0], &qz[0], n);
+        }
+
+        // Shapes without normals get (0,0,0), which encodes to +z: the
+        // default glNormal the immediate-mode path left in place.
+        std::vector<short> octahedral(2*n, 0);
+        if (mesh.normals.size() == 3*n && n) {
+            float3_soa normals;
+            deinterleave(mesh.normals, normals);
+            normalize(normals, normals);
+            encodeOctahedral(normals, &octahedral[0]);
+        }
+
+        std::vector<float> texcoords(2*n, 0.0f);
+        if (mesh.texcoords.size() == 2*n) {
+            float limit = half_texcoords ? half_max : float_texcoord_max;
+            for (size_t i=0; i<2*n; i++) {
+                float t = mesh.texcoords[i];
+                texcoords[i] = fabsf(t) <= limit ? t : 0.0f;
+            }
+        }
+        std::vector<unsigned short> halves(half_texcoords ? 2*n : 0);
+        if (half_texcoords && n) {
+            floatToHalf(&texcoords[0], &halves[0], 2*n);
+        }
+
+        shape.vertices.assign(n*stride, 0);
+        for (size_t i=0; i<n; i++) {
+            GLubyte *v = &shape.vertices[i*stride];
+            unsigned short p[4] = { qx[i], qy[i], qz[i], 0 };
+            memcpy(v + position_offset, p, sizeof(p));
+            memcpy(v + normal_offset, &octahedral[2*i], 2*sizeof(short));
+            if (half_texcoords) {
+                memcpy(v + texcoord_offset, &halves[2*i], 2*sizeof(unsigned short));
+            } else {
+                memcpy(v + texcoord_offset, &texcoords[2*i], 2*sizeof(float));
+            }
+        }
+
+        std::vector<unsigned int> all;
+        shape.lods.clear();
+        if (s < lods.size() && !lods[s].empty()) {
+            for (size_t l=0; l<lods[s].size(); l++) {
+                PackedLod lod = { GLsizei(all.size()), GLsizei(lods[s][l].indices.size()),
+                                  lods[s][l].error };
+                shape.lods.push_back(lod);
+                all.insert(all.end(), lods[s][l].indices.begin(), lods[s][l].indices.end());
+            }
+        } else {
+            PackedLod lod = { 0, GLsizei(mesh.indices.size()), 0.0f };
+            shape.lods.push_back(lod);
+            all = mesh.indices;
+        }
+        packIndices(all, shape);
+    }
+    buildMeshlets();
+}
+
+void PackedMesh::buildMeshlets()
+{
+    parallelFor(0, int(shapes.size()), 1, [&](int first, int last) {
+        for (int s = first; s < last; s++) {
+            PackedShape &shape = shapes[s];
+            tinyobj::mesh_t decoded;
+            dequantize(shape, half_texcoords, stride, decoded);
+            std::vector<unsigned int> all(shape.index_count);
+            for (GLsizei i=0; i<shape.index_count; i++) {
+                all[i] = indexAt(shape, i);
+            }
+            shape.meshlets.assign(shape.lods.size(), Meshlets());
+            shape.edges.assign(shape.lods.size(), EdgeMesh());
+            for (size_t l=0; l<shape.lods.size(); l++) {
+                const PackedLod &lod = shape.lods[l];
+                if (lod.count > 0) {
+                    ::buildMeshlets(decoded.positions, &all[lod.first], lod.count, lod.first,
+                                    shape.meshlets[l]);
+                    buildEdges(decoded.positions, &all[lod.first], lod.count,
+                               outline_crease_degrees, shape.edges[l]);
+                }
+            }
+            packIndices(all, shape);
+            shape.closed = shape.vertex_count > 0 && closedSurface(shape, stride);
+            shape.culled = false;
+            shape.occluded = false;
+            shape.occlusion_skip = 0;
+
+            float3 center = (shape.bounds_min + shape.bounds_max) * 0.5f;
+            float radius2 = 0;
+            for (size_t i=0; i<decoded.positions.size(); i+=3) {
+                float3 d = float3(decoded.positions[i], decoded.positions[i+1], decoded.positions[i+2]) - center;
+                float d2 = dot(d, d);
+                radius2 = d2 > radius2 ? d2 : radius2;
+            }
+            shape.radius = sqrtf(radius2);
+        }
+    });
+    volumes.clear();
+    for (size_t s=0; s<shapes.size(); s++) {
+        volumes.push_back(shapes[s].bounds_min, shapes[s].bounds_max, shapes[s].radius);
+    }
+}
+
+void PackedMesh::unpack(std::vector<tinyobj::shape_t> &source) const
+{
+    source.resize(shapes.size());
+    for (size_t s=0; s<shapes.size(); s++) {
+        dequantize(shapes[s], half_texcoords, stride, source[s].mesh);
+    }
+}
+
+void PackedMesh::report(const char *name, const std::vector<tinyobj::shape_t> &source) const
+{
+    assert(source.size() == shapes.size());
+    size_t vertices = 0, triangles = 0, packed_bytes = 0, float_bytes = 0;
+    size_t levels = 0;
+    for (size_t s=0; s<shapes.size(); s++) {
+        levels = shapes[s].lods.size() > levels ? shapes[s].lods.size() : levels;
+    }
+    std::vector<size_t> lod_triangles(levels, 0);
+    std::vector<float> lod_errors(levels, 0.0f);
+    float position_error = 0, relative_error = 0, normal_error = 0, texcoord_error = 0;
+
+    for (size_t s=0; s<shapes.size(); s++) {
+        const PackedShape &shape = shapes[s];
+        const tinyobj::mesh_t &original = source[s].mesh;
+        size_t n = size_t(shape.vertex_count);
+        size_t full = shape.lods.empty() ? size_t(shape.index_count) : size_t(shape.lods[0].count);
+        vertices += n;
+        triangles += full / 3;
+        packed_bytes += shape.vertices.size() + shape.indices.size();
+        float_bytes += n * 8*sizeof(float) + full * sizeof(unsigned int);
+
+        // Shapes with fewer levels count at their coarsest in the rest.
+        for (size_t l=0; l<levels && !shape.lods.empty(); l++) {
+            const PackedLod &lod = shape.lods[l < shape.lods.size() ? l : shape.lods.size() - 1];
+            lod_triangles[l] += size_t(lod.count) / 3;
+            lod_errors[l] = lod.error > lod_errors[l] ? lod.error : lod_errors[l];
+        }
+
+        tinyobj::mesh_t decoded;
+        dequantize(shape, half_texcoords, stride, decoded);
+        float diagonal = length(shape.bounds_max - shape.bounds_min);
+        for (size_t i=0; i<3*n; i++) {
+            float e = fabsf(decoded.positions[i] - original.positions[i]);
+            position_error = e > position_error ? e : position_error;
+            if (diagonal > 0 && e / diagonal > relative_error) {
+                relative_error = e / diagonal;
+            }
+        }
+        if (original.normals.size() == 3*n) {
+            for (size_t i=0; i<n; i++) {
+                float3 a(original.normals[3*i], original.normals[3*i+1], original.normals[3*i+2]);
+                float3 b(decoded.normals[3*i], decoded.normals[3*i+1], decoded.normals[3*i+2]);
+                float la = length(a);
+                if (la > 0) {
+                    float c = dot(a, b) / la;
+                    float degrees = acosf(c < 1 ? (c > -1 ? c : -1) : 1) * float(180 / M_PI);
+                    normal_error = degrees > normal_error ? degrees : normal_error;
+                }
+            }
+        }
+        if (original.texcoords.size() == 2*n) {
+            for (size_t i=0; i<2*n; i++) {
+                float e = fabsf(decoded.texcoords[i] - original.texcoords[i]);
+                if (e == e && fabsf(original.texcoords[i]) <= half_max) {
+                    texcoord_error = e > texcoord_error ? e : texcoord_error;
+                }
+            }
+        }
+    }
+
+    printf("%s: %ld vertices, %ld triangles, %.1f KB packed vs %.1f KB as floats (%.0f%%)\n",
+           name, long(vertices), long(triangles), packed_bytes / 1024.0, float_bytes / 1024.0,
+           float_bytes ? 100.0 * packed_bytes / float_bytes : 100.0);
+    printf("  max error: position %g (%.4f%% of bounds), normal %.4f degrees, texcoord %g (%s)\n",
+           position_error, 100 * relative_error, normal_error, texcoord_error,
+           half_texcoords ? "half" : "float");
+    if (lod_triangles.size() > 1) {
+        printf("  levels of detail:");
+        for (size_t l=0; l<lod_triangles.size(); l++) {
+            printf(" %ld (%g)", long(lod_triangles[l]), lod_errors[l]);
+        }
+        printf(" triangles (max error)\n");
+    }
+}
+
+void PackedMesh::selectLods(const float3 &eye_object, float pixel_scale, float pixel_error)
+{
+    for (size_t s=0; s<shapes.size(); s++) {
+        PackedShape &shape = shapes[s];
+        shape.lod = 0;
+        if (pixel_error <= 0 || shape.lods.size() < 2) {
+            continue;
+        }
+        float3 center = (shape.bounds_min + shape.bounds_max) * 0.5f;
+        float radius = length(shape.bounds_max - shape.bounds_min) * 0.5f;
+        float distance = length(eye_object - center) - radius;
+        if (distance <= 0) {
+            continue;
+        }
+        // Levels get coarser and their errors grow, so stop at the first
+        // one that would show.
+        float limit = pixel_error * distance / pixel_scale;
+        for (size_t l=1; l<shape.lods.size() && shape.lods[l].error <= limit; l++) {
+            shape.lod = int(l);
+        }
+    }
+}
+
+void PackedMesh::rasterizeOccluders(const float4x4 &clip_from_object, const float3 &eye_object,
+                                    OcclusionBuffer &occlusion, size_t triangle_budget) const
+{
+    Frustum frustum(clip_from_object);
+    std::vector<unsigned char> shape_visible(shapes.size());
+    if (!shapes.empty()) {
+        cullVolumes(volumes, 0, shapes.size(), frustum, &shape_visible[0]);
+    }
+
+    // Shapes hidden last frame are likely hidden again and so poor
+    // occluders.  The rest go largest on screen first.
+    std::vector< std::pair<float, size_t> > order;
+    for (size_t s=0; s<shapes.size(); s++) {
+        const PackedShape &shape = shapes[s];
+        if (shape.index_count == 0 || !shape_visible[s] || shape.occluded) {
+            continue;
+        }
+        float3 center = (shape.bounds_min + shape.bounds_max) * 0.5f;
+        float distance = length(eye_object - center);
+        float size = distance > shape.radius ? shape.radius / distance : 1.0f;
+        order.push_back(std::make_pair(-size, s));
+    }
+    std::sort(order.begin(), order.end());
+
+    // The full mesh is rasterized whatever level is drawn, since a coarser
+    // level can bulge past the surface and hide what the surface does not.
+    // Its vertices are decoded as the indices reach them, renumbered in
+    // order of first use.
+    std::vector<float> positions;
+    std::vector<unsigned int> indices, remap;
+    size_t triangles = 0;
+    for (size_t o=0; o<order.size() && triangles < triangle_budget; o++) {
+        const PackedShape &shape = shapes[order[o].second];
+        const PackedLod &lod = shape.lods[0];
+        float3 extent = shape.bounds_max - shape.bounds_min;
+        remap.assign(size_t(shape.vertex_count), ~0u);
+        positions.clear();
+        indices.resize(lod.count);
+        for (GLsizei i=0; i<lod.count; i++) {
+            unsigned int v = indexAt(shape, lod.first + i);
+            if (remap[v] == ~0u) {
+                remap[v] = unsigned(positions.size() / 3);
+                unsigned short p[3];
+                memcpy(p, &shape.vertices[v*stride + position_offset], sizeof(p));
+                for (int c=0; c<3; c++) {
+                    positions.push_back(shape.bounds_min[c] + extent[c] * (p[c] / 65535.0f));
+                }
+            }
+            indices[i] = remap[v];
+        }
+        if (!indices.empty()) {
+            occlusion.rasterize(clip_from_object, &positions[0], positions.size() / 3,
+                                &indices[0], indices.size(), shape.closed);
+        }
+        triangles += indices.size() / 3;
+    }
+}
+
+void PackedMesh::cull(const float4x4 &clip_from_object, const float3 &eye_object,
+                      bool cull_meshlets, bool cull_backfacing, const OcclusionBuffer *occlusion,
+                      CullStats &stats)
+{
+    Frustum frustum(clip_from_object);
+    std::vector<unsigned char> shape_visible(shapes.size()), visible;
+    if (!shapes.empty()) {
+        cullVolumes(volumes, 0, shapes.size(), frustum, &shape_visible[0]);
+    }
+    for (size_t s=0; s<shapes.size(); s++) {
+        PackedShape &shape = shapes[s];
+        shape.draw_counts.clear();
+        shape.draw_offsets.clear();
+        shape.culled = true;
+        if (shape.index_count == 0) {
+            continue;
+        }
+        const PackedLod &lod = shape.lods[shape.lod];
+        size_t index_size = shape.index_type == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+        stats.shapes++;
+        stats.triangles += lod.count / 3;
+        if (!shape_visible[s]) {
+            shape.occluded = false;
+            stats.shapes_culled++;
+            stats.triangles_culled += lod.count / 3;
+            continue;
+        }
+
+        // A shape found visible is trusted, meshlets and all, for a few
+        // frames; one found hidden is tested again every frame.
+        bool test_occlusion = occlusion && shape.occlusion_skip == 0;
+        if (shape.occlusion_skip > 0) {
+            shape.occlusion_skip--;
+        }
+        shape.occluded = test_occlusion &&
+            !occlusion->boxVisible(clip_from_object, shape.bounds_min, shape.bounds_max);
+        if (shape.occluded) {
+            stats.shapes_culled++;
+            stats.shapes_occluded++;
+            stats.triangles_culled += lod.count / 3;
+            continue;
+        }
+        if (test_occlusion) {
+            shape.occlusion_skip = occlusion_recheck_frames;
+        }
+        if (!cull_meshlets) {
+            shape.draw_counts.push_back(lod.count);
+            shape.draw_offsets.push_back((const GLvoid *)(lod.first * index_size));
+            continue;
+        }
+
+        const Meshlets &meshlets = shape.meshlets[shape.lod];
+        bool backfacing = cull_backfacing && shape.closed;
+        visible.resize(meshlets.size());
+        parallelFor(0, int(meshlets.size()), 1024, [&](int first, int last) {
+            cullMeshlets(meshlets, first, last, frustum, eye_object, backfacing, &visible[first]);
+            for (int i=first; test_occlusion && i<last; i++) {
+                if (!visible[i]) {
+                    continue;
+                }
+                float3 center(meshlets.center_x[i], meshlets.center_y[i], meshlets.center_z[i]);
+                float3 r(meshlets.radius[i]);
+                // 2 marks a meshlet that was only occluded, for the counts.
+                visible[i] = occlusion->boxVisible(clip_from_object, center - r, center + r) ? 1 : 2;
+            }
+        });
+
+        // Meshlets sit back to back in the index buffer, so neighbours that
+        // both survive become one range.
+        unsigned int end = 0;
+        stats.meshlets += int(meshlets.size());
+        for (size_t i=0; i<meshlets.size(); i++) {
+            if (visible[i] != 1) {
+                stats.meshlets_occluded += visible[i] == 2;
+                stats.meshlets_culled++;
+                stats.triangles_culled += meshlets.count[i] / 3;
+                continue;
+            }
+            if (!shape.draw_counts.empty() && meshlets.first[i] == end) {
+                shape.draw_counts.back() += GLsizei(meshlets.count[i]);
+            } else {
+                shape.draw_counts.push_back(GLsizei(meshlets.count[i]));
+                shape.draw_offsets.push_back((const GLvoid *)(meshlets.first[i] * index_size));
+            }
+            end = meshlets.first[i] + meshlets.count[i];
+        }
+    }
+}
+
+void PackedMesh::uncull()
+{
+    for (size_t s=0; s<shapes.size(); s++) {
+        shapes[s].culled = false;
+    }
+}
+
+size_t PackedMesh::extractOutlines(const float3 &eye_object)
+{
+    size_t lines = 0;
+    for (size_t s=0; s<shapes.size(); s++) {
+        PackedShape &shape = shapes[s];
+        shape.outline.clear();
+        if (shape.index_count == 0 || (shape.culled && shape.draw_counts.empty())) {
+            continue;
+        }
+        const EdgeMesh &edges = shape.edges[shape.lod];
+        shape.outline_selected.resize(edges.size());
+        parallelFor(0, int(edges.size()), 8192, [&](int first, int last) {
+            selectOutlineEdges(edges, first, last, eye_object, &shape.outline_selected[first]);
+        });
+        for (size_t i=0; i<edges.size(); i++) {
+            if (shape.outline_selected[i]) {
+                shape.outline.push_back(edges.v0[i]);
+                shape.outline.push_back(edges.v1[i]);
+            }
+        }
+        lines += shape.outline.size() / 2;
+    }
+    return lines;
+}
+
+void PackedMesh::tellGL()
+{
+    for (size_t s=0; s<shapes.size(); s++) {
+        PackedShape &shape = shapes[s];
+        if (shape.index_count == 0) {
+            continue;
+        }
+        if (!shape.vertex_buffer) {
+            glGenBuffers(1, &shape.vertex_buffer);
+            glGenBuffers(1, &shape.index_buffer);
+            glGenBuffers(1, &shape.outline_buffer);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, shape.vertex_buffer);
+        glBufferData(GL_ARRAY_BUFFER, shape.vertices.size(), &shape.vertices[0], GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, shape.index_buffer);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, shape.indices.size(), &shape.indices[0], GL_STATIC_DRAW);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+void PackedMesh::release()
+{
+    for (size_t s=0; s<shapes.size(); s++) {
+        PackedShape &shape = shapes[s];
+        if (shape.vertex_buffer) {
+            glDeleteBuffers(1, &shape.vertex_buffer);
+            glDeleteBuffers(1, &shape.index_buffer);
+            glDeleteBuffers(1, &shape.outline_buffer);
+            shape.vertex_buffer = 0;
+            shape.index_buffer = 0;
+            shape.outline_buffer = 0;
+        }
+    }
+}
+
+void PackedMesh::bindShape(const PackedShape &shape, GLint scale_location, GLint bias_location) const
+{
+    GLenum texcoord_type = half_texcoords ? GL_HALF_FLOAT_ARB : GL_FLOAT;
+    float3 extent = shape.bounds_max - shape.bounds_min;
+    glUniform3f(scale_location, extent.x, extent.y, extent.z);
+    glUniform3f(bias_location, shape.bounds_min.x, shape.bounds_min.y, shape.bounds_min.z);
+
+    glBindBuffer(GL_ARRAY_BUFFER, shape.vertex_buffer);
+    glVertexAttribPointer(PACKED_POSITION, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride,
+                          (const GLvoid *)position_offset);
+    glVertexAttribPointer(PACKED_NORMAL, 2, GL_SHORT, GL_TRUE, stride,
+                          (const GLvoid *)normal_offset);
+    glVertexAttribPointer(PACKED_TEXCOORD, 2, texcoord_type, GL_FALSE, stride,
+                          (const GLvoid *)texcoord_offset);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, shape.index_buffer);
+}
+
+void PackedMesh::draw(GLuint program) const
+{
+    GLint scale_location = glGetUniformLocation(program, "positionScale");
+    GLint bias_location = glGetUniformLocation(program, "positionBias");
+
+    glEnableVertexAttribArray(PACKED_POSITION);
+    glEnableVertexAttribArray(PACKED_NORMAL);
+    glEnableVertexAttribArray(PACKED_TEXCOORD);
+    for (size_t s=0; s<shapes.size(); s++) {
+        const PackedShape &shape = shapes[s];
+        if (!shape.vertex_buffer) {
+            continue;
+        }
+        bindShape(shape, scale_location, bias_location);
+        if (shape.culled) {
+            if (!shape.draw_counts.empty()) {
+                glMultiDrawElements(GL_TRIANGLES, &shape.draw_counts[0], shape.index_type,
+                                    const_cast<const GLvoid **>(&shape.draw_offsets[0]),
+                                    GLsizei(shape.draw_counts.size()));
+            }
+        } else {
+            const PackedLod &lod = shape.lods[shape.lod];
+            size_t index_size = shape.index_type == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+            glDrawElements(GL_TRIANGLES, lod.count, shape.index_type,
+                           (const GLvoid *)(lod.first * index_size));
+        }
+    }
+    glDisableVertexAttribArray(PACKED_POSITION);
+    glDisableVertexAttribArray(PACKED_NORMAL);
+    glDisableVertexAttribArray(PACKED_TEXCOORD);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+void PackedMesh::drawnIndices(size_t s, std::vector<unsigned int> &out) const
+{
+    const PackedShape &shape = shapes[s];
+    if (shape.culled) {
+        size_t index_size = shape.index_type == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+        for (size_t r=0; r<shape.draw_counts.size(); r++) {
+            GLsizei first = GLsizei(size_t(shape.draw_offsets[r]) / index_size);
+            for (GLsizei i=0; i<shape.draw_counts[r]; i++) {
+                out.push_back(indexAt(shape, first + i));
+            }
+        }
+    } else {
+        const PackedLod &lod = shape.lods[shape.lod];
+        for (GLsizei i=0; i<lod.count; i++) {
+            out.push_back(indexAt(shape, lod.first + i));
+        }
+    }
+}
+
+void PackedMesh::drawInstanced(GLuint program, size_t level, GLsizei instance_count) const
+{
+    GLint scale_location = glGetUniformLocation(program, "positionScale");
+    GLint bias_location = glGetUniformLocation(program, "positionBias");
+
+    glEnableVertexAttribArray(PACKED_POSITION);
+    glEnableVertexAttribArray(PACKED_NORMAL);
+    glEnableVertexAttribArray(PACKED_TEXCOORD);
+    for (size_t s=0; s<shapes.size(); s++) {
+        const PackedShape &shape = shapes[s];
+        if (!shape.vertex_buffer) {
+            continue;
+        }
+        bindShape(shape, scale_location, bias_location);
+        const PackedLod &lod = shape.lods[level < shape.lods.size() ? level : shape.lods.size() - 1];
+        size_t index_size = shape.index_type == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+        const GLvoid *offset = (const GLvoid *)(lod.first * index_size);
+        // One instance needs no instancing support, so the fallback path
+        // that sets instance attributes as constants can use this too.
+        if (instance_count == 1) {
+            glDrawElements(GL_TRIANGLES, lod.count, shape.index_type, offset);
+        } else {
+            glDrawElementsInstancedARB(GL_TRIANGLES, lod.count, shape.index_type, offset, instance_count);
+        }
+    }
+    glDisableVertexAttribArray(PACKED_POSITION);
+    glDisableVertexAttribArray(PACKED_NORMAL);
+    glDisableVertexAttribArray(PACKED_TEXCOORD);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+void PackedMesh::drawOutlines(GLuint program) const
+{
+    GLint scale_location = glGetUniformLocation(program, "positionScale");
+    GLint bias_location = glGetUniformLocation(program, "positionBias");
+
+    glEnableVertexAttribArray(PACKED_POSITION);
+    for (size_t s=0; s<shapes.size(); s++) {
+        const PackedShape &shape = shapes[s];
+        if (!shape.outline_buffer || shape.outline.empty()) {
+            continue;
+        }
+        bindShape(shape, scale_location, bias_location);
+        // The lines change every frame; orphan last frame's storage.
+        size_t bytes = shape.outline.size() * sizeof(unsigned int);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, shape.outline_buffer);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, bytes, &shape.outline[0]);
+        glDrawElements(GL_LINES, GLsizei(shape.outline.size()), GL_UNSIGNED_INT, 0);
+    }
+    glDisableVertexAttribArray(PACKED_POSITION);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+bool PackedMesh::writeCache(const char *cache_filename, const char *source_filename,
+                            const std::vector<tinyobj::shape_t> &source) const
+{
+    assert(source.size() == shapes.size());
+    CacheHeader header;
+    header.half_texcoords = half_texcoords;
+    header.optimized = optimized;
+    header.num_shapes = int(shapes.size());
+    if (!makeCacheStamp(header.stamp, cache_magic, cache_version, source_filename)) {
+        return false;
+    }
+
+    FILE *file = fopen(cache_filename, "wb");
+    if (!file) {
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (size_t s=0; ok && s<shapes.size(); s++) {
+        const PackedShape &shape = shapes[s];
+        float bounds[6] = { shape.bounds_min.x, shape.bounds_min.y, shape.bounds_min.z,
+                            shape.bounds_max.x, shape.bounds_max.y, shape.bounds_max.z };
+        int counts[4] = { shape.vertex_count, shape.index_count, int(shape.index_type),
+                          int(shape.lods.size()) };
+        ok = writeString(file, source[s].name) &&
+             writeMaterial(file, source[s].material) &&
+             fwrite(bounds, sizeof(bounds), 1, file) == 1 &&
+             fwrite(counts, sizeof(counts), 1, file) == 1 &&
+             (shape.lods.empty() || fwrite(&shape.lods[0], sizeof(PackedLod), shape.lods.size(), file) == shape.lods.size()) &&
+             (shape.vertices.empty() || fwrite(&shape.vertices[0], shape.vertices.size(), 1, file) == 1) &&
+             (shape.indices.empty() || fwrite(&shape.indices[0], shape.indices.size(), 1, file) == 1);
+    }
+    fclose(file);
+    if (!ok) {
+        remove(cache_filename);
+    }
+    return ok;
+}
+
+bool PackedMesh::readCache(const char *cache_filename, const char *source_filename,
+                           bool half_texcoords_, bool optimized_,
+                           std::vector<tinyobj::shape_t> &source)
+{
+    FILE *file = fopen(cache_filename, "rb");
+    if (!file) {
+        return false;
+    }
+
+    CacheHeader header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+              cacheStampMatches(header.stamp, cache_magic, cache_version, source_filename) &&
+              header.half_texcoords == int(half_texcoords_) &&
+              header.optimized == int(optimized_) &&
+              header.num_shapes >= 0 && header.num_shapes <= 65536;
+    GLsizei loaded_stride = GLsizei(texcoord_offset +
+        (half_texcoords_ ? 2*sizeof(unsigned short) : 2*sizeof(float)));
+    std::vector<PackedShape> loaded(ok ? header.num_shapes : 0);
+    std::vector<tinyobj::shape_t> names(loaded.size());
+    for (size_t s=0; ok && s<loaded.size(); s++) {
+        PackedShape &shape = loaded[s];
+        float bounds[6];
+        int counts[4];
+        ok = readString(file, names[s].name) &&
+             readMaterial(file, names[s].material) &&
+             fread(bounds, sizeof(bounds), 1, file) == 1 &&
+             fread(counts, sizeof(counts), 1, file) == 1 &&
+             counts[0] >= 0 && counts[1] >= 0 && counts[1] % 3 == 0 &&
+             (counts[2] == GL_UNSIGNED_SHORT || counts[2] == GL_UNSIGNED_INT) &&
+             counts[3] >= 1 && counts[3] <= 64;
+        if (ok) {
+            shape.lods.resize(counts[3]);
+            shape.lod = 0;
+            ok = fread(&shape.lods[0], sizeof(PackedLod), shape.lods.size(), file) == shape.lods.size();
+        }
+        if (ok) {
+            shape.bounds_min = float3(bounds[0], bounds[1], bounds[2]);
+            shape.bounds_max = float3(bounds[3], bounds[4], bounds[5]);
+            shape.vertex_count = counts[0];
+            shape.index_count = counts[1];
+            shape.index_type = GLenum(counts[2]);
+            shape.vertex_buffer = 0;
+            shape.index_buffer = 0;
+            shape.outline_buffer = 0;
+            shape.vertices.resize(size_t(counts[0]) * loaded_stride);
+            shape.indices.resize(size_t(counts[1]) *
+                (shape.index_type == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int)));
+            ok = (shape.vertices.empty() || fread(&shape.vertices[0], shape.vertices.size(), 1, file) == 1) &&
+                 (shape.indices.empty() || fread(&shape.indices[0], shape.indices.size(), 1, file) == 1) &&
+                 indicesInRange(shape);
+        }
+    }
+    fclose(file);
+    if (ok) {
+        release();
+        half_texcoords = half_texcoords_;
+        optimized = optimized_;
+        stride = loaded_stride;
+        shapes.swap(loaded);
+        source.swap(names);
+        unpack(source);
+        buildMeshlets();
+    }
+    return ok;
+}
+
+void bindPackedAttributes(GLuint program)
+{
+    glBindAttribLocation(program, PACKED_POSITION, "packedPosition");
+    glBindAttribLocation(program, PACKED_NORMAL, "packedNormal");
+    glBindAttribLocation(program, PACKED_TEXCOORD, "packedTexCoord");
+    glBindAttribLocation(program, INSTANCE_ROW0, "instanceRow0");
+    glBindAttribLocation(program, INSTANCE_ROW1, "instanceRow1");
+    glBindAttribLocation(program, INSTANCE_ROW2, "instanceRow2");
+    glBindAttribLocation(program, INSTANCE_COLOR, "instanceColor");
+    glLinkProgram(program);
+}
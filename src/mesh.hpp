@@ -0,0 +1,170 @@
+// mesh.hpp - compact vertex format for uploaded model meshes
+
+#ifndef __mesh_hpp__
+#define __mesh_hpp__
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+# pragma once
+#endif
+
+#include <GL/glew.h>
+
+#include <vector>
+
+#include <Cg/vector.hpp>
+#include <Cg/matrix.hpp>
+
+#include "tiny_obj_loader.hpp"
+#include "simplify.hpp"
+#include "meshlet.hpp"
+#include "silhouette.hpp"
+#include "occlusion.hpp"
+
+// Generic attribute locations of the packed vertex, and of the
+// per-instance attributes drawInstanced reads with a divisor of one.
+// Programs that draw a PackedMesh are relinked with these bindings by
+// bindPackedAttributes.
+enum PackedAttribute {
+    PACKED_POSITION = 0,  // 3 x unorm16, fraction of the shape's bounding box
+    PACKED_NORMAL = 1,    // 2 x snorm16, octahedral
+    PACKED_TEXCOORD = 2,  // 2 x half, or 2 x float without ARB_half_float_vertex
+    INSTANCE_ROW0 = 3,    // 4 x float, rows of the 3x4 object_from_instance matrix
+    INSTANCE_ROW1 = 4,
+    INSTANCE_ROW2 = 5,
+    INSTANCE_COLOR = 6    // 4 x float
+};
+
+// A range of a shape's index buffer holding one level of detail.
+struct PackedLod {
+    GLsizei first;  // in indices, not bytes
+    GLsizei count;
+    float error;    // object-space error of the level, 0 for the full mesh
+};
+
+struct PackedShape {
+    Cg::float3 bounds_min, bounds_max;
+    GLsizei vertex_count;
+    GLsizei index_count;            // every level together
+    GLenum index_type;              // GL_UNSIGNED_SHORT when every index fits
+    std::vector<GLubyte> vertices;  // vertex_count * stride bytes
+    std::vector<GLubyte> indices;
+    std::vector<PackedLod> lods;    // finest first; lods[0] is the full mesh
+    int lod;                        // level draw uses
+    float radius;                   // of a sphere about the bounding box's center
+    std::vector<Meshlets> meshlets; // per level, covering its index range
+    std::vector<EdgeMesh> edges;    // per level, for outlines
+    bool closed;                    // every edge has two triangles, so back faces are hidden
+    bool occluded;                  // by the last occlusion test
+    int occlusion_skip;             // frames left before the next occlusion test
+    GLuint vertex_buffer, index_buffer;
+
+    // Index ranges that survived cull, merged where they touch; used by
+    // draw instead of the whole level while culled is set.
+    bool culled;
+    std::vector<GLsizei> draw_counts;
+    std::vector<const GLvoid *> draw_offsets;
+
+    // Line indices from extractOutlines, uploaded by drawOutlines.
+    std::vector<unsigned int> outline;
+    std::vector<unsigned char> outline_selected;  // scratch, one per edge
+    GLuint outline_buffer;
+};
+
+// One vertex and one index buffer per shape.  A vertex is 16 bytes with
+// half-float texcoords (20 with float texcoords) against 32 bytes for the
+// float positions, normals and texcoords tinyobj loads.  Every level of
+// detail of a shape indexes the same vertices, so the levels sit back to
+// back in the one index buffer.
+struct PackedMesh {
+    bool half_texcoords;
+    bool optimized;  // indices went through optimizeMesh before build
+    GLsizei stride;
+    std::vector<PackedShape> shapes;
+    BoundingVolumes volumes;  // one per shape
+
+    PackedMesh();
+    ~PackedMesh();
+
+    // lods[s] holds the levels of shape s as buildLodChain makes them;
+    // shapes without any are drawn from their own indices alone.
+    void build(const std::vector<tinyobj::shape_t> &source,
+               const std::vector< std::vector<MeshLod> > &lods, bool half_texcoords);
+
+    // Dequantizes back into the positions, normals, texcoords and indices of
+    // source, for meshes read from the cache without parsing the OBJ.
+    void unpack(std::vector<tinyobj::shape_t> &source) const;
+
+    // Prints memory use and the worst quantization error against source.
+    void report(const char *name, const std::vector<tinyobj::shape_t> &source) const;
+
+    // Picks for each shape the coarsest level whose error, projected from
+    // the nearest point of the shape's bounding sphere to eye_object, stays
+    // within pixel_error pixels.  pixel_scale is pixels per unit at unit
+    // distance; a pixel_error of zero always picks the full mesh.
+    void selectLods(const Cg::float3 &eye_object, float pixel_scale, float pixel_error);
+
+    // Rasterizes the full mesh of the shapes inside the frustum that
+    // were not occluded last frame, largest on screen first, until
+    // triangle_budget triangles are in.
+    void rasterizeOccluders(const Cg::float4x4 &clip_from_object, const Cg::float3 &eye_object,
+                            OcclusionBuffer &occlusion, size_t triangle_budget) const;
+
+    // Culls whole shapes by their bounding volumes against the frustum of
+    // clip_from_object, then when cull_meshlets the meshlets of each
+    // remaining shape's selected level against the frustum and, for closed
+    // shapes when cull_backfacing, by their normal cones.  With occlusion,
+    // shapes and meshlets behind its occluders go too.  draw then issues
+    // the survivors with one glMultiDrawElements per shape until uncull.
+    // Counts go into stats.
+    void cull(const Cg::float4x4 &clip_from_object, const Cg::float3 &eye_object,
+              bool cull_meshlets, bool cull_backfacing, const OcclusionBuffer *occlusion,
+              CullStats &stats);
+    void uncull();
+
+    // Picks the silhouette and feature edges of each shape's selected
+    // level seen from eye_object, skipping shapes cull left nothing of.
+    // The edge tests are spread over the worker threads; only the picked
+    // edges reach drawOutlines.  Returns how many lines were picked.
+    size_t extractOutlines(const Cg::float3 &eye_object);
+
+    void tellGL();
+    void release();
+
+    // Draws every shape with program, which must be in use and linked
+    // after bindPackedAttributes.
+    void draw(GLuint program) const;
+    // Draws every shape's level (or its coarsest, if it has fewer) for
+    // instance_count instances with glDrawElementsInstancedARB, leaving the
+    // instance attributes to the caller.
+    void drawInstanced(GLuint program, size_t level, GLsizei instance_count) const;
+    // Draws the lines of the last extractOutlines as GL_LINES.
+    void drawOutlines(GLuint program) const;
+    // Appends the indices draw issues for shape s, in its order: what
+    // cull left of the selected level, or all of that level.
+    void drawnIndices(size_t s, std::vector<unsigned int> &out) const;
+
+    // Binary cache keyed on the OBJ file's size and modification time and
+    // on the texcoord format and index optimization it was built with.
+    // Shape names and their whole materials are kept alongside the buffers.
+    bool writeCache(const char *cache_filename, const char *source_filename,
+                    const std::vector<tinyobj::shape_t> &source) const;
+    bool readCache(const char *cache_filename, const char *source_filename,
+                   bool half_texcoords, bool optimized, std::vector<tinyobj::shape_t> &source);
+
+private:
+    void bindShape(const PackedShape &shape, GLint scale_location, GLint bias_location) const;
+
+    // Regroups each level's triangles into meshlets, finds each level's
+    // edges, bounds each shape and works out which shapes are closed, from
+    // the quantized positions that are drawn.
+    void buildMeshlets();
+};
+
+// Binds the packed vertex attributes to their locations and relinks program.
+extern void bindPackedAttributes(GLuint program);
+
+extern bool mesh_cache;
+extern float lod_pixel_error;
+extern bool meshlet_culling;
+
+#endif // __mesh_hpp__
@@ -0,0 +1,488 @@
+// mesh_optimize.cpp - load-time index and vertex reordering for the GPU
+//
+// tinyobj emits triangles in file order (fanned per face), which on
+// scanned models jumps all over the surface and defeats the post-transform
+// vertex cache.  Triangles are reordered for cache reuse first, then
+// clustered and sorted to cut overdraw without giving much of that reuse
+// back, and finally vertices are renumbered in first-use order.
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "mesh_optimize.hpp"
+
+bool mesh_optimize = true;
+
+namespace {
+
+// Forsyth's scoring parameters, from "Linear-Speed Vertex Cache
+// Optimisation" (2006).
+const int lru_cache_size = 32;
+const float cache_decay_power = 1.5f;
+const float last_triangle_score = 0.75f;
+const float valence_boost_scale = 2.0f;
+const float valence_boost_power = 0.5f;
+const int max_valence = 64;
+
+struct ScoreTables {
+    float cache[lru_cache_size];
+    float valence[max_valence];
+
+    ScoreTables() {
+        for (int i=0; i<lru_cache_size; i++) {
+            if (i < 3) {
+                // The last triangle's vertices are penalized slightly so the
+                // next triangle isn't chosen just for sharing an edge.
+                cache[i] = last_triangle_score;
+            } else {
+                cache[i] = powf(1.0f - float(i-3) / (lru_cache_size-3), cache_decay_power);
+            }
+        }
+        valence[0] = 0;
+        for (int i=1; i<max_valence; i++) {
+            valence[i] = valence_boost_scale * powf(float(i), -valence_boost_power);
+        }
+    }
+};
+
+const ScoreTables &scoreTables()
+{
+    static ScoreTables tables;
+    return tables;
+}
+
+// Vertices with few triangles left are boosted so they get finished off
+// rather than left as isolated triangles for later.
+inline float vertexScore(const ScoreTables &tables, int cache_position, unsigned int remaining)
+{
+    if (remaining == 0) {
+        return -1.0f;
+    }
+    float score = cache_position >= 0 ? tables.cache[cache_position] : 0.0f;
+    if (remaining < unsigned(max_valence)) {
+        score += tables.valence[remaining];
+    } else {
+        score += valence_boost_scale * powf(float(remaining), -valence_boost_power);
+    }
+    return score;
+}
+
+// FIFO cache simulation by timestamps: a vertex is resident while fewer
+// than cache_size misses have happened since it was last loaded.
+struct FifoCache {
+    std::vector<unsigned int> timestamps;
+    unsigned int time;
+    unsigned int size;
+
+    FifoCache(size_t vertex_count, int cache_size)
+        : timestamps(vertex_count, 0)
+        , time(unsigned(cache_size) + 1)
+        , size(unsigned(cache_size))
+    {
+    }
+
+    // Returns 1 for a miss.
+    unsigned int access(unsigned int v) {
+        if (time - timestamps[v] > size) {
+            timestamps[v] = time++;
+            return 1;
+        }
+        return 0;
+    }
+
+    void flush() {
+        time += size + 1;
+    }
+};
+
+struct VertexLess {
+    const tinyobj::mesh_t *mesh;
+    bool has_normals, has_texcoords;
+
+    bool operator()(unsigned int a, unsigned int b) const {
+        int c = memcmp(&mesh->positions[3*a], &mesh->positions[3*b], 3*sizeof(float));
+        if (c == 0 && has_normals) {
+            c = memcmp(&mesh->normals[3*a], &mesh->normals[3*b], 3*sizeof(float));
+        }
+        if (c == 0 && has_texcoords) {
+            c = memcmp(&mesh->texcoords[2*a], &mesh->texcoords[2*b], 2*sizeof(float));
+        }
+        return c < 0;
+    }
+};
+
+struct Cluster {
+    size_t first, count;  // triangles
+    float sort_key;
+};
+
+bool drawnEarlier(const Cluster &a, const Cluster &b)
+{
+    return a.sort_key > b.sort_key;
+}
+
+} // namespace
+
+VertexCacheStats::VertexCacheStats()
+    : triangles(0)
+    , vertices(0)
+    , transformed(0)
+{
+}
+
+void VertexCacheStats::add(const VertexCacheStats &other)
+{
+    triangles += other.triangles;
+    vertices += other.vertices;
+    transformed += other.transformed;
+}
+
+float VertexCacheStats::acmr() const
+{
+    return triangles ? float(transformed) / triangles : 0.0f;
+}
+
+float VertexCacheStats::atvr() const
+{
+    return vertices ? float(transformed) / vertices : 0.0f;
+}
+
+void weldVertices(tinyobj::mesh_t &mesh)
+{
+    size_t vertex_count = mesh.positions.size() / 3;
+    VertexLess less = { &mesh, mesh.normals.size() == 3*vertex_count,
+                        mesh.texcoords.size() == 2*vertex_count };
+    std::vector<unsigned int> order(vertex_count), remap(vertex_count);
+    for (size_t v=0; v<vertex_count; v++) {
+        order[v] = unsigned(v);
+    }
+    std::sort(order.begin(), order.end(), less);
+    for (size_t i=0; i<vertex_count; i++) {
+        remap[order[i]] = i > 0 && !less(order[i-1], order[i]) ? remap[order[i-1]] : order[i];
+    }
+    for (size_t i=0; i<mesh.indices.size(); i++) {
+        mesh.indices[i] = remap[mesh.indices[i]];
+    }
+    // The copies are now unreferenced and dropped by optimizeVertexFetch.
+}
+
+float triangleNormal(const float *a, const float *b, const float *c, float n[3])
+{
+    float e1[3] = { b[0]-a[0], b[1]-a[1], b[2]-a[2] };
+    float e2[3] = { c[0]-a[0], c[1]-a[1], c[2]-a[2] };
+    n[0] = e1[1]*e2[2] - e1[2]*e2[1];
+    n[1] = e1[2]*e2[0] - e1[0]*e2[2];
+    n[2] = e1[0]*e2[1] - e1[1]*e2[0];
+    float len = sqrtf(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+    float s = len > 0 ? 1 / len : 0;
+    n[0] *= s;
+    n[1] *= s;
+    n[2] *= s;
+    return len;
+}
+
+VertexCacheStats analyzeVertexCache(const std::vector<unsigned int> &indices,
+                                    size_t vertex_count, int cache_size)
+{
+    VertexCacheStats stats;
+    stats.triangles = indices.size() / 3;
+    stats.vertices = vertex_count;
+    FifoCache cache(vertex_count, cache_size);
+    for (size_t i=0; i<indices.size(); i++) {
+        stats.transformed += cache.access(indices[i]);
+    }
+    return stats;
+}
+
+void optimizeVertexCache(std::vector<unsigned int> &indices, size_t vertex_count)
+{
+    const ScoreTables &tables = scoreTables();
+    size_t triangle_count = indices.size() / 3;
+    if (triangle_count < 2) {
+        return;
+    }
+
+    // Triangles around each vertex; remaining[v] of them are not yet emitted
+    // and are kept at the front of the vertex's adjacency range.
+    std::vector<unsigned int> remaining(vertex_count, 0);
+    for (size_t i=0; i<indices.size(); i++) {
+        remaining[indices[i]]++;
+    }
+    std::vector<unsigned int> offsets(vertex_count + 1, 0);
+    for (size_t v=0; v<vertex_count; v++) {
+        offsets[v+1] = offsets[v] + remaining[v];
+    }
+    std::vector<unsigned int> adjacency(indices.size());
+    {
+        std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+        for (size_t i=0; i<indices.size(); i++) {
+            adjacency[fill[indices[i]]++] = unsigned(i / 3);
+        }
+    }
+
+    std::vector<int> cache_position(vertex_count, -1);
+    std::vector<float> vertex_score(vertex_count);
+    for (size_t v=0; v<vertex_count; v++) {
+        vertex_score[v] = vertexScore(tables, -1, remaining[v]);
+    }
+    std::vector<float> triangle_score(triangle_count);
+    std::vector<char> emitted(triangle_count, 0);
+    long best = -1;
+    float best_score = -1.0f;
+    for (size_t t=0; t<triangle_count; t++) {
+        const unsigned int *tri = &indices[3*t];
+        triangle_score[t] = vertex_score[tri[0]] + vertex_score[tri[1]] + vertex_score[tri[2]];
+        if (triangle_score[t] > best_score) {
+            best_score = triangle_score[t];
+            best = long(t);
+        }
+    }
+
+    std::vector<unsigned int> output;
+    output.reserve(indices.size());
+    unsigned int cache[lru_cache_size + 3];
+    int cache_count = 0;
+    size_t cursor = 0;
+
+    while (output.size() < 3*triangle_count) {
+        if (best < 0) {
+            // Dead end: nothing in the cache has triangles left, so carry on
+            // from the earliest triangle not yet emitted.
+            while (emitted[cursor]) {
+                cursor++;
+            }
+            best = long(cursor);
+        }
+        const unsigned int *tri = &indices[3*best];
+        emitted[best] = 1;
+        output.push_back(tri[0]);
+        output.push_back(tri[1]);
+        output.push_back(tri[2]);
+
+        unsigned int next_cache[lru_cache_size + 3];
+        int next_count = 0;
+        for (int k=0; k<3; k++) {
+            unsigned int v = tri[k];
+            if (next_count == 0 || (next_cache[0] != v && (next_count < 2 || next_cache[1] != v))) {
+                next_cache[next_count++] = v;
+            }
+            unsigned int *begin = &adjacency[offsets[v]];
+            unsigned int *end = begin + remaining[v];
+            unsigned int *found = std::find(begin, end, unsigned(best));
+            assert(found != end);
+            *found = *(end - 1);
+            remaining[v]--;
+        }
+        for (int i=0; i<cache_count; i++) {
+            unsigned int v = cache[i];
+            if (v != tri[0] && v != tri[1] && v != tri[2]) {
+                next_cache[next_count++] = v;
+            }
+        }
+
+        for (int i=0; i<next_count; i++) {
+            unsigned int v = next_cache[i];
+            cache_position[v] = i < lru_cache_size ? i : -1;
+            vertex_score[v] = vertexScore(tables, cache_position[v], remaining[v]);
+        }
+
+        // Only triangles touching the cache can have changed score.
+        best = -1;
+        best_score = -1.0f;
+        for (int i=0; i<next_count; i++) {
+            unsigned int v = next_cache[i];
+            for (unsigned int j=offsets[v], end=offsets[v]+remaining[v]; j<end; j++) {
+                unsigned int t = adjacency[j];
+                const unsigned int *a = &indices[3*t];
+                float score = vertex_score[a[0]] + vertex_score[a[1]] + vertex_score[a[2]];
+                triangle_score[t] = score;
+                if (score > best_score) {
+                    best_score = score;
+                    best = long(t);
+                }
+            }
+        }
+
+        cache_count = next_count < lru_cache_size ? next_count : lru_cache_size;
+        std::copy(next_cache, next_cache + cache_count, cache);
+    }
+    indices.swap(output);
+}
+
+void optimizeOverdraw(std::vector<unsigned int> &indices, const std::vector<float> &positions,
+                      float threshold)
+{
+    const int cache_size = 16;
+    size_t triangle_count = indices.size() / 3;
+    size_t vertex_count = positions.size() / 3;
+    if (triangle_count < 2) {
+        return;
+    }
+
+    // Hard boundaries are where the cache-ordered sequence already starts
+    // over with three misses; reordering there costs nothing.
+    std::vector<char> hard(triangle_count, 0);
+    size_t total_misses = 0;
+    {
+        FifoCache cache(vertex_count, cache_size);
+        for (size_t t=0; t<triangle_count; t++) {
+            unsigned int misses = cache.access(indices[3*t+0]) + cache.access(indices[3*t+1]) +
+                                  cache.access(indices[3*t+2]);
+            hard[t] = misses == 3;
+            total_misses += misses;
+        }
+    }
+    float acmr_limit = threshold * float(total_misses) / triangle_count;
+
+    // Soft boundaries split a run once it reaches an ACMR close to the
+    // whole mesh's on its own, starting from a cold cache.
+    std::vector<Cluster> clusters;
+    {
+        FifoCache cache(vertex_count, cache_size);
+        Cluster cluster = { 0, 0, 0.0f };
+        size_t misses = 0;
+        for (size_t t=0; t<triangle_count; t++) {
+            if (cluster.count > 0 && hard[t]) {
+                clusters.push_back(cluster);
+                cluster.first = t;
+                cluster.count = 0;
+                misses = 0;
+                cache.flush();
+            }
+            misses += cache.access(indices[3*t+0]) + cache.access(indices[3*t+1]) +
+                      cache.access(indices[3*t+2]);
+            cluster.count++;
+            if (float(misses) <= acmr_limit * cluster.count && t+1 < triangle_count) {
+                clusters.push_back(cluster);
+                cluster.first = t+1;
+                cluster.count = 0;
+                misses = 0;
+                cache.flush();
+            }
+        }
+        if (cluster.count > 0) {
+            clusters.push_back(cluster);
+        }
+    }
+    if (clusters.size() < 2) {
+        return;
+    }
+
+    // Area-weighted centroid and normal of each cluster and of the mesh.
+    std::vector<float> centroid(3*clusters.size()), normal(3*clusters.size());
+    double mesh_centroid[3] = { 0, 0, 0 };
+    double mesh_area = 0;
+    for (size_t c=0; c<clusters.size(); c++) {
+        float *cc = &centroid[3*c], *cn = &normal[3*c];
+        cc[0] = cc[1] = cc[2] = 0;
+        cn[0] = cn[1] = cn[2] = 0;
+        float area_sum = 0;
+        for (size_t t=clusters[c].first; t<clusters[c].first+clusters[c].count; t++) {
+            const float *p0 = &positions[3*indices[3*t+0]];
+            const float *p1 = &positions[3*indices[3*t+1]];
+            const float *p2 = &positions[3*indices[3*t+2]];
+            float e1[3] = { p1[0]-p0[0], p1[1]-p0[1], p1[2]-p0[2] };
+            float e2[3] = { p2[0]-p0[0], p2[1]-p0[1], p2[2]-p0[2] };
+            float n[3] = { e1[1]*e2[2] - e1[2]*e2[1],
+                           e1[2]*e2[0] - e1[0]*e2[2],
+                           e1[0]*e2[1] - e1[1]*e2[0] };
+            float area = sqrtf(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+            for (int k=0; k<3; k++) {
+                cc[k] += area * (p0[k] + p1[k] + p2[k]) / 3;
+                cn[k] += n[k];
+            }
+            area_sum += area;
+        }
+        for (int k=0; k<3; k++) {
+            mesh_centroid[k] += cc[k];
+        }
+        mesh_area += area_sum;
+        if (area_sum > 0) {
+            cc[0] /= area_sum;
+            cc[1] /= area_sum;
+            cc[2] /= area_sum;
+        }
+    }
+    if (mesh_area > 0) {
+        for (int k=0; k<3; k++) {
+            mesh_centroid[k] /= mesh_area;
+        }
+    }
+
+    // Clusters facing away from the centroid are likely in front of the
+    // ones facing toward it, whatever the view direction.
+    for (size_t c=0; c<clusters.size(); c++) {
+        const float *cc = &centroid[3*c], *cn = &normal[3*c];
+        float length = sqrtf(cn[0]*cn[0] + cn[1]*cn[1] + cn[2]*cn[2]);
+        float key = 0;
+        if (length > 0) {
+            for (int k=0; k<3; k++) {
+                key += float(cc[k] - mesh_centroid[k]) * cn[k] / length;
+            }
+        }
+        clusters[c].sort_key = key;
+    }
+    std::stable_sort(clusters.begin(), clusters.end(), drawnEarlier);
+
+    std::vector<unsigned int> output;
+    output.reserve(indices.size());
+    for (size_t c=0; c<clusters.size(); c++) {
+        output.insert(output.end(), indices.begin() + 3*clusters[c].first,
+                      indices.begin() + 3*(clusters[c].first + clusters[c].count));
+    }
+    indices.swap(output);
+}
+
+void optimizeVertexFetch(tinyobj::mesh_t &mesh)
+{
+    size_t vertex_count = mesh.positions.size() / 3;
+    const unsigned int unused = ~0u;
+    std::vector<unsigned int> remap(vertex_count, unused);
+    unsigned int next = 0;
+    for (size_t i=0; i<mesh.indices.size(); i++) {
+        unsigned int &r = remap[mesh.indices[i]];
+        if (r == unused) {
+            r = next++;
+        }
+        mesh.indices[i] = r;
+    }
+
+    bool has_normals = mesh.normals.size() == 3*vertex_count;
+    bool has_texcoords = mesh.texcoords.size() == 2*vertex_count;
+    std::vector<float> positions(3*next), normals(has_normals ? 3*next : 0),
+                       texcoords(has_texcoords ? 2*next : 0);
+    for (size_t v=0; v<vertex_count; v++) {
+        unsigned int r = remap[v];
+        if (r == unused) {
+            continue;
+        }
+        std::copy(&mesh.positions[3*v], &mesh.positions[3*v] + 3, &positions[3*r]);
+        if (has_normals) {
+            std::copy(&mesh.normals[3*v], &mesh.normals[3*v] + 3, &normals[3*r]);
+        }
+        if (has_texcoords) {
+            std::copy(&mesh.texcoords[2*v], &mesh.texcoords[2*v] + 2, &texcoords[2*r]);
+        }
+    }
+    mesh.positions.swap(positions);
+    if (has_normals) {
+        mesh.normals.swap(normals);
+    }
+    if (has_texcoords) {
+        mesh.texcoords.swap(texcoords);
+    }
+}
+
+void optimizeMesh(tinyobj::mesh_t &mesh, VertexCacheStats &before, VertexCacheStats &after)
+{
+    size_t vertex_count = mesh.positions.size() / 3;
+    before = analyzeVertexCache(mesh.indices, vertex_count);
+    weldVertices(mesh);
+    optimizeVertexCache(mesh.indices, vertex_count);
+    optimizeOverdraw(mesh.indices, mesh.positions);
+    optimizeVertexFetch(mesh);
+    after = analyzeVertexCache(mesh.indices, mesh.positions.size() / 3);
+}
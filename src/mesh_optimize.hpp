@@ -0,0 +1,66 @@
+// mesh_optimize.hpp - load-time index and vertex reordering for the GPU
+
+#ifndef __mesh_optimize_hpp__
+#define __mesh_optimize_hpp__
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+# pragma once
+#endif
+
+#include <stddef.h>
+
+#include <vector>
+
+#include "tiny_obj_loader.hpp"
+
+// Post-transform cache efficiency of an index buffer, simulated with a FIFO
+// of cache_size vertices.  ACMR is transformed vertices per triangle (0.5
+// is ideal for large regular meshes, 3 is no reuse); ATVR is transformed
+// vertices per unique vertex (1 is ideal).
+struct VertexCacheStats {
+    size_t triangles;
+    size_t vertices;
+    size_t transformed;
+
+    VertexCacheStats();
+    void add(const VertexCacheStats &other);
+    float acmr() const;
+    float atvr() const;
+};
+
+VertexCacheStats analyzeVertexCache(const std::vector<unsigned int> &indices,
+                                    size_t vertex_count, int cache_size = 16);
+
+// Unit normal of the counterclockwise triangle a, b, c, or (0,0,0) when
+// it has no area.  Returns twice its area.
+float triangleNormal(const float *a, const float *b, const float *c, float n[3]);
+
+// Merges vertices whose position, normal and texcoord are bitwise equal.
+// tinyobj keys vertices on the OBJ's v/vt/vn index triple, so files that
+// repeat vt or vn entries come out with many identical copies.
+void weldVertices(tinyobj::mesh_t &mesh);
+
+// Reorders triangles for post-transform cache reuse (Forsyth's linear-speed
+// greedy scoring with a 32-entry LRU model).
+void optimizeVertexCache(std::vector<unsigned int> &indices, size_t vertex_count);
+
+// Splits cache-ordered triangles into clusters at points where the cache
+// restarts or the local ACMR stays within threshold of the whole, then
+// draws outward-facing clusters far from the centroid first so they
+// occlude the rest (Sander, Nehab and Barczak, "Fast Triangle Reordering
+// for Vertex Locality and Reduced Overdraw").
+void optimizeOverdraw(std::vector<unsigned int> &indices, const std::vector<float> &positions,
+                      float threshold = 1.05f);
+
+// Renumbers vertices in the order the indices first reference them and
+// permutes positions, normals and texcoords to match, so vertex fetch
+// walks memory forward.  Unreferenced vertices are dropped.
+void optimizeVertexFetch(tinyobj::mesh_t &mesh);
+
+// Welds, then runs the three passes in order; before and after are the
+// FIFO cache stats.
+void optimizeMesh(tinyobj::mesh_t &mesh, VertexCacheStats &before, VertexCacheStats &after);
+
+extern bool mesh_optimize;
+
+#endif // __mesh_optimize_hpp__
@@ -0,0 +1,284 @@
+// meshlet.cpp - small triangle clusters with bounds for per-cluster culling
+//
+// Culling tests the bounding sphere against the six frustum planes and
+// the normal cone against the eye, the latter as in Arseny Kapoulkine's
+// meshoptimizer.  The four-lane kernel runs on <Cg/simd.hpp>.
+
+#include <math.h>
+
+#include <algorithm>
+
+#include <Cg/vector.hpp>
+#include <Cg/simd.hpp>
+
+#include "meshlet.hpp"
+#include "mesh_optimize.hpp"
+
+using namespace Cg;
+
+namespace {
+
+// How much a triangle's turn away from the meshlet's mean normal counts
+// against it, in new vertices per unit of (1 - cosine).
+const float cone_weight = 4.0f;
+
+// Normal spreads wider than acos(0.1) leave cones that never cull.
+const float cone_min_dot = 0.1f;
+
+void appendMeshlet(const std::vector<float> &positions, const unsigned int *indices,
+                   size_t first, size_t count, unsigned int first_index,
+                   const std::vector<unsigned int> &vertices, Meshlets &out)
+{
+    float lo[3] = { HUGE_VALF, HUGE_VALF, HUGE_VALF };
+    float hi[3] = { -HUGE_VALF, -HUGE_VALF, -HUGE_VALF };
+    for (size_t i=0; i<vertices.size(); i++) {
+        const float *p = &positions[3*vertices[i]];
+        for (int c=0; c<3; c++) {
+            lo[c] = p[c] < lo[c] ? p[c] : lo[c];
+            hi[c] = p[c] > hi[c] ? p[c] : hi[c];
+        }
+    }
+    float center[3] = { (lo[0]+hi[0])/2, (lo[1]+hi[1])/2, (lo[2]+hi[2])/2 };
+    float radius2 = 0;
+    for (size_t i=0; i<vertices.size(); i++) {
+        const float *p = &positions[3*vertices[i]];
+        float d[3] = { p[0]-center[0], p[1]-center[1], p[2]-center[2] };
+        float d2 = d[0]*d[0] + d[1]*d[1] + d[2]*d[2];
+        radius2 = d2 > radius2 ? d2 : radius2;
+    }
+
+    float axis[3] = { 0, 0, 0 };
+    std::vector<float> normals(3*count);
+    for (size_t t=0; t<count; t++) {
+        const unsigned int *tri = &indices[first + 3*t];
+        triangleNormal(&positions[3*tri[0]], &positions[3*tri[1]], &positions[3*tri[2]], &normals[3*t]);
+        for (int c=0; c<3; c++) {
+            axis[c] += normals[3*t+c];
+        }
+    }
+    float len = sqrtf(axis[0]*axis[0] + axis[1]*axis[1] + axis[2]*axis[2]);
+    float min_dot = len > 0 ? 1 : -1;
+    if (len > 0) {
+        for (int c=0; c<3; c++) {
+            axis[c] /= len;
+        }
+        for (size_t t=0; t<count; t++) {
+            const float *n = &normals[3*t];
+            if (n[0] != 0 || n[1] != 0 || n[2] != 0) {
+                float d = n[0]*axis[0] + n[1]*axis[1] + n[2]*axis[2];
+                min_dot = d < min_dot ? d : min_dot;
+            }
+        }
+    }
+
+    out.center_x.push_back(center[0]);
+    out.center_y.push_back(center[1]);
+    out.center_z.push_back(center[2]);
+    out.radius.push_back(sqrtf(radius2));
+    out.axis_x.push_back(axis[0]);
+    out.axis_y.push_back(axis[1]);
+    out.axis_z.push_back(axis[2]);
+    out.cutoff.push_back(min_dot > cone_min_dot ? sqrtf(1 - min_dot*min_dot) : 1.0f);
+    out.first.push_back(first_index + (unsigned int)first);
+    out.count.push_back((unsigned int)(3*count));
+}
+
+void cullScalar(const Meshlets &m, size_t begin, size_t end, const Frustum &frustum,
+                const float3 &eye, bool cull_backfacing, unsigned char *visible)
+{
+    for (size_t i=begin; i<end; i++) {
+        float c[3] = { m.center_x[i], m.center_y[i], m.center_z[i] };
+        float r = m.radius[i];
+        bool outside = false;
+        for (int p=0; p<6 && !outside; p++) {
+            const float4 &plane = frustum.planes[p];
+            outside = plane.x*c[0] + plane.y*c[1] + plane.z*c[2] + plane.w < -r;
+        }
+        if (!outside && cull_backfacing) {
+            float v[3] = { c[0]-eye.x, c[1]-eye.y, c[2]-eye.z };
+            float d = v[0]*m.axis_x[i] + v[1]*m.axis_y[i] + v[2]*m.axis_z[i];
+            outside = d >= m.cutoff[i] * sqrtf(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]) + r;
+        }
+        visible[i-begin] = !outside;
+    }
+}
+
+#ifdef __CG_SIMD
+
+void cull4(const Meshlets &m, size_t begin, size_t end, const Frustum &frustum,
+           const float3 &eye, bool cull_backfacing, unsigned char *visible)
+{
+    __CGsimd4f planes[6][4];
+    for (int p=0; p<6; p++) {
+        for (int c=0; c<4; c++) {
+            planes[p][c] = __CGsimd_set1(frustum.planes[p][c]);
+        }
+    }
+    const __CGsimd4f zero = __CGsimd_set1(0);
+    const __CGsimd4f ex = __CGsimd_set1(eye.x), ey = __CGsimd_set1(eye.y), ez = __CGsimd_set1(eye.z);
+    size_t i = begin;
+    for (; i+4<=end; i+=4) {
+        __CGsimd4f cx = __CGsimd_load(&m.center_x[i]);
+        __CGsimd4f cy = __CGsimd_load(&m.center_y[i]);
+        __CGsimd4f cz = __CGsimd_load(&m.center_z[i]);
+        __CGsimd4f r = __CGsimd_load(&m.radius[i]);
+        __CGsimd4f neg_r = __CGsimd_sub(zero, r);
+        int outside = 0;
+        for (int p=0; p<6; p++) {
+            __CGsimd4f d = __CGsimd_add(__CGsimd_add(__CGsimd_mul(planes[p][0], cx), __CGsimd_mul(planes[p][1], cy)),
+                                        __CGsimd_add(__CGsimd_mul(planes[p][2], cz), planes[p][3]));
+            outside |= __CGsimd_lessmask(d, neg_r);
+        }
+        if (cull_backfacing) {
+            __CGsimd4f vx = __CGsimd_sub(cx, ex), vy = __CGsimd_sub(cy, ey), vz = __CGsimd_sub(cz, ez);
+            __CGsimd4f d = __CGsimd_add(__CGsimd_add(__CGsimd_mul(vx, __CGsimd_load(&m.axis_x[i])),
+                                                     __CGsimd_mul(vy, __CGsimd_load(&m.axis_y[i]))),
+                                        __CGsimd_mul(vz, __CGsimd_load(&m.axis_z[i])));
+            __CGsimd4f len = __CGsimd_sqrt(__CGsimd_add(__CGsimd_add(__CGsimd_mul(vx, vx), __CGsimd_mul(vy, vy)),
+                                                        __CGsimd_mul(vz, vz)));
+            __CGsimd4f limit = __CGsimd_add(__CGsimd_mul(__CGsimd_load(&m.cutoff[i]), len), r);
+            // d >= limit is !(d < limit)
+            outside |= ~__CGsimd_lessmask(d, limit) & 0xf;
+        }
+        for (int k=0; k<4; k++) {
+            visible[i-begin+k] = !(outside & (1 << k));
+        }
+    }
+    cullScalar(m, i, end, frustum, eye, cull_backfacing, visible + (i-begin));
+}
+
+#endif
+
+} // namespace
+
+void Meshlets::clear()
+{
+    center_x.clear();
+    center_y.clear();
+    center_z.clear();
+    radius.clear();
+    axis_x.clear();
+    axis_y.clear();
+    axis_z.clear();
+    cutoff.clear();
+    first.clear();
+    count.clear();
+}
+
+void buildMeshlets(const std::vector<float> &positions, unsigned int *indices,
+                   size_t index_count, unsigned int first_index, Meshlets &out,
+                   size_t max_vertices, size_t max_triangles)
+{
+    size_t vertex_count = positions.size() / 3;
+    size_t triangle_count = index_count / 3;
+
+    std::vector<float> normals(3*triangle_count);
+    for (size_t t=0; t<triangle_count; t++) {
+        const unsigned int *tri = &indices[3*t];
+        triangleNormal(&positions[3*tri[0]], &positions[3*tri[1]], &positions[3*tri[2]], &normals[3*t]);
+    }
+
+    // Triangles around each vertex
+    std::vector<unsigned int> offsets(vertex_count+1, 0);
+    for (size_t i=0; i<3*triangle_count; i++) {
+        offsets[indices[i]+1]++;
+    }
+    for (size_t v=0; v<vertex_count; v++) {
+        offsets[v+1] += offsets[v];
+    }
+    std::vector<unsigned int> adjacent(3*triangle_count), fill(offsets.begin(), offsets.end()-1);
+    for (size_t i=0; i<3*triangle_count; i++) {
+        adjacent[fill[indices[i]]++] = (unsigned int)(i/3);
+    }
+
+    std::vector<bool> used(triangle_count, false);
+    // stamp[v] == meshlet while v is in the current meshlet
+    std::vector<unsigned int> stamp(vertex_count, 0);
+    unsigned int meshlet = 0;
+    std::vector<unsigned int> clustered;
+    clustered.reserve(3*triangle_count);
+    std::vector<unsigned int> vertices, candidates;
+    size_t seed = 0;
+
+    for (;;) {
+        while (seed < triangle_count && used[seed]) {
+            seed++;
+        }
+        if (seed == triangle_count) {
+            break;
+        }
+        meshlet++;
+        vertices.clear();
+        candidates.clear();
+        float mean[3] = { 0, 0, 0 };
+        size_t start = clustered.size();
+        size_t next = seed;
+
+        for (;;) {
+            const unsigned int *tri = &indices[3*next];
+            used[next] = true;
+            clustered.insert(clustered.end(), tri, tri+3);
+            for (int k=0; k<3; k++) {
+                mean[k] += normals[3*next+k];
+                if (stamp[tri[k]] != meshlet) {
+                    stamp[tri[k]] = meshlet;
+                    vertices.push_back(tri[k]);
+                    candidates.insert(candidates.end(), &adjacent[offsets[tri[k]]], &adjacent[offsets[tri[k]+1]]);
+                }
+            }
+            if ((clustered.size() - start) / 3 == max_triangles) {
+                break;
+            }
+
+            // Fewest new vertices first, then closest to the meshlet's mean
+            // normal, so the meshlet stays compact and its cone narrow.
+            float mean_len = sqrtf(mean[0]*mean[0] + mean[1]*mean[1] + mean[2]*mean[2]);
+            float inv_len = mean_len > 0 ? 1 / mean_len : 0;
+            float best_score = HUGE_VALF;
+            size_t live = 0;
+            for (size_t c=0; c<candidates.size(); c++) {
+                unsigned int t = candidates[c];
+                if (used[t]) {
+                    continue;
+                }
+                candidates[live++] = t;
+                const unsigned int *u = &indices[3*t];
+                size_t added = 0;
+                for (int k=0; k<3; k++) {
+                    if (stamp[u[k]] != meshlet && (k == 0 || u[k] != u[0]) && (k < 2 || u[k] != u[1])) {
+                        added++;
+                    }
+                }
+                if (vertices.size() + added > max_vertices) {
+                    continue;
+                }
+                const float *n = &normals[3*t];
+                float d = (n[0]*mean[0] + n[1]*mean[1] + n[2]*mean[2]) * inv_len;
+                float score = added + cone_weight * (1 - d);
+                if (score < best_score) {
+                    best_score = score;
+                    next = t;
+                }
+            }
+            candidates.resize(live);
+            if (best_score == HUGE_VALF) {
+                break;
+            }
+        }
+        appendMeshlet(positions, &clustered[0], start, (clustered.size() - start) / 3, first_index,
+                      vertices, out);
+    }
+
+    std::copy(clustered.begin(), clustered.end(), indices);
+}
+
+void cullMeshlets(const Meshlets &meshlets, size_t begin, size_t end,
+                  const Frustum &frustum, const float3 &eye, bool cull_backfacing,
+                  unsigned char *visible)
+{
+#ifdef __CG_SIMD
+    cull4(meshlets, begin, end, frustum, eye, cull_backfacing, visible);
+#else
+    cullScalar(meshlets, begin, end, frustum, eye, cull_backfacing, visible);
+#endif
+}
@@ -0,0 +1,50 @@
+// meshlet.hpp - small triangle clusters with bounds for per-cluster culling
+
+#ifndef __meshlet_hpp__
+#define __meshlet_hpp__
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+# pragma once
+#endif
+
+#include <stddef.h>
+
+#include <vector>
+
+#include <Cg/vector.hpp>
+
+#include "frustum.hpp"
+
+// Runs of consecutive triangles in an index buffer, each with a bounding
+// sphere and a cone bounding its triangles' normals.  Kept as a structure
+// of arrays so culling reads four meshlets per load.
+struct Meshlets {
+    std::vector<float> center_x, center_y, center_z, radius;
+    // A meshlet faces away from an eye e when
+    //   dot(center - e, axis) >= cutoff * length(center - e) + radius;
+    // cutoff is 1 when the normals spread too far for that ever to hold.
+    std::vector<float> axis_x, axis_y, axis_z, cutoff;
+    std::vector<unsigned int> first, count;  // in indices
+
+    size_t size() const { return first.size(); }
+    void clear();
+};
+
+// Groups the triangles of indices[0,index_count) into meshlets of at most
+// max_vertices distinct vertices and max_triangles triangles and reorders
+// them so each meshlet's triangles are consecutive.  Meshlets grow from
+// the first triangle not yet taken across shared vertices, preferring
+// triangles that add few vertices and turn little from the meshlet's
+// normal.  first is offset by first_index.
+void buildMeshlets(const std::vector<float> &positions, unsigned int *indices,
+                   size_t index_count, unsigned int first_index, Meshlets &out,
+                   size_t max_vertices = 64, size_t max_triangles = 124);
+
+// Sets visible[i-begin] for meshlets [begin,end) to whether meshlet i is
+// at least partly inside frustum and, when cull_backfacing, not facing
+// away from eye.  frustum and eye are in the meshlets' space.
+void cullMeshlets(const Meshlets &meshlets, size_t begin, size_t end,
+                  const Frustum &frustum, const Cg::float3 &eye, bool cull_backfacing,
+                  unsigned char *visible);
+
+#endif // __meshlet_hpp__
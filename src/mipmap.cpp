@@ -0,0 +1,409 @@
+// mipmap.cpp - CPU mipmap chain construction
+//
+// Levels are filtered in 4-wide float texels (one SSE register per texel
+// when available) so color textures can be averaged in linear light and
+// normal maps renormalized, neither of which glGenerateMipmap does.  Rows
+// of each level are split across threads.
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mipmap.hpp"
+#include "cachefile.hpp"
+#include "parallel.hpp"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+# include <xmmintrin.h>
+# define MIP_USE_SSE 1
+#endif
+
+MipFilter mip_filter = MIP_FILTER_KAISER;
+bool cpu_mipmaps = false;
+bool texture_cache = false;
+
+namespace {
+
+#ifdef MIP_USE_SSE
+typedef __m128 texel4f;
+inline texel4f load4(const float *p) { return _mm_loadu_ps(p); }
+inline void store4(float *p, texel4f v) { _mm_storeu_ps(p, v); }
+inline texel4f add4(texel4f a, texel4f b) { return _mm_add_ps(a, b); }
+inline texel4f scale4(texel4f a, float s) { return _mm_mul_ps(a, _mm_set1_ps(s)); }
+inline texel4f zero4() { return _mm_setzero_ps(); }
+#else
+struct texel4f { float v[4]; };
+inline texel4f load4(const float *p) { texel4f r = {{ p[0], p[1], p[2], p[3] }}; return r; }
+inline void store4(float *p, texel4f a) { p[0] = a.v[0]; p[1] = a.v[1]; p[2] = a.v[2]; p[3] = a.v[3]; }
+inline texel4f add4(texel4f a, texel4f b)
+{
+    texel4f r = {{ a.v[0]+b.v[0], a.v[1]+b.v[1], a.v[2]+b.v[2], a.v[3]+b.v[3] }};
+    return r;
+}
+inline texel4f scale4(texel4f a, float s)
+{
+    texel4f r = {{ a.v[0]*s, a.v[1]*s, a.v[2]*s, a.v[3]*s }};
+    return r;
+}
+inline texel4f zero4() { texel4f r = {{ 0, 0, 0, 0 }}; return r; }
+#endif
+
+const int rows_per_task = 16;
+
+inline int clampIndex(int i, int n)
+{
+    return i < 0 ? 0 : (i >= n ? n-1 : i);
+}
+
+// sRGB <-> linear conversion tables
+const int linear_to_srgb_entries = 4096;
+float srgb_to_linear[256];
+GLubyte linear_to_srgb[linear_to_srgb_entries];
+
+// 6-tap 2:1 decimation kernel, taps at source offsets -2..+3 from 2*x
+float kaiser_weights[6];
+
+double besselI0(double x)
+{
+    double sum = 1, term = 1;
+    for (int k=1; k<32; k++) {
+        term *= (x/(2*k)) * (x/(2*k));
+        sum += term;
+    }
+    return sum;
+}
+
+void initTables()
+{
+    static bool initialized = false;
+    if (initialized) {
+        return;
+    }
+    for (int i=0; i<256; i++) {
+        double c = i/255.0;
+        srgb_to_linear[i] = float(c <= 0.04045 ? c/12.92 : pow((c+0.055)/1.055, 2.4));
+    }
+    for (int i=0; i<linear_to_srgb_entries; i++) {
+        double l = (i+0.5)/linear_to_srgb_entries;
+        double c = l <= 0.0031308 ? l*12.92 : 1.055*pow(l, 1/2.4) - 0.055;
+        linear_to_srgb[i] = GLubyte(c*255 + 0.5);
+    }
+
+    const double radius = 3, alpha = 4;
+    const double pi = 3.14159265358979323846;
+    double sum = 0;
+    for (int k=0; k<6; k++) {
+        double d = fabs((k-2) - 0.5);  // distance from the output texel center
+        double x = d*0.5;              // half-band cutoff
+        double sinc = sin(pi*x)/(pi*x);
+        double r = d/radius;
+        double window = besselI0(alpha*sqrt(1-r*r)) / besselI0(alpha);
+        kaiser_weights[k] = float(sinc*window);
+        sum += kaiser_weights[k];
+    }
+    for (int k=0; k<6; k++) {
+        kaiser_weights[k] = float(kaiser_weights[k]/sum);
+    }
+    initialized = true;
+}
+
+void decodeLevel(const GLubyte *src, int width, int height, int components,
+                 MipColorSpace color_space, float *dst)
+{
+    parallelFor(0, height, rows_per_task, [=](int y0, int y1) {
+        for (int y=y0; y<y1; y++) {
+            const GLubyte *s = src + size_t(y)*width*components;
+            float *d = dst + size_t(y)*width*4;
+            for (int x=0; x<width; x++, s+=components, d+=4) {
+                float a = components == 4 ? s[3]/255.0f : 1.0f;
+                switch (color_space) {
+                case MIP_SRGB:
+                    d[0] = srgb_to_linear[s[0]];
+                    d[1] = srgb_to_linear[s[1]];
+                    d[2] = srgb_to_linear[s[2]];
+                    d[3] = a;
+                    break;
+                case MIP_NORMAL:
+                    d[0] = (s[0]-128)/127.0f;
+                    d[1] = (s[1]-128)/127.0f;
+                    d[2] = (s[2]-128)/127.0f;
+                    d[3] = a;
+                    break;
+                default:
+                    d[0] = s[0]/255.0f;
+                    d[1] = s[1]/255.0f;
+                    d[2] = s[2]/255.0f;
+                    d[3] = a;
+                    break;
+                }
+            }
+        }
+    });
+}
+
+inline GLubyte toUnorm8(float v)
+{
+    v = v < 0 ? 0 : (v > 1 ? 1 : v);
+    return GLubyte(v*255 + 0.5f);
+}
+
+void encodeLevel(const float *src, int width, int height, int components,
+                 MipColorSpace color_space, GLubyte *dst)
+{
+    parallelFor(0, height, rows_per_task, [=](int y0, int y1) {
+        for (int y=y0; y<y1; y++) {
+            const float *s = src + size_t(y)*width*4;
+            GLubyte *d = dst + size_t(y)*width*components;
+            for (int x=0; x<width; x++, s+=4, d+=components) {
+                switch (color_space) {
+                case MIP_SRGB:
+                    for (int c=0; c<3; c++) {
+                        float v = s[c] < 0 ? 0 : (s[c] > 1 ? 1 : s[c]);
+                        int i = int(v*(linear_to_srgb_entries-1) + 0.5f);
+                        d[c] = linear_to_srgb[i];
+                    }
+                    break;
+                case MIP_NORMAL:
+                    for (int c=0; c<3; c++) {
+                        float v = s[c] < -1 ? -1 : (s[c] > 1 ? 1 : s[c]);
+                        d[c] = GLubyte(128.5f + 127*v);
+                    }
+                    break;
+                default:
+                    for (int c=0; c<3; c++) {
+                        d[c] = toUnorm8(s[c]);
+                    }
+                    break;
+                }
+                if (components == 4) {
+                    d[3] = toUnorm8(s[3]);
+                }
+            }
+        }
+    });
+}
+
+void renormalize(float *texels, int width, int height)
+{
+    parallelFor(0, height, rows_per_task, [=](int y0, int y1) {
+        for (int y=y0; y<y1; y++) {
+            float *t = texels + size_t(y)*width*4;
+            for (int x=0; x<width; x++, t+=4) {
+                float len2 = t[0]*t[0] + t[1]*t[1] + t[2]*t[2];
+                if (len2 > 1e-12f) {
+                    float s = 1/sqrtf(len2);
+                    t[0] *= s;
+                    t[1] *= s;
+                    t[2] *= s;
+                } else {
+                    t[0] = 0;
+                    t[1] = 0;
+                    t[2] = 1;
+                }
+            }
+        }
+    });
+}
+
+void downsampleBox(const float *src, int sw, int sh, float *dst, int dw, int dh)
+{
+    parallelFor(0, dh, rows_per_task, [=](int y0, int y1) {
+        for (int y=y0; y<y1; y++) {
+            const float *row0 = src + size_t(clampIndex(2*y, sh))*sw*4;
+            const float *row1 = src + size_t(clampIndex(2*y+1, sh))*sw*4;
+            float *d = dst + size_t(y)*dw*4;
+            for (int x=0; x<dw; x++, d+=4) {
+                int x0 = clampIndex(2*x, sw)*4, x1 = clampIndex(2*x+1, sw)*4;
+                texel4f sum = add4(add4(load4(row0+x0), load4(row0+x1)),
+                                   add4(load4(row1+x0), load4(row1+x1)));
+                store4(d, scale4(sum, 0.25f));
+            }
+        }
+    });
+}
+
+void downsampleKaiser(const float *src, int sw, int sh, float *dst, int dw, int dh)
+{
+    // Horizontal pass into a dw x sh scratch image, then vertical into dst.
+    std::vector<float> scratch(size_t(dw)*sh*4);
+    float *tmp = &scratch[0];
+
+    parallelFor(0, sh, rows_per_task, [=](int y0, int y1) {
+        for (int y=y0; y<y1; y++) {
+            const float *s = src + size_t(y)*sw*4;
+            float *d = tmp + size_t(y)*dw*4;
+            for (int x=0; x<dw; x++, d+=4) {
+                texel4f sum = zero4();
+                for (int k=0; k<6; k++) {
+                    int sx = clampIndex(2*x-2+k, sw);
+                    sum = add4(sum, scale4(load4(s + sx*4), kaiser_weights[k]));
+                }
+                store4(d, sum);
+            }
+        }
+    });
+    parallelFor(0, dh, rows_per_task, [=](int y0, int y1) {
+        for (int y=y0; y<y1; y++) {
+            const float *rows[6];
+            for (int k=0; k<6; k++) {
+                rows[k] = tmp + size_t(clampIndex(2*y-2+k, sh))*dw*4;
+            }
+            float *d = dst + size_t(y)*dw*4;
+            for (int x=0; x<dw; x++, d+=4) {
+                texel4f sum = zero4();
+                for (int k=0; k<6; k++) {
+                    sum = add4(sum, scale4(load4(rows[k] + x*4), kaiser_weights[k]));
+                }
+                store4(d, sum);
+            }
+        }
+    });
+}
+
+struct CacheHeader {
+    CacheStamp stamp;
+    int components;
+    int num_levels;
+    int filter;
+    int color_space;
+};
+
+const char cache_magic[8] = { 'M','I','P','C','H','A','I','N' };
+const int cache_version = 2;
+
+} // namespace
+
+MipChain::MipChain()
+    : components(0)
+    , filter(MIP_FILTER_BOX)
+    , color_space(MIP_LINEAR)
+{
+}
+
+void MipChain::build(const GLubyte *image, int width, int height, int components_,
+                     MipFilter filter_, MipColorSpace color_space_)
+{
+    assert(image);
+    assert(width > 0 && height > 0);
+    assert(components_ == 3 || components_ == 4);
+    initTables();
+
+    components = components_;
+    filter = filter_;
+    color_space = color_space_;
+    levels.clear();
+
+    MipLevel base;
+    base.width = width;
+    base.height = height;
+    base.texels.assign(image, image + size_t(width)*height*components);
+    levels.push_back(base);
+
+    std::vector<float> current(size_t(width)*height*4), next;
+    decodeLevel(image, width, height, components, color_space, &current[0]);
+
+    int w = width, h = height;
+    while (w > 1 || h > 1) {
+        int nw = w > 1 ? w/2 : 1;
+        int nh = h > 1 ? h/2 : 1;
+        next.resize(size_t(nw)*nh*4);
+        if (filter == MIP_FILTER_KAISER) {
+            downsampleKaiser(&current[0], w, h, &next[0], nw, nh);
+        } else {
+            downsampleBox(&current[0], w, h, &next[0], nw, nh);
+        }
+        if (color_space == MIP_NORMAL) {
+            renormalize(&next[0], nw, nh);
+        }
+
+        MipLevel level;
+        level.width = nw;
+        level.height = nh;
+        level.texels.resize(size_t(nw)*nh*components);
+        encodeLevel(&next[0], nw, nh, components, color_space, &level.texels[0]);
+        levels.push_back(level);
+
+        current.swap(next);
+        w = nw;
+        h = nh;
+    }
+}
+
+void MipChain::tellGL(GLenum target, GLenum internal_format) const
+{
+    GLenum format = components == 3 ? GL_RGB : GL_RGBA;
+    for (size_t i=0; i<levels.size(); i++) {
+        const MipLevel &level = levels[i];
+        glTexImage2D(target, GLint(i), internal_format, level.width, level.height, 0,
+            format, GL_UNSIGNED_BYTE, &level.texels[0]);
+    }
+}
+
+bool MipChain::writeCache(const char *cache_filename, const char *source_filename) const
+{
+    CacheHeader header;
+    header.components = components;
+    header.num_levels = int(levels.size());
+    header.filter = filter;
+    header.color_space = color_space;
+    if (!makeCacheStamp(header.stamp, cache_magic, cache_version, source_filename)) {
+        return false;
+    }
+
+    FILE *file = fopen(cache_filename, "wb");
+    if (!file) {
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (size_t i=0; ok && i<levels.size(); i++) {
+        const MipLevel &level = levels[i];
+        int dims[2] = { level.width, level.height };
+        ok = fwrite(dims, sizeof(dims), 1, file) == 1 &&
+             fwrite(&level.texels[0], level.texels.size(), 1, file) == 1;
+    }
+    fclose(file);
+    if (!ok) {
+        remove(cache_filename);
+    }
+    return ok;
+}
+
+bool MipChain::readCache(const char *cache_filename, const char *source_filename,
+                         MipFilter filter_, MipColorSpace color_space_)
+{
+    FILE *file = fopen(cache_filename, "rb");
+    if (!file) {
+        return false;
+    }
+
+    CacheHeader header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+              cacheStampMatches(header.stamp, cache_magic, cache_version, source_filename) &&
+              header.filter == filter_ &&
+              header.color_space == color_space_ &&
+              (header.components == 3 || header.components == 4) &&
+              header.num_levels > 0 && header.num_levels <= 32;
+    std::vector<MipLevel> loaded;
+    for (int i=0; ok && i<header.num_levels; i++) {
+        int dims[2];
+        ok = fread(dims, sizeof(dims), 1, file) == 1 &&
+             dims[0] > 0 && dims[1] > 0 && dims[0] <= 65536 && dims[1] <= 65536;
+        if (ok) {
+            MipLevel level;
+            level.width = dims[0];
+            level.height = dims[1];
+            level.texels.resize(size_t(dims[0])*dims[1]*header.components);
+            ok = fread(&level.texels[0], level.texels.size(), 1, file) == 1;
+            loaded.push_back(level);
+        }
+    }
+    fclose(file);
+    if (ok) {
+        components = header.components;
+        filter = filter_;
+        color_space = color_space_;
+        levels.swap(loaded);
+    }
+    return ok;
+}
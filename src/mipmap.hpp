@@ -0,0 +1,56 @@
+// mipmap.hpp - CPU mipmap chain construction
+
+#ifndef __mipmap_hpp__
+#define __mipmap_hpp__
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+# pragma once
+#endif
+
+#include <GL/glew.h>
+
+#include <vector>
+
+enum MipFilter {
+    MIP_FILTER_BOX,     // 2x2 average
+    MIP_FILTER_KAISER   // 6-tap Kaiser-windowed sinc, separable
+};
+
+enum MipColorSpace {
+    MIP_LINEAR,         // filter the bytes as stored (height fields, masks)
+    MIP_SRGB,           // decode sRGB to linear, filter, re-encode; alpha stays linear
+    MIP_NORMAL          // unpack 128+127*n normals, filter, renormalize per level
+};
+
+struct MipLevel {
+    int width, height;
+    std::vector<GLubyte> texels;
+};
+
+struct MipChain {
+    int components;  // bytes per texel of every level, 3 or 4
+    MipFilter filter;
+    MipColorSpace color_space;
+    std::vector<MipLevel> levels;
+
+    MipChain();
+
+    // Builds the base level followed by every reduction down to 1x1.
+    void build(const GLubyte *image, int width, int height, int components,
+               MipFilter filter, MipColorSpace color_space);
+
+    // Uploads every level with glTexImage2D to target (a 2D or cube face target).
+    void tellGL(GLenum target, GLenum internal_format) const;
+
+    // Binary cache keyed on the source file's size and modification time
+    // and on the filter settings the chain was built with.
+    bool writeCache(const char *cache_filename, const char *source_filename) const;
+    bool readCache(const char *cache_filename, const char *source_filename,
+                   MipFilter filter, MipColorSpace color_space);
+};
+
+extern MipFilter mip_filter;
+extern bool cpu_mipmaps;
+extern bool texture_cache;
+
+#endif // __mipmap_hpp__
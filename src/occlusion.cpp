@@ -0,0 +1,205 @@
+// occlusion.cpp - software depth buffer and Hi-Z pyramid for occlusion culling
+//
+// Occluders are scan converted conservatively: a texel is written only
+// when the triangle covers all of it, and with the farthest depth the
+// triangle's plane takes over it, so whichever of its pixels the GPU
+// samples is no farther than the buffer says.
+
+#include <math.h>
+
+#include <Cg/vector.hpp>
+#include <Cg/matrix.hpp>
+#include <Cg/mul.hpp>
+
+#include "occlusion.hpp"
+#include "raster.hpp"
+
+using namespace Cg;
+
+bool occlusion_culling = true;
+
+namespace {
+
+// Slack against rounding between the CPU's depth and the GPU's.
+const float depth_epsilon = 1e-5f;
+
+// Twice the signed area of a, b and (x,y); positive with (x,y) to the
+// left of a to b.
+template <typename T>
+inline float edge(const T &a, const T &b, float x, float y)
+{
+    return (b.x - a.x) * (y - a.y) - (b.y - a.y) * (x - a.x);
+}
+
+} // namespace
+
+OcclusionBuffer::OcclusionBuffer(int width_, int height_)
+    : width(width_)
+    , height(height_)
+    , triangles(0)
+{
+    int w = width, h = height;
+    for (;;) {
+        level_width.push_back(w);
+        level_height.push_back(h);
+        levels.push_back(std::vector<float>(size_t(w) * h, 1.0f));
+        if (w == 1 && h == 1) {
+            break;
+        }
+        w = (w + 1) / 2;
+        h = (h + 1) / 2;
+    }
+}
+
+void OcclusionBuffer::clear()
+{
+    levels[0].assign(levels[0].size(), 1.0f);
+    triangles = 0;
+}
+
+void OcclusionBuffer::rasterize(const float4x4 &m, const float *positions, size_t vertex_count,
+                                const unsigned int *indices, size_t index_count, bool cull_backfacing)
+{
+    // Vertices are shared by about six triangles, so project them once.
+    screen.resize(vertex_count);
+    for (size_t i=0; i<vertex_count; i++) {
+        float4 c = mul(m, float4(positions[3*i], positions[3*i+1], positions[3*i+2], 1));
+        ScreenVertex &s = screen[i];
+        s.front = c.w > 0 && c.z >= -c.w;
+        if (s.front) {
+            float inv_w = 1 / c.w;
+            s.x = (c.x * inv_w * 0.5f + 0.5f) * width;
+            s.y = (c.y * inv_w * 0.5f + 0.5f) * height;
+            s.z = c.z * inv_w * 0.5f + 0.5f;
+        }
+    }
+
+    std::vector<float> &depth = levels[0];
+    for (size_t t=0; t+3<=index_count; t+=3) {
+        ScreenVertex v[3] = { screen[indices[t]], screen[indices[t+1]], screen[indices[t+2]] };
+        if (!v[0].front || !v[1].front || !v[2].front) {
+            continue;
+        }
+        float area = edge(v[0], v[1], v[2].x, v[2].y);
+        if (fabsf(area) < 1e-8f || (cull_backfacing && area < 0)) {
+            continue;
+        }
+        if (area < 0) {
+            ScreenVertex swap = v[1];
+            v[1] = v[2];
+            v[2] = swap;
+            area = -area;
+        }
+
+        int x0, x1, y0, y1;
+        pixelSpan(min3(v[0].x, v[1].x, v[2].x), max3(v[0].x, v[1].x, v[2].x), width, x0, x1);
+        pixelSpan(min3(v[0].y, v[1].y, v[2].y), max3(v[0].y, v[1].y, v[2].y), height, y0, y1);
+        if (x0 > x1 || y0 > y1) {
+            continue;
+        }
+        triangles++;
+
+        // Edge functions and depth, a plane over the screen through the
+        // three vertices, step by constant amounts along a row.  Being
+        // linear, each is most against us at a texel corner, half a step
+        // in x and in y from the center, so edges are inset and depth
+        // pushed back by that much.  Depth is clamped to the triangle's
+        // farthest vertex, as no covered texel reaches past it.
+        float inv_area = 1 / area;
+        float step0 = v[1].y - v[2].y, step1 = v[2].y - v[0].y, step2 = v[0].y - v[1].y;
+        float rise0 = v[2].x - v[1].x, rise1 = v[0].x - v[2].x, rise2 = v[1].x - v[0].x;
+        float z_step = (step0 * v[0].z + step1 * v[1].z + step2 * v[2].z) * inv_area;
+        float z_rise = (rise0 * v[0].z + rise1 * v[1].z + rise2 * v[2].z) * inv_area;
+        float inset0 = 0.5f * (fabsf(step0) + fabsf(rise0));
+        float inset1 = 0.5f * (fabsf(step1) + fabsf(rise1));
+        float inset2 = 0.5f * (fabsf(step2) + fabsf(rise2));
+        float z_outset = 0.5f * (fabsf(z_step) + fabsf(z_rise));
+        float z_far = max3(v[0].z, v[1].z, v[2].z);
+        for (int y=y0; y<=y1; y++) {
+            float px = x0 + 0.5f, py = y + 0.5f;
+            float w0 = edge(v[1], v[2], px, py);
+            float w1 = edge(v[2], v[0], px, py);
+            float w2 = edge(v[0], v[1], px, py);
+            float z = (w0 * v[0].z + w1 * v[1].z + w2 * v[2].z) * inv_area + z_outset;
+            w0 -= inset0;
+            w1 -= inset1;
+            w2 -= inset2;
+            float *d = &depth[size_t(y) * width];
+            for (int x=x0; x<=x1; x++) {
+                float farthest = min2(z, z_far);
+                if (w0 >= 0 && w1 >= 0 && w2 >= 0 && farthest < d[x]) {
+                    d[x] = farthest;
+                }
+                w0 += step0;
+                w1 += step1;
+                w2 += step2;
+                z += z_step;
+            }
+        }
+    }
+}
+
+void OcclusionBuffer::buildPyramid()
+{
+    for (size_t l=1; l<levels.size(); l++) {
+        const std::vector<float> &below = levels[l-1];
+        int bw = level_width[l-1], bh = level_height[l-1];
+        int w = level_width[l], h = level_height[l];
+        std::vector<float> &level = levels[l];
+        for (int y=0; y<h; y++) {
+            int y0 = 2*y, y1 = 2*y+1 < bh ? 2*y+1 : 2*y;
+            for (int x=0; x<w; x++) {
+                int x0 = 2*x, x1 = 2*x+1 < bw ? 2*x+1 : 2*x;
+                float a = max2(below[size_t(y0)*bw + x0], below[size_t(y0)*bw + x1]);
+                float b = max2(below[size_t(y1)*bw + x0], below[size_t(y1)*bw + x1]);
+                level[size_t(y)*w + x] = max2(a, b);
+            }
+        }
+    }
+}
+
+bool OcclusionBuffer::boxVisible(const float4x4 &m, const float3 &lo, const float3 &hi) const
+{
+    if (triangles == 0) {
+        return true;
+    }
+    float min_x = HUGE_VALF, max_x = -HUGE_VALF, min_y = HUGE_VALF, max_y = -HUGE_VALF;
+    float min_z = HUGE_VALF;
+    for (int i=0; i<8; i++) {
+        float4 c = mul(m, float4(i & 1 ? hi.x : lo.x, i & 2 ? hi.y : lo.y, i & 4 ? hi.z : lo.z, 1));
+        if (c.w <= 0 || c.z < -c.w) {
+            return true;  // reaches the near plane
+        }
+        float inv_w = 1 / c.w;
+        float x = (c.x * inv_w * 0.5f + 0.5f) * width;
+        float y = (c.y * inv_w * 0.5f + 0.5f) * height;
+        float z = c.z * inv_w * 0.5f + 0.5f;
+        min_x = min2(min_x, x);
+        max_x = max2(max_x, x);
+        min_y = min2(min_y, y);
+        max_y = max2(max_y, y);
+        min_z = min2(min_z, z);
+    }
+    if (max_x < 0 || max_y < 0 || min_x >= width || min_y >= height) {
+        return true;  // off screen; frustum culling's business
+    }
+    int x0 = int(max2(min_x, 0)), x1 = int(min2(max_x, float(width-1)));
+    int y0 = int(max2(min_y, 0)), y1 = int(min2(max_y, float(height-1)));
+
+    // The finest level where the box spans at most two texels a side, so
+    // at most three by three are read.
+    size_t l = 0;
+    while (l+1 < levels.size() && ((x1 >> l) - (x0 >> l) > 1 || (y1 >> l) - (y0 >> l) > 1)) {
+        l++;
+    }
+    const std::vector<float> &level = levels[l];
+    int w = level_width[l];
+    for (int y=y0>>l; y<=y1>>l; y++) {
+        for (int x=x0>>l; x<=x1>>l; x++) {
+            if (min_z <= level[size_t(y)*w + x] + depth_epsilon) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
@@ -0,0 +1,59 @@
+// occlusion.hpp - software depth buffer and Hi-Z pyramid for occlusion culling
+
+#ifndef __occlusion_hpp__
+#define __occlusion_hpp__
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+# pragma once
+#endif
+
+#include <stddef.h>
+
+#include <vector>
+
+#include <Cg/vector.hpp>
+#include <Cg/matrix.hpp>
+
+// A small depth buffer the CPU rasterizes the frame's biggest occluders
+// into, reduced to a pyramid where each texel keeps the farthest depth of
+// the four below it.  A box is hidden when its nearest depth is behind
+// the farthest depth of every texel it covers, so one pyramid level
+// where it covers a few texels answers for it.  Depth is window depth,
+// 0 at the near plane and 1 at the far plane or where nothing was drawn.
+class OcclusionBuffer {
+    struct ScreenVertex {
+        float x, y, z;  // pixels and window depth
+        bool front;     // beyond the near plane
+    };
+
+    int width, height;
+    std::vector< std::vector<float> > levels;  // levels[0] is the full buffer
+    std::vector<int> level_width, level_height;
+    std::vector<ScreenVertex> screen;          // scratch for rasterize
+    size_t triangles;
+
+public:
+    OcclusionBuffer(int width = 256, int height = 128);
+
+    void clear();
+
+    // Triangles of positions (x,y,z triples) seen through clip_from_object.
+    // A texel takes a triangle only when the triangle covers it whole, at
+    // the farthest depth the triangle has over it.  Triangles crossing the
+    // near plane are left out, as are clockwise ones when cull_backfacing,
+    // which only ever hides less.
+    void rasterize(const Cg::float4x4 &clip_from_object, const float *positions, size_t vertex_count,
+                   const unsigned int *indices, size_t index_count, bool cull_backfacing);
+
+    // Call after the last rasterize and before testing.
+    void buildPyramid();
+
+    // False only when the box is certainly behind what was rasterized.
+    bool boxVisible(const Cg::float4x4 &clip_from_object, const Cg::float3 &lo, const Cg::float3 &hi) const;
+
+    size_t occluderTriangles() const { return triangles; }
+};
+
+extern bool occlusion_culling;
+
+#endif // __occlusion_hpp__
@@ -0,0 +1,64 @@
+// offscreen.cpp - framebuffers for frames that never reach the window
+
+#include <stdio.h>
+
+#include "offscreen.hpp"
+
+extern const char *program_name;
+
+OffscreenFrame::OffscreenFrame()
+    : fbo(0)
+    , frame_width(0)
+    , frame_height(0)
+{
+    renderbuffers[0] = renderbuffers[1] = 0;
+}
+
+OffscreenFrame::~OffscreenFrame()
+{
+    if (fbo) {
+        glDeleteFramebuffersEXT(1, &fbo);
+        glDeleteRenderbuffersEXT(2, renderbuffers);
+    }
+}
+
+bool OffscreenFrame::create(int width, int height)
+{
+    if (!GLEW_EXT_framebuffer_object) {
+        printf("%s: offscreen frames need EXT_framebuffer_object\n", program_name);
+        return false;
+    }
+    if (!fbo) {
+        glGenFramebuffersEXT(1, &fbo);
+        glGenRenderbuffersEXT(2, renderbuffers);
+    }
+    frame_width = width;
+    frame_height = height;
+    glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, renderbuffers[0]);
+    glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_RGBA8, width, height);
+    glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, renderbuffers[1]);
+    glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, 0);
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fbo);
+    glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_RENDERBUFFER_EXT, renderbuffers[0]);
+    glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_RENDERBUFFER_EXT, renderbuffers[1]);
+    GLenum status = glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT);
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE_EXT) {
+        printf("%s: %dx%d offscreen framebuffer incomplete (0x%x)\n", program_name, width, height, status);
+        return false;
+    }
+    return true;
+}
+
+void OffscreenFrame::bind()
+{
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fbo);
+    glViewport(0, 0, frame_width, frame_height);
+}
+
+void OffscreenFrame::read(unsigned char *rgba)
+{
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fbo);
+    glReadPixels(0, 0, frame_width, frame_height, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+}
@@ -0,0 +1,40 @@
+// offscreen.hpp - framebuffers for frames that never reach the window
+
+#ifndef __offscreen_hpp__
+#define __offscreen_hpp__
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+# pragma once
+#endif
+
+#include <GL/glew.h>
+
+// An RGBA8 color and 24-bit depth framebuffer object of a fixed size.
+class OffscreenFrame {
+    GLuint fbo;
+    GLuint renderbuffers[2];
+    int frame_width, frame_height;
+
+    OffscreenFrame(const OffscreenFrame &);  // not copyable
+    OffscreenFrame &operator =(const OffscreenFrame &);
+
+public:
+    OffscreenFrame();
+    ~OffscreenFrame();
+
+    // False, saying why, when EXT_framebuffer_object is missing or the
+    // framebuffer is incomplete.
+    bool create(int width, int height);
+
+    // Binds the framebuffer and sets the viewport to all of it.  Loading
+    // textures and models may bind others, so bind before each frame.
+    void bind();
+    // The color buffer into rgba, width by height RGBA8 with rows bottom
+    // first.  Binds the framebuffer, which drawing may have changed.
+    void read(unsigned char *rgba);
+
+    int width() const { return frame_width; }
+    int height() const { return frame_height; }
+};
+
+#endif // __offscreen_hpp__
@@ -0,0 +1,61 @@
+// parallel.hpp - split loops across the machine's hardware threads
+
+#ifndef __parallel_hpp__
+#define __parallel_hpp__
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+# pragma once
+#endif
+
+#include <thread>
+#include <vector>
+
+inline int numWorkerThreads()
+{
+    int n = int(std::thread::hardware_concurrency());
+    return n > 0 ? n : 1;
+}
+
+// Runs body(first, last) over contiguous sub-ranges of [begin,end).  Ranges
+// smaller than grain are not split; the calling thread takes the first chunk.
+template <typename Body>
+void parallelFor(int begin, int end, int grain, const Body &body)
+{
+    int count = end - begin;
+    if (count <= 0) {
+        return;
+    }
+    if (grain < 1) {
+        grain = 1;
+    }
+    int chunks = (count + grain - 1) / grain;
+    if (chunks <= 1) {
+        body(begin, end);
+        return;
+    }
+    int workers = numWorkerThreads();
+    if (chunks > workers) {
+        chunks = workers;
+    }
+    if (chunks <= 1) {
+        body(begin, end);
+        return;
+    }
+
+    int per_chunk = (count + chunks - 1) / chunks;
+    std::vector<std::thread> threads;
+    threads.reserve(chunks-1);
+    for (int c=1; c<chunks; c++) {
+        int first = begin + c*per_chunk;
+        int last = first + per_chunk < end ? first + per_chunk : end;
+        if (first < last) {
+            threads.push_back(std::thread(body, first, last));
+        }
+    }
+    body(begin, begin + per_chunk < end ? begin + per_chunk : end);
+    for (size_t i=0; i<threads.size(); i++) {
+        threads[i].join();
+    }
+}
+
+#endif // __parallel_hpp__
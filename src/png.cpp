@@ -0,0 +1,295 @@
+// png.cpp - PNG encoding of framebuffer images
+//
+// A zlib stream of a single deflate block with the fixed Huffman codes
+// (RFC 1951, 3.2.6): no code tables to build or store, which suits the
+// small, flat-shaded images written here.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+
+#include "png.hpp"
+
+namespace {
+
+const int window = 32768;      // farthest a match may reach back
+const int min_match = 3;
+const int max_match = 258;
+const int hash_bits = 15;
+const int max_chain = 16;      // candidates tried per position
+
+const unsigned short length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+const unsigned char length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+const unsigned short distance_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+const unsigned char distance_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+// Deflate's bit order: values least significant bit first, Huffman
+// codes most significant first.
+class BitWriter {
+    std::vector<unsigned char> &out;
+    unsigned int bits;
+    int count;
+
+public:
+    BitWriter(std::vector<unsigned char> &out) : out(out), bits(0), count(0) {}
+
+    void put(unsigned int value, int n) {
+        bits |= value << count;
+        count += n;
+        while (count >= 8) {
+            out.push_back((unsigned char)bits);
+            bits >>= 8;
+            count -= 8;
+        }
+    }
+    void putCode(unsigned int code, int n) {
+        unsigned int reversed = 0;
+        for (int i=0; i<n; i++) {
+            reversed = reversed << 1 | ((code >> i) & 1);
+        }
+        put(reversed, n);
+    }
+    void flush() {
+        if (count > 0) {
+            out.push_back((unsigned char)bits);
+        }
+        bits = 0;
+        count = 0;
+    }
+};
+
+void putSymbol(BitWriter &w, int symbol)
+{
+    if (symbol < 144) {
+        w.putCode(0x30 + symbol, 8);
+    } else if (symbol < 256) {
+        w.putCode(0x190 + symbol - 144, 9);
+    } else if (symbol < 280) {
+        w.putCode(symbol - 256, 7);
+    } else {
+        w.putCode(0xc0 + symbol - 280, 8);
+    }
+}
+
+void putMatch(BitWriter &w, int length, int distance)
+{
+    int l = int(std::upper_bound(length_base, length_base + 29, length) - length_base) - 1;
+    putSymbol(w, 257 + l);
+    w.put(length - length_base[l], length_extra[l]);
+    int d = int(std::upper_bound(distance_base, distance_base + 30, distance) - distance_base) - 1;
+    w.putCode(d, 5);
+    w.put(distance - distance_base[d], distance_extra[d]);
+}
+
+inline unsigned int hash3(const unsigned char *p)
+{
+    unsigned int v = p[0] | p[1] << 8 | p[2] << 16;
+    return (v * 2654435761u) >> (32 - hash_bits);
+}
+
+void deflateFixed(const std::vector<unsigned char> &data, std::vector<unsigned char> &out)
+{
+    BitWriter w(out);
+    w.put(1, 1);  // the final block
+    w.put(1, 2);  // fixed Huffman codes
+
+    int n = int(data.size());
+    std::vector<int> head(1 << hash_bits, -1);
+    std::vector<int> previous(n);
+    const unsigned char *p = data.empty() ? NULL : &data[0];
+    int i = 0;
+    // Records position j in the hash chains.
+    auto insert = [&](int j) {
+        if (j + min_match <= n) {
+            unsigned int h = hash3(p + j);
+            previous[j] = head[h];
+            head[h] = j;
+        }
+    };
+    while (i < n) {
+        int best_length = 0, best_distance = 0;
+        if (i + min_match <= n) {
+            int limit = std::min(max_match, n - i);
+            int candidate = head[hash3(p + i)];
+            for (int chain=0; chain<max_chain && candidate >= 0 && i - candidate <= window; chain++) {
+                if (p[candidate + best_length] == p[i + best_length]) {
+                    int length = 0;
+                    while (length < limit && p[candidate + length] == p[i + length]) {
+                        length++;
+                    }
+                    if (length > best_length) {
+                        best_length = length;
+                        best_distance = i - candidate;
+                        if (length == limit) {
+                            break;
+                        }
+                    }
+                }
+                candidate = previous[candidate];
+            }
+        }
+        if (best_length >= min_match) {
+            putMatch(w, best_length, best_distance);
+            for (int j=i; j<i+best_length; j++) {
+                insert(j);
+            }
+            i += best_length;
+        } else {
+            putSymbol(w, p[i]);
+            insert(i);
+            i++;
+        }
+    }
+    putSymbol(w, 256);  // end of block
+    w.flush();
+}
+
+unsigned int crc32(const unsigned char *p, size_t n, unsigned int crc = 0)
+{
+    static const std::vector<unsigned int> table = [] {
+        std::vector<unsigned int> t(256);
+        for (unsigned int k=0; k<256; k++) {
+            unsigned int c = k;
+            for (int j=0; j<8; j++) {
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            t[k] = c;
+        }
+        return t;
+    }();
+    crc = ~crc;
+    for (size_t i=0; i<n; i++) {
+        crc = table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+unsigned int adler32(const std::vector<unsigned char> &data)
+{
+    unsigned int a = 1, b = 0;
+    for (size_t i=0; i<data.size(); ) {
+        // Sums cannot overflow within 5552 bytes.
+        size_t end = std::min(data.size(), i + 5552);
+        for (; i<end; i++) {
+            a += data[i];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return b << 16 | a;
+}
+
+void putBigEndian(std::vector<unsigned char> &out, unsigned int v)
+{
+    out.push_back((unsigned char)(v >> 24));
+    out.push_back((unsigned char)(v >> 16));
+    out.push_back((unsigned char)(v >> 8));
+    out.push_back((unsigned char)v);
+}
+
+void putChunk(std::vector<unsigned char> &png, const char *type, const std::vector<unsigned char> &data)
+{
+    putBigEndian(png, unsigned(data.size()));
+    size_t start = png.size();
+    png.insert(png.end(), type, type + 4);
+    png.insert(png.end(), data.begin(), data.end());
+    putBigEndian(png, crc32(&png[start], png.size() - start));
+}
+
+inline int paeth(int a, int b, int c)
+{
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+}
+
+} // namespace
+
+void encodePNG(const unsigned char *rgba, int width, int height, std::vector<unsigned char> &png)
+{
+    const int bpp = 3;
+    size_t stride = size_t(width) * bpp;
+    std::vector<unsigned char> filtered;
+    filtered.reserve((stride + 1) * height);
+    std::vector<unsigned char> row(stride), above(stride, 0), trial[5];
+    for (int f=0; f<5; f++) {
+        trial[f].resize(stride);
+    }
+    for (int y=height-1; y>=0; y--) {
+        const unsigned char *src = rgba + size_t(y) * width * 4;
+        for (int x=0; x<width; x++) {
+            row[3*x+0] = src[4*x+0];
+            row[3*x+1] = src[4*x+1];
+            row[3*x+2] = src[4*x+2];
+        }
+        int best = 0;
+        long best_cost = -1;
+        for (int f=0; f<5; f++) {
+            long cost = 0;
+            for (size_t i=0; i<stride; i++) {
+                int a = i >= bpp ? row[i-bpp] : 0;
+                int b = above[i];
+                int c = i >= bpp ? above[i-bpp] : 0;
+                int predicted = f == 0 ? 0 : f == 1 ? a : f == 2 ? b : f == 3 ? (a + b) / 2 : paeth(a, b, c);
+                unsigned char v = (unsigned char)(row[i] - predicted);
+                trial[f][i] = v;
+                cost += v < 128 ? v : 256 - v;
+            }
+            if (best_cost < 0 || cost < best_cost) {
+                best = f;
+                best_cost = cost;
+            }
+        }
+        filtered.push_back((unsigned char)best);
+        filtered.insert(filtered.end(), trial[best].begin(), trial[best].end());
+        above.swap(row);
+    }
+
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    png.assign(signature, signature + 8);
+
+    std::vector<unsigned char> header;
+    putBigEndian(header, unsigned(width));
+    putBigEndian(header, unsigned(height));
+    header.push_back(8);  // bits per channel
+    header.push_back(2);  // RGB
+    header.push_back(0);  // deflate
+    header.push_back(0);  // adaptive filtering
+    header.push_back(0);  // not interlaced
+    putChunk(png, "IHDR", header);
+
+    std::vector<unsigned char> zlib;
+    zlib.push_back(0x78);  // deflate with a 32K window
+    zlib.push_back(0x01);  // no dictionary, fastest
+    deflateFixed(filtered, zlib);
+    putBigEndian(zlib, adler32(filtered));
+    putChunk(png, "IDAT", zlib);
+
+    putChunk(png, "IEND", std::vector<unsigned char>());
+}
+
+bool writePNG(const char *filename, const unsigned char *rgba, int width, int height)
+{
+    std::vector<unsigned char> png;
+    encodePNG(rgba, width, height, png);
+    FILE *file = fopen(filename, "wb");
+    if (!file) {
+        return false;
+    }
+    size_t written = fwrite(&png[0], 1, png.size(), file);
+    return (fclose(file) == 0) & (written == png.size());
+}
@@ -0,0 +1,22 @@
+// png.hpp - PNG encoding of framebuffer images
+
+#ifndef __png_hpp__
+#define __png_hpp__
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+# pragma once
+#endif
+
+#include <vector>
+
+// width by height RGBA8 pixels, rows bottom first as glReadPixels returns
+// them, as an 8-bit RGB PNG with the top row first; alpha is dropped.
+// Each row takes the filter that leaves the smallest bytes, and the
+// result is deflated with the fixed Huffman codes and a short greedy
+// match search, which favours speed over size.  Safe to call from many
+// threads at once.
+void encodePNG(const unsigned char *rgba, int width, int height, std::vector<unsigned char> &png);
+
+bool writePNG(const char *filename, const unsigned char *rgba, int width, int height);
+
+#endif // __png_hpp__
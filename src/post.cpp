@@ -0,0 +1,520 @@
+// post.cpp - screen-space passes over the rendered scene
+
+#include <math.h>
+#include <stdio.h>
+
+#include <Cg/double.hpp>
+#include <Cg/vector.hpp>
+
+#include "post.hpp"
+#include "blur.hpp"
+
+using namespace Cg;
+
+extern const char *program_name;
+extern bool verbose;
+
+bool screen_edges = false;
+float edge_width = 1.0f;
+
+namespace {
+
+const float4 ink_color = float4(0, 0, 0, 1);
+const float god_ray_blur_radius = 4.0f;  // pixels
+
+// Draws the unit square, texture coordinates the same as positions,
+// which the full-screen vertex shaders stretch over the viewport.
+void drawFullScreenQuad()
+{
+    glBegin(GL_QUADS);
+    glTexCoord2f(0, 0);
+    glVertex2f(0, 0);
+    glTexCoord2f(1, 0);
+    glVertex2f(1, 0);
+    glTexCoord2f(1, 1);
+    glVertex2f(1, 1);
+    glTexCoord2f(0, 1);
+    glVertex2f(0, 1);
+    glEnd();
+}
+
+} // namespace
+
+GpuTimer::GpuTimer()
+    : next(0)
+    , running(false)
+    , last_milliseconds(-1)
+{
+    for (int i=0; i<ring; i++) {
+        queries[i] = 0;
+        pending[i] = false;
+    }
+}
+
+GpuTimer::~GpuTimer()
+{
+    if (queries[0]) {
+        glDeleteQueries(ring, queries);
+    }
+}
+
+bool GpuTimer::supported()
+{
+    return GLEW_ARB_timer_query || GLEW_EXT_timer_query;
+}
+
+// Reads finished queries oldest first, stopping at the first the GPU has
+// not reached, so nothing here waits.
+void GpuTimer::collect()
+{
+    for (int k=0; k<ring; k++) {
+        int i = (next + k) % ring;
+        if (!pending[i]) {
+            continue;
+        }
+        GLint available = 0;
+        glGetQueryObjectiv(queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            break;
+        }
+        if (GLEW_ARB_timer_query) {
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &ns);
+            last_milliseconds = ns * 1e-6;
+        } else {
+            GLuint64EXT ns = 0;
+            glGetQueryObjectui64vEXT(queries[i], GL_QUERY_RESULT, &ns);
+            last_milliseconds = ns * 1e-6;
+        }
+        pending[i] = false;
+    }
+}
+
+void GpuTimer::begin()
+{
+    if (!supported()) {
+        return;
+    }
+    if (!queries[0]) {
+        glGenQueries(ring, queries);
+    }
+    collect();
+    if (pending[next]) {
+        return;
+    }
+    glBeginQuery(GL_TIME_ELAPSED_EXT, queries[next]);
+    running = true;
+}
+
+void GpuTimer::end()
+{
+    if (!running) {
+        return;
+    }
+    glEndQuery(GL_TIME_ELAPSED_EXT);
+    pending[next] = true;
+    next = (next + 1) % ring;
+    running = false;
+}
+
+PostPass::PostPass(const char *name_, const char *vertex_filename_, const char *fragment_filename_)
+    : name(name_)
+    , vertex_filename(vertex_filename_)
+    , fragment_filename(fragment_filename_)
+    , output(PostChain::OUTPUT)
+    , program(NULL)
+    , failed(false)
+{
+}
+
+PostPass::~PostPass()
+{
+    delete program;
+}
+
+PostPass &PostPass::read(const char *sampler, int target)
+{
+    inputs.push_back(std::make_pair(std::string(sampler), target));
+    return *this;
+}
+
+PostPass &PostPass::write(int target)
+{
+    output = target;
+    return *this;
+}
+
+PostPass &PostPass::setUniforms(const Uniforms &u)
+{
+    uniforms = u;
+    return *this;
+}
+
+bool PostPass::load()
+{
+    if (program) {
+        return true;
+    }
+    if (failed) {
+        return false;
+    }
+    failed = true;
+
+    VertexShader vs;
+    FragmentShader fs;
+    bool vs_ok = vs.readTextFile(vertex_filename.c_str());
+    bool fs_ok = fs.readTextFile(fragment_filename.c_str());
+    if (vs_ok && fs_ok) {
+        GLSLProgram new_program(vs.getShader(), fs.getShader());
+        vs.release();
+        fs.release();
+        if (new_program.validate()) {
+            program = new GLSLProgram;
+            program->swap(new_program);
+            failed = false;
+            return true;
+        }
+        printf("GLSL shader compilation failed\n");
+    } else {
+        if (!vs_ok) {
+            printf("Vertex shader failed to load\n");
+        }
+        if (!fs_ok) {
+            printf("Fragment shader failed to load\n");
+        }
+    }
+    return false;
+}
+
+PostChain::PostChain()
+    : scene_fbo(0)
+    , pass_fbo(0)
+    , output_fbo(0)
+    , compiled(false)
+    , failed(false)
+{
+    for (int i=0; i<4; i++) {
+        viewport[i] = 0;
+    }
+    clear();
+}
+
+PostChain::~PostChain()
+{
+    clear();
+    if (scene_fbo) {
+        glDeleteFramebuffersEXT(1, &scene_fbo);
+        glDeleteFramebuffersEXT(1, &pass_fbo);
+    }
+}
+
+void PostChain::clear()
+{
+    for (size_t i=0; i<passes.size(); i++) {
+        delete passes[i];
+    }
+    passes.clear();
+    for (size_t i=0; i<textures.size(); i++) {
+        glDeleteTextures(1, &textures[i].object);
+    }
+    textures.clear();
+
+    targets.clear();
+    Target target;
+    target.downsample = 0;
+    target.first = -1;
+    target.last = -1;
+    target.texture = -1;
+    target.name = "scene color";
+    target.format = POST_COLOR;
+    targets.push_back(target);
+    target.name = "scene depth";
+    target.format = POST_DEPTH;
+    targets.push_back(target);
+    target.name = "output";
+    target.format = POST_COLOR;
+    targets.push_back(target);
+
+    compiled = false;
+    failed = false;
+}
+
+int PostChain::addTarget(const char *name, int downsample)
+{
+    Target target;
+    target.name = name;
+    target.format = POST_COLOR;
+    target.downsample = downsample;
+    target.first = -1;
+    target.last = -1;
+    target.texture = -1;
+    targets.push_back(target);
+    compiled = false;
+    return int(targets.size()) - 1;
+}
+
+PostPass &PostChain::addPass(const char *name, const char *vertex_filename, const char *fragment_filename)
+{
+    passes.push_back(new PostPass(name, vertex_filename, fragment_filename));
+    compiled = false;
+    return *passes.back();
+}
+
+// Finds each target's lifetime and gives it a texture.  Passes are walked
+// in order; a texture is free again once the last pass reading its target
+// is done, not before, so no pass writes a texture it reads.
+bool PostChain::compile()
+{
+    for (size_t i=0; i<textures.size(); i++) {
+        glDeleteTextures(1, &textures[i].object);
+    }
+    textures.clear();
+
+    for (size_t t=0; t<targets.size(); t++) {
+        targets[t].first = t == SCENE_COLOR || t == SCENE_DEPTH ? -1 : int(passes.size());
+        targets[t].last = -1;
+        targets[t].texture = -1;
+    }
+    for (size_t p=0; p<passes.size(); p++) {
+        const PostPass &pass = *passes[p];
+        for (size_t i=0; i<pass.inputs.size(); i++) {
+            int t = pass.inputs[i].second;
+            if (t < 0 || t >= int(targets.size()) || t == OUTPUT || targets[t].first >= int(p)) {
+                printf("%s: post pass %s reads a target no earlier pass wrote\n", program_name, pass.name.c_str());
+                return false;
+            }
+            targets[t].last = int(p);
+        }
+        int t = pass.output;
+        if (t < 0 || t >= int(targets.size()) || t == SCENE_COLOR || t == SCENE_DEPTH ||
+            (t != OUTPUT && targets[t].first < int(p))) {
+            printf("%s: post pass %s writes a scene target or one already written\n", program_name, pass.name.c_str());
+            return false;
+        }
+        targets[t].first = int(p);
+    }
+
+    std::vector<bool> busy;              // per texture
+    std::vector<bool> held(targets.size());  // per target, until released
+    // Hands target t a free texture of its kind, or a new one.
+    auto acquire = [&](int t) {
+        Target &target = targets[t];
+        for (size_t i=0; i<textures.size(); i++) {
+            if (!busy[i] && textures[i].format == target.format && textures[i].downsample == target.downsample) {
+                busy[i] = true;
+                held[t] = true;
+                target.texture = int(i);
+                return;
+            }
+        }
+        Texture texture;
+        glGenTextures(1, &texture.object);
+        texture.format = target.format;
+        texture.downsample = target.downsample;
+        texture.width = 0;
+        texture.height = 0;
+        textures.push_back(texture);
+        busy.push_back(true);
+        held[t] = true;
+        target.texture = int(textures.size()) - 1;
+    };
+    // Frees the textures of targets last read by pass p; -1 frees those
+    // of scene targets no pass reads.
+    auto release = [&](int p) {
+        for (size_t t=0; t<targets.size(); t++) {
+            if (held[t] && targets[t].last <= p) {
+                busy[targets[t].texture] = false;
+                held[t] = false;
+            }
+        }
+    };
+
+    acquire(SCENE_COLOR);
+    acquire(SCENE_DEPTH);
+    release(-1);
+    for (size_t p=0; p<passes.size(); p++) {
+        if (passes[p]->output != OUTPUT) {
+            acquire(passes[p]->output);
+        }
+        release(int(p));
+    }
+    for (size_t t=OUTPUT+1; t<targets.size(); t++) {
+        if (targets[t].texture >= 0 && targets[t].last < 0) {
+            printf("%s: post target %s is written but never read\n", program_name, targets[t].name.c_str());
+        }
+    }
+    if (verbose) {
+        printf("%s: post chain of %d passes keeps %d targets in %d textures\n", program_name,
+               int(passes.size()), int(targets.size()) - 1, int(textures.size()));
+    }
+    compiled = true;
+    return true;
+}
+
+bool PostChain::allocate(int width, int height)
+{
+    for (size_t i=0; i<textures.size(); i++) {
+        Texture &texture = textures[i];
+        int w = width >> texture.downsample, h = height >> texture.downsample;
+        w = w > 0 ? w : 1;
+        h = h > 0 ? h : 1;
+        if (w == texture.width && h == texture.height) {
+            continue;
+        }
+        texture.width = w;
+        texture.height = h;
+
+        GLenum filter = texture.format == POST_DEPTH ? GL_NEAREST : GL_LINEAR;
+        glBindTexture(GL_TEXTURE_2D, texture.object);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        if (texture.format == POST_DEPTH) {
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, w, h, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+        } else {
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        }
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    if (!scene_fbo) {
+        glGenFramebuffersEXT(1, &scene_fbo);
+        glGenFramebuffersEXT(1, &pass_fbo);
+    }
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, scene_fbo);
+    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D,
+                              textures[targets[SCENE_COLOR].texture].object, 0);
+    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_TEXTURE_2D,
+                              textures[targets[SCENE_DEPTH].texture].object, 0);
+    GLenum status = glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT);
+    if (status != GL_FRAMEBUFFER_COMPLETE_EXT) {
+        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, output_fbo);
+        printf("%s: post chain framebuffer incomplete (0x%x)\n", program_name, status);
+        return false;
+    }
+    return true;
+}
+
+bool PostChain::begin()
+{
+    if (failed || passes.empty()) {
+        return false;
+    }
+    if (!GLEW_EXT_framebuffer_object) {
+        printf("%s: post-processing needs EXT_framebuffer_object\n", program_name);
+        failed = true;
+        return false;
+    }
+    if (!compiled) {
+        bool ok = compile();
+        for (size_t p=0; ok && p<passes.size(); p++) {
+            ok = passes[p]->load();
+        }
+        if (!ok) {
+            failed = true;
+            return false;
+        }
+    }
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT, &output_fbo);
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    if (!allocate(viewport[2], viewport[3])) {
+        failed = true;
+        return false;
+    }
+    // The scene's textures fill their own framebuffer from its corner.
+    glViewport(0, 0, viewport[2], viewport[3]);
+    return true;
+}
+
+void PostChain::bindOutput(int target)
+{
+    if (target == OUTPUT) {
+        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, output_fbo);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+        return;
+    }
+    const Texture &texture = textures[targets[target].texture];
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, pass_fbo);
+    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, texture.object, 0);
+    glViewport(0, 0, texture.width, texture.height);
+}
+
+void PostChain::end(const Camera &camera)
+{
+    glPushAttrib(GL_ENABLE_BIT | GL_DEPTH_BUFFER_BIT | GL_POLYGON_BIT);
+    glDisable(GL_DEPTH_TEST);
+    glDepthMask(GL_FALSE);
+    glDisable(GL_CULL_FACE);
+    glDisable(GL_BLEND);
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+
+    for (size_t p=0; p<passes.size(); p++) {
+        PostPass &pass = *passes[p];
+        pass.timer.begin();
+        bindOutput(pass.output);
+        for (size_t i=0; i<pass.inputs.size(); i++) {
+            glActiveTexture(GLenum(GL_TEXTURE0 + i));
+            glBindTexture(GL_TEXTURE_2D, textures[targets[pass.inputs[i].second].texture].object);
+            pass.program->setSampler(pass.inputs[i].first.c_str(), int(i));
+        }
+        glActiveTexture(GL_TEXTURE0);
+        if (!pass.inputs.empty()) {
+            const Texture &input = textures[targets[pass.inputs[0].second].texture];
+            pass.program->setVec2f("texelSize", float2(1.0f/input.width, 1.0f/input.height));
+        }
+        if (pass.uniforms) {
+            pass.uniforms(*pass.program, camera);
+        }
+        pass.program->use();
+        drawFullScreenQuad();
+        pass.timer.end();
+    }
+    glUseProgram(0);
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, output_fbo);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    glPopAttrib();
+}
+
+void PostChain::printTimes(const char *name) const
+{
+    if (!GpuTimer::supported()) {
+        return;
+    }
+    for (size_t p=0; p<passes.size(); p++) {
+        printf("%s: %.3f ms of GPU time in post pass %s\n", name,
+               passes[p]->timer.milliseconds(), passes[p]->name.c_str());
+    }
+}
+
+void addScreenEdges(PostChain &chain, int color, int depth, int output)
+{
+    chain.addPass("edges", "glsl/edge.vert", "glsl/edge.frag")
+        .read("sceneColor", color)
+        .read("sceneDepth", depth)
+        .write(output)
+        .setUniforms([](GLSLProgram &program, const Camera &camera) {
+            // View-space x and y are ndc times depth times these.
+            float tan_half_fov = tanf(camera.fov_degrees * float(M_PI / 360));
+            program.setVec1f("edgeWidth", edge_width);
+            program.setVec2f("clipPlanes", float2(camera.znear, camera.zfar));
+            program.setVec2f("viewScale", float2(tan_half_fov * camera.aspect_ratio, tan_half_fov));
+            program.setVec4f("inkColor", ink_color);
+        });
+}
+
+void addGodRays(PostChain &chain, int color, int output)
+{
+    int rays = chain.addTarget("rays", 1);
+    chain.addPass("rays", "glsl/gods_ray.vert", "glsl/gods_ray.frag")
+        .read("ColorBuffer", color)
+        .write(rays);
+    // The gather takes a quarter of the samples it once did; a small
+    // blur hides the banding between them.
+    rays = addBlur(chain, rays, god_ray_blur_radius, 1, blur_method);
+    chain.addPass("rays composite", "glsl/post.vert", "glsl/gods_ray_composite.frag")
+        .read("ColorBuffer", color)
+        .read("RayBuffer", rays)
+        .write(output);
+}
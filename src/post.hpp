@@ -0,0 +1,161 @@
+// post.hpp - screen-space passes over the rendered scene
+
+#ifndef __post_hpp__
+#define __post_hpp__
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+# pragma once
+#endif
+
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "scene.hpp"
+
+// Times the GL commands between begin and end on the GPU.  Results are
+// read back frames later from a small ring of queries, so timing never
+// waits on the GPU; a frame whose query slot is still in flight goes
+// untimed.  Needs ARB_timer_query or EXT_timer_query.
+class GpuTimer {
+    enum { ring = 4 };
+
+    GLuint queries[ring];
+    bool pending[ring];
+    int next;
+    bool running;
+    double last_milliseconds;
+
+    void collect();
+
+public:
+    GpuTimer();
+    ~GpuTimer();
+
+    static bool supported();
+
+    void begin();
+    void end();
+
+    // The latest finished measurement, or a negative value before one.
+    double milliseconds() const { return last_milliseconds; }
+};
+
+// Render target formats a pass can read or write.
+enum PostFormat {
+    POST_COLOR,   // RGBA8, linearly filtered
+    POST_DEPTH    // 24-bit depth, sampled unfiltered; only the scene's
+};
+
+// One full-screen draw of a program into a target, with other targets
+// bound to its samplers.  Declared through PostChain::addPass:
+//
+//     chain.addPass("rays", "glsl/post.vert", "glsl/gods_ray.frag")
+//         .read("ColorBuffer", PostChain::SCENE_COLOR)
+//         .write(rays);
+//
+// Every pass gets texelSize, one over the size of its first input, and
+// whatever its uniforms function sets.
+struct PostPass {
+    typedef std::function<void (GLSLProgram &program, const Camera &camera)> Uniforms;
+
+    std::string name;
+    std::string vertex_filename, fragment_filename;
+    std::vector< std::pair<std::string, int> > inputs;  // sampler, target
+    int output;
+    Uniforms uniforms;
+    GLSLProgram *program;
+    bool failed;
+    GpuTimer timer;
+
+    PostPass(const char *name, const char *vertex_filename, const char *fragment_filename);
+    ~PostPass();
+
+    PostPass &read(const char *sampler, int target);
+    PostPass &write(int target);
+    PostPass &setUniforms(const Uniforms &uniforms);
+
+    bool load();
+};
+
+// A sequence of passes over the rendered scene.  The scene draws between
+// begin and end into SCENE_COLOR and SCENE_DEPTH; end runs the passes in
+// the order they were added.  Targets are declared up front with their
+// resolution, and the textures behind them are shared: a target's
+// lifetime runs from the pass that writes it to the last that reads it,
+// and targets whose lifetimes do not overlap use the same texture when
+// their format and resolution agree.  OUTPUT is the framebuffer bound at
+// begin, which the last pass should write.
+class PostChain {
+    struct Target {
+        std::string name;
+        PostFormat format;
+        int downsample;   // the size is the viewport's shifted right by this
+        int first, last;  // passes that write and last read it; -1 is the scene
+        int texture;      // index into textures
+    };
+    struct Texture {
+        GLuint object;
+        PostFormat format;
+        int downsample;
+        int width, height;
+    };
+
+    std::vector<Target> targets;
+    std::vector<PostPass *> passes;
+    std::vector<Texture> textures;
+    GLuint scene_fbo, pass_fbo;
+    GLint output_fbo;
+    GLint viewport[4];
+    bool compiled, failed;
+
+    bool compile();
+    bool allocate(int width, int height);
+    void bindOutput(int target);
+
+public:
+    enum {
+        SCENE_COLOR,
+        SCENE_DEPTH,
+        OUTPUT
+    };
+
+    PostChain();
+    ~PostChain();
+
+    // Forgets every pass and every target but the predefined ones.
+    void clear();
+
+    // downsample is 0 for full resolution, 1 for half, 2 for quarter and
+    // so on, down to a single pixel.
+    int addTarget(const char *name, int downsample = 0);
+    PostPass &addPass(const char *name, const char *vertex_filename, const char *fragment_filename);
+
+    int downsample(int target) const { return targets[target].downsample; }
+    bool empty() const { return passes.empty(); }
+    size_t targetCount() const { return targets.size(); }
+    size_t textureCount() const { return textures.size(); }
+
+    // Redirects drawing to the scene targets, sized to the viewport.
+    // False when the chain cannot run, leaving the framebuffer bound.
+    bool begin();
+    // Runs the passes.  camera is the one the scene was drawn with.
+    void end(const Camera &camera);
+
+    void printTimes(const char *name) const;
+};
+
+// Appends the screen-space edge pass: ink lines where depth or surface
+// orientation changes abruptly, composited over color.
+void addScreenEdges(PostChain &chain, int color, int depth, int output);
+// Appends light shafts streaming from the middle of the screen, gathered
+// at half resolution, smoothed with addBlur and added over color.
+void addGodRays(PostChain &chain, int color, int output);
+
+extern bool screen_edges;   // -edges
+extern float edge_width;    // -edgewidth, in pixels
+
+#endif // __post_hpp__
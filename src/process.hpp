@@ -0,0 +1,17 @@
+// process.hpp - POSIX process pipes under their Windows names too
+
+#ifndef __process_hpp__
+#define __process_hpp__
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+# pragma once
+#endif
+
+#include <stdio.h>
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#endif
+
+#endif // __process_hpp__
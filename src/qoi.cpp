@@ -0,0 +1,105 @@
+// qoi.cpp - QOI encoding of framebuffer images
+//
+// Follows the QOI specification 1.0 (qoiformat.org): each pixel becomes
+// a run of the one before, an index into the 64 most recently hashed
+// colors, a small difference from the one before, or the color itself.
+
+#include <stddef.h>
+
+#include "qoi.hpp"
+
+namespace {
+
+enum {
+    QOI_OP_INDEX = 0x00,
+    QOI_OP_DIFF = 0x40,
+    QOI_OP_LUMA = 0x80,
+    QOI_OP_RUN = 0xc0,
+    QOI_OP_RGB = 0xfe
+};
+
+const int max_run = 62;
+
+void putBigEndian(std::vector<unsigned char> &out, unsigned int v)
+{
+    out.push_back((unsigned char)(v >> 24));
+    out.push_back((unsigned char)(v >> 16));
+    out.push_back((unsigned char)(v >> 8));
+    out.push_back((unsigned char)v);
+}
+
+} // namespace
+
+void encodeQOI(const unsigned char *rgba, int width, int height, std::vector<unsigned char> &qoi)
+{
+    qoi.clear();
+    // The worst case is a tag and three bytes a pixel.
+    qoi.reserve(14 + size_t(width) * height * 4 + 8);
+    qoi.push_back('q');
+    qoi.push_back('o');
+    qoi.push_back('i');
+    qoi.push_back('f');
+    putBigEndian(qoi, unsigned(width));
+    putBigEndian(qoi, unsigned(height));
+    qoi.push_back(3);  // RGB
+    qoi.push_back(0);  // sRGB with linear alpha
+
+    // Colors as 0xrrggbb.  The table starts out transparent black, which
+    // no opaque color matches.
+    int seen[64];
+    for (int i=0; i<64; i++) {
+        seen[i] = -1;
+    }
+    // Alpha stays 255, so it counts in the hash as 255 * 11.
+    const int alpha_hash = 255 * 11;
+    int pr = 0, pg = 0, pb = 0;
+    int run = 0;
+    for (int y=height-1; y>=0; y--) {
+        const unsigned char *p = rgba + size_t(y) * width * 4;
+        for (int x=0; x<width; x++, p+=4) {
+            int r = p[0], g = p[1], b = p[2];
+            if (r == pr && g == pg && b == pb) {
+                if (++run == max_run) {
+                    qoi.push_back((unsigned char)(QOI_OP_RUN | (run - 1)));
+                    run = 0;
+                }
+                continue;
+            }
+            if (run > 0) {
+                qoi.push_back((unsigned char)(QOI_OP_RUN | (run - 1)));
+                run = 0;
+            }
+            int index = (r * 3 + g * 5 + b * 7 + alpha_hash) & 63;
+            int color = r << 16 | g << 8 | b;
+            if (seen[index] == color) {
+                qoi.push_back((unsigned char)(QOI_OP_INDEX | index));
+            } else {
+                seen[index] = color;
+                // Differences wrap around, as bytes do.
+                int dr = (signed char)(r - pr);
+                int dg = (signed char)(g - pg);
+                int db = (signed char)(b - pb);
+                int dr_dg = dr - dg, db_dg = db - dg;
+                if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                    qoi.push_back((unsigned char)(QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2)));
+                } else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7) {
+                    qoi.push_back((unsigned char)(QOI_OP_LUMA | (dg + 32)));
+                    qoi.push_back((unsigned char)((dr_dg + 8) << 4 | (db_dg + 8)));
+                } else {
+                    qoi.push_back(QOI_OP_RGB);
+                    qoi.push_back((unsigned char)r);
+                    qoi.push_back((unsigned char)g);
+                    qoi.push_back((unsigned char)b);
+                }
+            }
+            pr = r;
+            pg = g;
+            pb = b;
+        }
+    }
+    if (run > 0) {
+        qoi.push_back((unsigned char)(QOI_OP_RUN | (run - 1)));
+    }
+    static const unsigned char end_marker[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+    qoi.insert(qoi.end(), end_marker, end_marker + 8);
+}
@@ -0,0 +1,19 @@
+// qoi.hpp - QOI encoding of framebuffer images
+
+#ifndef __qoi_hpp__
+#define __qoi_hpp__
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+# pragma once
+#endif
+
+#include <vector>
+
+// width by height RGBA8 pixels, rows bottom first as glReadPixels returns
+// them, as a 3-channel sRGB QOI image with the top row first; alpha is
+// dropped.  A single pass over the pixels, several times faster than
+// encodePNG for files a little larger.  Safe to call from many threads at
+// once.
+void encodeQOI(const unsigned char *rgba, int width, int height, std::vector<unsigned char> &qoi);
+
+#endif // __qoi_hpp__
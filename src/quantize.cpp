@@ -0,0 +1,289 @@
+// quantize.cpp - batch vertex format conversions declared in <Cg/quantize.hpp>
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#include <Cg/vector.hpp>
+#include <Cg/quantize.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# include <emmintrin.h>
+# define QUANTIZE_USE_SSE2 1
+#endif
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+# include <immintrin.h>
+# define QUANTIZE_HAVE_F16C 1
+#endif
+
+namespace Cg {
+
+namespace {
+
+inline unsigned int floatBits(float f)
+{
+    unsigned int u;
+    memcpy(&u, &f, sizeof(u));
+    return u;
+}
+
+inline float bitsFloat(unsigned int u)
+{
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+inline float clampf(float v, float lo, float hi)
+{
+    return v < lo ? lo : (v > hi ? hi : v);
+}
+
+// Round to nearest even, including denormals; overflow becomes infinity and
+// NaNs stay (quiet) NaNs.
+unsigned short floatToHalf1(float value)
+{
+    unsigned int f = floatBits(value);
+    unsigned int sign = f & 0x80000000u;
+    unsigned int o;
+
+    f ^= sign;
+    if (f >= 0x47800000u) {             // too large for half, Inf or NaN
+        o = f > 0x7f800000u ? 0x7e00u : 0x7c00u;
+    } else if (f < 0x38800000u) {       // half denormal or zero
+        // Adding 0.5 aligns the mantissa so the FPU does the rounding.
+        o = floatBits(bitsFloat(f) + 0.5f) - 0x3f000000u;
+    } else {
+        unsigned int mantissa_odd = (f >> 13) & 1;
+        f += (unsigned int)(15 - 127) << 23;
+        f += 0xfffu + mantissa_odd;
+        o = f >> 13;
+    }
+    return (unsigned short)(o | (sign >> 16));
+}
+
+float halfToFloat1(unsigned short h)
+{
+    unsigned int sign = (unsigned int)(h & 0x8000u) << 16;
+    unsigned int exponent = (h >> 10) & 0x1fu;
+    unsigned int mantissa = h & 0x3ffu;
+    float f;
+
+    if (exponent == 0) {
+        f = ldexpf(float(mantissa), -24);
+    } else if (exponent == 31) {
+        f = bitsFloat(0x7f800000u | (mantissa << 13));
+    } else {
+        f = bitsFloat(((exponent + 127 - 15) << 23) | (mantissa << 13));
+    }
+    return sign ? -f : f;
+}
+
+void floatToHalfScalar(const float *in, unsigned short *out, size_t n)
+{
+    for (size_t i=0; i<n; i++) {
+        out[i] = floatToHalf1(in[i]);
+    }
+}
+
+void halfToFloatScalar(const unsigned short *in, float *out, size_t n)
+{
+    for (size_t i=0; i<n; i++) {
+        out[i] = halfToFloat1(in[i]);
+    }
+}
+
+#ifdef QUANTIZE_HAVE_F16C
+
+__attribute__((target("f16c")))
+void floatToHalfF16C(const float *in, unsigned short *out, size_t n)
+{
+    size_t i = 0;
+    for (; i+8<=n; i+=8) {
+        __m128i lo = _mm_cvtps_ph(_mm_loadu_ps(in+i), _MM_FROUND_TO_NEAREST_INT);
+        __m128i hi = _mm_cvtps_ph(_mm_loadu_ps(in+i+4), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out+i), _mm_unpacklo_epi64(lo, hi));
+    }
+    floatToHalfScalar(in+i, out+i, n-i);
+}
+
+__attribute__((target("f16c")))
+void halfToFloatF16C(const unsigned short *in, float *out, size_t n)
+{
+    size_t i = 0;
+    for (; i+4<=n; i+=4) {
+        __m128i h = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(in+i));
+        _mm_storeu_ps(out+i, _mm_cvtph_ps(h));
+    }
+    halfToFloatScalar(in+i, out+i, n-i);
+}
+
+#endif // QUANTIZE_HAVE_F16C
+
+struct HalfKernels {
+    const char *name;
+    void (*toHalf)(const float *in, unsigned short *out, size_t n);
+    void (*toFloat)(const unsigned short *in, float *out, size_t n);
+};
+
+const HalfKernels &selectHalfKernels()
+{
+#ifdef QUANTIZE_HAVE_F16C
+    static const HalfKernels f16c = { "f16c", floatToHalfF16C, halfToFloatF16C };
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("f16c")) {
+        return f16c;
+    }
+#endif
+    static const HalfKernels scalar = { "scalar", floatToHalfScalar, halfToFloatScalar };
+    return scalar;
+}
+
+const HalfKernels &halfKernels()
+{
+    static const HalfKernels &selected = selectHalfKernels();
+    return selected;
+}
+
+// Scales clamped values into [lo,hi] integers with round-to-nearest-even,
+// which is also what _mm_cvtps_epi32 does in the default rounding mode.
+inline int quantize1(float v, float lo, float hi, float scale)
+{
+    return int(lrintf(clampf(v, lo, hi) * scale));
+}
+
+} // namespace
+
+void floatToHalf(const float *in, unsigned short *out, size_t n)
+{
+    halfKernels().toHalf(in, out, n);
+}
+
+void halfToFloat(const unsigned short *in, float *out, size_t n)
+{
+    halfKernels().toFloat(in, out, n);
+}
+
+void floatToSnorm16(const float *in, short *out, size_t n)
+{
+    size_t i = 0;
+#ifdef QUANTIZE_USE_SSE2
+    const __m128 lo = _mm_set1_ps(-1), hi = _mm_set1_ps(1), scale = _mm_set1_ps(32767);
+    for (; i+8<=n; i+=8) {
+        __m128 a = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in+i), lo), hi);
+        __m128 b = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in+i+4), lo), hi);
+        __m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(_mm_mul_ps(a, scale)),
+                                         _mm_cvtps_epi32(_mm_mul_ps(b, scale)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out+i), packed);
+    }
+#endif
+    for (; i<n; i++) {
+        out[i] = short(quantize1(in[i], -1, 1, 32767));
+    }
+}
+
+void floatToUnorm16(const float *in, unsigned short *out, size_t n)
+{
+    size_t i = 0;
+#ifdef QUANTIZE_USE_SSE2
+    // SSE2 has no unsigned 32-to-16 pack, so bias into signed range first.
+    const __m128 lo = _mm_set1_ps(0), hi = _mm_set1_ps(1), scale = _mm_set1_ps(65535);
+    const __m128i bias32 = _mm_set1_epi32(32768), bias16 = _mm_set1_epi16(short(0x8000));
+    for (; i+8<=n; i+=8) {
+        __m128 a = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in+i), lo), hi);
+        __m128 b = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in+i+4), lo), hi);
+        __m128i ia = _mm_sub_epi32(_mm_cvtps_epi32(_mm_mul_ps(a, scale)), bias32);
+        __m128i ib = _mm_sub_epi32(_mm_cvtps_epi32(_mm_mul_ps(b, scale)), bias32);
+        __m128i packed = _mm_xor_si128(_mm_packs_epi32(ia, ib), bias16);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out+i), packed);
+    }
+#endif
+    for (; i<n; i++) {
+        out[i] = (unsigned short)(quantize1(in[i], 0, 1, 65535));
+    }
+}
+
+void floatToUnorm8(const float *in, unsigned char *out, size_t n)
+{
+    size_t i = 0;
+#ifdef QUANTIZE_USE_SSE2
+    const __m128 lo = _mm_set1_ps(0), hi = _mm_set1_ps(1), scale = _mm_set1_ps(255);
+    for (; i+16<=n; i+=16) {
+        __m128i q[4];
+        for (int k=0; k<4; k++) {
+            __m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in+i+4*k), lo), hi);
+            q[k] = _mm_cvtps_epi32(_mm_mul_ps(v, scale));
+        }
+        __m128i packed = _mm_packus_epi16(_mm_packs_epi32(q[0], q[1]), _mm_packs_epi32(q[2], q[3]));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out+i), packed);
+    }
+#endif
+    for (; i<n; i++) {
+        out[i] = (unsigned char)(quantize1(in[i], 0, 1, 255));
+    }
+}
+
+// Projects n onto the octahedron |x|+|y|+|z| = 1 and folds the lower half
+// over the diagonals so the whole sphere maps onto the [-1,1] square.
+void encodeOctahedral(const float3_soa & normals, short *out)
+{
+    const size_t n = normals.size();
+    const float *x = n ? &normals.x[0] : NULL;
+    const float *y = n ? &normals.y[0] : NULL;
+    const float *z = n ? &normals.z[0] : NULL;
+    size_t i = 0;
+#ifdef QUANTIZE_USE_SSE2
+    const __m128 sign_bit = _mm_set1_ps(-0.0f), one = _mm_set1_ps(1);
+    const __m128 tiny = _mm_set1_ps(FLT_MIN), scale = _mm_set1_ps(32767);
+    for (; i+4<=n; i+=4) {
+        __m128 nx = _mm_loadu_ps(x+i), ny = _mm_loadu_ps(y+i), nz = _mm_loadu_ps(z+i);
+        __m128 l1 = _mm_add_ps(_mm_add_ps(_mm_andnot_ps(sign_bit, nx), _mm_andnot_ps(sign_bit, ny)),
+                               _mm_andnot_ps(sign_bit, nz));
+        __m128 inv = _mm_div_ps(one, _mm_max_ps(l1, tiny));
+        __m128 px = _mm_mul_ps(nx, inv), py = _mm_mul_ps(ny, inv);
+        // Lower hemisphere: ((1-|py|)*sign(px), (1-|px|)*sign(py))
+        __m128 fx = _mm_or_ps(_mm_sub_ps(one, _mm_andnot_ps(sign_bit, py)), _mm_and_ps(px, sign_bit));
+        __m128 fy = _mm_or_ps(_mm_sub_ps(one, _mm_andnot_ps(sign_bit, px)), _mm_and_ps(py, sign_bit));
+        __m128 lower = _mm_cmplt_ps(nz, _mm_setzero_ps());
+        px = _mm_or_ps(_mm_and_ps(lower, fx), _mm_andnot_ps(lower, px));
+        py = _mm_or_ps(_mm_and_ps(lower, fy), _mm_andnot_ps(lower, py));
+        __m128i qx = _mm_cvtps_epi32(_mm_mul_ps(px, scale));
+        __m128i qy = _mm_cvtps_epi32(_mm_mul_ps(py, scale));
+        // Interleave to u0 v0 u1 v1 ... as 16-bit values.
+        __m128i uv = _mm_packs_epi32(_mm_unpacklo_epi32(qx, qy), _mm_unpackhi_epi32(qx, qy));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out+2*i), uv);
+    }
+#endif
+    for (; i<n; i++) {
+        float l1 = fabsf(x[i]) + fabsf(y[i]) + fabsf(z[i]);
+        float inv = 1 / (l1 > FLT_MIN ? l1 : FLT_MIN);
+        float px = x[i]*inv, py = y[i]*inv;
+        if (z[i] < 0) {
+            float fx = (1 - fabsf(py)) * (px < 0 || (px == 0 && signbit(px)) ? -1 : 1);
+            float fy = (1 - fabsf(px)) * (py < 0 || (py == 0 && signbit(py)) ? -1 : 1);
+            px = fx;
+            py = fy;
+        }
+        out[2*i+0] = short(quantize1(px, -1, 1, 32767));
+        out[2*i+1] = short(quantize1(py, -1, 1, 32767));
+    }
+}
+
+float3 decodeOctahedral(short u, short v)
+{
+    float x = clampf(u / 32767.0f, -1, 1);
+    float y = clampf(v / 32767.0f, -1, 1);
+    float z = 1 - fabsf(x) - fabsf(y);
+    float t = z < 0 ? -z : 0;
+    x += x >= 0 ? -t : t;
+    y += y >= 0 ? -t : t;
+    float len = sqrtf(x*x + y*y + z*z);
+    return float3(x/len, y/len, z/len);
+}
+
+const char *quantizeKernelName()
+{
+    return halfKernels().name;
+}
+
+} // namespace Cg
@@ -0,0 +1,36 @@
+// raster.hpp - arithmetic shared by the CPU rasterizers and shaders
+
+#ifndef __raster_hpp__
+#define __raster_hpp__
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+# pragma once
+#endif
+
+#include <math.h>
+
+// Plain comparisons, which unlike fminf and fmaxf need no NaN handling
+// and so compile to single instructions.
+inline float min2(float a, float b) { return a < b ? a : b; }
+inline float max2(float a, float b) { return a > b ? a : b; }
+inline float min3(float a, float b, float c) { return min2(min2(a, b), c); }
+inline float max3(float a, float b, float c) { return max2(max2(a, b), c); }
+
+// Pixel index range whose centers lie in [lo,hi), within [0,size).
+inline void pixelSpan(float lo, float hi, int size, int &first, int &last)
+{
+    lo = lo < 0 ? 0 : lo;
+    hi = hi > size ? size : hi;
+    first = int(ceilf(lo - 0.5f));
+    last = int(ceilf(hi - 0.5f)) - 1;
+}
+
+// GLSL's pow as GPUs evaluate it, through exp2 and log2, so a negative
+// base gives NaN; that is returned directly, as log2f takes a slow path
+// to report the domain error.
+inline float glslPow(float x, float y)
+{
+    return x < 0 ? NAN : exp2f(y * log2f(x));
+}
+
+#endif // __raster_hpp__
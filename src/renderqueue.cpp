@@ -0,0 +1,174 @@
+// renderqueue.cpp - sorted draw packets and a cache of bound GL state
+
+#include <stdio.h>
+#include <string.h>
+
+#include "renderqueue.hpp"
+
+RenderState render_state;
+
+namespace {
+
+// Key layout, most significant first.  Ids are handed out per frame in
+// order of first appearance, so the fields only need to hold a frame's
+// worth of distinct programs and materials.
+const int depth_bits = 24;
+const int material_bits = 12;
+const int program_bits = 12;
+const int material_shift = depth_bits;
+const int program_shift = material_shift + material_bits;
+const int pass_shift = program_shift + program_bits;
+
+template <typename T>
+unsigned long long idOf(std::vector<T> &ids, T value, int bits)
+{
+    for (size_t i=0; i<ids.size(); i++) {
+        if (ids[i] == value) {
+            return i;
+        }
+    }
+    ids.push_back(value);
+    // Past the field's range ids share its last value, which only costs
+    // some state changes.
+    unsigned long long limit = (1ull << bits) - 1;
+    return ids.size() - 1 < limit ? ids.size() - 1 : limit;
+}
+
+} // namespace
+
+void RenderQueue::clear()
+{
+    packets.clear();
+    programs.clear();
+    materials.clear();
+}
+
+void RenderQueue::push(RenderPass pass, GLuint program, const void *material, float depth, size_t item)
+{
+    depth = depth < 0 ? 0 : depth > 1 ? 1 : depth;
+    unsigned long long max_depth = (1ull << depth_bits) - 1;
+    unsigned long long d = (unsigned long long)(depth * max_depth);
+    if (pass == RENDER_PASS_BLENDED) {
+        d = max_depth - d;
+    }
+    RenderPacket packet;
+    packet.key = (unsigned long long)pass << pass_shift
+               | idOf(programs, program, program_bits) << program_shift
+               | idOf(materials, material, material_bits) << material_shift
+               | d;
+    packet.item = item;
+    packets.push_back(packet);
+}
+
+void RenderQueue::sort()
+{
+    size_t n = packets.size();
+    if (n < 2) {
+        return;
+    }
+    unsigned long long all_or = 0, all_and = ~0ull;
+    for (size_t i=0; i<n; i++) {
+        all_or |= packets[i].key;
+        all_and &= packets[i].key;
+    }
+    scratch.resize(n);
+    for (int shift=0; shift<64; shift+=8) {
+        // A byte that no key differs in leaves the order as it is.
+        if ((((all_or ^ all_and) >> shift) & 0xff) == 0) {
+            continue;
+        }
+        size_t offsets[256];
+        memset(offsets, 0, sizeof(offsets));
+        for (size_t i=0; i<n; i++) {
+            offsets[(packets[i].key >> shift) & 0xff]++;
+        }
+        size_t total = 0;
+        for (int b=0; b<256; b++) {
+            size_t count = offsets[b];
+            offsets[b] = total;
+            total += count;
+        }
+        for (size_t i=0; i<n; i++) {
+            scratch[offsets[(packets[i].key >> shift) & 0xff]++] = packets[i];
+        }
+        packets.swap(scratch);
+    }
+}
+
+RenderStats::RenderStats()
+    : packets(0)
+    , program_binds(0), program_binds_avoided(0)
+    , texture_binds(0), texture_binds_avoided(0)
+{
+}
+
+void RenderStats::print(const char *name) const
+{
+    printf("%s: %d draw packets, %d of %d program binds and %d of %d texture binds avoided\n",
+           name, packets,
+           program_binds_avoided, program_binds + program_binds_avoided,
+           texture_binds_avoided, texture_binds + texture_binds_avoided);
+}
+
+RenderState::RenderState()
+    : active(false)
+{
+    forget();
+}
+
+// ~0 is never a GL object name, so nothing is taken to be bound.
+void RenderState::forget()
+{
+    program = ~0u;
+    unit = ~0u;
+    for (int i=0; i<max_units; i++) {
+        textures_2d[i] = ~0u;
+        cube_maps[i] = ~0u;
+    }
+}
+
+void RenderState::begin()
+{
+    forget();
+    stats = RenderStats();
+    active = true;
+}
+
+void RenderState::end()
+{
+    active = false;
+    forget();
+}
+
+void RenderState::useProgram(GLuint p)
+{
+    if (active && p == program) {
+        stats.program_binds_avoided++;
+        return;
+    }
+    glUseProgram(p);
+    program = p;
+    stats.program_binds++;
+}
+
+void RenderState::bindTexture(GLenum u, GLenum target, GLuint texture)
+{
+    int i = int(u - GL_TEXTURE0);
+    GLuint *bound = NULL;
+    if (i >= 0 && i < max_units) {
+        bound = target == GL_TEXTURE_CUBE_MAP ? &cube_maps[i] : &textures_2d[i];
+    }
+    if (active && bound && *bound == texture) {
+        stats.texture_binds_avoided++;
+        return;
+    }
+    if (!active || u != unit) {
+        glActiveTexture(u);
+        unit = u;
+    }
+    glBindTexture(target, texture);
+    if (bound) {
+        *bound = texture;
+    }
+    stats.texture_binds++;
+}
@@ -0,0 +1,93 @@
+// renderqueue.hpp - sorted draw packets and a cache of bound GL state
+
+#ifndef __renderqueue_hpp__
+#define __renderqueue_hpp__
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+# pragma once
+#endif
+
+#include <stddef.h>
+
+#include <vector>
+
+#include <GL/glew.h>
+
+// Passes draw in this order.
+enum RenderPass {
+    RENDER_PASS_OPAQUE,   // front to back, so early depth testing rejects more
+    RENDER_PASS_BLENDED   // back to front
+};
+
+// One draw, with a key that orders packets by pass, then program, then
+// material, then depth, so neighbouring packets share as much bound state
+// as possible.  item is the caller's, typically an index into its list of
+// things to draw.
+struct RenderPacket {
+    unsigned long long key;
+    size_t item;
+};
+
+class RenderQueue {
+    std::vector<RenderPacket> packets;
+    std::vector<RenderPacket> scratch;   // for sort
+    std::vector<GLuint> programs;        // key ids in order of first push
+    std::vector<const void *> materials;
+
+public:
+    void clear();
+
+    // depth is 0 at the near plane and 1 at the far plane; it is clamped.
+    // material need only identify the set of textures bound for the draw.
+    void push(RenderPass pass, GLuint program, const void *material, float depth, size_t item);
+
+    // A least significant digit first radix sort on the keys, a byte per
+    // pass, skipping bytes that all keys share.  Stable, so equal keys
+    // keep the order they were pushed in.
+    void sort();
+
+    size_t size() const { return packets.size(); }
+    const RenderPacket &operator [](size_t i) const { return packets[i]; }
+};
+
+// Binds issued and skipped as redundant since the frame began.
+struct RenderStats {
+    int packets;
+    int program_binds, program_binds_avoided;
+    int texture_binds, texture_binds_avoided;
+
+    RenderStats();
+    void print(const char *name) const;
+};
+
+// Shadows the program and texture bindings so that binding what is
+// already bound costs nothing.  Only trusted between begin and end, when
+// the scene's draws are the only code binding state; outside that every
+// call goes straight to GL.
+class RenderState {
+    enum { max_units = 8 };
+
+    bool active;
+    GLuint program;
+    GLenum unit;
+    GLuint textures_2d[max_units], cube_maps[max_units];
+
+    void forget();
+
+public:
+    RenderStats stats;
+
+    RenderState();
+
+    // GL's state is unknown at begin; stats start over.
+    void begin();
+    void end();
+
+    void useProgram(GLuint program);
+    // target is GL_TEXTURE_2D or GL_TEXTURE_CUBE_MAP; unit is GL_TEXTUREi.
+    void bindTexture(GLenum unit, GLenum target, GLuint texture);
+};
+
+extern RenderState render_state;
+
+#endif // __renderqueue_hpp__
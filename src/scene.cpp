@@ -16,6 +16,8 @@
 using std::vector;
 
 #include <ctime>
+#include <chrono>
+#include <random>
 
 #include <boost/shared_ptr.hpp>
 using boost::shared_ptr;
@@ -30,14 +32,20 @@ using boost::shared_ptr;
 #include <Cg/length.hpp>
 #include <Cg/sin.hpp>
 #include <Cg/cos.hpp>
+#include <Cg/inverse.hpp>
+#include <Cg/batch.hpp>
 #include <Cg/mul.hpp>
 #include <Cg/stdlib.hpp>
 #include <Cg/iostream.hpp>
 
 #include "global.hpp"
 #include "scene.hpp"
+#include "mesh_optimize.hpp"
+#include "frustum.hpp"
+#include "parallel.hpp"
 #include "glmatrix.hpp"
 #include "matrix_stack.hpp"
+#include "timesource.hpp"
 
 
 using namespace Cg;
@@ -219,9 +227,10 @@ bool GLSLProgram::validate()
             glGetProgramiv(program_object, GL_LINK_STATUS, &linked);
             if (verbose || !linked) {
                 showInfoLog("linked program");
+            }
+            if (!linked) {
                 return false;
             }
-            assert(linked == GL_TRUE);
         }
     }
     return true;
@@ -254,7 +263,7 @@ void GLSLProgram::use()
 {
     validate();
     assert(program_object);
-    glUseProgram(program_object);
+    render_state.useProgram(program_object);
 }
 
 void GLSLProgram::reset()
@@ -311,6 +320,15 @@ void GLSLProgram::setVec1f(const char *name, float v)
     }
 }
 
+void GLSLProgram::setVec1i(const char *name, int v)
+{
+    use();
+    GLint loc = glGetUniformLocation(program_object, name);
+    if (loc >= 0) {
+        glUniform1i(loc, v);
+    }
+}
+
 void GLSLProgram::setVec2f(const char *name, float2 v)
 {
     use();
@@ -376,11 +394,22 @@ GLint GLSLProgram::getLocation(const char *name)
   return location;
 }
 
+// The same frame number and times reach every program drawn in a frame;
+// see timesource.hpp.
+static void setFrameTime(GLSLProgram &program)
+{
+    program.setVec1i("frameIndex", frame_time.frame());
+    program.setVec1f("timePreviousFrame", float(frame_time.previousTime()));
+    program.setVec1f("timeCurrentFrame", float(frame_time.time()));
+}
+
 GLSLProgram::~GLSLProgram()
 {
     reset();
 }
 
+static const float torus_outer_radius = 1.5, torus_inner_radius = 0.5;
+
 void Torus::loadProgram()
 {
     VertexShader vs;
@@ -397,9 +426,8 @@ void Torus::loadProgram()
             glBindAttribLocation(program.program_object, 0, "parametric");
             glLinkProgram(program.program_object);
             GLint torusInfo_location = program.getLocation("torusInfo");
-            const float outerRadius = 1.5, innerRadius = 0.5;
             program.use();
-            glUniform2f(torusInfo_location, outerRadius, innerRadius);
+            glUniform2f(torusInfo_location, torus_outer_radius, torus_inner_radius);
 
             // Assign samplers statically to texture units 0 through 3
             program.setSampler("normalMap", 0);
@@ -435,6 +463,14 @@ Torus::Torus(Transform t, MaterialPtr m)
 Torus::~Torus() {
 }
 
+// The torus shader's axis is not fixed here, so bound it on every axis.
+bool Torus::getBounds(float3& lo, float3& hi) const {
+    float r = torus_outer_radius + torus_inner_radius;
+    lo = float3(-r,-r,-r);
+    hi = float3(r,r,r);
+    return true;
+}
+
 void Torus::draw(const View& view, LightPtr light) {
     program.use();
 
@@ -457,6 +493,7 @@ void Torus::draw(const View& view, LightPtr light) {
     program.setVec1f("shininess", material->shininess);
 
     program.setMat3f("objectToWorld", transform);
+    setFrameTime(program);
     
     ERR_CHECK();
 
@@ -465,12 +502,46 @@ void Torus::draw(const View& view, LightPtr light) {
     popGLMatrix(GL_MODELVIEW);
 }
 
+// In pixels.
+static const float outline_width = 2.0f;
+
 void ModelObject::setOutline(){
     if(outline){
         outline = false;
     }
     else{
         outline = true;
+        if (!outline_program.program_object) {
+            loadOutlineProgram();
+        }
+    }
+}
+
+// Silhouette and crease lines in a flat color.
+void ModelObject::loadOutlineProgram()
+{
+    VertexShader vs;
+    FragmentShader fs;
+    bool vs_ok = vs.readTextFile("glsl/outline.vert");
+    bool fs_ok = fs.readTextFile("glsl/outline.frag");
+    if (vs_ok && fs_ok) {
+        GLSLProgram new_program(vs.getShader(), fs.getShader());
+        vs.release();
+        fs.release();
+        bool ok = new_program.validate();
+        if (ok) {
+            outline_program.swap(new_program);
+            bindPackedAttributes(outline_program.program_object);
+        } else {
+            printf("GLSL shader compilation failed\n");
+        }
+    } else {
+        if (!vs_ok) {
+            printf("Vertex shader failed to load\n");
+        }
+        if (!fs_ok) {
+            printf("Fragment shader failed to load\n");
+        }
     }
 }
 void ModelObject::setExplosion(bool val){
@@ -501,6 +572,7 @@ void ModelObject::loadGodsRay(){
         bool ok = new_program.validate();
         if (ok) {
             lighting.swap(new_program);
+            bindPackedAttributes(lighting.program_object);
             lighting.use();
         } else {
             printf("GLSL shader compilation failed\n");
@@ -513,34 +585,6 @@ void ModelObject::loadGodsRay(){
             printf("Fragment shader failed to load\n");
         }
     }
-
-    VertexShader vs_ray;
-    FragmentShader fs_ray;
-
-    vertex_f = "glsl/gods_ray.vert";
-    frag_f = "glsl/gods_ray.frag";
-
-    vs_ok = vs_ray.readTextFile(vertex_f.c_str());
-    fs_ok = fs_ray.readTextFile(frag_f.c_str());
-    if (vs_ok && fs_ok) {
-        GLSLProgram new_program(vs_ray.getShader(), fs_ray.getShader());
-        vs_ray.release();
-        fs_ray.release();
-        bool ok = new_program.validate();
-        if (ok) {
-            rays.swap(new_program);
-            rays.use();
-        } else {
-            printf("GLSL shader compilation failed\n");
-        }
-    } else {
-        if (!vs_ok) {
-            printf("Vertex shader failed to load\n");
-        }
-        if (!fs_ok) {
-            printf("Fragment shader failed to load\n");
-        }
-    }
 }
 void ModelObject::loadExplosionProgram()
 {
@@ -559,6 +603,7 @@ void ModelObject::loadExplosionProgram()
         bool ok = new_program.validate();
         if (ok) {
             explosion_program.swap(new_program);
+            bindPackedAttributes(explosion_program.program_object);
             explosion_program.use();
             explosion_program.setSampler("normalMap", 0);
             explosion_program.setSampler("texture", 1);
@@ -595,6 +640,7 @@ void ModelObject::loadExplosion2Program()
         bool ok = new_program.validate();
         if (ok) {
             explosion2_program.swap(new_program);
+            bindPackedAttributes(explosion2_program.program_object);
             explosion2_program.use();
             explosion2_program.setSampler("normalMap", 0);
             explosion2_program.setSampler("texture", 1);
@@ -632,12 +678,13 @@ void ModelObject::loadRandomProgram()
         fs_explosion.release();
         bool ok = new_program.validate();
         if (ok) {
-            explosion2_program.swap(new_program);
-            explosion2_program.use();
-            explosion2_program.setSampler("normalMap", 0);
-            explosion2_program.setSampler("texture", 1);
-            explosion2_program.setSampler("heightField", 2);
-            explosion2_program.setSampler("envmap", 3);
+            random_program.swap(new_program);
+            bindPackedAttributes(random_program.program_object);
+            random_program.use();
+            random_program.setSampler("normalMap", 0);
+            random_program.setSampler("texture", 1);
+            random_program.setSampler("heightField", 2);
+            random_program.setSampler("envmap", 3);
         } else {
             printf("GLSL shader compilation failed\n");
         }
@@ -664,6 +711,7 @@ void ModelObject::loadProgram()
         bool ok = new_program.validate();
         if (ok) {
             program.swap(new_program);
+            bindPackedAttributes(program.program_object);
            // glBindAttribLocation(program.program_object, 0, "parametric");
            // glLinkProgram(program.program_object);
            // GLint torusInfo_location = program.getLocation("torusInfo");
@@ -689,30 +737,99 @@ void ModelObject::loadProgram()
     }
 }
 
+// Reorders each shape's triangles and vertices for the post-transform
+// cache and overdraw and simplifies it into levels of detail, one shape
+// per thread.
+static void optimizeShapes(const std::string& filename, std::vector<tinyobj::shape_t>& shapes,
+                           std::vector< std::vector<MeshLod> >& lods) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<VertexCacheStats> before(shapes.size()), after(shapes.size());
+    lods.assign(shapes.size(), std::vector<MeshLod>());
+    parallelFor(0, int(shapes.size()), 1, [&](int first, int last) {
+        for (int i = first; i < last; i++) {
+            optimizeMesh(shapes[i].mesh, before[i], after[i]);
+            buildLodChain(shapes[i].mesh, lods[i]);
+        }
+    });
+    VertexCacheStats total_before, total_after;
+    for (size_t i = 0; i < shapes.size(); i++) {
+        total_before.add(before[i]);
+        total_after.add(after[i]);
+    }
+    if (verbose) {
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        printf("%s: vertex cache ACMR %.3f -> %.3f, ATVR %.3f -> %.3f (%.1f ms)\n", filename.c_str(),
+               total_before.acmr(), total_after.acmr(), total_before.atvr(), total_after.atvr(), ms);
+    }
+}
+
+// Loads folder_path + file_name into shapes and a packed mesh, through
+// the mesh cache when it is on, and uploads it.  False if the OBJ could
+// not be read.
+static bool loadPackedMesh(const std::string& filename, const std::string& folderpath,
+                           std::vector<tinyobj::shape_t>& shapes, PackedMesh& packed) {
+    // Half-float vertex attributes are core in OpenGL 3.0; without them the
+    // packed vertex keeps float texcoords.
+    bool half_texcoords = GLEW_ARB_half_float_vertex || GLEW_VERSION_3_0;
+    std::string obj_filename = folderpath + filename;
+    std::string cache_filename = obj_filename + ".mesh";
+    bool cached = mesh_cache &&
+        packed.readCache(cache_filename.c_str(), obj_filename.c_str(), half_texcoords,
+                         mesh_optimize, shapes);
+    if (!cached) {
+        std::string err = tinyobj::LoadObj(shapes, obj_filename.c_str(), folderpath.c_str());
+
+        if (!err.empty()) {
+            std::cerr << err << std::endl;
+            return false;
+        }
+
+        std::vector< std::vector<MeshLod> > lods;
+        if (mesh_optimize) {
+            optimizeShapes(filename, shapes, lods);
+        }
+        packed.build(shapes, lods, half_texcoords);
+        packed.optimized = mesh_optimize;
+        if (verbose) {
+            packed.report(filename.c_str(), shapes);
+        }
+        if (mesh_cache && !packed.writeCache(cache_filename.c_str(), obj_filename.c_str(), shapes)) {
+            printf("%s: could not write mesh cache %s\n", program_name, cache_filename.c_str());
+        }
+    } else if (verbose) {
+        printf("%s: read packed mesh from %s\n", filename.c_str(), cache_filename.c_str());
+    }
+    if (!without_gl) {
+        packed.tellGL();
+    }
+    return true;
+}
+
 ModelObject::ModelObject(std::string file_name, std::string folder_path, Transform t, MaterialPtr m)
 : Object(t, m), filename(file_name), folderpath(folder_path)
 {
     std::cout << "Constructing '" << filename << "'" << std::endl;
     outline = false;
+    godsRay = false;
     explosion =false;
     random = false;
     explosion2 = false;
-    std::string err = tinyobj::LoadObj(shapes, (folderpath+filename).c_str(), folderpath.c_str());
-    
-
-    if (!err.empty()) {
-        std::cerr << err << std::endl;
+    if (!loadPackedMesh(filename, folderpath, shapes, packed)) {
         return;
     }
-    
+
     // print(); 
+    if (verbose) {
+        printBounds();
+    }
     
     vertex_filename = "glsl/model.vert";
     fragment_filename = "glsl/phong.frag";
-    
-    clockStartProgram = clock();
 
     loadTexture();
+    if (without_gl) {
+        return;  // the software renderer needs no programs
+    }
     if(explosion){
         loadExplosionProgram();
     }
@@ -733,6 +850,77 @@ ModelObject::~ModelObject() {
     std::cout << "Destructing '" << filename << "'" << std::endl;
 }
 
+// Level of detail for the coming frame: the camera's vertical field of
+// view over the viewport height gives how many pixels a unit of error at
+// unit distance covers.
+void ModelObject::selectLod(const Camera& camera, const View& view, int viewport_height) {
+    float pixel_scale = viewport_height / (2 * tanf(camera.fov_degrees * float(M_PI / 360)));
+    float4 eye_position_object_space = mul(transform.getInverseMatrix(), float4(view.eye_position,1));
+    packed.selectLods(eye_position_object_space.xyz / eye_position_object_space.w,
+                      pixel_scale, lod_pixel_error);
+}
+
+// Enough for the big shapes of the models here at their selected levels
+// while keeping the software rasterizer to a fraction of a millisecond.
+static const size_t occluder_triangle_budget = 16384;
+
+// The model's biggest visible shapes into the occlusion buffer, after
+// selectLod and before cull.  The explosion shaders move vertices, so
+// their models hide nothing.
+void ModelObject::renderOccluders(const Camera& camera, const View& view, OcclusionBuffer& occlusion) {
+    if (explosion || explosion2 || random) {
+        return;
+    }
+    float4x4 clip_from_object = mul(camera.projection_matrix, mul(view.view_matrix, transform.getMatrix()));
+    float4 eye_position_object_space = mul(transform.getInverseMatrix(), float4(view.eye_position,1));
+    packed.rasterizeOccluders(clip_from_object, eye_position_object_space.xyz / eye_position_object_space.w,
+                              occlusion, occluder_triangle_budget);
+}
+
+// Shape and meshlet culling for the coming frame.  The explosion shaders
+// move vertices out of their bounds, so those skip it.
+void ModelObject::cull(const Camera& camera, const View& view, const OcclusionBuffer *occlusion,
+                       CullStats& stats) {
+    if (explosion || explosion2 || random) {
+        packed.uncull();
+        return;
+    }
+    float4x4 clip_from_object = mul(camera.projection_matrix, mul(view.view_matrix, transform.getMatrix()));
+    float4 eye_position_object_space = mul(transform.getInverseMatrix(), float4(view.eye_position,1));
+    packed.cull(clip_from_object, eye_position_object_space.xyz / eye_position_object_space.w,
+                meshlet_culling, true, occlusion, stats);
+}
+
+// Must agree with the choice draw makes.
+GLuint ModelObject::drawProgram() const {
+    if (godsRay) {
+        return lighting.program_object;
+    }
+    if (explosion) {
+        return explosion_program.program_object;
+    }
+    if (explosion2) {
+        return explosion2_program.program_object;
+    }
+    if (random) {
+        return random_program.program_object;
+    }
+    return program.program_object;
+}
+
+void ModelObject::printBounds() {
+    for (size_t i = 0; i < shapes.size(); i++) {
+        float3_soa positions;
+        float3 lo, hi;
+        deinterleave(shapes[i].mesh.positions, positions);
+        if (boundingBox(positions, lo, hi)) {
+            printf("shape[%zu] '%s' bounds (%f, %f, %f) to (%f, %f, %f)\n", i, shapes[i].name.c_str(),
+                   double(lo[0]), double(lo[1]), double(lo[2]), double(hi[0]), double(hi[1]), double(hi[2]));
+        }
+    }
+    printf("batch kernels: %s\n", batchKernelName());
+}
+
 void ModelObject::print() {
     std::cout << "# of shapes : " << shapes.size() << std::endl;
 
@@ -777,153 +965,13 @@ void ModelObject::print() {
 void ModelObject::draw(const View& view, LightPtr light) {
 
 
+    // The rays themselves are a post pass over what this draws; see
+    // addGodRays.
     if(godsRay){
-
-        //printf("HERER\n" );
-        bool WireFrame = false;
-        bool blur = false;
-
-// generate textures ------------------------------------------------------------------------------------------------------
-
-    glGenTextures(1, &ColorBuffer);
-    glGenTextures(1, &DepthBuffer);
-
-    // generate FBO -----------------------------------------------------------------------------------------------------------
-
-    glGenFramebuffersEXT(1, &FBO);
-
-    if(blur)
-    {
-        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, FBO);
-        glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, ColorBuffer, 0);
-        glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_TEXTURE_2D, DepthBuffer, 0);
-    }
-
-
-
         pushAndMultGLMatrix(GL_MODELVIEW, transform.getMatrix());
         lighting.use();
-/* For every shape... */
-    for (size_t shapeId = 0; shapeId < shapes.size(); ++shapeId) {
-        
-        // assert((shapes[shapeId].mesh.indices.size() % 3) == 0);
-        
-        /* For every triangle face in the mesh... */
-        for (size_t indexId = 0; indexId < shapes[shapeId].mesh.indices.size(); indexId+=3) {
-            
-            float2 uvs;
-            
-            glBegin(GL_TRIANGLES);
-            
-            /* Vertex 0. */
-            size_t vertexId = shapes[shapeId].mesh.indices[indexId];
-            if (!shapes[shapeId].mesh.texcoords.empty()) {
-                uvs[0] = shapes[shapeId].mesh.texcoords[2*vertexId];
-                uvs[1] = shapes[shapeId].mesh.texcoords[2*vertexId+1];
-                                if( uvs[1] >10000000000000000 or   uvs[1]  < -10000000000000000){
-                    uvs[1] =0;
-                }
-              if( uvs[0] >10000000000000000 or   uvs[0]  < -10000000000000000){
-                    uvs[0] =0;
-                }
-                glTexCoord2f(uvs[0],uvs[1]);
-            }
-            if (shapes[shapeId].mesh.normals.size() > 0) {
-                glNormal3f(
-                           shapes[shapeId].mesh.normals[3*vertexId],
-                           shapes[shapeId].mesh.normals[3*vertexId+1],
-                           shapes[shapeId].mesh.normals[3*vertexId+2]
-                           );
-            }
-
-            glVertex3f(
-                       shapes[shapeId].mesh.positions[3*vertexId],
-                       shapes[shapeId].mesh.positions[3*vertexId+1],
-                       shapes[shapeId].mesh.positions[3*vertexId+2]
-                       );
-            
-            /* Vertex 1. */
-            vertexId = shapes[shapeId].mesh.indices[indexId+1];
-            if (!shapes[shapeId].mesh.texcoords.empty()) {
-                uvs[0] = shapes[shapeId].mesh.texcoords[2*vertexId];
-                uvs[1] = shapes[shapeId].mesh.texcoords[2*vertexId+1];
-                                if( uvs[1] >10000000000000000 or   uvs[1]  < -10000000000000000){
-                    uvs[1] =0;
-                }
-              if( uvs[0] >10000000000000000 or   uvs[0]  < -10000000000000000){
-                    uvs[0] =0;
-                }
-                glTexCoord2f(uvs[0],uvs[1]);
-            }
-            if (shapes[shapeId].mesh.normals.size() > 0) {
-                glNormal3f(
-                           shapes[shapeId].mesh.normals[3*vertexId],
-                           shapes[shapeId].mesh.normals[3*vertexId+1],
-                           shapes[shapeId].mesh.normals[3*vertexId+2]
-                           );
-            }
-
-            glVertex3f(
-                       shapes[shapeId].mesh.positions[3*vertexId],
-                       shapes[shapeId].mesh.positions[3*vertexId+1],
-                       shapes[shapeId].mesh.positions[3*vertexId+2]
-                       );
-            
-            /* Vertex 2. */
-            vertexId = shapes[shapeId].mesh.indices[indexId+2];
-            if (!shapes[shapeId].mesh.texcoords.empty()) {
-                uvs[0] = shapes[shapeId].mesh.texcoords[2*vertexId];
-                uvs[1] = shapes[shapeId].mesh.texcoords[2*vertexId+1];
-                                if( uvs[1] >10000000000000000 or   uvs[1]  < -10000000000000000){
-                    uvs[1] =0;
-                }
-              if( uvs[0] >10000000000000000 or   uvs[0]  < -10000000000000000){
-                    uvs[0] =0;
-                }
-                glTexCoord2f(uvs[0],uvs[1]);
-            }
-            if (shapes[shapeId].mesh.normals.size() > 0) {
-                glNormal3f(
-                           shapes[shapeId].mesh.normals[3*vertexId],
-                           shapes[shapeId].mesh.normals[3*vertexId+1],
-                           shapes[shapeId].mesh.normals[3*vertexId+2]
-                           );
-            }
-
-            glVertex3f(
-                       shapes[shapeId].mesh.positions[3*vertexId],
-                       shapes[shapeId].mesh.positions[3*vertexId+1],
-                       shapes[shapeId].mesh.positions[3*vertexId+2]
-                       );
-            
-            glEnd();
-        }
-    }
-
-
-        glUseProgram(0);
-
-    if(blur)
-    {
-        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
-
-        glBindTexture(GL_TEXTURE_2D, ColorBuffer);
-
-        rays.use();
-
-        glBegin(GL_QUADS);
-            glVertex2f(0.0f, 0.0f);
-            glVertex2f(1.0f, 0.0f);
-            glVertex2f(1.0f, 1.0f);
-            glVertex2f(0.0f, 1.0f);
-        glEnd();
-
-        glUseProgram(0);
-
-        glBindTexture(GL_TEXTURE_2D, 0);
-    }
-
-
+        setFrameTime(lighting);
+        packed.draw(lighting.program_object);
         popGLMatrix(GL_MODELVIEW);
     }
 
@@ -940,8 +988,9 @@ void ModelObject::draw(const View& view, LightPtr light) {
     float4 LMa = material->ambient*light->getColor();
     float4 LMd = material->diffuse*light->getColor();
     float4 LMs = material->specular*light->getColor();
+    GLSLProgram *active_program = &program;
     if(explosion){
-        glUseProgram(0);
+        active_program = &explosion_program;
         explosion_program.use();
         explosion_program.setVec3f("eyePosition", eye_position_object_space.xyz);
         explosion_program.setVec3f("lightPosition", light_position_object_space.xyz);
@@ -951,12 +1000,10 @@ void ModelObject::draw(const View& view, LightPtr light) {
         explosion_program.setVec1f("shininess", material->shininess);
         
         explosion_program.setMat3f("objectToWorld", transform);
-        // Send current frame time and previous frame time to gfx card.
-        explosion_program.setVec1f("timePreviousFrame", timePreviousFrame );
-        explosion_program.setVec1f("timeCurrentFrame", timeCurrentFrame );
+        setFrameTime(explosion_program);
     }
     else if(explosion2){
-        glUseProgram(0);
+        active_program = &explosion2_program;
         explosion2_program.use();
         explosion2_program.setVec3f("eyePosition", eye_position_object_space.xyz);
         explosion2_program.setVec3f("lightPosition", light_position_object_space.xyz);
@@ -966,12 +1013,10 @@ void ModelObject::draw(const View& view, LightPtr light) {
         explosion2_program.setVec1f("shininess", material->shininess);
         
         explosion2_program.setMat3f("objectToWorld", transform);
-        // Send current frame time and previous frame time to gfx card.
-        explosion2_program.setVec1f("timePreviousFrame", timePreviousFrame );
-        explosion2_program.setVec1f("timeCurrentFrame", timeCurrentFrame );  
+        setFrameTime(explosion2_program);
     }
     else if(random){
-        glUseProgram(0);
+        active_program = &random_program;
         random_program.use();
         random_program.setVec3f("eyePosition", eye_position_object_space.xyz);
         random_program.setVec3f("lightPosition", light_position_object_space.xyz);
@@ -981,12 +1026,9 @@ void ModelObject::draw(const View& view, LightPtr light) {
         random_program.setVec1f("shininess", material->shininess);
         
         random_program.setMat3f("objectToWorld", transform);
-        // Send current frame time and previous frame time to gfx card.
-        random_program.setVec1f("timePreviousFrame", timePreviousFrame );
-        random_program.setVec1f("timeCurrentFrame", timeCurrentFrame );  
+        setFrameTime(random_program);
     }
     else{
-        glUseProgram(0);
         program.use();        
         program.setVec3f("eyePosition", eye_position_object_space.xyz);
         program.setVec3f("lightPosition", light_position_object_space.xyz);
@@ -996,153 +1038,32 @@ void ModelObject::draw(const View& view, LightPtr light) {
         program.setVec1f("shininess", material->shininess);
         
         program.setMat3f("objectToWorld", transform);
-        // Send current frame time and previous frame time to gfx card.
-        program.setVec1f("timePreviousFrame", timePreviousFrame );
-        program.setVec1f("timeCurrentFrame", timeCurrentFrame );
+        setFrameTime(program);
     }
     
     pushAndMultGLMatrix(GL_MODELVIEW, transform.getMatrix());
-    if(!outline){
-    /* For every shape... */
-    for (size_t shapeId = 0; shapeId < shapes.size(); ++shapeId) {
-        // assert((shapes[shapeId].mesh.indices.size() % 3) == 0);
-        /* For every triangle face in the mesh... */
-        for (size_t indexId = 0; indexId < shapes[shapeId].mesh.indices.size(); indexId+=3) {
-        float2 uvs = float2(1.0,1.0);
-            glBegin(GL_TRIANGLES);
-            /* Vertex 0. */
-            size_t vertexId = shapes[shapeId].mesh.indices[indexId];
-            if (!shapes[shapeId].mesh.texcoords.empty()) {
-                uvs[0] = shapes[shapeId].mesh.texcoords[2*vertexId];
-                uvs[1] = shapes[shapeId].mesh.texcoords[2*vertexId+1];
-                                if( uvs[1] >10000000000000000 or   uvs[1]  < -10000000000000000){
-                    uvs[1] =0;
-                }
-              if( uvs[0] >10000000000000000 or   uvs[0]  < -10000000000000000){
-                    uvs[0] =0;
-                }
-                glTexCoord2f(uvs[0],uvs[1]);
-            }
-            if (shapes[shapeId].mesh.normals.size() > 0) {
-                glNormal3f(
-                           shapes[shapeId].mesh.normals[3*vertexId],
-                           shapes[shapeId].mesh.normals[3*vertexId+1],
-                           shapes[shapeId].mesh.normals[3*vertexId+2]
-                           );
-            }
-
-            glVertex3f(
-                       shapes[shapeId].mesh.positions[3*vertexId],
-                       shapes[shapeId].mesh.positions[3*vertexId+1],
-                       shapes[shapeId].mesh.positions[3*vertexId+2]
-                       );
-            
-            /* Vertex 1. */
-            vertexId = shapes[shapeId].mesh.indices[indexId+1];
-            if (!shapes[shapeId].mesh.texcoords.empty()) {
-                uvs[0] = shapes[shapeId].mesh.texcoords[2*vertexId];
-                uvs[1] = shapes[shapeId].mesh.texcoords[2*vertexId+1];
-                                if( uvs[1] >10000000000000000 or   uvs[1]  < -10000000000000000){
-                    uvs[1] =0;
-                }
-              if( uvs[0] >10000000000000000 or   uvs[0]  < -10000000000000000){
-                    uvs[0] =0;
-                }
-                glTexCoord2f(uvs[0],uvs[1]);
-            }
-            if (shapes[shapeId].mesh.normals.size() > 0) {
-                glNormal3f(
-                           shapes[shapeId].mesh.normals[3*vertexId],
-                           shapes[shapeId].mesh.normals[3*vertexId+1],
-                           shapes[shapeId].mesh.normals[3*vertexId+2]
-                           );
-            }
-
-            glVertex3f(
-                       shapes[shapeId].mesh.positions[3*vertexId],
-                       shapes[shapeId].mesh.positions[3*vertexId+1],
-                       shapes[shapeId].mesh.positions[3*vertexId+2]
-                       );
-            
-            /* Vertex 2. */
-            vertexId = shapes[shapeId].mesh.indices[indexId+2];
-            if (!shapes[shapeId].mesh.texcoords.empty()) {
-                uvs[0] = shapes[shapeId].mesh.texcoords[2*vertexId];
-                uvs[1] = shapes[shapeId].mesh.texcoords[2*vertexId+1];
-                if( uvs[1] >10000000000000000 or   uvs[1]  < -10000000000000000){
-                    uvs[1] =0;
-                }
-              if( uvs[0] >10000000000000000 or   uvs[0]  < -10000000000000000){
-                    uvs[0] =0;
-                }
-                glTexCoord2f(uvs[0],uvs[1]);
-            }
-            if (shapes[shapeId].mesh.normals.size() > 0) {
-                glNormal3f(
-                           shapes[shapeId].mesh.normals[3*vertexId],
-                           shapes[shapeId].mesh.normals[3*vertexId+1],
-                           shapes[shapeId].mesh.normals[3*vertexId+2]
-                           );
-            }
-            glVertex3f(
-                       shapes[shapeId].mesh.positions[3*vertexId],
-                       shapes[shapeId].mesh.positions[3*vertexId+1],
-                       shapes[shapeId].mesh.positions[3*vertexId+2]
-                       );
-            glEnd();
-        }
-    }
+    // The explosions move the vertices in their shaders, while the edges
+    // are found on the mesh as it was loaded, so they go without outlines.
+    if(!outline || explosion || explosion2 || random){
+        packed.draw(active_program->program_object);
     }
     else{
-        glPushMatrix();
-        float       outlineColor[3] = { 255.0f, 255.0f, 255.0f };
-
-        glEnable (GL_BLEND);                // Enable Blending
-        glBlendFunc (GL_SRC_ALPHA ,GL_ONE_MINUS_SRC_ALPHA);
-        glPolygonMode (GL_FRONT_AND_BACK, GL_LINE);       // Draw Backfacing Polygons As Wireframes
-        glLineWidth (0.3);         // Set The Line Width
-        glCullFace (GL_FRONT);              // Don't Draw Any Front-Facing Polygons
-        glDepthFunc (GL_LEQUAL);            // Change The Depth Mode
-        glColor3fv (&outlineColor[0]);          // Set The Outline Color
-        
-
-            /* For every shape... */
-            for (size_t shapeId = 0; shapeId < shapes.size(); ++shapeId) {
-                /* For every triangle face in the mesh... */
-                for (size_t indexId = 0; indexId < shapes[shapeId].mesh.indices.size(); indexId+=3) {
-                    glBegin(GL_TRIANGLES);
-                    
-                    /* Vertex 0. */
-                    size_t vertexId = shapes[shapeId].mesh.indices[indexId];
-                    glVertex3f(
-                               shapes[shapeId].mesh.positions[3*vertexId],
-                               shapes[shapeId].mesh.positions[3*vertexId+1],
-                               shapes[shapeId].mesh.positions[3*vertexId+2]
-                               );
-                    
-                    /* Vertex 1. */
-                    vertexId = shapes[shapeId].mesh.indices[indexId+1];
-                    glVertex3f(
-                               shapes[shapeId].mesh.positions[3*vertexId],
-                               shapes[shapeId].mesh.positions[3*vertexId+1],
-                               shapes[shapeId].mesh.positions[3*vertexId+2]
-                               );
-                    
-                    /* Vertex 2. */
-                    vertexId = shapes[shapeId].mesh.indices[indexId+2];
-                    glVertex3f(
-                               shapes[shapeId].mesh.positions[3*vertexId], 
-                               shapes[shapeId].mesh.positions[3*vertexId+1], 
-                               shapes[shapeId].mesh.positions[3*vertexId+2]
-                               );
-                    
-                    glEnd();
-                }
-            }
-		glDepthFunc (GL_LESS);									// Reset The Depth-Testing Mode ( NEW )
-		glCullFace (GL_FRONT);									// Reset The Face To Be Culled ( NEW )
-		glPolygonMode (GL_FRONT_AND_BACK, GL_FILL);						// Reset Back-Facing Polygon Drawing Mode ( NEW )
-		glDisable (GL_BLEND);
+        // The fill goes a little deeper so the outline over it wins.
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(1, 1);
+        packed.draw(active_program->program_object);
+        glDisable(GL_POLYGON_OFFSET_FILL);
+
+        // Then only the silhouette and crease edges seen from the eye,
+        // rather than every triangle again as lines.
+        packed.extractOutlines(eye_position_object_space.xyz);
+        outline_program.use();
+        outline_program.setVec4f("outlineColor", float4(0,0,0,1));
+        glLineWidth(outline_width);
+        glDepthFunc(GL_LEQUAL);
+        packed.drawOutlines(outline_program.program_object);
+        glDepthFunc(GL_LESS);
+        glLineWidth(1);
     }
    glPopMatrix();
 
@@ -1159,13 +1080,313 @@ void ModelObject::loadTexture() {
 
     Texture2DPtr texture(new Texture2D(filename.c_str()));
     texture->load();
-    texture->tellGL();
-
     material->texture = texture;
+    if (without_gl) {
+        return;
+    }
+    texture->tellGL();
     material->bindTextures();
 }
 
 
+// The instance buffer's layout is what the INSTANCE_* attribute pointers
+// assume.
+static_assert(sizeof(Instance) == 16 * sizeof(float), "Instance must be four packed float4s");
+
+InstancedObject::InstancedObject(std::string file_name, std::string folder_path, Transform t, MaterialPtr m)
+    : Object(t, m)
+    , mesh_min(0,0,0)
+    , mesh_max(0,0,0)
+    , mesh_radius(0)
+    , bounds_min(HUGE_VALF, HUGE_VALF, HUGE_VALF)
+    , bounds_max(-HUGE_VALF, -HUGE_VALF, -HUGE_VALF)
+    , culled(false)
+    , instance_buffer(0)
+    , filename(file_name)
+    , folderpath(folder_path)
+{
+    std::cout << "Constructing instanced '" << filename << "'" << std::endl;
+    vertex_filename = "glsl/instanced.vert";
+    fragment_filename = "glsl/instanced.frag";
+    if (!loadPackedMesh(filename, folderpath, shapes, packed)) {
+        return;
+    }
+
+    // One box and sphere for the whole mesh, and at each level the largest
+    // error of any shape, so one level choice per instance suits every
+    // shape.  Shapes with fewer levels count at their coarsest.
+    bool empty = true;
+    size_t levels = 1;
+    for (size_t s=0; s<packed.shapes.size(); s++) {
+        const PackedShape &shape = packed.shapes[s];
+        if (shape.index_count == 0) {
+            continue;
+        }
+        for (int c=0; c<3; c++) {
+            mesh_min[c] = empty || shape.bounds_min[c] < mesh_min[c] ? shape.bounds_min[c] : mesh_min[c];
+            mesh_max[c] = empty || shape.bounds_max[c] > mesh_max[c] ? shape.bounds_max[c] : mesh_max[c];
+        }
+        empty = false;
+        levels = shape.lods.size() > levels ? shape.lods.size() : levels;
+    }
+    float3 center = (mesh_min + mesh_max) * 0.5f;
+    level_errors.assign(levels, 0.0f);
+    for (size_t s=0; s<packed.shapes.size(); s++) {
+        const PackedShape &shape = packed.shapes[s];
+        if (shape.index_count == 0) {
+            continue;
+        }
+        float r = length((shape.bounds_min + shape.bounds_max) * 0.5f - center) + shape.radius;
+        mesh_radius = r > mesh_radius ? r : mesh_radius;
+        for (size_t l=0; l<levels; l++) {
+            float e = shape.lods[l < shape.lods.size() ? l : shape.lods.size() - 1].error;
+            level_errors[l] = e > level_errors[l] ? e : level_errors[l];
+        }
+    }
+
+    glGenBuffers(1, &instance_buffer);
+    loadProgram();
+}
+
+InstancedObject::~InstancedObject() {
+    std::cout << "Destructing instanced '" << filename << "'" << std::endl;
+    if (instance_buffer) {
+        glDeleteBuffers(1, &instance_buffer);
+    }
+    packed.release();
+}
+
+void InstancedObject::addInstance(const float4x4& object_from_instance, const float4& color) {
+    const float4x4& m = object_from_instance;
+    Instance instance;
+    for (int r=0; r<3; r++) {
+        instance.rows[r] = m[r];
+    }
+    instance.color = color;
+    instances.push_back(instance);
+
+    // The mesh box carried through the instance's affine transform, and
+    // its sphere grown by the largest axis scale.
+    float3 center = (mesh_min + mesh_max) * 0.5f, half = (mesh_max - mesh_min) * 0.5f;
+    float3 lo, hi;
+    float scale = 0;
+    for (int r=0; r<3; r++) {
+        float c = m[r][0]*center.x + m[r][1]*center.y + m[r][2]*center.z + m[r][3];
+        float e = fabsf(m[r][0])*half.x + fabsf(m[r][1])*half.y + fabsf(m[r][2])*half.z;
+        lo[r] = c - e;
+        hi[r] = c + e;
+        bounds_min[r] = lo[r] < bounds_min[r] ? lo[r] : bounds_min[r];
+        bounds_max[r] = hi[r] > bounds_max[r] ? hi[r] : bounds_max[r];
+        float column = sqrtf(m[0][r]*m[0][r] + m[1][r]*m[1][r] + m[2][r]*m[2][r]);
+        scale = column > scale ? column : scale;
+    }
+    volumes.push_back(lo, hi, mesh_radius * scale);
+}
+
+void InstancedObject::clearInstances() {
+    instances.clear();
+    volumes.clear();
+    visible.clear();
+    level_counts.clear();
+    bounds_min = float3(HUGE_VALF, HUGE_VALF, HUGE_VALF);
+    bounds_max = float3(-HUGE_VALF, -HUGE_VALF, -HUGE_VALF);
+}
+
+void InstancedObject::scatter(int count, unsigned int seed) {
+    int side = int(ceilf(sqrtf(float(count))));
+    float spacing = 1.5f * length(mesh_max - mesh_min);
+    float3 center = (mesh_min + mesh_max) * 0.5f;
+    // Its own generator, so the same seed gives the same crowd whatever
+    // else draws from rand().
+    std::mt19937 random(seed);
+    std::uniform_real_distribution<float> unit(0, 1);
+    for (int i=0; i<count; i++) {
+        float x = (i % side - (side-1) * 0.5f) * spacing;
+        float z = (i / side - (side-1) * 0.5f) * spacing;
+        float yaw = 360.0f * unit(random);
+        float scale = 0.75f + 0.5f * unit(random);
+        float hue = 6.2831853f * unit(random);
+        float4x4 m = mul(translate4x4(float3(x, 0, z)),
+                         mul(rotate4x4(yaw, float3(0,1,0)),
+                             mul(scale4x4(float3(scale, scale, scale)), translate4x4(-center))));
+        float4 color(0.6f + 0.4f*cosf(hue), 0.6f + 0.4f*cosf(hue - 2.0943951f),
+                     0.6f + 0.4f*cosf(hue + 2.0943951f), 1);
+        addInstance(m, color);
+    }
+}
+
+void InstancedObject::loadProgram()
+{
+    VertexShader vs;
+    FragmentShader fs;
+    bool vs_ok = vs.readTextFile(vertex_filename.c_str());
+    bool fs_ok = fs.readTextFile(fragment_filename.c_str());
+    if (vs_ok && fs_ok) {
+        GLSLProgram new_program(vs.getShader(), fs.getShader());
+        vs.release();
+        fs.release();
+        bool ok = new_program.validate();
+        if (ok) {
+            program.swap(new_program);
+            bindPackedAttributes(program.program_object);
+        } else {
+            printf("GLSL shader compilation failed\n");
+        }
+    } else {
+        if (!vs_ok) {
+            printf("Vertex shader failed to load\n");
+        }
+        if (!fs_ok) {
+            printf("Fragment shader failed to load\n");
+        }
+    }
+}
+
+bool InstancedObject::getBounds(float3& lo, float3& hi) const {
+    if (instances.empty()) {
+        return false;
+    }
+    lo = bounds_min;
+    hi = bounds_max;
+    return true;
+}
+
+// Frustum and occlusion tests for every instance, four to a SIMD register
+// and spread over the worker threads, then a level of detail for each
+// survivor as selectLod picks one, with errors grown by the instance's
+// scale.  Survivors are packed by level with a counting sort.
+void InstancedObject::cull(const Camera& camera, const View& view, const OcclusionBuffer *occlusion,
+                           CullStats& stats) {
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    float pixel_scale = viewport[3] / (2 * tanf(camera.fov_degrees * float(M_PI / 360)));
+    float4x4 clip_from_object = mul(camera.projection_matrix, mul(view.view_matrix, transform.getMatrix()));
+    float4 eye_position_object_space = mul(transform.getInverseMatrix(), float4(view.eye_position,1));
+    float3 eye = eye_position_object_space.xyz / eye_position_object_space.w;
+    Frustum frustum(clip_from_object);
+
+    // 0 culled, 1 occluded, else 2 plus the level
+    size_t n = instances.size();
+    std::vector<unsigned char> result(n);
+    parallelFor(0, int(n), 1024, [&](int first, int last) {
+        cullVolumes(volumes, first, last, frustum, &result[first]);
+        for (int i=first; i<last; i++) {
+            if (!result[i]) {
+                continue;
+            }
+            float3 center(volumes.center_x[i], volumes.center_y[i], volumes.center_z[i]);
+            float3 extent(volumes.extent_x[i], volumes.extent_y[i], volumes.extent_z[i]);
+            if (occlusion && !occlusion->boxVisible(clip_from_object, center - extent, center + extent)) {
+                result[i] = 1;
+                continue;
+            }
+            size_t level = 0;
+            float distance = length(eye - center) - volumes.radius[i];
+            if (lod_pixel_error > 0 && distance > 0 && mesh_radius > 0) {
+                float scale = volumes.radius[i] / mesh_radius;
+                float limit = lod_pixel_error * distance / (pixel_scale * scale);
+                while (level+1 < level_errors.size() && level_errors[level+1] <= limit) {
+                    level++;
+                }
+            }
+            result[i] = (unsigned char)(2 + level);
+        }
+    });
+
+    level_counts.assign(level_errors.size(), 0);
+    for (size_t i=0; i<n; i++) {
+        if (result[i] >= 2) {
+            level_counts[result[i] - 2]++;
+        } else {
+            stats.objects_culled++;
+            stats.objects_occluded += result[i];
+        }
+    }
+    stats.objects += int(n);
+    std::vector<size_t> next(level_counts.size(), 0);
+    for (size_t l=1; l<level_counts.size(); l++) {
+        next[l] = next[l-1] + level_counts[l-1];
+    }
+    visible.resize(level_counts.empty() ? 0 : next.back() + level_counts.back());
+    for (size_t i=0; i<n; i++) {
+        if (result[i] >= 2) {
+            visible[next[result[i] - 2]++] = instances[i];
+        }
+    }
+    culled = true;
+}
+
+void InstancedObject::draw(const View& view, LightPtr light) {
+    // Without a cull this frame every instance draws at full detail.
+    if (!culled) {
+        visible = instances;
+        level_counts.assign(1, GLsizei(instances.size()));
+    }
+    culled = false;
+    if (visible.empty() || !instance_buffer) {
+        return;
+    }
+
+    program.use();
+    float4 eye_position_object_space = mul(transform.getInverseMatrix(), float4(view.eye_position,1));
+    eye_position_object_space.xyz /= eye_position_object_space.w;
+    program.setVec3f("eyePosition", eye_position_object_space.xyz);
+    float4 light_position_object_space = mul(transform.getInverseMatrix(), light->getPosition());
+    light_position_object_space.xyz /= light_position_object_space.w;
+    program.setVec3f("lightPosition", light_position_object_space.xyz);
+    program.setVec4f("LMa", material->ambient*light->getColor());
+    program.setVec4f("LMd", material->diffuse*light->getColor());
+    program.setVec4f("LMs", material->specular*light->getColor());
+    program.setVec1f("shininess", material->shininess);
+    setFrameTime(program);
+
+    // Orphan last frame's storage rather than wait for the GPU to finish
+    // reading it.
+    glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+    glBufferData(GL_ARRAY_BUFFER, visible.size() * sizeof(Instance), NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, visible.size() * sizeof(Instance), &visible[0]);
+
+    bool instancing = GLEW_ARB_instanced_arrays && GLEW_ARB_draw_instanced;
+    pushAndMultGLMatrix(GL_MODELVIEW, transform.getMatrix());
+    size_t first = 0;
+    for (size_t l=0; l<level_counts.size(); l++) {
+        GLsizei count = level_counts[l];
+        if (count == 0) {
+            continue;
+        }
+        if (instancing) {
+            // GL 2.1 has no base instance, so each level's run starts at
+            // its own offset into the buffer.
+            glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+            for (GLuint a=0; a<4; a++) {
+                glEnableVertexAttribArray(INSTANCE_ROW0 + a);
+                glVertexAttribPointer(INSTANCE_ROW0 + a, 4, GL_FLOAT, GL_FALSE, sizeof(Instance),
+                                      (const GLvoid *)(first * sizeof(Instance) + a * sizeof(float4)));
+                glVertexAttribDivisorARB(INSTANCE_ROW0 + a, 1);
+            }
+            packed.drawInstanced(program.program_object, l, count);
+        } else {
+            // Each instance as its own draw, its attributes set as constants.
+            for (size_t i=first; i<first+count; i++) {
+                const GLfloat *attributes = reinterpret_cast<const GLfloat *>(&visible[i]);
+                for (GLuint a=0; a<4; a++) {
+                    glVertexAttrib4fv(INSTANCE_ROW0 + a, attributes + 4*a);
+                }
+                packed.drawInstanced(program.program_object, l, 1);
+            }
+        }
+        first += count;
+    }
+    if (instancing) {
+        for (GLuint a=0; a<4; a++) {
+            glVertexAttribDivisorARB(INSTANCE_ROW0 + a, 0);
+            glDisableVertexAttribArray(INSTANCE_ROW0 + a);
+        }
+    }
+    popGLMatrix(GL_MODELVIEW);
+}
+
+
 void Camera::validate()
 {
     projection_matrix = perspective(fov_degrees, aspect_ratio, znear, zfar);
@@ -1405,18 +1626,26 @@ void Light::draw(const View& view) {
 
 Transform::Transform()
     : matrix(identity4x4())
+    , structure(TRANSFORM_RIGID)
     , dirty(true)
 {}
 
 Transform::Transform(const float4x4& m)
     : matrix(m)
+    , structure(TRANSFORM_GENERAL)
     , dirty(true)
 {}
 
 void Transform::validate() const
 {
     if (dirty) {
-        inverse_matrix = inverse(matrix);
+        if (structure == TRANSFORM_RIGID) {
+            inverse_matrix = inverseRigid(matrix);
+        } else if (matrix[3][0] == 0 && matrix[3][1] == 0 && matrix[3][2] == 0 && matrix[3][3] == 1) {
+            inverse_matrix = inverseAffine(matrix);
+        } else {
+            inverse_matrix = inverse(matrix);
+        }
         dirty = false;
     }
 }
@@ -1432,13 +1661,14 @@ float4x4 Transform::getInverseMatrix() const
     return inverse_matrix;
 }
 
-void Transform::setMatrix(float4x4 m)
+void Transform::setMatrix(float4x4 m, TransformStructure s)
 {
     matrix = m;
+    structure = s;
     dirty = true;
 }
 
-void Transform::setMatrix(const GLfloat m[4][4])
+void Transform::setMatrix(const GLfloat m[4][4], TransformStructure s)
 {
     // GL matrix is stored in column-major order so transpose it
     for (int i=0; i<4; i++) {
@@ -1446,12 +1676,14 @@ void Transform::setMatrix(const GLfloat m[4][4])
             matrix[i][j] = m[j][i];
         }
     }
+    structure = s;
     dirty = true;
 }
 
 void Transform::multMatrix(float4x4 m)
 {
     matrix = mul(matrix, m);
+    structure = TRANSFORM_GENERAL;
     dirty = true;
 }
 
@@ -1470,14 +1702,77 @@ void Scene::setCamera(const Camera& c)
     camera = c;
 }
 
+void Scene::cullModel(int viewport_height)
+{
+    cull_stats = CullStats();
+    models->selectLod(camera, view, viewport_height);
+
+    // Hi-Z occlusion: the model's largest shapes go into a small software
+    // depth buffer first, then objects, shapes and meshlets are tested
+    // against its pyramid.
+    occlusion.clear();
+    if (occlusion_culling) {
+        models->renderOccluders(camera, view, occlusion);
+    }
+    occlusion.buildPyramid();
+    cull_stats.occluder_triangles = occlusion.occluderTriangles();
+    models->cull(camera, view, occlusion_culling ? &occlusion : NULL, cull_stats);
+}
+
 void Scene::draw()
 {
     camera.tellGL();
     view.tellGL();
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    cullModel(viewport[3]);
+
+    float4x4 clip_from_world = mul(camera.projection_matrix, view.view_matrix);
+    draw_list.clear();
     for (size_t i=0; i<object_list.size(); i++) {
-        object_list[i]->draw(view, light_list[0]);
+        float3 lo, hi;
+        cull_stats.objects++;
+        if (object_list[i]->getBounds(lo, hi)) {
+            float4x4 clip_from_object = mul(clip_from_world, object_list[i]->transform.getMatrix());
+            if (Frustum(clip_from_object).boxOutside(lo, hi)) {
+                cull_stats.objects_culled++;
+                continue;
+            }
+            if (!occlusion.boxVisible(clip_from_object, lo, hi)) {
+                cull_stats.objects_culled++;
+                cull_stats.objects_occluded++;
+                continue;
+            }
+        }
+        object_list[i]->cull(camera, view, occlusion_culling ? &occlusion : NULL, cull_stats);
+        draw_list.push_back(object_list[i].get());
+    }
+    draw_list.push_back(models);
+
+    // Order the survivors by pass, program, textures and then depth, each
+    // at the center of its bounds, and draw them skipping binds of what
+    // is already bound.
+    render_queue.clear();
+    for (size_t i=0; i<draw_list.size(); i++) {
+        Object *object = draw_list[i];
+        float3 lo(0,0,0), hi(0,0,0);
+        object->getBounds(lo, hi);
+        float4 center = mul(view.view_matrix, mul(object->transform.getMatrix(), float4((lo + hi) / 2, 1)));
+        float depth = (-center.z / center.w - camera.znear) / (camera.zfar - camera.znear);
+        render_queue.push(object->renderPass(), object->drawProgram(), object->material.get(), depth, i);
+    }
+    render_queue.sort();
+    render_state.begin();
+    for (size_t i=0; i<render_queue.size(); i++) {
+        Object *object = draw_list[render_queue[i].item];
+        if (object->material) {
+            object->material->bindTextures();
+        }
+        object->draw(view, light_list[0]);
     }
-    models->draw(view, light_list[0]);
+    render_state.end();
+    render_stats = render_state.stats;
+    render_stats.packets = int(render_queue.size());
 
     for (size_t i=0; i<light_list.size(); i++) {
         LightPtr light = light_list[i];
@@ -1524,17 +1819,173 @@ Material::Material()
 void Material::bindTextures()
 {
     if (normal_map) {
-        normal_map->bind(GL_TEXTURE0);
+        render_state.bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, normal_map->getTextureObject());
     }
     if (texture) {
-        texture->bind(GL_TEXTURE1);
+        render_state.bindTexture(GL_TEXTURE1, GL_TEXTURE_2D, texture->getTextureObject());
     }
     if (height_field) {
-        height_field->bind(GL_TEXTURE2);
+        render_state.bindTexture(GL_TEXTURE2, GL_TEXTURE_2D, height_field->getTextureObject());
     }
     if (envmap) {
-        envmap->bind(GL_TEXTURE3);
+        render_state.bindTexture(GL_TEXTURE3, GL_TEXTURE_CUBE_MAP, envmap->getTextureObject());
+    }
+}
+
+// Programs and FBO for the height-to-normal pass and the normal mip pass.
+// Created on first use and kept for the life of the GL context.
+static GLSLProgram *height_to_normal = NULL;
+static GLSLProgram *normal_mip = NULL;
+static GLuint height_to_normal_fbo = 0;
+
+// Loads a full-screen pass over the unit square with fragment_file into
+// program, once; failed remembers a pass that would not load.
+static bool loadPassProgram(GLSLProgram *&program, bool &failed, const char *fragment_file)
+{
+    if (program) {
+        return true;
+    }
+    if (failed) {
+        return false;
     }
+    failed = true;
+
+    VertexShader vs;
+    FragmentShader fs;
+    bool vs_ok = vs.readTextFile("glsl/height_to_normal.vert");
+    bool fs_ok = fs.readTextFile(fragment_file);
+    if (vs_ok && fs_ok) {
+        GLSLProgram new_program(vs.getShader(), fs.getShader());
+        vs.release();
+        fs.release();
+        bool ok = new_program.validate();
+        if (ok) {
+            program = new GLSLProgram;
+            program->swap(new_program);
+            failed = false;
+        } else {
+            printf("GLSL shader compilation failed\n");
+        }
+    } else {
+        if (!vs_ok) {
+            printf("Vertex shader failed to load\n");
+        }
+        if (!fs_ok) {
+            printf("Fragment shader failed to load\n");
+        }
+    }
+    return !failed;
+}
+
+static bool loadHeightToNormalProgram()
+{
+    static bool failed = false;
+    return loadPassProgram(height_to_normal, failed, "glsl/height_to_normal.frag");
+}
+
+static bool loadNormalMipProgram()
+{
+    static bool failed = false;
+    return loadPassProgram(normal_mip, failed, "glsl/normal_mip.frag");
+}
+
+static void drawUnitSquare()
+{
+    glBegin(GL_QUADS);
+    glVertex2f(0, 0);
+    glVertex2f(1, 0);
+    glVertex2f(1, 1);
+    glVertex2f(0, 1);
+    glEnd();
+}
+
+// Fills levels 1 and down of the bound normal map, width by height at level
+// 0, each from the one above with normal_mip, through the bound FBO.  Only
+// the level read is visible to the sampler, so no level is read and
+// written at once.
+static void renormalizedNormalMips(GLuint texture, int width, int height)
+{
+    normal_mip->setSampler("normalMap", 2);
+    normal_mip->use();
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    for (int level=1; width > 1 || height > 1; level++) {
+        normal_mip->setVec2f("texelSize", float2(1.0f/width, 1.0f/height));
+        width = width > 1 ? width/2 : 1;
+        height = height > 1 ? height/2 : 1;
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+        glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, texture, level);
+        glViewport(0, 0, width, height);
+        drawUnitSquare();
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 1000);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glActiveTexture(GL_TEXTURE0);
+    glUseProgram(0);
+}
+
+// Renders the already uploaded height field into the normal map's texture
+// with a full-screen pass, and one more for each mip level, so changing the
+// bump scale needs neither a file decode nor a CPU conversion.  Returns
+// false when the pass is not available so the caller can fall back to
+// NormalMap::load.
+bool Material::generateNormalMap(float scale)
+{
+    if (!normal_map || !height_field || !height_field->getTextureObject()) {
+        return false;
+    }
+    if (!loadHeightToNormalProgram()) {
+        return false;
+    }
+
+    const int width = height_field->width, height = height_field->height;
+    normal_map->allocate(width, height);
+
+    if (!height_to_normal_fbo) {
+        glGenFramebuffersEXT(1, &height_to_normal_fbo);
+    }
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, height_to_normal_fbo);
+    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D,
+        normal_map->getTextureObject(), 0);
+    GLenum status = glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT);
+    if (status != GL_FRAMEBUFFER_COMPLETE_EXT) {
+        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+        printf("%s: normal map framebuffer incomplete (0x%x)\n", program_name, status);
+        return false;
+    }
+
+    glPushAttrib(GL_VIEWPORT_BIT | GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT);
+    glViewport(0, 0, width, height);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_CULL_FACE);
+    glDisable(GL_BLEND);
+
+    height_field->bind(GL_TEXTURE2);
+    height_to_normal->setSampler("heightField", 2);
+    height_to_normal->setVec2f("texelSize", float2(1.0f/width, 1.0f/height));
+    height_to_normal->setVec1f("scale", scale);
+    height_to_normal->use();
+    drawUnitSquare();
+    glUseProgram(0);
+
+    if (normal_map->isMipmapped()) {
+        // glGenerateMipmap would average the normals without renormalizing.
+        if (loadNormalMipProgram()) {
+            renormalizedNormalMips(normal_map->getTextureObject(), width, height);
+        } else {
+            normal_map->bind();
+            glGenerateMipmap(GL_TEXTURE_2D);
+        }
+    }
+
+    glPopAttrib();
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+    return true;
 }
 
 Material& Material::operator =(const Material& rhs)
@@ -30,6 +30,8 @@ using boost::shared_ptr;
 #include "glmatrix.hpp"
 
 #include "texture.hpp"
+#include "mesh.hpp"
+#include "renderqueue.hpp"
 
 #include "tiny_obj_loader.hpp"
 
@@ -39,8 +41,15 @@ using namespace Cg;
 
 
 
+// What the caller knows about a Transform's matrix; selects the inverse.
+enum TransformStructure {
+    TRANSFORM_GENERAL,  // affine matrices are detected, others fully inverted
+    TRANSFORM_RIGID     // rotation plus translation, inverted by transposing
+};
+
 class Transform {
     float4x4 matrix;
+    TransformStructure structure;
 
     mutable bool dirty;
     mutable float4x4 inverse_matrix;
@@ -51,8 +60,8 @@ public:
     Transform();
     Transform(const float4x4& matrix);
 
-    void setMatrix(float4x4 m);
-    void setMatrix(const GLfloat m[4][4]);
+    void setMatrix(float4x4 m, TransformStructure structure = TRANSFORM_GENERAL);
+    void setMatrix(const GLfloat m[4][4], TransformStructure structure = TRANSFORM_GENERAL);
     void multMatrix(float4x4 m);
 
     float4x4 getMatrix() const;
@@ -177,6 +186,7 @@ struct GLSLProgram {
     void reset();
     void swap(GLSLProgram &other);
     void setVec1f(const char *name, float v);
+    void setVec1i(const char *name, int v);
     void setVec2f(const char *name, float2 v);
     void setVec3f(const char *name, float3 v);
     void setVec4f(const char *name, float4 v);
@@ -298,6 +308,7 @@ struct Material {
     Material();
 
     void bindTextures();
+    bool generateNormalMap(float scale);
 
     Material& operator =(const Material& rhs);
 };
@@ -311,7 +322,6 @@ struct Object {
     string vertex_filename;
     string fragment_filename;
     GLSLProgram program;
-    GLSLProgram rays;
     GLSLProgram lighting;
     GLSLProgram explosion_program;
     GLSLProgram explosion2_program;
@@ -319,7 +329,6 @@ struct Object {
 
 
     GLSLProgram temp_program;
-    GLuint ColorBuffer, DepthBuffer, FBO;
 
 
     Transform transform;
@@ -332,6 +341,15 @@ struct Object {
 
     virtual void draw(const View& view, LightPtr light) = 0;
     virtual void loadProgram() = 0;
+    // Object-space bounding box, for culling; false if unknown.
+    virtual bool getBounds(float3& lo, float3& hi) const { return false; }
+    // Finer culling of the object's own parts for the coming frame, once
+    // its bounds have passed.
+    virtual void cull(const Camera& camera, const View& view, const OcclusionBuffer *occlusion,
+                      CullStats& stats) {}
+    // What the next draw binds, for ordering draws by state.
+    virtual RenderPass renderPass() const { return RENDER_PASS_OPAQUE; }
+    virtual GLuint drawProgram() const { return program.program_object; }
     virtual void loadExplosionProgram() = 0;
 };
 typedef shared_ptr<Object> ObjectPtr;
@@ -348,6 +366,7 @@ public:
     Torus(Transform t, MaterialPtr m);
     ~Torus();
     void loadProgram();
+    bool getBounds(float3& lo, float3& hi) const;
     void draw(const View& view, LightPtr light);
 };
 typedef shared_ptr<Torus> TorusPtr;
@@ -359,6 +378,8 @@ typedef shared_ptr<Torus> TorusPtr;
 class ModelObject : public Object {
 private:
     std::vector<tinyobj::shape_t> shapes;
+    PackedMesh packed;
+    GLSLProgram outline_program;
     bool outline;
     bool godsRay;
     bool explosion;
@@ -375,6 +396,7 @@ public:
     void loadExplosionProgram();
     void loadExplosion2Program();
     void loadRandomProgram();
+    void loadOutlineProgram();
     void loadTexture();
     void setGodsRay();
     void setExplosion(bool val);
@@ -382,10 +404,20 @@ public:
     void setRandom(bool val);
     bool getRandom(){return random;};
     bool getExplosion2(){return explosion2;};
+    bool getGodsRay(){return godsRay;};
+    bool getOutline(){return outline;};
+    const std::vector<tinyobj::shape_t>& getShapes() const {return shapes;};
+    const PackedMesh& getPackedMesh() const {return packed;};
     void setEdgeDetection();
     void loadGodsRay();
     void setOutline();
     void print();
+    void printBounds();
+    void selectLod(const Camera& camera, const View& view, int viewport_height);
+    void renderOccluders(const Camera& camera, const View& view, OcclusionBuffer& occlusion);
+    void cull(const Camera& camera, const View& view, const OcclusionBuffer *occlusion,
+              CullStats& stats);
+    GLuint drawProgram() const;
     void draw(const View& view, LightPtr light);
 };
 typedef shared_ptr<ModelObject> ModelPtr;
@@ -394,6 +426,58 @@ typedef shared_ptr<ModelObject> ModelPtr;
 
 
 
+// Per-instance data as uploaded for INSTANCE_ROW0..2 and INSTANCE_COLOR:
+// the top three rows of object_from_instance and a tint for the material.
+struct Instance {
+    float4 rows[3];
+    float4 color;
+};
+
+// One model drawn many times with glDrawElementsInstancedARB.  cull
+// tests every instance's bounds against the frustum and the occlusion
+// buffer and packs the survivors, grouped by level of detail, into the
+// instance buffer; draw then issues one instanced draw per level.
+class InstancedObject : public Object {
+private:
+    std::vector<tinyobj::shape_t> shapes;
+    PackedMesh packed;
+    float3 mesh_min, mesh_max;
+    float mesh_radius;                 // about the box center
+    std::vector<float> level_errors;   // the largest shape error at each level
+
+    std::vector<Instance> instances;
+    BoundingVolumes volumes;           // of each instance, in object space
+    float3 bounds_min, bounds_max;     // of all instances
+
+    std::vector<Instance> visible;     // this frame's, ordered by level
+    std::vector<GLsizei> level_counts; // how many of visible use each level
+    bool culled;
+    GLuint instance_buffer;
+    const std::string filename;
+    const std::string folderpath;
+
+public:
+    InstancedObject(std::string file_name, std::string folder_path, Transform t, MaterialPtr m);
+    ~InstancedObject();
+    void addInstance(const float4x4& object_from_instance, const float4& color);
+    void clearInstances();
+    size_t size() const { return instances.size(); }
+    // count instances on a square grid in the y=0 plane, each turned,
+    // scaled and tinted at random.
+    void scatter(int count, unsigned int seed);
+    void loadProgram();
+    void loadExplosionProgram() {}
+    bool getBounds(float3& lo, float3& hi) const;
+    void cull(const Camera& camera, const View& view, const OcclusionBuffer *occlusion,
+              CullStats& stats);
+    void draw(const View& view, LightPtr light);
+};
+typedef shared_ptr<InstancedObject> InstancedObjectPtr;
+
+
+
+
+
 struct Scene {
     Camera camera;
     View view;
@@ -402,10 +486,19 @@ struct Scene {
     CubeMapPtr envmap;
     ModelObject *models;
     bool loadedModelAlready = false;
+    CullStats cull_stats;  // of the last draw
+    OcclusionBuffer occlusion;
+    RenderQueue render_queue;
+    vector<Object *> draw_list;  // what render_queue's items index
+    RenderStats render_stats;    // of the last draw
 
     Scene(const Camera& c, const View& v);
     void setView(const View& v);
     void setCamera(const Camera& c);
+    // What draw does before drawing anything: picks the model's levels of
+    // detail for a viewport viewport_height pixels tall and culls it, with
+    // the occlusion buffer when occlusion_culling is set.
+    void cullModel(int viewport_height);
     void draw();
     void addObject(ObjectPtr object);
     void changeModel(std::string file_name, std::string folder_path);
@@ -0,0 +1,194 @@
+// silhouette.cpp - mesh edges with their faces' planes for outline extraction
+//
+// Edges are found once by sorting every triangle's edges on their welded
+// endpoints.  Each frame only the facing of the two planes per edge is
+// evaluated, four edges at a time on <Cg/simd.hpp>.
+
+#include <math.h>
+
+#include <algorithm>
+
+#include <Cg/vector.hpp>
+#include <Cg/cross.hpp>
+#include <Cg/simd.hpp>
+
+#include "silhouette.hpp"
+
+using namespace Cg;
+
+namespace {
+
+struct HalfEdge {
+    unsigned long long key;  // welded endpoints, lower first
+    unsigned int triangle;
+    unsigned int a, b;       // the triangle's own indices, in winding order
+    bool forward;            // a's welded id is the lower
+
+    bool operator <(const HalfEdge &other) const {
+        return key < other.key || (key == other.key && triangle < other.triangle);
+    }
+};
+
+void pushPlanes(EdgeMesh &out, const float *plane0, const float *plane1)
+{
+    out.n0x.push_back(plane0[0]);
+    out.n0y.push_back(plane0[1]);
+    out.n0z.push_back(plane0[2]);
+    out.d0.push_back(plane0[3]);
+    out.n1x.push_back(plane1[0]);
+    out.n1y.push_back(plane1[1]);
+    out.n1z.push_back(plane1[2]);
+    out.d1.push_back(plane1[3]);
+}
+
+void selectScalar(const EdgeMesh &e, size_t begin, size_t end,
+                  const float3 &eye, unsigned char *selected)
+{
+    for (size_t i=begin; i<end; i++) {
+        bool front0 = e.n0x[i]*eye.x + e.n0y[i]*eye.y + e.n0z[i]*eye.z + e.d0[i] > 0;
+        bool front1 = e.n1x[i]*eye.x + e.n1y[i]*eye.y + e.n1z[i]*eye.z + e.d1[i] > 0;
+        selected[i-begin] = front0 != front1 || (e.feature[i] && (front0 || front1));
+    }
+}
+
+#ifdef __CG_SIMD
+
+void select4(const EdgeMesh &e, size_t begin, size_t end,
+             const float3 &eye, unsigned char *selected)
+{
+    const __CGsimd4f ex = __CGsimd_set1(eye.x);
+    const __CGsimd4f ey = __CGsimd_set1(eye.y);
+    const __CGsimd4f ez = __CGsimd_set1(eye.z);
+    const __CGsimd4f zero = __CGsimd_set1(0);
+    size_t i = begin;
+    for (; i+4<=end; i+=4) {
+        __CGsimd4f s0 = __CGsimd_add(__CGsimd_add(__CGsimd_mul(__CGsimd_load(&e.n0x[i]), ex),
+                                                  __CGsimd_mul(__CGsimd_load(&e.n0y[i]), ey)),
+                                     __CGsimd_add(__CGsimd_mul(__CGsimd_load(&e.n0z[i]), ez),
+                                                  __CGsimd_load(&e.d0[i])));
+        __CGsimd4f s1 = __CGsimd_add(__CGsimd_add(__CGsimd_mul(__CGsimd_load(&e.n1x[i]), ex),
+                                                  __CGsimd_mul(__CGsimd_load(&e.n1y[i]), ey)),
+                                     __CGsimd_add(__CGsimd_mul(__CGsimd_load(&e.n1z[i]), ez),
+                                                  __CGsimd_load(&e.d1[i])));
+        int front0 = __CGsimd_lessmask(zero, s0);
+        int front1 = __CGsimd_lessmask(zero, s1);
+        int silhouette = front0 ^ front1;
+        int either = front0 | front1;
+        for (int k=0; k<4; k++) {
+            selected[i-begin+k] = ((silhouette >> k) & 1) || (e.feature[i+k] && ((either >> k) & 1));
+        }
+    }
+    selectScalar(e, i, end, eye, selected + (i-begin));
+}
+
+#endif
+
+} // namespace
+
+void EdgeMesh::clear()
+{
+    v0.clear();
+    v1.clear();
+    n0x.clear();
+    n0y.clear();
+    n0z.clear();
+    d0.clear();
+    n1x.clear();
+    n1y.clear();
+    n1z.clear();
+    d1.clear();
+    feature.clear();
+}
+
+void buildEdges(const std::vector<float> &positions, const unsigned int *indices,
+                size_t index_count, float crease_degrees, EdgeMesh &out)
+{
+    out.clear();
+    size_t vertex_count = positions.size() / 3;
+
+    // Vertices sorted by position; each takes the rank of the first with
+    // its position as its welded id.
+    std::vector<unsigned int> order(vertex_count);
+    for (size_t i=0; i<vertex_count; i++) {
+        order[i] = unsigned(i);
+    }
+    const float *p = positions.empty() ? NULL : &positions[0];
+    std::sort(order.begin(), order.end(), [p](unsigned int a, unsigned int b) {
+        return std::lexicographical_compare(p + 3*a, p + 3*a + 3, p + 3*b, p + 3*b + 3);
+    });
+    std::vector<unsigned int> weld(vertex_count);
+    for (size_t i=0, id=0; i<vertex_count; i++) {
+        if (i > 0 && !std::equal(p + 3*order[i], p + 3*order[i] + 3, p + 3*order[i-1])) {
+            id = i;
+        }
+        weld[order[i]] = unsigned(id);
+    }
+
+    size_t triangle_count = index_count / 3;
+    std::vector<float> planes(4*triangle_count);
+    std::vector<HalfEdge> half_edges;
+    half_edges.reserve(index_count);
+    for (size_t t=0; t<triangle_count; t++) {
+        const unsigned int *tri = &indices[3*t];
+        const float *a = p + 3*tri[0], *b = p + 3*tri[1], *c = p + 3*tri[2];
+        float3 n = cross(float3(b[0]-a[0], b[1]-a[1], b[2]-a[2]), float3(c[0]-a[0], c[1]-a[1], c[2]-a[2]));
+        float len = sqrtf(n.x*n.x + n.y*n.y + n.z*n.z);
+        // A triangle with no area faces nowhere, but still counts toward
+        // its edges' neighbours.
+        n = len > 0 ? n / len : float3(0,0,0);
+        float *plane = &planes[4*t];
+        plane[0] = n.x;
+        plane[1] = n.y;
+        plane[2] = n.z;
+        plane[3] = -(n.x*a[0] + n.y*a[1] + n.z*a[2]);
+        for (int k=0; k<3; k++) {
+            HalfEdge h;
+            h.a = tri[k];
+            h.b = tri[(k+1)%3];
+            unsigned int wa = weld[h.a], wb = weld[h.b];
+            if (wa == wb) {
+                continue;
+            }
+            h.forward = wa < wb;
+            h.key = h.forward ? (unsigned long long)wa << 32 | wb : (unsigned long long)wb << 32 | wa;
+            h.triangle = unsigned(t);
+            half_edges.push_back(h);
+        }
+    }
+    std::sort(half_edges.begin(), half_edges.end());
+
+    float crease_cos = cosf(crease_degrees * float(M_PI / 180));
+    for (size_t i=0; i<half_edges.size(); ) {
+        size_t j = i + 1;
+        while (j < half_edges.size() && half_edges[j].key == half_edges[i].key) {
+            j++;
+        }
+        const HalfEdge &first = half_edges[i];
+        const float *plane0 = &planes[4*first.triangle];
+        out.v0.push_back(first.a);
+        out.v1.push_back(first.b);
+        if (j - i == 2) {
+            // Neighbours wound the same way along the edge disagree about
+            // which side is out, so their facing says nothing.
+            const HalfEdge &second = half_edges[i+1];
+            const float *plane1 = &planes[4*second.triangle];
+            float cosine = plane0[0]*plane1[0] + plane0[1]*plane1[1] + plane0[2]*plane1[2];
+            pushPlanes(out, plane0, plane1);
+            out.feature.push_back(cosine < crease_cos || first.forward == second.forward);
+        } else {
+            pushPlanes(out, plane0, plane0);
+            out.feature.push_back(1);
+        }
+        i = j;
+    }
+}
+
+void selectOutlineEdges(const EdgeMesh &edges, size_t begin, size_t end,
+                        const float3 &eye, unsigned char *selected)
+{
+#ifdef __CG_SIMD
+    select4(edges, begin, end, eye, selected);
+#else
+    selectScalar(edges, begin, end, eye, selected);
+#endif
+}
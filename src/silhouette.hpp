@@ -0,0 +1,44 @@
+// silhouette.hpp - mesh edges with their faces' planes for outline extraction
+
+#ifndef __silhouette_hpp__
+#define __silhouette_hpp__
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+# pragma once
+#endif
+
+#include <stddef.h>
+
+#include <vector>
+
+#include <Cg/vector.hpp>
+
+// The unique edges of a triangle mesh, each with the planes of the two
+// triangles that share it, as a structure of arrays.  A face p faces an
+// eye e when dot(normal, e) + d > 0.  Border and non-manifold edges carry
+// their first triangle's plane twice.
+struct EdgeMesh {
+    std::vector<unsigned int> v0, v1;  // vertex indices, as in the mesh
+    std::vector<float> n0x, n0y, n0z, d0;
+    std::vector<float> n1x, n1y, n1z, d1;
+    // Set for creases, borders and non-manifold edges, which outline
+    // whenever either face is toward the eye.
+    std::vector<unsigned char> feature;
+
+    size_t size() const { return v0.size(); }
+    void clear();
+};
+
+// Finds the edges of the triangles indices[0,index_count) with vertices
+// at the same position taken as one, so texture seams are not borders.
+// Edges whose faces meet at more than crease_degrees are creases.
+void buildEdges(const std::vector<float> &positions, const unsigned int *indices,
+                size_t index_count, float crease_degrees, EdgeMesh &out);
+
+// Sets selected[i-begin] for edges [begin,end) to whether edge i outlines
+// the mesh seen from eye: its faces face opposite ways, or it is a
+// feature edge with a face toward eye.  eye is in the mesh's space.
+void selectOutlineEdges(const EdgeMesh &edges, size_t begin, size_t end,
+                        const Cg::float3 &eye, unsigned char *selected);
+
+#endif // __silhouette_hpp__
@@ -0,0 +1,362 @@
+// simplify.cpp - quadric error edge-collapse simplification and LOD chains
+//
+// Each position accumulates the area-weighted planes of the triangles
+// around it (Garland and Heckbert, "Surface Simplification Using Quadric
+// Error Metrics"); collapsing a vertex onto a neighbour costs the summed
+// quadric evaluated at the neighbour, normalized by area so the error is
+// a distance.  Collapses happen in passes: every candidate edge is costed
+// in parallel, sorted, and the cheapest non-interfering ones applied.
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "mesh_optimize.hpp"
+#include "parallel.hpp"
+#include "simplify.hpp"
+
+namespace {
+
+struct Quadric {
+    double a00, a01, a02, a11, a12, a22;
+    double b0, b1, b2;
+    double c;
+    double weight;
+};
+
+void addPlane(Quadric &q, const double n[3], double d, double weight)
+{
+    q.a00 += weight * n[0]*n[0];
+    q.a01 += weight * n[0]*n[1];
+    q.a02 += weight * n[0]*n[2];
+    q.a11 += weight * n[1]*n[1];
+    q.a12 += weight * n[1]*n[2];
+    q.a22 += weight * n[2]*n[2];
+    q.b0 += weight * n[0]*d;
+    q.b1 += weight * n[1]*d;
+    q.b2 += weight * n[2]*d;
+    q.c += weight * d*d;
+    q.weight += weight;
+}
+
+void addQuadric(Quadric &q, const Quadric &r)
+{
+    q.a00 += r.a00;  q.a01 += r.a01;  q.a02 += r.a02;
+    q.a11 += r.a11;  q.a12 += r.a12;  q.a22 += r.a22;
+    q.b0 += r.b0;  q.b1 += r.b1;  q.b2 += r.b2;
+    q.c += r.c;
+    q.weight += r.weight;
+}
+
+// Area-weighted mean squared distance from p to the quadric's planes.
+double evaluate(const Quadric &q, const float *p)
+{
+    double x = p[0], y = p[1], z = p[2];
+    double r = q.a00*x*x + q.a11*y*y + q.a22*z*z +
+               2*(q.a01*x*y + q.a02*x*z + q.a12*y*z) +
+               2*(q.b0*x + q.b1*y + q.b2*z) + q.c;
+    return q.weight > 0 ? fabs(r) / q.weight : 0;
+}
+
+struct Collapse {
+    unsigned int from, to;  // vertices
+    float cost;             // squared distance
+};
+
+bool byVertices(const Collapse &a, const Collapse &b)
+{
+    return a.from != b.from ? a.from < b.from : a.to < b.to;
+}
+
+bool sameVertices(const Collapse &a, const Collapse &b)
+{
+    return a.from == b.from && a.to == b.to;
+}
+
+bool byCost(const Collapse &a, const Collapse &b)
+{
+    return a.cost < b.cost;
+}
+
+struct PositionLess {
+    const float *positions;
+
+    bool operator()(unsigned int a, unsigned int b) const {
+        const float *pa = positions + 3*a, *pb = positions + 3*b;
+        if (pa[0] != pb[0]) return pa[0] < pb[0];
+        if (pa[1] != pb[1]) return pa[1] < pb[1];
+        return pa[2] < pb[2];
+    }
+};
+
+inline void sub3(const float *a, const float *b, float *r)
+{
+    r[0] = a[0] - b[0];
+    r[1] = a[1] - b[1];
+    r[2] = a[2] - b[2];
+}
+
+inline float dot3(const float *a, const float *b)
+{
+    return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+}
+
+// Refuses collapses that turn any surviving triangle around from by more
+// than about 75 degrees.
+bool keepsOrientation(const std::vector<unsigned int> &indices,
+                      const unsigned int *triangles, unsigned int triangle_count,
+                      const std::vector<unsigned int> &position_id, const float *positions,
+                      unsigned int from, unsigned int to)
+{
+    const float *target = positions + 3*to;
+    for (unsigned int i=0; i<triangle_count; i++) {
+        const unsigned int *tri = &indices[3*triangles[i]];
+        if (position_id[tri[0]] == position_id[to] || position_id[tri[1]] == position_id[to] ||
+            position_id[tri[2]] == position_id[to]) {
+            continue;  // collapses away
+        }
+        const float *p[3], *q[3];
+        for (int k=0; k<3; k++) {
+            p[k] = positions + 3*tri[k];
+            q[k] = tri[k] == from ? target : p[k];
+        }
+        float before[3], after[3];
+        triangleNormal(p[0], p[1], p[2], before);
+        triangleNormal(q[0], q[1], q[2], after);
+        float d = dot3(before, after);
+        if (d <= 0.25f * sqrtf(dot3(before, before) * dot3(after, after))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+float simplifyMesh(const tinyobj::mesh_t &mesh, const std::vector<unsigned int> &indices,
+                   size_t target_index_count, std::vector<unsigned int> &out)
+{
+    size_t vertex_count = mesh.positions.size() / 3;
+    if (indices.size() <= target_index_count || vertex_count == 0) {
+        out = indices;
+        return 0;
+    }
+    const float *positions = &mesh.positions[0];
+    bool has_normals = mesh.normals.size() == 3*vertex_count;
+
+    // Vertices with identical positions are wedges of one position.
+    std::vector<unsigned int> order(vertex_count), position_id(vertex_count);
+    for (size_t v=0; v<vertex_count; v++) {
+        order[v] = unsigned(v);
+    }
+    PositionLess less = { positions };
+    std::sort(order.begin(), order.end(), less);
+    std::vector<char> referenced(vertex_count, 0);
+    for (size_t i=0; i<indices.size(); i++) {
+        referenced[indices[i]] = 1;
+    }
+    std::vector<unsigned int> wedges;
+    for (size_t i=0; i<vertex_count; i++) {
+        if (i == 0 || less(order[i-1], order[i])) {
+            wedges.push_back(0);
+        }
+        position_id[order[i]] = unsigned(wedges.size() - 1);
+        wedges.back() += referenced[order[i]];
+    }
+    size_t position_count = wedges.size();
+
+    // Seams keep their attribute split only if they stay put; open
+    // borders and non-manifold edges would shrink the silhouette.
+    std::vector<char> locked(position_count, 0);
+    for (size_t p=0; p<position_count; p++) {
+        locked[p] = wedges[p] > 1;
+    }
+    {
+        std::vector<unsigned long long> edges;
+        edges.reserve(indices.size());
+        for (size_t i=0; i<indices.size(); i+=3) {
+            for (int k=0; k<3; k++) {
+                unsigned long long a = position_id[indices[i+k]];
+                unsigned long long b = position_id[indices[i+(k+1)%3]];
+                if (a != b) {
+                    edges.push_back(a < b ? (a << 32) | b : (b << 32) | a);
+                }
+            }
+        }
+        std::sort(edges.begin(), edges.end());
+        for (size_t i=0; i<edges.size(); ) {
+            size_t j = i;
+            while (j < edges.size() && edges[j] == edges[i]) {
+                j++;
+            }
+            if (j - i != 2) {
+                locked[edges[i] >> 32] = 1;
+                locked[edges[i] & 0xffffffffu] = 1;
+            }
+            i = j;
+        }
+    }
+
+    std::vector<Quadric> quadrics(position_count);
+    memset(&quadrics[0], 0, quadrics.size() * sizeof(Quadric));
+    for (size_t i=0; i<indices.size(); i+=3) {
+        const float *p0 = positions + 3*indices[i];
+        float n[3];
+        double length = triangleNormal(p0, positions + 3*indices[i+1], positions + 3*indices[i+2], n);
+        if (length == 0) {
+            continue;
+        }
+        double unit[3] = { n[0], n[1], n[2] };
+        double d = -(unit[0]*p0[0] + unit[1]*p0[1] + unit[2]*p0[2]);
+        for (int k=0; k<3; k++) {
+            addPlane(quadrics[position_id[indices[i+k]]], unit, d, 0.5*length);
+        }
+    }
+
+    std::vector<unsigned int> current(indices), next;
+    std::vector<unsigned int> offsets, adjacency, remap(vertex_count);
+    std::vector<Collapse> candidates;
+    std::vector<char> touched;
+    double max_error = 0;
+
+    while (current.size() > target_index_count) {
+        size_t triangle_count = current.size() / 3;
+
+        offsets.assign(vertex_count + 1, 0);
+        for (size_t i=0; i<current.size(); i++) {
+            offsets[current[i]+1]++;
+        }
+        for (size_t v=0; v<vertex_count; v++) {
+            offsets[v+1] += offsets[v];
+        }
+        adjacency.resize(current.size());
+        {
+            std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+            for (size_t i=0; i<current.size(); i++) {
+                adjacency[fill[current[i]]++] = unsigned(i / 3);
+            }
+        }
+
+        candidates.clear();
+        for (size_t i=0; i<current.size(); i+=3) {
+            for (int k=0; k<3; k++) {
+                unsigned int a = current[i+k], b = current[i+(k+1)%3];
+                if (position_id[a] == position_id[b]) {
+                    continue;
+                }
+                if (!locked[position_id[a]]) {
+                    Collapse c = { a, b, 0.0f };
+                    candidates.push_back(c);
+                }
+                if (!locked[position_id[b]]) {
+                    Collapse c = { b, a, 0.0f };
+                    candidates.push_back(c);
+                }
+            }
+        }
+        std::sort(candidates.begin(), candidates.end(), byVertices);
+        candidates.erase(std::unique(candidates.begin(), candidates.end(), sameVertices),
+                         candidates.end());
+        if (candidates.empty()) {
+            break;
+        }
+
+        parallelFor(0, int(candidates.size()), 4096, [&](int first, int last) {
+            for (int i=first; i<last; i++) {
+                Collapse &c = candidates[i];
+                Quadric q = quadrics[position_id[c.from]];
+                addQuadric(q, quadrics[position_id[c.to]]);
+                const float *to = positions + 3*c.to;
+                double cost = evaluate(q, to);
+                if (has_normals) {
+                    // Charge for folding across a normal crease in proportion
+                    // to how far the vertex moves.
+                    float edge[3];
+                    sub3(to, positions + 3*c.from, edge);
+                    float bend = 1 - dot3(&mesh.normals[3*c.from], &mesh.normals[3*c.to]);
+                    cost += bend > 0 ? bend * dot3(edge, edge) : 0;
+                }
+                c.cost = float(cost);
+            }
+        });
+        std::sort(candidates.begin(), candidates.end(), byCost);
+
+        // Each collapse removes about two triangles; once a vertex is
+        // involved, everything around it waits for the next pass.
+        size_t to_remove = triangle_count - target_index_count / 3;
+        size_t removed = 0;
+        touched.assign(position_count, 0);
+        for (size_t v=0; v<vertex_count; v++) {
+            remap[v] = unsigned(v);
+        }
+        for (size_t i=0; i<candidates.size() && removed < to_remove; i++) {
+            const Collapse &c = candidates[i];
+            unsigned int from_id = position_id[c.from], to_id = position_id[c.to];
+            if (touched[from_id] || touched[to_id]) {
+                continue;
+            }
+            const unsigned int *around = &adjacency[offsets[c.from]];
+            unsigned int around_count = offsets[c.from+1] - offsets[c.from];
+            if (!keepsOrientation(current, around, around_count, position_id, positions,
+                                  c.from, c.to)) {
+                continue;
+            }
+            remap[c.from] = c.to;
+            addQuadric(quadrics[to_id], quadrics[from_id]);
+            max_error = c.cost > max_error ? c.cost : max_error;
+            for (unsigned int j=0; j<around_count; j++) {
+                const unsigned int *tri = &current[3*around[j]];
+                touched[position_id[tri[0]]] = 1;
+                touched[position_id[tri[1]]] = 1;
+                touched[position_id[tri[2]]] = 1;
+            }
+            touched[to_id] = 1;
+            removed += 2;
+        }
+        if (removed == 0) {
+            break;
+        }
+
+        next.clear();
+        for (size_t i=0; i<current.size(); i+=3) {
+            unsigned int a = remap[current[i]], b = remap[current[i+1]], c = remap[current[i+2]];
+            if (position_id[a] != position_id[b] && position_id[b] != position_id[c] &&
+                position_id[a] != position_id[c]) {
+                next.push_back(a);
+                next.push_back(b);
+                next.push_back(c);
+            }
+        }
+        current.swap(next);
+    }
+    out.swap(current);
+    return float(sqrt(max_error));
+}
+
+void buildLodChain(const tinyobj::mesh_t &mesh, std::vector<MeshLod> &lods,
+                   int max_levels, size_t min_triangles)
+{
+    size_t vertex_count = mesh.positions.size() / 3;
+    lods.resize(1);
+    lods[0].indices = mesh.indices;
+    lods[0].error = 0;
+
+    for (int level=1; level<max_levels; level++) {
+        size_t target = lods.back().indices.size() / 6 * 3;
+        if (target / 3 < min_triangles) {
+            break;
+        }
+        MeshLod lod;
+        lod.error = simplifyMesh(mesh, mesh.indices, target, lod.indices);
+        // Locked seams and borders eventually stop further reduction.
+        if (lod.indices.size() > lods.back().indices.size() * 85 / 100) {
+            break;
+        }
+        optimizeVertexCache(lod.indices, vertex_count);
+        lods.push_back(MeshLod());
+        lods.back().indices.swap(lod.indices);
+        lods.back().error = lod.error;
+    }
+}
@@ -0,0 +1,40 @@
+// simplify.hpp - quadric error edge-collapse simplification and LOD chains
+
+#ifndef __simplify_hpp__
+#define __simplify_hpp__
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+# pragma once
+#endif
+
+#include <stddef.h>
+
+#include <vector>
+
+#include "tiny_obj_loader.hpp"
+
+// One level of detail: triangles over the mesh's own vertex buffer, so all
+// levels share one set of vertices.
+struct MeshLod {
+    std::vector<unsigned int> indices;
+    float error;  // object-space distance the surface moved, at most
+};
+
+// Collapses edges of indices (triangles of mesh) in order of quadric error
+// until at most target_index_count indices remain or nothing more can
+// collapse.  Vertices are only ever moved onto neighbouring vertices, so
+// no new vertices are made.  Vertices on UV or normal seams (a position
+// shared by several vertices) and on open borders never move; collapses
+// that turn a triangle over are refused, and ones across a normal crease
+// are charged for it.  Returns the error of the result.
+float simplifyMesh(const tinyobj::mesh_t &mesh, const std::vector<unsigned int> &indices,
+                   size_t target_index_count, std::vector<unsigned int> &out);
+
+// lods[0] is the mesh's own indices; each further level aims for half the
+// triangles of the one before, stopping after max_levels, below
+// min_triangles, or once a level no longer shrinks by a useful amount.
+// Every level is simplified from the full mesh.
+void buildLodChain(const tinyobj::mesh_t &mesh, std::vector<MeshLod> &lods,
+                   int max_levels = 6, size_t min_triangles = 64);
+
+#endif // __simplify_hpp__
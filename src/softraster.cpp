@@ -0,0 +1,749 @@
+// softraster.cpp - tile-based CPU rasterizer for the toon shaders
+//
+// Frames go through three parallel stages: model.vert for every vertex,
+// clipping, setup and binning of the triangles split evenly over the
+// threads, and then the tiles, handed out one at a time.  A tile reads
+// its bins in job order, which keeps the triangles in the order the GL
+// path draws them; blending needs that order.
+
+#include <math.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <chrono>
+
+#include <Cg/double.hpp>
+#include <Cg/vector/xyzw.hpp>
+#include <Cg/vector.hpp>
+#include <Cg/matrix.hpp>
+#include <Cg/mul.hpp>
+#include <Cg/dot.hpp>
+#include <Cg/normalize.hpp>
+#include <Cg/simd.hpp>
+
+#include "softraster.hpp"
+#include "cpushade.hpp"
+#include "parallel.hpp"
+#include "raster.hpp"
+#include "timesource.hpp"
+
+using namespace Cg;
+
+bool software_rendering = false;
+
+namespace {
+
+const int tile_shift = 6;                 // 64x64 pixel tiles
+const int tile_size = 1 << tile_shift;
+const int block_size = 8;                 // of the tile's depth bounds
+const int blocks_per_row = tile_size / block_size;
+
+inline float4 saturate(const float4 &c)
+{
+    return float4(fminf(fmaxf(c.x, 0), 1), fminf(fmaxf(c.y, 0), 1),
+                  fminf(fmaxf(c.z, 0), 1), fminf(fmaxf(c.w, 0), 1));
+}
+
+inline float3 reflect(const float3 &i, const float3 &n)
+{
+    return i - 2 * dot(n, i) * n;
+}
+
+// Bilinear at the base level with GL_REPEAT, the mipmapped filter's
+// result where the texture is not minified.  A texture without an image
+// is incomplete in GL and so samples as opaque black.
+float4 texture2D(const TextureImage *texture, const float2 &st)
+{
+    if (!texture || !texture->image) {
+        return float4(0, 0, 0, 1);
+    }
+    int w = texture->width, h = texture->height;
+    float u = st.x * w - 0.5f, v = st.y * h - 0.5f;
+    float fu = floorf(u), fv = floorf(v);
+    float du = u - fu, dv = v - fv;
+    int i0 = int(fu) % w, j0 = int(fv) % h;
+    i0 = i0 < 0 ? i0 + w : i0;
+    j0 = j0 < 0 ? j0 + h : j0;
+    int i1 = i0 + 1 < w ? i0 + 1 : 0, j1 = j0 + 1 < h ? j0 + 1 : 0;
+    const unsigned char *p = texture->image;
+    float4 texel[4];
+    int corners[4][2] = { {i0, j0}, {i1, j0}, {i0, j1}, {i1, j1} };
+    for (int k=0; k<4; k++) {
+        const unsigned char *t = p + 4 * (size_t(corners[k][1]) * w + corners[k][0]);
+        texel[k] = float4(t[0], t[1], t[2], t[3]) / 255.0f;
+    }
+    return (texel[0] * (1 - du) + texel[1] * du) * (1 - dv) + (texel[2] * (1 - du) + texel[3] * du) * dv;
+}
+
+// glsl/phong.frag
+float4 phong(const SoftUniforms &u, const SoftVaryings &v)
+{
+    float diffuse = dot(v.light_direction, v.normal);
+    float amount_light_to_eye = dot(reflect(v.light_direction, v.normal), v.eye_direction);
+    float specular = glslPow(amount_light_to_eye, u.shininess);
+    float4 tex = texture2D(u.texture, v.texcoord);
+    return saturate(u.LMa + u.LMd * diffuse + specular * u.LMs + tex);
+}
+
+// glsl/toon.frag, with the normal varying for the c2 it never declares.
+float4 toon(const SoftUniforms &u, const SoftVaryings &v)
+{
+    float3 N = normalize(v.normal);
+    float3 L = normalize(v.light_direction);
+    float3 E = float3(0, 0, 1);
+    float3 H = normalize(L + E);
+
+    float df = max2(0, dot(N, L));
+    float sf = glslPow(max2(0, dot(N, H)), u.shininess);
+
+    if (df < 0.1f) df = 0;
+    else if (df < 0.3f) df = 0.3f;
+    else if (df < 0.6f) df = 0.6f;
+    else df = 1;
+    sf = sf < 0.5f ? 0 : 1;
+
+    float4 color = u.LMa + df * u.LMd + sf * u.LMs;
+    return float4(color.x, color.y, color.z, 1);
+}
+
+// glsl/toon_simple.frag
+float4 toonSimple(const SoftUniforms &u, const SoftVaryings &v)
+{
+    const float outline = 0.3f;
+    float diffuse = dot(v.light_direction, v.normal);
+    float4 color;
+    if (diffuse > 0.95f) {
+        color = 1.0f * u.LMd;
+    } else if (diffuse > 0.5f) {
+        color = 0.625f * u.LMd;
+    } else if (diffuse > 0.05f) {
+        color = 0.35f * u.LMd;
+    } else {
+        color = 0.1f * u.LMd;
+    }
+    color *= diffuse;
+    if (dot(normalize(v.normal), normalize(v.c)) < outline) {
+        color = float4(0, 0, 0, 1);
+    }
+    return color;
+}
+
+unsigned char toUnorm8(float c)
+{
+    return (unsigned char)(c * 255 + 0.5f);
+}
+
+SoftUniforms uniformsFor(const ModelObject &model, Light &light)
+{
+    SoftUniforms uniforms;
+    uniforms.LMa = model.material->ambient * light.getColor();
+    uniforms.LMd = model.material->diffuse * light.getColor();
+    uniforms.LMs = model.material->specular * light.getColor();
+    uniforms.shininess = model.material->shininess;
+    uniforms.texture = model.material->texture.get();
+    return uniforms;
+}
+
+} // namespace
+
+bool softShaderFor(const std::string &fragment_filename, SoftShader &shader)
+{
+    if (fragment_filename == "glsl/phong.frag") {
+        shader = SOFT_PHONG;
+    } else if (fragment_filename == "glsl/toon.frag") {
+        shader = SOFT_TOON;
+    } else if (fragment_filename == "glsl/toon_simple.frag") {
+        shader = SOFT_TOON_SIMPLE;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+float4 shadeSoft(SoftShader shader, const SoftUniforms &uniforms, const SoftVaryings &varyings)
+{
+    switch (shader) {
+    case SOFT_TOON:
+        return toon(uniforms, varyings);
+    case SOFT_TOON_SIMPLE:
+        return toonSimple(uniforms, varyings);
+    case SOFT_PHONG:
+    default:
+        return phong(uniforms, varyings);
+    }
+}
+
+GBuffer::GBuffer()
+    : width(0)
+    , height(0)
+{
+}
+
+void GBuffer::resize(int w, int h)
+{
+    if (w == width && h == height) {
+        return;
+    }
+    width = w > 0 ? w : 0;
+    height = h > 0 ? h : 0;
+    for (int p=0; p<planes; p++) {
+        plane[p].assign(size_t(width) * height, 0.0f);
+    }
+    covered.assign(size_t(width) * height, 0);
+}
+
+void GBuffer::clear()
+{
+    covered.assign(covered.size(), 0);
+}
+
+SoftStats::SoftStats()
+    : triangles(0)
+    , bin_entries(0)
+    , tiles_rejected(0)
+    , blocks_rejected(0)
+    , fragments(0)
+    , deferred_pixels(0)
+    , milliseconds(0)
+    , shading_milliseconds(0)
+{
+}
+
+void SoftStats::print(const char *name) const
+{
+    printf("%s: software raster of %d triangles in %d tile bins, %d tile and %d block visits skipped, "
+           "%d fragments shaded in %.2f ms\n",
+           name, triangles, bin_entries, tiles_rejected, blocks_rejected, fragments, milliseconds);
+    if (deferred_pixels > 0) {
+        printf("%s: %d pixels shaded from the G-buffer in %.2f ms\n", name, deferred_pixels, shading_milliseconds);
+    }
+}
+
+SoftRenderer::SoftRenderer()
+    : width(0)
+    , height(0)
+    , tiles_x(0)
+    , tiles_y(0)
+    , gbuffer(NULL)
+{
+}
+
+void SoftRenderer::resize(int w, int h)
+{
+    if (w == width && h == height) {
+        return;
+    }
+    width = w > 0 ? w : 0;
+    height = h > 0 ? h : 0;
+    color.assign(size_t(width) * height * 4, 0);
+    // Four pixels are tested at a time from 8-aligned starts, so rows may
+    // be read a little past their end; the last needs the slack.
+    depth.assign(size_t(width) * height + 4, 1.0f);
+    tiles_x = (width + tile_size - 1) >> tile_shift;
+    tiles_y = (height + tile_size - 1) >> tile_shift;
+    tiles.resize(size_t(tiles_x) * tiles_y);
+    for (int ty=0; ty<tiles_y; ty++) {
+        for (int tx=0; tx<tiles_x; tx++) {
+            Tile &tile = tiles[size_t(ty) * tiles_x + tx];
+            tile.x0 = tx * tile_size;
+            tile.y0 = ty * tile_size;
+            tile.x1 = tile.x0 + tile_size < width ? tile.x0 + tile_size : width;
+            tile.y1 = tile.y0 + tile_size < height ? tile.y0 + tile_size : height;
+        }
+    }
+    bins.clear();
+    clear(float4(0, 0, 0, 0));
+}
+
+void SoftRenderer::clear(const float4 &c)
+{
+    float4 s = saturate(c);
+    unsigned char rgba[4] = { toUnorm8(s.x), toUnorm8(s.y), toUnorm8(s.z), toUnorm8(s.w) };
+    for (size_t i=0; i<color.size(); i+=4) {
+        color[i+0] = rgba[0];
+        color[i+1] = rgba[1];
+        color[i+2] = rgba[2];
+        color[i+3] = rgba[3];
+    }
+    depth.assign(depth.size(), 1.0f);
+    // Blocks past the window's edge hold nothing, so never raise a
+    // tile's farthest depth.
+    for (size_t t=0; t<tiles.size(); t++) {
+        Tile &tile = tiles[t];
+        tile.max_z = 1;
+        for (int b=0; b<blocks_per_row*blocks_per_row; b++) {
+            int bx = tile.x0 + (b % blocks_per_row) * block_size;
+            int by = tile.y0 + (b / blocks_per_row) * block_size;
+            tile.block_max_z[b] = bx < tile.x1 && by < tile.y1 ? 1.0f : 0.0f;
+        }
+    }
+}
+
+// model.vert for every vertex of every shape, and the triangles the GL
+// path would draw of each, in its order, pointing into the one vertex
+// array.
+void SoftRenderer::transform(const ModelObject &model, const View &view, const Camera &camera, Light &light)
+{
+    float4x4 object_to_world = model.transform.getMatrix();
+    float4x4 world_to_object = model.transform.getInverseMatrix();
+    float4x4 view_from_object = mul(view.view_matrix, object_to_world);
+    float4x4 clip_from_object = mul(camera.projection_matrix, view_from_object);
+    float4 eye = mul(world_to_object, float4(view.eye_position, 1));
+    float3 eye_position = eye.xyz / eye.w;
+    float4 light_object = mul(world_to_object, light.getPosition());
+    float3 light_position = light_object.xyz / light_object.w;
+
+    const std::vector<tinyobj::shape_t> &shapes = model.getShapes();
+    const PackedMesh &packed = model.getPackedMesh();
+    size_t vertex_count = 0;
+    for (size_t s=0; s<shapes.size(); s++) {
+        vertex_count += shapes[s].mesh.positions.size() / 3;
+    }
+    vertices.resize(vertex_count);
+    indices.clear();
+
+    size_t vertex_base = 0;
+    for (size_t s=0; s<shapes.size() && s<packed.shapes.size(); s++) {
+        const tinyobj::mesh_t &mesh = shapes[s].mesh;
+        int n = int(mesh.positions.size() / 3);
+        bool has_normals = mesh.normals.size() == mesh.positions.size();
+        bool has_texcoords = mesh.texcoords.size() == 2 * size_t(n);
+        Vertex *out = vertices.empty() ? NULL : &vertices[vertex_base];
+        parallelFor(0, n, 4096, [&](int first, int last) {
+            for (int i=first; i<last; i++) {
+                float4 p = float4(mesh.positions[3*i], mesh.positions[3*i+1], mesh.positions[3*i+2], 1);
+                // Shapes without normals are packed as +z.
+                float3 normal = float3(0, 0, 1);
+                if (has_normals) {
+                    float3 n = float3(mesh.normals[3*i], mesh.normals[3*i+1], mesh.normals[3*i+2]);
+                    if (dot(n, n) > 0) {
+                        normal = normalize(n);
+                    }
+                }
+                float3 light_direction = normalize(light_position - p.xyz);
+                float3 eye_direction = normalize(eye_position - p.xyz);
+                float4 in_view = mul(view_from_object, p);
+                Vertex &v = out[i];
+                v.clip = mul(clip_from_object, p);
+                float *f = v.varyings;
+                for (int k=0; k<3; k++) {
+                    f[k] = light_direction[k];
+                    f[3+k] = eye_direction[k];
+                    f[6+k] = normal[k];
+                    f[9+k] = -in_view[k];
+                }
+                f[12] = has_texcoords ? mesh.texcoords[2*i] : 0;
+                f[13] = has_texcoords ? mesh.texcoords[2*i+1] : 0;
+            }
+        });
+        size_t index_base = indices.size();
+        packed.drawnIndices(s, indices);
+        for (size_t i=index_base; i<indices.size(); i++) {
+            indices[i] += unsigned(vertex_base);
+        }
+        vertex_base += n;
+    }
+    indices.resize(indices.size() / 3 * 3);
+}
+
+// Triangles [first,last) into the job's setups and bins.  Only the near
+// plane is clipped against: beyond it w is positive, so the rest of the
+// frustum is the window's bounds and the far plane's the depth test.
+void SoftRenderer::setupTriangles(int job, size_t first, size_t last)
+{
+    const float3 corner_weights[3] = { float3(1, 0, 0), float3(0, 1, 0), float3(0, 0, 1) };
+    for (size_t t=first; t<last; t++) {
+        unsigned int source = unsigned(3*t);
+        float4 clip[3];
+        int outside_all = 0x3f, outside_any = 0;
+        for (int k=0; k<3; k++) {
+            clip[k] = vertices[indices[source+k]].clip;
+            const float4 &c = clip[k];
+            int outside = (c.x < -c.w) | (c.x > c.w) << 1 | (c.y < -c.w) << 2 | (c.y > c.w) << 3
+                        | (c.z > c.w) << 4 | (c.z < -c.w) << 5;
+            outside_all &= outside;
+            outside_any |= outside;
+        }
+        if (outside_all) {
+            continue;
+        }
+        if (!(outside_any & 0x20)) {
+            addSetup(job, clip, corner_weights, source);
+            continue;
+        }
+
+        // Cut off what is in front of the near plane, z = -w; a triangle
+        // leaves at most a quadrilateral, set up as two.
+        float4 kept[4];
+        float3 kept_weights[4];
+        int count = 0;
+        for (int k=0; k<3; k++) {
+            int next = (k + 1) % 3;
+            float d0 = clip[k].z + clip[k].w, d1 = clip[next].z + clip[next].w;
+            if (d0 >= 0) {
+                kept[count] = clip[k];
+                kept_weights[count] = corner_weights[k];
+                count++;
+            }
+            if ((d0 >= 0) != (d1 >= 0)) {
+                float s = d0 / (d0 - d1);
+                kept[count] = clip[k] + s * (clip[next] - clip[k]);
+                kept_weights[count] = corner_weights[k] + s * (corner_weights[next] - corner_weights[k]);
+                count++;
+            }
+        }
+        for (int k=2; k<count; k++) {
+            float4 fan[3] = { kept[0], kept[k-1], kept[k] };
+            float3 fan_weights[3] = { kept_weights[0], kept_weights[k-1], kept_weights[k] };
+            addSetup(job, fan, fan_weights, source);
+        }
+    }
+}
+
+void SoftRenderer::addSetup(int job, const float4 clip[], const float3 weights[], unsigned int source)
+{
+    Setup s;
+    float x[3], y[3], z[3];
+    for (int k=0; k<3; k++) {
+        s.inv_w[k] = 1 / clip[k].w;
+        x[k] = (clip[k].x * s.inv_w[k] * 0.5f + 0.5f) * width;
+        y[k] = (clip[k].y * s.inv_w[k] * 0.5f + 0.5f) * height;
+        z[k] = clip[k].z * s.inv_w[k] * 0.5f + 0.5f;
+        for (int j=0; j<3; j++) {
+            s.weights_over_w[k][j] = weights[k][j] * s.inv_w[k];
+        }
+    }
+    // Nothing culls back faces in the GL path, so both windings draw.
+    float area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+    if (!(fabsf(area) > 1e-8f)) {
+        return;
+    }
+    pixelSpan(min3(x[0], x[1], x[2]), max3(x[0], x[1], x[2]), width, s.x0, s.x1);
+    pixelSpan(min3(y[0], y[1], y[2]), max3(y[0], y[1], y[2]), height, s.y0, s.y1);
+    if (s.x0 > s.x1 || s.y0 > s.y1) {
+        return;
+    }
+
+    // Edge k is the one across from corner k, so it is corner k's
+    // barycentric; planes are taken about corner 0 to keep precision.
+    s.ox = x[0];
+    s.oy = y[0];
+    float inv_area = 1 / area;
+    for (int k=0; k<3; k++) {
+        int i = (k + 1) % 3, j = (k + 2) % 3;
+        s.a[k] = (y[i] - y[j]) * inv_area;
+        s.b[k] = (x[j] - x[i]) * inv_area;
+        s.c[k] = -(s.a[k] * (x[i] - s.ox) + s.b[k] * (y[i] - s.oy));
+        // Inside is to the right of a left edge and below a top one.
+        s.top_left[k] = s.a[k] > 0 || (s.a[k] == 0 && s.b[k] < 0);
+    }
+    s.za = s.a[0] * z[0] + s.a[1] * z[1] + s.a[2] * z[2];
+    s.zb = s.b[0] * z[0] + s.b[1] * z[1] + s.b[2] * z[2];
+    s.zc = s.c[0] * z[0] + s.c[1] * z[1] + s.c[2] * z[2];
+    s.min_z = min3(z[0], z[1], z[2]);
+    s.source = source;
+
+    std::vector<Setup> &job_setups = setups[job];
+    unsigned int index = unsigned(job_setups.size());
+    job_setups.push_back(s);
+    std::vector< std::vector<unsigned int> > &job_bins = bins[job];
+    for (int ty=s.y0>>tile_shift; ty<=s.y1>>tile_shift; ty++) {
+        for (int tx=s.x0>>tile_shift; tx<=s.x1>>tile_shift; tx++) {
+            job_bins[size_t(ty) * tiles_x + tx].push_back(index);
+        }
+    }
+}
+
+// Whether a pixel whose center is e from an edge, in s's barycentrics, is
+// inside it.  Centers on the edge go to the triangle for which it is a
+// top or left edge, as GL does, so two triangles sharing it do not both
+// shade them.
+static inline bool insideEdge(float e, bool top_left)
+{
+    return e > 0 || (e == 0 && top_left);
+}
+
+#ifdef __CG_SIMD
+static inline int outsideEdgeMask(__CGsimd4f e, bool top_left)
+{
+    const __CGsimd4f zero = __CGsimd_set1(0);
+    return top_left ? __CGsimd_lessmask(e, zero) : ~__CGsimd_lessmask(zero, e);
+}
+#endif
+
+// Of the four pixels along the row from (x,y), those inside s and nearer
+// than depth_row[x..x+3] as mask bits, with their barycentrics for
+// corners 1 and 2 and their depths.
+int SoftRenderer::cover4(const Setup &s, int x, int y, const float *depth_row,
+                         float l1[4], float l2[4], float z[4]) const
+{
+    float px = x + 0.5f - s.ox, py = y + 0.5f - s.oy;
+#ifdef __CG_SIMD
+    static const float lane[4] = { 0, 1, 2, 3 };
+    const __CGsimd4f one = __CGsimd_set1(1);
+    __CGsimd4f dx = __CGsimd_add(__CGsimd_set1(px), __CGsimd_load(lane));
+    __CGsimd4f e0 = __CGsimd_add(__CGsimd_mul(__CGsimd_set1(s.a[0]), dx), __CGsimd_set1(s.b[0] * py + s.c[0]));
+    __CGsimd4f e1 = __CGsimd_add(__CGsimd_mul(__CGsimd_set1(s.a[1]), dx), __CGsimd_set1(s.b[1] * py + s.c[1]));
+    __CGsimd4f e2 = __CGsimd_add(__CGsimd_mul(__CGsimd_set1(s.a[2]), dx), __CGsimd_set1(s.b[2] * py + s.c[2]));
+    __CGsimd4f zz = __CGsimd_add(__CGsimd_mul(__CGsimd_set1(s.za), dx), __CGsimd_set1(s.zb * py + s.zc));
+    int outside = outsideEdgeMask(e0, s.top_left[0]) | outsideEdgeMask(e1, s.top_left[1])
+                | outsideEdgeMask(e2, s.top_left[2]) | __CGsimd_lessmask(one, zz);
+    int nearer = __CGsimd_lessmask(zz, __CGsimd_load(depth_row + x));
+    __CGsimd_store(l1, e1);
+    __CGsimd_store(l2, e2);
+    __CGsimd_store(z, zz);
+    return nearer & ~outside & 0xf;
+#else
+    int mask = 0;
+    for (int k=0; k<4; k++) {
+        float dx = px + k;
+        float e0 = s.a[0] * dx + s.b[0] * py + s.c[0];
+        l1[k] = s.a[1] * dx + s.b[1] * py + s.c[1];
+        l2[k] = s.a[2] * dx + s.b[2] * py + s.c[2];
+        z[k] = s.za * dx + s.zb * py + s.zc;
+        if (insideEdge(e0, s.top_left[0]) && insideEdge(l1[k], s.top_left[1]) && insideEdge(l2[k], s.top_left[2])
+            && z[k] <= 1 && z[k] < depth_row[x+k]) {
+            mask |= 1 << k;
+        }
+    }
+    return mask;
+#endif
+}
+
+// Interpolates model.vert's varyings at the pixel with perspective,
+// shades, blends and writes depth, or with a G-buffer set stores them.
+void SoftRenderer::shadePixel(int x, int y, float z, const Setup &s, float l1, float l2,
+                              SoftShader shader, const SoftUniforms &uniforms)
+{
+    float l0 = 1 - l1 - l2;
+    float inv_w = 1 / (l0 * s.inv_w[0] + l1 * s.inv_w[1] + l2 * s.inv_w[2]);
+    float w[3];
+    for (int j=0; j<3; j++) {
+        w[j] = (l0 * s.weights_over_w[0][j] + l1 * s.weights_over_w[1][j] + l2 * s.weights_over_w[2][j]) * inv_w;
+    }
+    const float *v0 = vertices[indices[s.source]].varyings;
+    const float *v1 = vertices[indices[s.source+1]].varyings;
+    const float *v2 = vertices[indices[s.source+2]].varyings;
+    float f[varying_floats];
+    for (int k=0; k<varying_floats; k++) {
+        f[k] = w[0] * v0[k] + w[1] * v1[k] + w[2] * v2[k];
+    }
+    size_t i = size_t(y) * width + x;
+    if (gbuffer) {
+        for (int k=0; k<varying_floats; k++) {
+            gbuffer->plane[k][i] = f[k];
+        }
+        gbuffer->covered[i] = 1;
+        depth[i] = z;
+        return;
+    }
+    SoftVaryings v;
+    v.light_direction = float3(f[0], f[1], f[2]);
+    v.eye_direction = float3(f[3], f[4], f[5]);
+    v.normal = float3(f[6], f[7], f[8]);
+    v.c = float3(f[9], f[10], f[11]);
+    v.texcoord = float2(f[12], f[13]);
+
+    // glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA) on every channel.
+    float4 src = saturate(shadeSoft(shader, uniforms, v));
+    unsigned char *dst = &color[4*i];
+    float a = src.w;
+    dst[0] = toUnorm8(src.x * a + dst[0] / 255.0f * (1 - a));
+    dst[1] = toUnorm8(src.y * a + dst[1] / 255.0f * (1 - a));
+    dst[2] = toUnorm8(src.z * a + dst[2] / 255.0f * (1 - a));
+    dst[3] = toUnorm8(src.w * a + dst[3] / 255.0f * (1 - a));
+    depth[i] = z;
+}
+
+void SoftRenderer::rasterizeTile(int t, SoftShader shader, const SoftUniforms &uniforms, SoftStats &tile_stats)
+{
+    Tile &tile = tiles[t];
+    for (size_t job=0; job<bins.size(); job++) {
+        const std::vector<unsigned int> &bin = bins[job][t];
+        for (size_t n=0; n<bin.size(); n++) {
+            const Setup &s = setups[job][bin[n]];
+            if (s.min_z >= tile.max_z) {
+                tile_stats.tiles_rejected++;
+                continue;
+            }
+            int x0 = s.x0 > tile.x0 ? s.x0 : tile.x0, x1 = s.x1 < tile.x1 - 1 ? s.x1 : tile.x1 - 1;
+            int y0 = s.y0 > tile.y0 ? s.y0 : tile.y0, y1 = s.y1 < tile.y1 - 1 ? s.y1 : tile.y1 - 1;
+            bool touched = false;
+            for (int by=(y0-tile.y0)/block_size; by<=(y1-tile.y0)/block_size; by++) {
+                for (int bx=(x0-tile.x0)/block_size; bx<=(x1-tile.x0)/block_size; bx++) {
+                    float &block_max_z = tile.block_max_z[by*blocks_per_row + bx];
+                    if (s.min_z >= block_max_z) {
+                        tile_stats.blocks_rejected++;
+                        continue;
+                    }
+                    int block_x = tile.x0 + bx*block_size, block_y = tile.y0 + by*block_size;
+                    int px0 = x0 > block_x ? x0 : block_x;
+                    int px1 = x1 < block_x + block_size - 1 ? x1 : block_x + block_size - 1;
+                    int py0 = y0 > block_y ? y0 : block_y;
+                    int py1 = y1 < block_y + block_size - 1 ? y1 : block_y + block_size - 1;
+
+                    // An edge negative at the block's farthest pixel center
+                    // along its gradient leaves the block out entirely.
+                    float lo_x = px0 + 0.5f - s.ox, hi_x = px1 + 0.5f - s.ox;
+                    float lo_y = py0 + 0.5f - s.oy, hi_y = py1 + 0.5f - s.oy;
+                    bool outside = false;
+                    for (int k=0; k<3 && !outside; k++) {
+                        float e = s.a[k] * (s.a[k] > 0 ? hi_x : lo_x) + s.b[k] * (s.b[k] > 0 ? hi_y : lo_y) + s.c[k];
+                        outside = e < 0;
+                    }
+                    if (outside) {
+                        tile_stats.blocks_rejected++;
+                        continue;
+                    }
+
+                    bool wrote = false;
+                    int span = ((1 << (px1 - block_x + 1)) - 1) & ~((1 << (px0 - block_x)) - 1);
+                    for (int y=py0; y<=py1; y++) {
+                        const float *depth_row = &depth[size_t(y) * width];
+                        for (int x=block_x; x<=px1; x+=4) {
+                            float l1[4], l2[4], z[4];
+                            int mask = cover4(s, x, y, depth_row, l1, l2, z) & (span >> (x - block_x));
+                            for (int k=0; k<4; k++) {
+                                if (mask & (1 << k)) {
+                                    shadePixel(x+k, y, z[k], s, l1[k], l2[k], shader, uniforms);
+                                    tile_stats.fragments++;
+                                    wrote = true;
+                                }
+                            }
+                        }
+                    }
+                    if (wrote) {
+                        int ex = block_x + block_size < tile.x1 ? block_x + block_size : tile.x1;
+                        int ey = block_y + block_size < tile.y1 ? block_y + block_size : tile.y1;
+                        float farthest = 0;
+                        for (int y=block_y; y<ey; y++) {
+                            const float *d = &depth[size_t(y) * width];
+                            for (int x=block_x; x<ex; x++) {
+                                farthest = max2(farthest, d[x]);
+                            }
+                        }
+                        block_max_z = farthest;
+                        touched = true;
+                    }
+                }
+            }
+            if (touched) {
+                float farthest = 0;
+                for (int b=0; b<blocks_per_row*blocks_per_row; b++) {
+                    farthest = max2(farthest, tile.block_max_z[b]);
+                }
+                tile.max_z = farthest;
+            }
+        }
+    }
+}
+
+void SoftRenderer::rasterize(Scene &scene, SoftShader shader, const SoftUniforms &uniforms)
+{
+    scene.view.validate();
+    scene.cullModel(height);
+    transform(*scene.models, scene.view, scene.camera, *scene.light_list[0]);
+
+    int jobs = numWorkerThreads();
+    setups.resize(jobs);
+    bins.resize(jobs);
+    for (int j=0; j<jobs; j++) {
+        setups[j].clear();
+        bins[j].resize(tiles.size());
+        for (size_t t=0; t<tiles.size(); t++) {
+            bins[j][t].clear();
+        }
+    }
+    size_t triangle_count = indices.size() / 3;
+    size_t per_job = (triangle_count + jobs - 1) / jobs;
+    parallelFor(0, jobs, 1, [&](int first, int last) {
+        for (int j=first; j<last; j++) {
+            size_t begin = j * per_job < triangle_count ? j * per_job : triangle_count;
+            size_t end = begin + per_job < triangle_count ? begin + per_job : triangle_count;
+            setupTriangles(j, begin, end);
+        }
+    });
+    for (int j=0; j<jobs; j++) {
+        stats.triangles += int(setups[j].size());
+        for (size_t t=0; t<tiles.size(); t++) {
+            stats.bin_entries += int(bins[j][t].size());
+        }
+    }
+
+    // Tiles differ a lot in how much they hold, so threads take the next
+    // one as they finish rather than a fixed share.
+    std::atomic<int> next_tile(0);
+    int tile_count = int(tiles.size());
+    std::vector<SoftStats> worker_stats(jobs);
+    parallelFor(0, jobs, 1, [&](int first, int last) {
+        SoftStats &local = worker_stats[first];
+        for (int t = next_tile++; t < tile_count; t = next_tile++) {
+            rasterizeTile(t, shader, uniforms, local);
+        }
+    });
+    for (int j=0; j<jobs; j++) {
+        stats.tiles_rejected += worker_stats[j].tiles_rejected;
+        stats.blocks_rejected += worker_stats[j].blocks_rejected;
+        stats.fragments += worker_stats[j].fragments;
+    }
+}
+
+bool SoftRenderer::draw(Scene &scene)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    stats = SoftStats();
+    SoftUniforms uniforms = uniformsFor(*scene.models, *scene.light_list[0]);
+    const std::string &fragment_filename = scene.models->fragment_filename;
+
+    SoftShader shader = SOFT_PHONG;
+    CpuShader deferred_shader = CPU_GOOCH;
+    bool ported = softShaderFor(fragment_filename, shader);
+    if (!ported && cpuShaderFor(fragment_filename, deferred_shader)) {
+        deferred.resize(width, height);
+        deferred.clear();
+        gbuffer = &deferred;
+        rasterize(scene, shader, uniforms);
+        gbuffer = NULL;
+        std::chrono::steady_clock::time_point shading_start = std::chrono::steady_clock::now();
+        stats.deferred_pixels = shadeGBuffer(deferred_shader, uniforms, deferred, color.empty() ? NULL : &color[0]);
+        stats.shading_milliseconds = elapsedMilliseconds(shading_start);
+        ported = true;
+    } else {
+        rasterize(scene, shader, uniforms);
+    }
+    stats.milliseconds = elapsedMilliseconds(start);
+    return ported;
+}
+
+void SoftRenderer::drawGBuffer(Scene &scene, GBuffer &out)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    stats = SoftStats();
+    SoftUniforms uniforms = uniformsFor(*scene.models, *scene.light_list[0]);
+    out.resize(width, height);
+    out.clear();
+    gbuffer = &out;
+    rasterize(scene, SOFT_PHONG, uniforms);
+    gbuffer = NULL;
+    stats.milliseconds = elapsedMilliseconds(start);
+}
+
+bool SoftRenderer::writePPM(const char *filename) const
+{
+    FILE *file = fopen(filename, "wb");
+    if (!file) {
+        return false;
+    }
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+    std::vector<unsigned char> row(size_t(width) * 3 + 1);
+    for (int y=height-1; y>=0; y--) {
+        const unsigned char *src = &color[size_t(y) * width * 4];
+        for (int x=0; x<width; x++) {
+            row[3*x+0] = src[4*x+0];
+            row[3*x+1] = src[4*x+1];
+            row[3*x+2] = src[4*x+2];
+        }
+        fwrite(&row[0], 1, size_t(width) * 3, file);
+    }
+    return fclose(file) == 0;
+}
@@ -0,0 +1,181 @@
+// softraster.hpp - tile-based CPU rasterizer for the toon shaders
+
+#ifndef __softraster_hpp__
+#define __softraster_hpp__
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+# pragma once
+#endif
+
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+#include <Cg/vector.hpp>
+#include <Cg/matrix.hpp>
+
+#include <GL/glew.h>
+
+#include "scene.hpp"
+
+// The fragment shaders with a C++ port for the software rasterizer.
+enum SoftShader {
+    SOFT_PHONG,        // glsl/phong.frag
+    SOFT_TOON,         // glsl/toon.frag
+    SOFT_TOON_SIMPLE   // glsl/toon_simple.frag
+};
+
+// The port of fragment_filename; false when it has none.
+bool softShaderFor(const std::string &fragment_filename, SoftShader &shader);
+
+// model.vert's varyings at a fragment, interpolated as GL does.
+struct SoftVaryings {
+    Cg::float3 light_direction;  // object space, normalized per vertex
+    Cg::float3 eye_direction;
+    Cg::float3 normal;
+    Cg::float3 c;                // from the vertex to the eye, in eye space
+    Cg::float2 texcoord;
+};
+
+// model.vert's varyings of the nearest fragment at every pixel, for
+// shading after rasterization.  Each component is a plane of its own, so
+// neighbouring pixels load together.
+struct GBuffer {
+    enum {
+        LIGHT_X, LIGHT_Y, LIGHT_Z,
+        EYE_X, EYE_Y, EYE_Z,
+        NORMAL_X, NORMAL_Y, NORMAL_Z,
+        C_X, C_Y, C_Z,
+        TEXCOORD_S, TEXCOORD_T,
+        planes
+    };
+
+    int width, height;
+    std::vector<float> plane[planes];    // rows bottom first
+    std::vector<unsigned char> covered;  // 1 where a fragment was written
+
+    GBuffer();
+
+    void resize(int width, int height);
+    void clear();
+};
+
+// What ModelObject::draw sets for the fragment shaders.
+struct SoftUniforms {
+    Cg::float4 LMa, LMd, LMs;
+    float shininess;
+    const TextureImage *texture;  // sampled as black when NULL or not loaded
+};
+
+// gl_FragColor of shader for one fragment, before clamping.
+Cg::float4 shadeSoft(SoftShader shader, const SoftUniforms &uniforms, const SoftVaryings &varyings);
+
+struct SoftStats {
+    int triangles;          // set up, after clipping and culling
+    int bin_entries;        // triangle and tile pairs
+    int tiles_rejected;     // pairs dropped whole by the tile's farthest depth
+    int blocks_rejected;    // 8x8 blocks dropped by their edges or depth
+    int fragments;          // shaded and blended, or written to the G-buffer
+    int deferred_pixels;    // shaded from the G-buffer by cpushade.hpp
+    double milliseconds;
+    double shading_milliseconds;  // of those, shading the G-buffer
+
+    SoftStats();
+    void print(const char *name) const;
+};
+
+// Draws the scene's model the way the GL path does, without GL: the
+// triangles Scene::cullModel leaves, in the same order, with the same
+// transforms and light, model.vert's varyings interpolated with
+// perspective, the model's fragment shader ported to C++, the GL_LESS
+// depth test and blending of the source over the framebuffer by its
+// alpha.  Triangles are set up and binned into 64x64 pixel tiles in
+// parallel, then each tile is rasterized and shaded on its own by
+// whichever thread takes it next, testing four pixels at a time.  Every
+// tile and every 8x8 block in it keeps its farthest depth, so a
+// triangle entirely behind a tile or block skips it without touching
+// its pixels.  Shaders without a port here but with one in cpushade.hpp
+// are drawn deferred: the nearest fragments go to a G-buffer, which is
+// then shaded and blended over the cleared color.  Lights and the
+// environment map are not drawn.
+class SoftRenderer {
+    // SoftVaryings as plain floats, which interpolate in a simple loop.
+    enum { varying_floats = 14 };
+    struct Vertex {
+        Cg::float4 clip;
+        float varyings[varying_floats];
+    };
+    // A triangle ready for scan conversion: its three edge functions and
+    // depth as planes over the window, normalized so the edges give the
+    // screen-space barycentrics, and for perspective each corner's 1/w
+    // and weights on the source triangle's vertices over w, as clipping
+    // may have made new corners.
+    struct Setup {
+        float ox, oy;                    // where the planes are taken about
+        float a[3], b[3], c[3];
+        bool top_left[3];                // edges that own the centers on them
+        float za, zb, zc;
+        float min_z;
+        int x0, x1, y0, y1;              // pixels whose centers may be inside
+        float inv_w[3];
+        float weights_over_w[3][3];
+        unsigned int source;             // first of its three indices
+    };
+    struct Tile {
+        int x0, y0, x1, y1;              // pixels, last exclusive
+        float max_z;
+        float block_max_z[64];
+    };
+
+    int width, height;
+    int tiles_x, tiles_y;
+    std::vector<unsigned char> color;    // RGBA8, rows bottom first
+    std::vector<float> depth;
+    std::vector<Tile> tiles;
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+    std::vector< std::vector<Setup> > setups;                      // per binning job
+    std::vector< std::vector< std::vector<unsigned int> > > bins;  // per job, per tile
+    GBuffer *gbuffer;                    // written instead of color while set
+    GBuffer deferred;
+
+    void rasterize(Scene &scene, SoftShader shader, const SoftUniforms &uniforms);
+    void transform(const ModelObject &model, const View &view, const Camera &camera, Light &light);
+    void setupTriangles(int job, size_t first, size_t last);
+    void addSetup(int job, const Cg::float4 clip[], const Cg::float3 weights[], unsigned int source);
+    int cover4(const Setup &s, int x, int y, const float *depth_row,
+               float l1[4], float l2[4], float z[4]) const;
+    void rasterizeTile(int tile, SoftShader shader, const SoftUniforms &uniforms, SoftStats &tile_stats);
+    void shadePixel(int x, int y, float z, const Setup &setup, float l1, float l2,
+                    SoftShader shader, const SoftUniforms &uniforms);
+
+public:
+    SoftStats stats;  // of the last draw
+
+    SoftRenderer();
+
+    void resize(int width, int height);
+    // Sets every pixel to color and every depth to the far plane.
+    void clear(const Cg::float4 &color);
+    // Draws the scene's model lit by its first light.  False when the
+    // model's shader has no port, which then draws with phong's.
+    bool draw(Scene &scene);
+    // Rasterizes the scene's model into out, sized to the window, without
+    // shading; depth is tested and written as draw does.
+    void drawGBuffer(Scene &scene, GBuffer &out);
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    // As glReadPixels returns them with GL_PACK_ALIGNMENT 1.
+    const unsigned char *pixels() const { return color.empty() ? NULL : &color[0]; }
+    // Window depths, 0 at the near plane and 1 at the far, rows bottom first.
+    const float *depths() const { return depth.empty() ? NULL : &depth[0]; }
+
+    // A binary PPM of the color, top row first.
+    bool writePPM(const char *filename) const;
+};
+
+extern bool software_rendering;  // -software
+
+#endif // __softraster_hpp__
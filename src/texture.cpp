@@ -1,8 +1,12 @@
 
 #include <assert.h>
+#include <math.h>
 #include <stdio.h>
 #include <string.h>
 
+#include <chrono>
+#include <string>
+
 #include <GL/glew.h>
 #ifdef __APPLE__
 #include <GLUT/glut.h>
@@ -12,12 +16,19 @@
 
 #include "texture.hpp"
 #include "matrix_stack.hpp"
+#include "parallel.hpp"
+#include "timesource.hpp"
 
 #include <Cg/stdlib.hpp>
 #include <Cg/iostream.hpp>
 
 #include "../stb/stb_image.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# include <emmintrin.h>
+# define NORMALMAP_USE_SSE 1
+#endif
+
 extern const char *program_name;
 extern bool verbose;
 
@@ -49,6 +60,7 @@ TextureImage::~TextureImage()
 
 TextureGLState::TextureGLState()
     : mipmapped(true)
+    , mip_color_space(MIP_SRGB)
     , texture_object(0)
 {
 }
@@ -77,6 +89,64 @@ bool TextureGLState::isMipmapped()
     return mipmapped;
 }
 
+void TextureGLState::setMipColorSpace(MipColorSpace color_space)
+{
+    mip_color_space = color_space;
+}
+
+// Uploads image with a full mip chain to the bound texture's target.  With
+// cpu_mipmaps (-cpumipmaps) the chain is filtered on the CPU (and optionally
+// cached beside the source file); otherwise, and by default, the driver's
+// glGenerateMipmap is used, which is several times faster.  Both paths
+// report their time when verbose, and -kernelbench times them on the same
+// images.  An image that failed to load leaves the texture empty, as it
+// always has.
+void TextureGLState::uploadMipmapped(GLenum target, GLenum internal_format,
+                                     const GLubyte *image, int width, int height, int components,
+                                     const char *filename, bool cacheable)
+{
+    GLenum format = components == 3 ? GL_RGB : GL_RGBA;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    if (cpu_mipmaps && image) {
+        MipChain chain;
+        std::string cache_filename = std::string(filename) + ".mips";
+        bool use_cache = texture_cache && cacheable;
+        bool cached = use_cache &&
+            chain.readCache(cache_filename.c_str(), filename, mip_filter, mip_color_space) &&
+            chain.components == components &&
+            chain.levels[0].width == width && chain.levels[0].height == height;
+        if (!cached) {
+            chain.build(image, width, height, components, mip_filter, mip_color_space);
+            if (use_cache && !chain.writeCache(cache_filename.c_str(), filename)) {
+                printf("%s: could not write texture cache %s\n", program_name, cache_filename.c_str());
+            }
+        }
+        double cpu_ms = elapsedMilliseconds(start);
+        chain.tellGL(target, internal_format);
+        if (verbose) {
+            glFinish();
+            printf("%s: %d mip levels %s in %.2f ms, uploaded in %.2f ms\n",
+                filename, int(chain.levels.size()), cached ? "read from cache" : "filtered",
+                cpu_ms, elapsedMilliseconds(start) - cpu_ms);
+        }
+    } else {
+        glTexImage2D(target, 0, internal_format, width, height, 0, format, GL_UNSIGNED_BYTE, image);
+        if (verbose) {
+            glFinish();
+            start = std::chrono::steady_clock::now();
+        }
+        // Cube map faces are generated together by the caller.
+        if (target == GL_TEXTURE_2D) {
+            glGenerateMipmap(target);
+        }
+        if (verbose && target == GL_TEXTURE_2D) {
+            glFinish();
+            printf("%s: glGenerateMipmap in %.2f ms\n", filename, elapsedMilliseconds(start));
+        }
+    }
+}
+
 Texture::Texture(const char *fn)
     : TextureImage(fn)
 {
@@ -120,12 +190,12 @@ void Texture2D::tellGL()
     TextureGLState::tellGL();
 
     bind();
-    glTexImage2D(target, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
     if (isMipmapped()) {
-        glGenerateMipmap(target);
+        uploadMipmapped(target, GL_RGBA8, image, width, height, 4, filename, true);
         glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     } else {
+        glTexImage2D(target, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
         glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     }
 }
@@ -136,8 +206,10 @@ Texture::~Texture()
 
 NormalMap::NormalMap(const char *fn)
     : Texture2D(fn)
-    , normal_image(NULL)
-{}
+    , normal_scale(0)
+{
+    setMipColorSpace(MIP_NORMAL);
+}
 
 struct PackedNormal {
     GLubyte n[3];
@@ -147,31 +219,162 @@ struct PackedNormal {
 
 PackedNormal::PackedNormal(float3 normal)
 {
-    assert(normal.x >= -1);
-    assert(normal.y >= -1);
-    assert(normal.z >= -1);
+    n[0] = GLubyte(128.5f + 127*normal.x);
+    n[1] = GLubyte(128.5f + 127*normal.y);
+    n[2] = GLubyte(128.5f + 127*normal.z);
+}
+
+// Height fields tile, so neighbors wrap around the image edges.
+static inline int wrap(int i, int n)
+{
+    return i < 0 ? i + n : (i >= n ? i - n : i);
+}
+
+// Computes Sobel gradients for the base level and box filters them down to
+// 1x1.  Gradients are linear in the bump scale, so every mip level of the
+// normal map can later be derived from its own gradient level without
+// filtering normals again.
+void NormalMap::computeGradients()
+{
+    gradients.clear();
+
+    Gradients base;
+    base.width = width;
+    base.height = height;
+    base.s.resize(size_t(width)*height);
+    base.t.resize(size_t(width)*height);
+    gradients.push_back(base);
+
+    {
+        const int w = width, h = height;
+        const GLubyte *heights = image;
+        float *gs = &gradients[0].s[0];
+        float *gt = &gradients[0].t[0];
+        // Normalized so a unit height step per texel (in [0,1] height
+        // units) yields a gradient of 1.
+        const float k = 1.0f/(8*255);
+        parallelFor(0, h, 32, [=](int y0, int y1) {
+            for (int y=y0; y<y1; y++) {
+                const GLubyte *r0 = heights + size_t(wrap(y-1, h))*w;
+                const GLubyte *r1 = heights + size_t(y)*w;
+                const GLubyte *r2 = heights + size_t(wrap(y+1, h))*w;
+                for (int x=0; x<w; x++) {
+                    int xl = wrap(x-1, w), xr = wrap(x+1, w);
+                    int ds = (r0[xr] - r0[xl]) + 2*(r1[xr] - r1[xl]) + (r2[xr] - r2[xl]);
+                    int dt = (r2[xl] + 2*r2[x] + r2[xr]) - (r0[xl] + 2*r0[x] + r0[xr]);
+                    gs[size_t(y)*w + x] = ds*k;
+                    gt[size_t(y)*w + x] = dt*k;
+                }
+            }
+        });
+    }
 
-    assert(normal.x <= 1);
-    assert(normal.y <= 1);
-    assert(normal.z <= 1);
-    n[0] = 128 + 127*normal.x;
-    n[1] = 128 + 127*normal.y;
-    n[2] = 128 + 127*normal.z;
+    while (gradients.back().width > 1 || gradients.back().height > 1) {
+        const Gradients &src = gradients.back();
+        Gradients dst;
+        dst.width = src.width > 1 ? src.width/2 : 1;
+        dst.height = src.height > 1 ? src.height/2 : 1;
+        dst.s.resize(size_t(dst.width)*dst.height);
+        dst.t.resize(size_t(dst.width)*dst.height);
+        for (int y=0; y<dst.height; y++) {
+            int y0 = 2*y, y1 = 2*y+1 < src.height ? 2*y+1 : 2*y;
+            for (int x=0; x<dst.width; x++) {
+                int x0 = 2*x, x1 = 2*x+1 < src.width ? 2*x+1 : 2*x;
+                size_t a = size_t(y0)*src.width, b = size_t(y1)*src.width;
+                dst.s[size_t(y)*dst.width + x] = 0.25f*(src.s[a+x0] + src.s[a+x1] + src.s[b+x0] + src.s[b+x1]);
+                dst.t[size_t(y)*dst.width + x] = 0.25f*(src.t[a+x0] + src.t[a+x1] + src.t[b+x0] + src.t[b+x1]);
+            }
+        }
+        gradients.push_back(dst);
+    }
 }
 
-float3 NormalMap::computeNormal(int i, int j, float scale)
+float3 NormalMap::computeNormal(int i, int j, float scale, int level)
 {
-    float3 normal = float3(0,0,1);  // XXX fix me
-    return normal;
+    const Gradients &g = gradients[level];
+    size_t ndx = size_t(j)*g.width + i;
+    float3 normal = float3(-scale*g.s[ndx], -scale*g.t[ndx], 1);
+    return normal / ::sqrtf(normal.x*normal.x + normal.y*normal.y + 1);
+}
+
+// Scales the cached gradients into packed normals for every level, four
+// texels at a time with SSE and with bands of rows spread across threads.
+void NormalMap::computeNormals(float scale)
+{
+    normal_chain.components = 3;
+    normal_chain.filter = MIP_FILTER_BOX;
+    normal_chain.color_space = MIP_NORMAL;
+    normal_chain.levels.resize(gradients.size());
+
+    for (size_t level=0; level<gradients.size(); level++) {
+        const Gradients &g = gradients[level];
+        MipLevel &dst = normal_chain.levels[level];
+        dst.width = g.width;
+        dst.height = g.height;
+        dst.texels.resize(size_t(g.width)*g.height*3);
+
+        const int w = g.width;
+        const float *gs_base = &g.s[0];
+        const float *gt_base = &g.t[0];
+        GLubyte *packed = &dst.texels[0];
+        NormalMap *self = this;
+        const int lvl = int(level);
+
+        parallelFor(0, g.height, 32, [=](int y0, int y1) {
+            for (int y=y0; y<y1; y++) {
+                GLubyte *p = packed + size_t(y)*w*3;
+                int x = 0;
+#ifdef NORMALMAP_USE_SSE
+                const float *gs = gs_base + size_t(y)*w;
+                const float *gt = gt_base + size_t(y)*w;
+                const __m128 neg_scale = _mm_set1_ps(-scale);
+                const __m128 one = _mm_set1_ps(1), half = _mm_set1_ps(0.5f), three_halves = _mm_set1_ps(1.5f);
+                const __m128 bias = _mm_set1_ps(128.5f), range = _mm_set1_ps(127);
+                for (; x+4<=w; x+=4) {
+                    __m128 nx = _mm_mul_ps(neg_scale, _mm_loadu_ps(gs+x));
+                    __m128 ny = _mm_mul_ps(neg_scale, _mm_loadu_ps(gt+x));
+                    __m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), one);
+                    // rsqrt estimate refined with one Newton-Raphson step
+                    __m128 r = _mm_rsqrt_ps(len2);
+                    r = _mm_mul_ps(r, _mm_sub_ps(three_halves, _mm_mul_ps(_mm_mul_ps(half, len2), _mm_mul_ps(r, r))));
+                    __m128i bx = _mm_cvttps_epi32(_mm_add_ps(bias, _mm_mul_ps(range, _mm_mul_ps(nx, r))));
+                    __m128i by = _mm_cvttps_epi32(_mm_add_ps(bias, _mm_mul_ps(range, _mm_mul_ps(ny, r))));
+                    __m128i bz = _mm_cvttps_epi32(_mm_add_ps(bias, _mm_mul_ps(range, r)));
+                    int ix[4], iy[4], iz[4];
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(ix), bx);
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(iy), by);
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(iz), bz);
+                    for (int i=0; i<4; i++, p+=3) {
+                        p[0] = GLubyte(ix[i]);
+                        p[1] = GLubyte(iy[i]);
+                        p[2] = GLubyte(iz[i]);
+                    }
+                }
+#endif
+                for (; x<w; x++, p+=3) {
+                    PackedNormal packed_normal(self->computeNormal(x, y, scale, lvl));
+                    p[0] = packed_normal.n[0];
+                    p[1] = packed_normal.n[1];
+                    p[2] = packed_normal.n[2];
+                }
+            }
+        });
+    }
+    normal_scale = scale;
 }
 
+// Decodes the height field (once) and computes normals for scale.
 bool NormalMap::load(float scale)
 {
-    int actual_components = 0;
-    int requested_components = 1;
-    components = requested_components;
-    image = stbi_load(filename, &width, &height, &actual_components, requested_components);
-    if (image) {
+    if (!image) {
+        int actual_components = 0;
+        int requested_components = 1;
+        components = requested_components;
+        image = stbi_load(filename, &width, &height, &actual_components, requested_components);
+        if (!image) {
+            printf("%s: failed to load image %s\n", program_name, filename);
+            return false;
+        }
         assert(width > 0);
         assert(height > 0);
         assert(actual_components > 0);
@@ -181,26 +384,24 @@ bool NormalMap::load(float scale)
                     actual_components);
             }
         }
-        normal_image = new GLubyte[width*height*3];
-        assert(normal_image);
-        GLubyte* p = normal_image;
-        for (int y=0; y<height; y++) {
-            for (int x=0; x<width; x++) {
-                float3 normal = computeNormal(x,y, scale);
-                PackedNormal packed_normal(normal);
-                p[0] = packed_normal.n[0];
-                p[1] = packed_normal.n[1];
-                p[2] = packed_normal.n[2];
-                p += 3;
-            }
-        }
-        assert(p == normal_image+(width*height*3));
-        // success
-        return true;
-    } else {
-        printf("%s: failed to load image %s\n", program_name, filename);
+        computeGradients();
+    }
+    computeNormals(scale);
+    return true;
+}
+
+// Recomputes the normals only when scale actually changed; returns true if
+// they were updated and need to be told to GL again.
+bool NormalMap::setScale(float scale)
+{
+    if (!image) {
+        return load(scale);
+    }
+    if (scale == normal_scale) {
         return false;
     }
+    computeNormals(scale);
+    return true;
 }
 
 void NormalMap::tellGL()
@@ -208,20 +409,54 @@ void NormalMap::tellGL()
     TextureGLState::tellGL();
 
     bind();
-    glTexImage2D(target, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, normal_image);
+    if (normal_chain.levels.empty()) {
+        // The height field could not be read; a flat normal leaves the
+        // surface unbumped rather than the texture incomplete.
+        static const GLubyte flat_normal[3] = { 128, 128, 255 };
+        glTexImage2D(target, 0, GL_RGB8, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, flat_normal);
+        glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        return;
+    }
+    const GLubyte *normal_image = &normal_chain.levels[0].texels[0];
     if (isMipmapped()) {
-        glGenerateMipmap(target);
+        if (cpu_mipmaps) {
+            normal_chain.tellGL(target, GL_RGB8);
+        } else {
+            glTexImage2D(target, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, normal_image);
+            glGenerateMipmap(target);
+        }
         glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     } else {
+        glTexImage2D(target, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, normal_image);
         glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     }
 }
 
+void NormalMap::allocate(int w, int h)
+{
+    if (getTextureObject() && width == w && height == h) {
+        return;
+    }
+    width = w;
+    height = h;
+    TextureGLState::tellGL();
+
+    bind();
+    glTexImage2D(target, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    if (isMipmapped()) {
+        glGenerateMipmap(target);
+        glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    } else {
+        glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    }
+}
+
 NormalMap::~NormalMap()
 {
-    delete normal_image;
 }
 
 static const char *face_name[6] = {
@@ -268,14 +503,27 @@ void CubeMap::tellGL()
     bind();
     
     GLint base_level = 0;
+    // A face that failed to load has no chain of its own, so then the
+    // driver generates every face's mips, as it does without cpu_mipmaps.
+    bool cpu_chains = cpu_mipmaps;
+    for (int i=0; i<6; i++) {
+        cpu_chains = cpu_chains && face[i].image != NULL;
+    }
     for (int i=0; i<6; i++) {
         TextureImage &img = face[i];
 
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X+i, base_level,
-            GL_RGBA8, img.width, img.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, img.image);
+        if (isMipmapped() && cpu_chains) {
+            uploadMipmapped(GL_TEXTURE_CUBE_MAP_POSITIVE_X+i, GL_RGBA8,
+                img.image, img.width, img.height, 4, img.filename, true);
+        } else {
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X+i, base_level,
+                GL_RGBA8, img.width, img.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, img.image);
+        }
     }
     if (isMipmapped()) {
-        glGenerateMipmap(target);
+        if (!cpu_chains) {
+            glGenerateMipmap(target);
+        }
         glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     } else {
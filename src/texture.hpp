@@ -7,6 +7,10 @@
 #include <Cg/vector/xyzw.hpp>
 #include <Cg/vector.hpp>
 
+#include "mipmap.hpp"
+
+#include <vector>
+
 #include <boost/shared_ptr.hpp>
 using boost::shared_ptr;
 
@@ -27,8 +31,14 @@ struct TextureImage {
 class TextureGLState {
 private:
     bool mipmapped;
+    MipColorSpace mip_color_space;
     GLuint texture_object;
 
+protected:
+    void uploadMipmapped(GLenum target, GLenum internal_format,
+                         const GLubyte *image, int width, int height, int components,
+                         const char *filename, bool cacheable);
+
 public:
     TextureGLState();
     ~TextureGLState();
@@ -36,6 +46,7 @@ public:
     void tellGL();
     GLuint getTextureObject();
     bool isMipmapped();
+    void setMipColorSpace(MipColorSpace color_space);
 };
 
 struct Texture : TextureImage, TextureGLState {
@@ -58,15 +69,31 @@ typedef shared_ptr<Texture2D> Texture2DPtr;
 
 class NormalMap : public Texture2D {
 private:
-    GLubyte* normal_image;
-    float3 computeNormal(int i, int j, float scale);
+    // Sobel height gradients along s and t for one mip level
+    struct Gradients {
+        int width, height;
+        std::vector<float> s, t;
+    };
+    // Gradient pyramid, built once per decoded height field
+    std::vector<Gradients> gradients;
+    // Packed normals for every mip level, rebuilt when the scale changes
+    MipChain normal_chain;
+    float normal_scale;
+
+    float3 computeNormal(int i, int j, float scale, int level = 0);
+    void computeGradients();
+    void computeNormals(float scale);
 
 public:
     NormalMap(const char *filename);
     ~NormalMap();
 
     bool load(float scale);
+    bool setScale(float scale);
     void tellGL();
+
+    // Allocates mipmapped storage to be rendered into by a GPU pass.
+    void allocate(int width, int height);
 };
 typedef shared_ptr<NormalMap> NormalMapPtr;
 
@@ -80,6 +107,8 @@ public:
     ~CubeMap();
 
     bool load();
+    using TextureGLState::getTextureObject;
+
     void tellGL();
     void bind();
     void bind(GLenum texture_unit);
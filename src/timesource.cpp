@@ -0,0 +1,101 @@
+// timesource.cpp - where the time of each frame comes from
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "timesource.hpp"
+
+TimeSource frame_time;
+
+TimeSource::TimeSource()
+    : time_mode(REAL)
+    , step(0)
+{
+    restart();
+}
+
+void TimeSource::useReal()
+{
+    time_mode = REAL;
+    restart();
+}
+
+void TimeSource::useFixed(double seconds_per_frame)
+{
+    time_mode = FIXED;
+    step = seconds_per_frame;
+    restart();
+}
+
+bool TimeSource::useScript(const char *filename)
+{
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        return false;
+    }
+    std::vector<double> times;
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        if (char *comment = strchr(line, '#')) {
+            *comment = '\0';
+        }
+        char *end;
+        double t = strtod(line, &end);
+        if (end != line) {
+            times.push_back(t);
+        }
+    }
+    fclose(file);
+    if (times.empty()) {
+        return false;
+    }
+    time_mode = SCRIPTED;
+    script.swap(times);
+    restart();
+    return true;
+}
+
+void TimeSource::restart()
+{
+    start = std::chrono::steady_clock::now();
+    frame_index = -1;
+    current = previous = 0;
+}
+
+void TimeSource::advance()
+{
+    frame_index++;
+    double t = timeOf(frame_index);
+    previous = frame_index > 0 ? current : t;
+    current = t;
+}
+
+void TimeSource::seek(int frame)
+{
+    frame_index = frame;
+    current = timeOf(frame);
+    previous = frame > 0 ? timeOf(frame - 1) : current;
+}
+
+double TimeSource::timeOf(int frame) const
+{
+    switch (time_mode) {
+    case FIXED:
+        return frame * step;
+    case SCRIPTED:
+        {
+            int last = int(script.size()) - 1;
+            if (frame <= last) {
+                return script[frame < 0 ? 0 : frame];
+            }
+            double last_step = last > 0 ? script[last] - script[last-1] : 0;
+            return script[last] + (frame - last) * last_step;
+        }
+    default:
+        {
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            return elapsed.count();
+        }
+    }
+}
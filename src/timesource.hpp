@@ -0,0 +1,70 @@
+// timesource.hpp - where the time of each frame comes from
+
+#ifndef __timesource_hpp__
+#define __timesource_hpp__
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+# pragma once
+#endif
+
+#include <chrono>
+#include <vector>
+
+// Numbers the frames and gives each one its time in seconds, which every
+// program sees as frameIndex, timeCurrentFrame and timePreviousFrame.
+// The real clock follows the wall clock, so what a frame shows depends on
+// how fast it was drawn; a fixed step puts frame n at n times the step,
+// and a script lists the time of each frame, so that a run shows the
+// same frames however fast or slow it goes.
+class TimeSource {
+public:
+    enum Mode {
+        REAL,
+        FIXED,
+        SCRIPTED
+    };
+
+private:
+    Mode time_mode;
+    double step;
+    std::vector<double> script;
+    std::chrono::steady_clock::time_point start;
+    int frame_index;
+    double current, previous;
+
+public:
+    TimeSource();
+
+    void useReal();
+    void useFixed(double seconds_per_frame);
+    // A text file of one time in seconds per frame, in order; # starts a
+    // comment.  Past its end, frames go on at its last step.  Keeps the
+    // current source and returns false when the file cannot be read or
+    // lists no times.
+    bool useScript(const char *filename);
+
+    // Back to before the first frame, and the real clock to zero.
+    void restart();
+    // On to the next frame; the first call gives frame 0.
+    void advance();
+    // Straight to frame; frames before it are skipped, not drawn.
+    void seek(int frame);
+
+    Mode mode() const { return time_mode; }
+    int frame() const { return frame_index; }
+    double time() const { return current; }
+    double previousTime() const { return previous; }
+    // When frame is shown; for the real clock, the time since restart.
+    double timeOf(int frame) const;
+};
+
+extern TimeSource frame_time;  // -fixedstep, -timescript
+
+// Wall-clock milliseconds since start, for timing work rather than frames.
+inline double elapsedMilliseconds(std::chrono::steady_clock::time_point start)
+{
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+#endif // __timesource_hpp__
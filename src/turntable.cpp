@@ -0,0 +1,382 @@
+// turntable.cpp - offline rendering of turntable sequences from job files
+
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+
+#include <Cg/double.hpp>
+#include <Cg/vector.hpp>
+
+#include <GL/glew.h>
+
+#include "turntable.hpp"
+#include "offscreen.hpp"
+#include "menus.hpp"
+#include "global.hpp"
+#include "timesource.hpp"
+#include "process.hpp"
+
+#ifndef _WIN32
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+extern const char *program_name;
+extern bool verbose;
+
+const char *batch_filename = NULL;
+int batch_job = -1;
+int batch_processes = 1;
+
+TurntableJob::TurntableJob()
+    : start_degrees(0)
+    , degrees(360)
+    , lift(0)
+    , distance(0)
+    , frames(120)
+    , width(640)
+    , height(480)
+    , fps(30)
+    , format(CAPTURE_PNG)
+{
+}
+
+namespace {
+
+std::string trim(const char *s)
+{
+    while (isspace((unsigned char)*s)) {
+        s++;
+    }
+    std::string t = s;
+    while (!t.empty() && isspace((unsigned char)t[t.size()-1])) {
+        t.erase(t.size() - 1);
+    }
+    return t;
+}
+
+// Sets key of job to value; false for a key or value it cannot take.
+bool setKey(TurntableJob &job, const std::string &key, const std::string &value)
+{
+    const char *v = value.c_str();
+    if (key == "model") {
+        job.model = value;
+        return findModel(v) >= 0;
+    } else if (key == "shader") {
+        job.shader = value;
+        return findShader(v) >= 0;
+    } else if (key == "extra") {
+        job.extra = value;
+        return findExtra(v) >= 0;
+    } else if (key == "material") {
+        job.material = value;
+        return findMaterial(v) >= 0;
+    } else if (key == "envmap") {
+        job.envmap = value;
+        return findEnvMap(v) >= 0;
+    } else if (key == "light") {
+        job.light = value;
+        return findLight(v) >= 0;
+    } else if (key == "orbit") {
+        return sscanf(v, "%f %f", &job.start_degrees, &job.degrees) == 2;
+    } else if (key == "lift") {
+        return sscanf(v, "%f", &job.lift) == 1;
+    } else if (key == "distance") {
+        return sscanf(v, "%f", &job.distance) == 1 && job.distance >= 0;
+    } else if (key == "frames") {
+        return sscanf(v, "%d", &job.frames) == 1 && job.frames > 0;
+    } else if (key == "size") {
+        return sscanf(v, "%d %d", &job.width, &job.height) == 2 && job.width > 0 && job.height > 0;
+    } else if (key == "fps") {
+        return sscanf(v, "%lf", &job.fps) == 1 && job.fps > 0;
+    } else if (key == "format") {
+        if (value == "png") {
+            job.format = CAPTURE_PNG;
+        } else if (value == "qoi") {
+            job.format = CAPTURE_QOI;
+        } else if (value == "raw") {
+            job.format = CAPTURE_RAW;
+        } else {
+            return false;
+        }
+        return true;
+    } else if (key == "output") {
+        job.output = value;
+        return FrameWriter::valid(value);
+    }
+    return false;
+}
+
+// Loads the menu items job names, and for those it leaves out, the ones
+// the program starts with, so a job draws the same after any other.
+void applyJob(const TurntableJob &job, int &loaded_model)
+{
+    int model = job.model.empty() ? 0 : findModel(job.model.c_str());
+    if (model != loaded_model) {
+        modelMenu(model);
+        loaded_model = model;
+    }
+    clearExtras();
+    shaderMenu(job.shader.empty() ? 0 : findShader(job.shader.c_str()));
+    if (!job.extra.empty()) {
+        extraMenu(findExtra(job.extra.c_str()));
+    }
+    materialMenu(job.material.empty() ? 0 : findMaterial(job.material.c_str()));
+    envMapMenu(job.envmap.empty() ? 0 : findEnvMap(job.envmap.c_str()));
+    lightMenu(job.light.empty() ? 1 : findLight(job.light.c_str()));
+}
+
+bool renderTurntable(const TurntableJob &job, int &loaded_model, const std::function<void ()> &draw_frame)
+{
+    OffscreenFrame offscreen;
+    if (!offscreen.create(job.width, job.height)) {
+        return false;
+    }
+    applyJob(job, loaded_model);
+    scene->camera.setAspectRatio(float(job.width) / job.height);
+    frame_time.useFixed(1 / job.fps);
+
+    FrameWriter writer(job.output);
+    FrameCapture capture;
+    capture.begin(job.format, [&](int frame, const std::vector<unsigned char> &encoded) {
+        return writer.write(frame, encoded);
+    });
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    int drawn = 0;
+    for (; drawn<job.frames; drawn++) {
+        View &view = scene->view;
+        view.reset();
+        if (job.distance > 0) {
+            view.eye_radius = job.distance;
+        }
+        view.lift(job.lift);
+        view.spinDegrees(job.start_degrees + job.degrees * drawn / job.frames);
+        frame_time.advance();
+        offscreen.bind();
+        draw_frame();
+        // Drawing may leave another framebuffer bound.
+        offscreen.bind();
+        capture.capture(drawn, job.width, job.height);
+    }
+    bool ok = capture.finish();
+    ok = writer.close() && ok;
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+
+    if (!ok) {
+        printf("%s: %s: could not write all the frames to %s\n", program_name, job.name.c_str(), job.output.c_str());
+    }
+    printf("%s: %s: %d frames of %dx%d in %.2f s, %.1f frames per second\n", program_name, job.name.c_str(),
+           drawn, job.width, job.height, elapsed.count(), drawn / elapsed.count());
+    if (verbose) {
+        capture.printTimes(program_name);
+    }
+    return ok;
+}
+
+std::string shellQuote(const char *arg)
+{
+#ifdef _WIN32
+    std::string quoted = "\"";
+    for (const char *c=arg; *c; c++) {
+        if (*c == '"') {
+            quoted += '\\';
+        }
+        quoted += *c;
+    }
+    return quoted + "\"";
+#else
+    std::string quoted = "'";
+    for (const char *c=arg; *c; c++) {
+        if (*c == '\'') {
+            quoted += "'\\''";
+        } else {
+            quoted += *c;
+        }
+    }
+    return quoted + "'";
+#endif
+}
+
+// Passes on what a job's process says until it exits; false when it failed.
+bool drain(FILE *process)
+{
+    char line[1024];
+    while (fgets(line, sizeof(line), process)) {
+        fputs(line, stdout);
+    }
+    fflush(stdout);
+    return pclose(process) == 0;
+}
+
+// A job's process, and what it has said short of a whole line.
+struct Child {
+    FILE *process;
+    std::string partial;
+};
+
+// Passes on what the running processes say, whole lines at a time so
+// that theirs do not interleave, until any one of them exits.  Removes
+// that one; false when it failed.
+bool reapChild(std::vector<Child> &running)
+{
+#ifndef _WIN32
+    std::vector<pollfd> fds(running.size());
+    for (;;) {
+        for (size_t i=0; i<running.size(); i++) {
+            fds[i].fd = fileno(running[i].process);
+            fds[i].events = POLLIN;
+            fds[i].revents = 0;
+        }
+        if (poll(&fds[0], fds.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        for (size_t i=0; i<running.size(); i++) {
+            if (!fds[i].revents) {
+                continue;
+            }
+            Child &child = running[i];
+            char buffer[4096];
+            ssize_t length = read(fds[i].fd, buffer, sizeof(buffer));
+            if (length < 0 && errno == EINTR) {
+                continue;
+            }
+            if (length > 0) {
+                child.partial.append(buffer, length);
+                size_t end = child.partial.rfind('\n');
+                if (end != std::string::npos) {
+                    fwrite(child.partial.data(), 1, end + 1, stdout);
+                    fflush(stdout);
+                    child.partial.erase(0, end + 1);
+                }
+                continue;
+            }
+            // The end of its output: it has exited, or is about to.
+            fputs(child.partial.c_str(), stdout);
+            fflush(stdout);
+            bool ok = pclose(child.process) == 0;
+            running.erase(running.begin() + i);
+            return ok;
+        }
+    }
+#endif
+    // Without poll, the oldest is waited on.
+    fputs(running.front().partial.c_str(), stdout);
+    bool ok = drain(running.front().process);
+    running.erase(running.begin());
+    return ok;
+}
+
+} // namespace
+
+bool readTurntableJobs(const char *filename, std::vector<TurntableJob> &jobs)
+{
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        printf("%s: could not open job file %s\n", program_name, filename);
+        return false;
+    }
+    TurntableJob defaults;
+    bool ok = true;
+    char line[1024];
+    for (int number=1; fgets(line, sizeof(line), file); number++) {
+        if (char *comment = strchr(line, '#')) {
+            *comment = '\0';
+        }
+        std::string text = trim(line);
+        if (text.empty()) {
+            continue;
+        }
+        size_t space = text.find_first_of(" \t");
+        std::string key = text.substr(0, space);
+        std::string value = space == std::string::npos ? std::string() : trim(text.c_str() + space);
+        if (key == "job") {
+            jobs.push_back(defaults);
+            jobs.back().name = value.empty() ? "job" : value;
+        } else if (!setKey(jobs.empty() ? defaults : jobs.back(), key, value)) {
+            printf("%s: %s:%d: cannot take %s \"%s\"\n", program_name, filename, number, key.c_str(), value.c_str());
+            ok = false;
+        }
+    }
+    fclose(file);
+    for (size_t i=0; i<jobs.size(); i++) {
+        if (jobs[i].output.empty()) {
+            printf("%s: %s: job %s has no output\n", program_name, filename, jobs[i].name.c_str());
+            ok = false;
+        }
+    }
+    if (jobs.empty()) {
+        printf("%s: %s has no jobs\n", program_name, filename);
+        ok = false;
+    }
+    return ok;
+}
+
+int renderTurntables(const std::vector<TurntableJob> &jobs, int only, const std::function<void ()> &draw_frame)
+{
+    if (only >= int(jobs.size())) {
+        printf("%s: there is no job %d\n", program_name, only);
+        return 1;
+    }
+#ifdef SIGPIPE
+    // An encoder that quits should fail the job, not end the process.
+    signal(SIGPIPE, SIG_IGN);
+#endif
+    TimeSource saved_time = frame_time;
+    View saved_view = scene->view;
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    int failures = 0, loaded_model = -1;
+    for (size_t i=0; i<jobs.size(); i++) {
+        if (only < 0 || int(i) == only) {
+            failures += !renderTurntable(jobs[i], loaded_model, draw_frame);
+        }
+    }
+    frame_time = saved_time;
+    scene->view = saved_view;
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    if (viewport[3] > 0) {
+        scene->camera.setAspectRatio(float(viewport[2]) / viewport[3]);
+    }
+    return failures;
+}
+
+int runTurntableProcesses(int argc, char **argv, int job_count, int processes)
+{
+    std::string command;
+    for (int i=0; i<argc; i++) {
+        command += shellQuote(argv[i]) + " ";
+    }
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<Child> running;
+    int failures = 0;
+    for (int job=0; job<job_count || !running.empty(); ) {
+        if (job < job_count && int(running.size()) < processes) {
+            char option[32];
+            snprintf(option, sizeof(option), "-batchjob %d", job);
+            FILE *process = popen((command + option).c_str(), "r");
+            if (!process) {
+                printf("%s: could not start job %d\n", program_name, job);
+                failures++;
+            } else {
+                running.push_back(Child());
+                running.back().process = process;
+            }
+            job++;
+            continue;
+        }
+        failures += !reapChild(running);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    printf("%s: %d jobs in %.2f s over %d processes, %d failed\n", program_name, job_count,
+           elapsed.count(), processes, failures);
+    return failures;
+}
@@ -0,0 +1,72 @@
+// turntable.hpp - offline rendering of turntable sequences from job files
+
+#ifndef __turntable_hpp__
+#define __turntable_hpp__
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+# pragma once
+#endif
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "capture.hpp"
+
+// One sequence: the camera circles the model while frames are drawn
+// offscreen and written out.  Menu items go by their names or those of
+// their files, as findModel and the rest take them; empty picks the one
+// the program starts with.
+struct TurntableJob {
+    std::string name;
+    std::string model, shader, extra, material, envmap, light;
+    float start_degrees, degrees;  // the orbit, spread over all the frames
+    float lift;                    // the eye's height over the model
+    float distance;                // the eye's from the model; 0 keeps the view's
+    int frames;
+    int width, height;
+    double fps;                    // sets the time step of animated shaders
+    CaptureFormat format;
+    std::string output;            // as FrameWriter takes it
+
+    TurntableJob();
+};
+
+// A job file is lines of a key and its value; # starts a comment.
+// "job name" starts a job, and keys before the first job set the
+// defaults of all of them:
+//
+//     size 640 480
+//     frames 120
+//     orbit 0 360
+//     job skull_toon
+//     model Skull
+//     shader toon_simple
+//     output turntables/skull_toon_%04d.png
+//     job skull_gooch
+//     shader Gooch
+//     format raw
+//     output | ffmpeg -f rawvideo -pix_fmt rgb24 -s 640x480 -r 30 -i - skull_gooch.mp4
+//
+// The other keys are model, extra, material, envmap, light, lift,
+// distance and fps; format is png, qoi or raw.  Says what is wrong and
+// returns false for a file that cannot be read or a job that cannot be
+// drawn.
+bool readTurntableJobs(const char *filename, std::vector<TurntableJob> &jobs);
+
+// Draws each of jobs, or only jobs[only] when only is not negative, with
+// draw_frame in this process, reporting the frame rate of each.  Frames
+// are read back and encoded through a FrameCapture, so drawing goes on
+// while they are written.  Returns how many failed.
+int renderTurntables(const std::vector<TurntableJob> &jobs, int only, const std::function<void ()> &draw_frame);
+
+// Runs argv again once per job, adding -batchjob and the job's index, with
+// up to processes of them at once, passing on what they report.  Needs no
+// GL.  Returns how many jobs failed.
+int runTurntableProcesses(int argc, char **argv, int job_count, int processes);
+
+extern const char *batch_filename;  // -batch
+extern int batch_job;               // -batchjob, negative for all
+extern int batch_processes;         // -batchprocesses
+
+#endif // __turntable_hpp__